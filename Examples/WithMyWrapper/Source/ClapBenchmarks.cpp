@@ -0,0 +1,823 @@
+#include <iostream>    // cout
+#include <chrono>      // high_resolution_clock
+#include <sstream>     // ostringstream, for the old number-to-string conversions
+#include <iomanip>     // setprecision
+
+#include "ClapBenchmarks.h"
+
+/** Calls the given function and returns the time it took in seconds. */
+template<class F>
+double measureSeconds(F func)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  func();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+/** Prints a line with the given label and a throughput in MB/s. */
+void printThroughput(const std::string& label, double numBytes, double seconds)
+{
+  std::cout << "  " << label << ": " << (numBytes / (1024*1024)) / seconds << " MB/s\n";
+}
+
+/** Prints a line with the given label and a rate in millions of operations per second. */
+void printRate(const std::string& label, double numOps, double seconds)
+{
+  std::cout << "  " << label << ": " << (numOps / 1.e6) / seconds << " M/s\n";
+}
+
+void runAllClapBenchmarks()
+{
+  std::cout << "Benchmarks for Robin's CLAP wrapper classes.\n\n";
+  runStateStreamingBenchmark();
+  runStateCompressionBenchmark();
+  runNumberToStringBenchmark();
+  runChoiceLookupBenchmark();
+  runParameterMappingBenchmark();
+  runSineVoiceBenchmark();
+  runSineOscillatorBenchmark();
+  runPitchIncrementBenchmark();
+  runNoteExpressionBenchmark();
+  runNoteTimingBenchmark();
+  runMidiDecoderBenchmark();
+  runWaveShaperBenchmark();
+}
+
+//-------------------------------------------------------------------------------------------------
+// State
+
+void runStateStreamingBenchmark()
+{
+  using namespace RobsClapHelpers;
+
+  clap_plugin_descriptor_t desc = ClapBigState::descriptor;
+  ClapBigState plugin(&desc, nullptr);
+  plugin.setStateFormat(ClapBigState::kBinaryState);
+
+  for(size_t numMegaBytes : { 1, 100 })
+  {
+    size_t numFloats = numMegaBytes * 1024 * 1024 / sizeof(float);
+    plugin.data.resize(numFloats);
+    for(size_t i = 0; i < numFloats; i++)
+      plugin.data[i] = (float) i;
+    std::cout << "State streaming, " << numMegaBytes << " MB:\n";
+
+    // The host's storage for the state. We use an std::string as memory stream:
+    std::string hostData;
+    hostData.reserve(numFloats * sizeof(float) + 1024);
+
+    // Streaming save and load, i.e. the way it is done now:
+    double tSave = measureSeconds([&]()
+    {
+      hostData.clear();
+      StringOutStream os(&hostData);
+      plugin.stateSave(os.getWrappee());
+    });
+    double tLoad = measureSeconds([&]()
+    {
+      StringInStream is(hostData);
+      plugin.stateLoad(is.getWrappee());
+    });
+    double numBytes = (double) hostData.size();
+    printThroughput("Save, streaming    ", numBytes, tSave);
+    printThroughput("Load, streaming    ", numBytes, tLoad);
+
+    // Materialized save and load, i.e. the way it used to be done. The state is first built as a 
+    // whole in a string which is then copied into the stream. On load, the stream is read in 8 KB 
+    // chunks which are appended to a string which is parsed when the end is reached:
+    tSave = measureSeconds([&]()
+    {
+      std::string state;
+      StringOutStream tmp(&state);
+      ClapStreamWriter writer(tmp.getWrappee());
+      plugin.writeState(writer);
+      writer.flush();
+      hostData.clear();
+      StringOutStream os(&hostData);
+      size_t written = 0;
+      while(written < state.size())
+        written += os.getWrappee()->write(os.getWrappee(), &state[written], 
+                                          state.size() - written);
+    });
+    tLoad = measureSeconds([&]()
+    {
+      StringInStream is(hostData);
+      std::string total, buf;
+      size_t bufSize = 8192;
+      bool endReached = false;
+      while(!endReached)
+      {
+        buf.resize(bufSize);
+        size_t numBytes = is.getWrappee()->read(is.getWrappee(), &buf[0], bufSize);
+        buf.resize(numBytes);
+        total += buf;
+        endReached = numBytes == 0;
+      }
+      StringInStream tmp(total);
+      ClapStreamReader reader(tmp.getWrappee());
+      plugin.readState(reader);
+    });
+    printThroughput("Save, materialized ", numBytes, tSave);
+    printThroughput("Load, materialized ", numBytes, tLoad);
+    std::cout << "\n";
+  }
+}
+
+void runStateCompressionBenchmark()
+{
+  using namespace RobsClapHelpers;
+
+  clap_plugin_descriptor_t desc = ClapBigState::descriptor;
+  ClapBigState bigState(&desc, nullptr);
+  clap_plugin_descriptor_t manyDesc = ClapManyParams::descriptor;
+  ClapManyParams manyParams(&manyDesc, nullptr, 10000);
+
+  // A wavetable with 256 frames of 2048 samples (2 MB) that morphs from a sine to a saw. That's 
+  // typical for the kind of data that makes states big. For comparison, we also use white noise 
+  // which is the worst case for the compressor:
+  size_t frameSize = 2048, numFrames = 256;
+  std::vector<float> wavetable(frameSize * numFrames), noise(frameSize * numFrames);
+  double pi = 3.14159265358979323846;
+  for(size_t k = 0; k < numFrames; k++)
+  {
+    int numHarmonics = 1 + (int) (k / 4);
+    for(size_t n = 0; n < frameSize; n++)
+    {
+      double x = 0.0;
+      for(int h = 1; h <= numHarmonics; h++)
+        x += sin(2 * pi * h * n / frameSize) / h;
+      wavetable[k*frameSize + n] = (float) (0.5 * x);
+    }
+  }
+  uint32_t state = 1;
+  for(float& x : noise)
+  {
+    state = state * 1664525u + 1013904223u;
+    x = (float) state / 4294967296.f - 0.5f;
+  }
+
+  // Saves and loads the state of the given plugin with and without compression and prints the 
+  // results:
+  auto run = [&](const char* name, ClapPluginWithParams& plugin)
+  {
+    std::string plain, packed;
+    plain.reserve(4 * 1024 * 1024);
+    packed.reserve(4 * 1024 * 1024);
+
+    plugin.setCompressedState(false);
+    double tSavePlain = measureSeconds([&]()
+    {
+      plain.clear();
+      StringOutStream os(&plain);
+      plugin.stateSave(os.getWrappee());
+    });
+    double tLoadPlain = measureSeconds([&]()
+    {
+      StringInStream is(plain);
+      plugin.stateLoad(is.getWrappee());
+    });
+
+    plugin.setCompressedState(true);
+    double tSavePacked = measureSeconds([&]()
+    {
+      packed.clear();
+      StringOutStream os(&packed);
+      plugin.stateSave(os.getWrappee());
+    });
+    double tLoadPacked = measureSeconds([&]()
+    {
+      StringInStream is(packed);
+      plugin.stateLoad(is.getWrappee());
+    });
+
+    double numBytes = (double) plain.size();
+    std::cout << "State compression, " << name << ": " << plain.size() << " -> " << packed.size()
+      << " bytes, ratio " << numBytes / (double) packed.size() << "\n";
+    printThroughput("Save, plain     ", numBytes, tSavePlain);
+    printThroughput("Save, compressed", numBytes, tSavePacked);
+    printThroughput("Load, plain     ", numBytes, tLoadPlain);
+    printThroughput("Load, compressed", numBytes, tLoadPacked);
+    std::cout << "\n";
+  };
+
+  bigState.setStateFormat(ClapBigState::kBinaryState);
+  bigState.data = wavetable;
+  run("wavetable", bigState);
+  bigState.data = noise;
+  run("noise", bigState);
+
+  // A big plugin with 10000 parameters at random values, in both formats:
+  for(clap_id id = 0; id < 10000; id++)
+    manyParams.setParameter(id, (double) (id * 7919 % 2001) / 1000.0 - 1.0);
+  manyParams.setStateFormat(ClapManyParams::kTextState);
+  run("10000 parameters, text", manyParams);
+  manyParams.setStateFormat(ClapManyParams::kBinaryState);
+  run("10000 parameters, binary", manyParams);
+
+  // Notes:
+  //
+  // -The throughputs are all given with respect to the uncompressed size, so they are directly
+  //  comparable.
+}
+
+//-------------------------------------------------------------------------------------------------
+// Strings
+
+void runNumberToStringBenchmark()
+{
+  using namespace RobsClapHelpers;
+
+  // Create some numbers of the kind that typically occur as parameter values:
+  int N = 1000000;
+  std::vector<double> values(N);
+  uint32_t state = 0;
+  for(int i = 0; i < N; i++)
+  {
+    state = 1664525 * state + 1013904223;
+    values[i] = (double(state) / 4294967296.0) * 2000.0 - 1000.0;
+  }
+  char buf[64];
+  size_t checkSum = 0;  // Prevents the compiler from optimizing the conversions away
+  std::cout << "Number to string conversion, " << N << " values:\n";
+
+  // toStringExact, the way it used to be done vs the way it is done now:
+  double t = measureSeconds([&]()
+  {
+    for(int i = 0; i < N; i++)
+    {
+      std::ostringstream os;
+      os << std::setprecision(std::numeric_limits<double>::max_digits10) << values[i];
+      checkSum += os.str().size();
+    }
+  });
+  printRate("toStringExact, ostringstream      ", N, t);
+  t = measureSeconds([&]()
+  {
+    for(int i = 0; i < N; i++)
+      checkSum += toStringExact(values[i]).size();
+  });
+  printRate("toStringExact, to_chars, string   ", N, t);
+  t = measureSeconds([&]()
+  {
+    for(int i = 0; i < N; i++)
+      checkSum += toStringExact(values[i], buf, 64);
+  });
+  printRate("toStringExact, to_chars, buffer   ", N, t);
+
+  // toStringWithSuffix, the way it used to be done vs the way it is done now:
+  t = measureSeconds([&]()
+  {
+    for(int i = 0; i < N; i++)
+    {
+      std::ostringstream os;
+      os << std::fixed << std::setprecision(2) << values[i] << " dB";
+      checkSum += copyString(os.str().c_str(), buf, 64);
+    }
+  });
+  printRate("toStringWithSuffix, ostringstream ", N, t);
+  t = measureSeconds([&]()
+  {
+    for(int i = 0; i < N; i++)
+      checkSum += toStringWithSuffix(values[i], buf, 64, 2, " dB");
+  });
+  printRate("toStringWithSuffix, to_chars      ", N, t);
+  std::cout << "  (checksum: " << checkSum << ")\n\n";
+}
+
+void runChoiceLookupBenchmark()
+{
+  using namespace RobsClapHelpers;
+  std::cout << "Choice string lookup:\n";
+  for(int N : { 4, 16, 100, 1000 })
+  {
+    std::vector<std::string> names(N);
+    for(int i = 0; i < N; i++)
+      names[i] = "Wavetable " + std::to_string(i);
+    ChoiceStrings cs(names);
+
+    // Look up all strings in turn, so on average, the linear search has to scan half the list:
+    int numLookups = 1000000;
+    size_t checkSum = 0;
+    double tLinear = measureSeconds([&]()
+    {
+      for(int i = 0; i < numLookups; i++)
+        checkSum += findString(names, names[i % N].c_str());
+    });
+    double tHashed = measureSeconds([&]()
+    {
+      for(int i = 0; i < numLookups; i++)
+        checkSum += cs.find(names[i % N].c_str());
+    });
+    std::cout << "  " << N << " strings:\n";
+    printRate("  findString         ", numLookups, tLinear);
+    printRate("  ChoiceStrings::find", numLookups, tHashed);
+    std::cout << "    (checksum: " << checkSum << ")\n";
+  }
+  std::cout << "\n";
+}
+
+//-------------------------------------------------------------------------------------------------
+// Parameters
+
+void runParameterMappingBenchmark()
+{
+  using namespace RobsClapHelpers;
+  using Map = ParameterMapping;
+
+  // A block of ramped parameter values (like from a smoother) that is mapped over and over again:
+  int blockSize = 256, numBlocks = 4000;
+  std::vector<float> x(blockSize), y(blockSize);
+  for(int n = 0; n < blockSize; n++)
+    x[n] = (float) n / (float) (blockSize-1);
+  double numValues = (double) blockSize * numBlocks;
+
+  auto run = [&](const char* name, Map m, double inMin, double inMax)
+  {
+    m.setInputRange(inMin, inMax);
+    for(int n = 0; n < blockSize; n++)
+      x[n] = (float) (inMin + (inMax - inMin) * n / (blockSize-1));
+    double checkSum = 0.0;
+
+    // Per-sample mapping with the library functions, i.e. what a plugin would do without the 
+    // batch mapping:
+    double tSingle = measureSeconds([&]()
+    {
+      for(int b = 0; b < numBlocks; b++)
+      {
+        for(int n = 0; n < blockSize; n++)
+          y[n] = (float) m.map(x[n]);
+        checkSum += y[b % blockSize];
+      }
+    });
+
+    // Batch mapping:
+    double tArray = measureSeconds([&]()
+    {
+      for(int b = 0; b < numBlocks; b++)
+      {
+        m.mapArray(x.data(), y.data(), blockSize);
+        checkSum += y[b % blockSize];
+      }
+    });
+
+    std::cout << "  " << name << ":\n";
+    printRate("  map      ", numValues, tSingle);
+    printRate("  mapArray ", numValues, tArray);
+    std::cout << "    (checksum: " << checkSum << ")\n";
+  };
+
+  std::cout << "Parameter mapping, blocks of " << blockSize << " values:\n";
+  run("Linear",      Map::linear(0.0, 1.0),             -1.0,  1.0);
+  run("Exponential", Map::exponential(20.0, 20000.0),    0.0,  1.0);
+  run("Decibel",     Map::decibel(),                   -60.0, 20.0);
+  run("Skewed",      Map::skewed(0.0, 1.0, 3.0),         0.0,  1.0);
+  std::cout << "\n";
+}
+
+//-------------------------------------------------------------------------------------------------
+// Voices
+
+void runSineVoiceBenchmark()
+{
+  using namespace RobsClapHelpers;
+
+  // We render blocks of 256 frames and scale the number of blocks such that the total number of 
+  // voice-samples is the same for all voice counts:
+  int blockSize = 256;
+  double voiceSamples = 1 << 24;
+  std::vector<float> out(blockSize);
+
+  std::cout << "Sine voices, blocks of " << blockSize << " frames (M voice-samples/s):\n";
+  std::cout << "  voices  sinCycleFast  std::sin   4 lanes   8 lanes  16 lanes\n";
+  for(int numVoices = 1; numVoices <= 512; numVoices *= 2)
+  {
+    int numBlocks = std::max(1, (int) (voiceSamples / (numVoices * blockSize)));
+    std::cout << "  " << std::setw(6) << numVoices;
+    double checkSum = 0.0;
+
+    // One voice at a time with the same polynomial sine and envelope as the lanes use. That's how
+    // the voices of a synth would naturally be written when they don't use the bank:
+    std::vector<float> phs(numVoices, 0.f), incs(numVoices), amps(numVoices), envs(numVoices, 0.f);
+    for(int v = 0; v < numVoices; v++)
+    {
+      incs[v] = 0.001f + 0.2f * v / numVoices;
+      amps[v] = 1.f / numVoices;
+    }
+    float envCoeff = std::exp(-1.f / 100.f);
+    double t = measureSeconds([&]()
+    {
+      for(int b = 0; b < numBlocks; b++)
+      {
+        for(int n = 0; n < blockSize; n++)
+          out[n] = 0.f;
+        for(int v = 0; v < numVoices; v++)
+        {
+          for(int n = 0; n < blockSize; n++)
+          {
+            envs[v] = 1.f + envCoeff * (envs[v] - 1.f);
+            out[n] += amps[v] * envs[v] * sinCycleFast(phs[v]);
+            phs[v] += incs[v];
+            phs[v] -= (float) (int) phs[v];
+          }
+        }
+        checkSum += out[b % blockSize];
+      }
+    });
+    double rate = ((double) numVoices * blockSize * numBlocks / 1.e6) / t;
+    std::cout << std::setw(14) << std::fixed << std::setprecision(1) << rate;
+
+    for(int numLanes : { 1, 4, 8, 16 })
+    {
+      SineVoiceBank bank;
+      bank.setCapacity(numVoices);
+      bank.setNumLanes(numLanes);
+      bank.setAttackRelease(100.f, 1000.f);
+      for(int v = 0; v < numVoices; v++)
+        bank.startVoice(v, 0.001f + 0.2f * v / numVoices, 1.f / numVoices);
+      double t = measureSeconds([&]()
+      {
+        for(int b = 0; b < numBlocks; b++)
+        {
+          bank.render(out.data(), blockSize);
+          checkSum += out[b % blockSize];
+        }
+      });
+      double rate = ((double) numVoices * blockSize * numBlocks / 1.e6) / t;
+      std::cout << std::setw(10) << std::fixed << std::setprecision(1) << rate;
+    }
+    std::cout << std::defaultfloat << std::setprecision(6) << "   (checksum: " << checkSum << ")\n";
+  }
+  std::cout << "\n";
+}
+
+void runSineOscillatorBenchmark()
+{
+  using namespace RobsClapHelpers;
+
+  // 64 voices, rendered in blocks of various sizes, as they occur when the host block gets split 
+  // by events:
+  int numVoices = 64;
+  double voiceSamples = 1 << 25;
+  std::vector<float> out(4096);
+
+  // The wavetables are created once per process. Measure how long that takes for one waveform:
+  double t = measureSeconds([]() { MipMappedWavetable tmp(MipMappedWavetable::kSaw); });
+  std::cout << "Wavetable creation: " << 1.e3 * t << " ms per waveform\n";
+  const MipMappedWavetable* saw = &MipMappedWavetable::getShared(MipMappedWavetable::kSaw);
+
+  std::cout << "Oscillators, " << numVoices << " voices (ns per voice-sample):\n";
+  std::cout << "              old           polynomial            rotator      wavetable (saw)\n";
+  std::cout << "   block getSample   8 lanes  16 lanes   8 lanes  16 lanes   8 lanes  16 lanes\n";
+  for(int blockSize : { 16, 64, 256, 1024, 4096 })
+  {
+    int numBlocks = std::max(1, (int) (voiceSamples / (numVoices * blockSize)));
+    std::cout << "  " << std::setw(6) << blockSize;
+    double checkSum = 0.0;
+
+    // The old per-sample path of the tone generator: one voice at a time, each with a double 
+    // phasor, a float sin and a wrap-around branch per sample, see ClapToneGenerator::getSample()
+    // in earlier versions:
+    static const double pi2 = 6.2831853071795864769;
+    std::vector<double> phasors(numVoices, 0.0), incs(numVoices);
+    for(int v = 0; v < numVoices; v++)
+      incs[v] = 0.001 + 0.2 * v / numVoices;
+    t = measureSeconds([&]()
+    {
+      for(int b = 0; b < numBlocks; b++)
+      {
+        for(int n = 0; n < blockSize; n++)
+          out[n] = 0.f;
+        for(int v = 0; v < numVoices; v++)
+        {
+          for(int n = 0; n < blockSize; n++)
+          {
+            out[n] += std::sin((float) (pi2 * phasors[v]));
+            phasors[v] += incs[v];
+            if(phasors[v] > 1.0)
+              phasors[v] -= 1.0;
+          }
+        }
+        checkSum += out[b % blockSize];
+      }
+    });
+    double ns = 1.e9 * t / ((double) numVoices * blockSize * numBlocks);
+    std::cout << std::setw(10) << std::fixed << std::setprecision(3) << ns;
+    for(auto osc : { SineVoiceBank::kPolynomial, SineVoiceBank::kRotator, 
+                     SineVoiceBank::kWavetable })
+    {
+      for(int numLanes : { 8, 16 })
+      {
+        SineVoiceBank bank;
+        bank.setCapacity(numVoices);
+        bank.setNumLanes(numLanes);
+        bank.setWavetable(saw);
+        bank.setOscillator(osc);
+        bank.setAttackRelease(100.f, 1000.f);
+        for(int v = 0; v < numVoices; v++)
+          bank.startVoice(v, 0.001f + 0.2f * v / numVoices, 1.f / numVoices);
+        t = measureSeconds([&]()
+        {
+          for(int b = 0; b < numBlocks; b++)
+          {
+            bank.render(out.data(), blockSize);
+            checkSum += out[b % blockSize];
+          }
+        });
+        ns = 1.e9 * t / ((double) numVoices * blockSize * numBlocks);
+        std::cout << std::setw(10) << std::fixed << std::setprecision(3) << ns;
+      }
+    }
+    std::cout << std::defaultfloat << std::setprecision(6) << "   (checksum: " << checkSum << ")\n";
+  }
+  std::cout << "\n";
+}
+
+void runPitchIncrementBenchmark()
+{
+  using namespace RobsClapHelpers;
+
+  // Random fractional pitches as they occur with pitch bend or tuning expressions:
+  int numPitches = 1 << 16, numPasses = 64;
+  double sampleRate = 48000.0;
+  std::vector<float> pitches(numPitches), incs(numPitches);
+  uint32_t state = 12345;
+  for(int i = 0; i < numPitches; i++)
+  {
+    state = state * 1664525u + 1013904223u;
+    pitches[i] = 128.f * (float) (state >> 8) / (float) (1 << 24);
+  }
+
+  PitchIncrementTable pt;
+  pt.setSampleRate(sampleRate);
+  double checkSum = 0.0;
+  double t1 = measureSeconds([&]()
+  {
+    for(int p = 0; p < numPasses; p++)
+    {
+      for(int i = 0; i < numPitches; i++)
+        incs[i] = (float) (pitchToFreq((double) pitches[i]) / sampleRate);
+      checkSum += incs[p];
+    }
+  });
+  double t2 = measureSeconds([&]()
+  {
+    for(int p = 0; p < numPasses; p++)
+    {
+      for(int i = 0; i < numPitches; i++)
+        incs[i] = pt.getIncrement(pitches[i]);
+      checkSum += incs[p];
+    }
+  });
+
+  double n = (double) numPitches * numPasses;
+  std::cout << "Pitch to phase increment conversion:\n";
+  printRate("pitchToFreq / sampleRate", n, t1);
+  printRate("PitchIncrementTable     ", n, t2);
+  std::cout << "    (checksum: " << checkSum << ")\n\n";
+}
+
+void runNoteExpressionBenchmark()
+{
+  using namespace RobsClapHelpers;
+
+  // An MPE-like stream: every 4 frames, an expression event for a random note arrives, so the 
+  // block is split into many small sub-blocks and the ramps must be computed for each of them. 
+  // The notes are either those of 10 fingers while the other voices are sustained or all voices:
+  int blockSize = 512, eventSpacing = 4, numBlocks = 2000;
+  int numEvents = blockSize / eventSpacing;
+  std::cout << "Note expressions, one event every " << eventSpacing << " frames, ns per event "
+    << "including the ramps:\n";
+  std::cout << "  voices   10 moving   all moving\n";
+  for(int numVoices : { 16, 64, 256 })
+  {
+    std::cout << "  " << std::setw(6) << numVoices;
+    for(int numMoving : { 10, numVoices })
+    {
+      clap_plugin_descriptor_t desc = ClapVoiceRecorder::descriptor;
+      ClapVoiceRecorder synth(&desc, nullptr, numVoices);
+      synth.activate(44100.0, 1, blockSize);
+      synth.setNoteExpressionSmoothing(220.f);
+      ClapProcessBuffer_1In_1Out buf(2, 2, blockSize);
+      for(int v = 0; v < numVoices; v++)
+        buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON, (int16_t) (v % 128), 1.0, 0, v, 0, 
+          (int16_t) (v / 128));
+      synth.process(buf.getWrappee());
+      buf.clearInputEvents();
+      uint32_t state = 12345;
+      for(int e = 0; e < numEvents; e++)
+      {
+        state = state * 1664525u + 1013904223u;
+        int32_t noteId = (state >> 8) % numMoving;
+        int32_t id     = CLAP_NOTE_EXPRESSION_TUNING + (state >> 20) % 5;
+        buf.addInputNoteExpressionEvent(id, (state >> 24) / 255.0, -1, e * eventSpacing, noteId);
+      }
+      double t = measureSeconds([&]()
+      {
+        for(int b = 0; b < numBlocks; b++)
+          synth.process(buf.getWrappee());
+      });
+      double n = (double) numEvents * numBlocks;
+      std::cout << std::setw(12) << std::fixed << std::setprecision(1) << 1.e9 * t / n;
+      synth.deactivate();
+    }
+    std::cout << std::defaultfloat << std::setprecision(6) << "\n";
+  }
+  std::cout << "\n";
+}
+
+void runNoteTimingBenchmark()
+{
+  using namespace RobsClapHelpers;
+
+  // 32 sustained voices and a number of short notes in each block that start and end at random 
+  // frames. We run at a low sample rate to make the release short in terms of frames. The short
+  // notes then ring for about 4 blocks after their note-off, so with 32 notes per block, we peak
+  // at around 160 voices and no stealing. With dense chords like that, the sub-blocks get only a 
+  // few frames long, whereas with offsets, the lanes keep running over full chunks:
+  int blockSize = 512, numHeld = 32, numBlocks = 2000;
+  double sampleRate = 4410.0;
+  std::cout << "Tone generator with " << numHeld << " sustained voices, blocks of " << blockSize
+    << " frames, ns per frame:\n";
+  std::cout << "  notes/block   sub-blocks   offsets\n";
+  for(int numNotes : { 0, 4, 16, 32 })
+  {
+    std::cout << "  " << std::setw(11) << numNotes;
+    for(auto timing : { ClapSynthStereo32Bit::kSubBlocks, ClapSynthStereo32Bit::kVoiceOffsets })
+    {
+      clap_plugin_descriptor_t desc = ClapToneGenerator::descriptor;
+      ClapToneGenerator tone(&desc, nullptr);
+      tone.setNoteTiming(timing);
+      tone.activate(sampleRate, 1, blockSize);
+      ClapProcessBuffer_1In_1Out buf(2, 2, blockSize);
+      for(int k = 0; k < numHeld; k++)
+        buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON, (int16_t) (36 + k), 1.0, 0, k, 0, 0);
+      tone.process(buf.getWrappee());
+      buf.clearInputEvents();
+
+      // The events must be sorted by time, so we put the note-ons into the first half of the 
+      // block and the note-offs into the second:
+      uint32_t state = 12345;
+      int32_t  noteId = numHeld;
+      double t = measureSeconds([&]()
+      {
+        for(int b = 0; b < numBlocks; b++)
+        {
+          buf.clearInputEvents();
+          buf.clearOutputEvents();
+          std::vector<uint32_t> times(2 * numNotes);
+          for(int i = 0; i < numNotes; i++)
+          {
+            state = state * 1664525u + 1013904223u;
+            times[i]            = (state >> 8)  % (blockSize/2);
+            times[numNotes + i] = (state >> 20) % (blockSize/2) + blockSize/2;
+          }
+          std::sort(times.begin(), times.begin() + numNotes);
+          std::sort(times.begin() + numNotes, times.end());
+          for(int i = 0; i < numNotes; i++)
+            buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON, (int16_t) (72 + i), 1.0, times[i], 
+              noteId + i, 0, 0);
+          for(int i = 0; i < numNotes; i++)
+            buf.addInputNoteEvent(CLAP_EVENT_NOTE_OFF, (int16_t) (72 + i), 1.0, 
+              times[numNotes + i], noteId + i, 0, 0);
+          noteId += numNotes;
+          tone.process(buf.getWrappee());
+        }
+      });
+      double n = (double) blockSize * numBlocks;
+      std::cout << std::setw(13) << std::fixed << std::setprecision(1) << 1.e9 * t / n;
+      tone.deactivate();
+    }
+    std::cout << std::defaultfloat << std::setprecision(6) << "\n";
+  }
+  std::cout << "\n";
+
+  // Notes:
+  //
+  // -The setup of the events is included in the measurement. It's small compared to rendering 
+  //  the voices.
+}
+
+//-------------------------------------------------------------------------------------------------
+// MIDI
+
+void runMidiDecoderBenchmark()
+{
+  using namespace RobsClapHelpers;
+
+  // An MPE-like stream: per-channel pitch bend, CC 74 (timbre) and channel pressure on 15 member 
+  // channels, with random values:
+  int numMessages = 1 << 20, numPasses = 8;
+  std::vector<uint8_t>  midi1(3 * numMessages);
+  std::vector<uint32_t> midi2(4 * numMessages, 0);
+  uint32_t state = 12345;
+  for(int i = 0; i < numMessages; i++)
+  {
+    state = state * 1664525u + 1013904223u;
+    uint8_t channel = 1 + (state >> 8) % 15;
+    uint8_t kind    = (state >> 16) % 3;
+    uint8_t d1      = (state >> 20) & 0x7f;
+    uint8_t d2      = (state >> 24) & 0x7f;
+    uint8_t status  = (uint8_t) ((kind == 0 ? 0xE0 : (kind == 1 ? 0xB0 : 0xD0)) | channel);
+    if(kind == 1)
+      d1 = 74;
+    midi1[3*i+0] = status; midi1[3*i+1] = d1; midi1[3*i+2] = d2;
+    midi2[4*i+0] = 0x40000000 | (status << 16) | (d1 << 8);
+    midi2[4*i+1] = state;
+  }
+
+  MidiDecoder dec;
+  MidiDecoder::Event ev;
+  double checkSum = 0.0;
+  double t1 = measureSeconds([&]()
+  {
+    for(int p = 0; p < numPasses; p++)
+      for(int i = 0; i < numMessages; i++)
+      {
+        dec.decodeMidi1(&midi1[3*i], ev);
+        checkSum += ev.raw;
+      }
+  });
+  double t2 = measureSeconds([&]()
+  {
+    for(int p = 0; p < numPasses; p++)
+      for(int i = 0; i < numMessages; i++)
+      {
+        dec.decodeMidi2(&midi2[4*i], ev);
+        checkSum += ev.raw;
+      }
+  });
+
+  double n = (double) numMessages * numPasses;
+  std::cout << "MIDI decoding of an MPE controller stream:\n";
+  printRate("MIDI 1.0", n, t1);
+  printRate("MIDI 2.0", n, t2);
+  std::cout << "    (" << 1.e9 * t1 / n << " and " << 1.e9 * t2 / n << " ns per message, checksum: " 
+    << checkSum << ")\n\n";
+}
+
+//-------------------------------------------------------------------------------------------------
+// Demo plugins
+
+void runWaveShaperBenchmark()
+{
+  // We process the same number of frames for all block sizes. The input has values in -2..+2 so 
+  // the clipper actually clips:
+  using ID = ClapWaveShaper::ParamId;
+  int maxBlockSize = 4096, numFrames = 1 << 21;
+  std::vector<float> inL(maxBlockSize), inR(maxBlockSize), outL(maxBlockSize), 
+    outR(maxBlockSize);
+  for(int n = 0; n < maxBlockSize; n++)
+  {
+    inL[n] = 2.f * sin(0.01f * n);
+    inR[n] = 2.f * cos(0.013f * n);
+  }
+  clap_plugin_descriptor_t desc = ClapWaveShaper::descriptor;
+  ClapWaveShaper ws(&desc, nullptr);
+  ws.setParameter(ID::kDrive, 3.0);
+  double checkSum = 0.0;
+
+  const char* names[ClapWaveShaper::numShapes] = { "clip", "tanh", "atan", "erf" };
+  std::cout << "WaveShaper, ns per stereo frame, shape selected per sample / per block:\n";
+  std::cout << "  block";
+  for(int s = 0; s < ClapWaveShaper::numShapes; s++)
+    std::cout << std::setw(17) << names[s];
+  std::cout << "\n";
+  for(int blockSize : { 16, 64, 256, 1024, 4096 })
+  {
+    int numBlocks = numFrames / blockSize;
+    std::cout << "  " << std::setw(5) << blockSize;
+    for(int s = 0; s < ClapWaveShaper::numShapes; s++)
+    {
+      ws.setParameter(ID::kShape, s);
+      double t1 = measureSeconds([&]()
+      {
+        for(int b = 0; b < numBlocks; b++)
+          for(int n = 0; n < blockSize; n++)
+          {
+            outL[n] = ws.applyDistortion(inL[n]);
+            outR[n] = ws.applyDistortion(inR[n]);
+          }
+        checkSum += outL[blockSize-1];
+      });
+      double t2 = measureSeconds([&]()
+      {
+        for(int b = 0; b < numBlocks; b++)
+          ws.processBlockStereo(&inL[0], &inR[0], &outL[0], &outR[0], (uint32_t) blockSize);
+        checkSum += outL[blockSize-1];
+      });
+      double n = (double) numBlocks * blockSize;
+      std::cout << std::fixed << std::setprecision(2) << std::setw(9) << 1.e9 * t1 / n << " / " 
+        << std::setw(5) << 1.e9 * t2 / n;
+    }
+    std::cout << std::defaultfloat << std::setprecision(6) << "\n";
+  }
+  std::cout << "  (checksum: " << checkSum << ")\n\n";
+
+  // Notes:
+  //
+  // -The per-sample loop calls applyDistortion across translation units, so it isn't inlined 
+  //  here. The old processBlockStereo had the call in the same file, so the numbers for the 
+  //  switch per sample are a bit pessimistic. The difference is the call overhead, though, and 
+  //  the switch remains.
+}
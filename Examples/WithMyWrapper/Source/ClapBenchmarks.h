@@ -0,0 +1,65 @@
+#pragma once
+
+#include "ClapTestHelpers.h"
+
+// This file contains performance measurements for various parts of the framework. Unlike the unit
+// tests, they do not pass or fail. They just print their results to the console. It is 
+// recommended to run them in a release build because debug builds are not representative.
+
+
+/** Runs all the benchmarks and prints the results. */
+void runAllClapBenchmarks();
+
+/** Measures the throughput of stateSave/stateLoad for big states (1 MB and 100 MB) with the 
+streaming implementation and compares it to building the whole state as a string first, which is 
+how it used to work. */
+void runStateStreamingBenchmark();
+
+/** Measures the compression ratio and the speed of stateSave/stateLoad with and without state 
+compression for a big wavetable, for white noise and for a plugin with many parameters. */
+void runStateCompressionBenchmark();
+
+/** Measures the number of double-to-string conversions per second done by toStringExact and 
+toStringWithSuffix and compares them to the old implementations based on std::ostringstream. */
+void runNumberToStringBenchmark();
+
+/** Compares the lookup of choice strings by findString (linear search) and ChoiceStrings::find 
+(hash index) for various numbers of strings. */
+void runChoiceLookupBenchmark();
+
+/** Compares the mapping of blocks of parameter values by ParameterMapping::map (per value, double
+precision, library functions) and ParameterMapping::mapArray (vectorizable) for all curves. */
+void runParameterMappingBenchmark();
+
+/** Renders 1 to 512 simultaneous sine voices with SineVoiceBank and compares the scalar path (one 
+voice at a time with std::sin) to the SIMD paths with 4, 8 and 16 lanes. A plain loop over the 
+voices with sinCycleFast shows how much of the gain is due to the lanes alone. The lane counts are
+maxima. With few voices, the bank uses narrower groups, see SineVoiceBank::setNumLanes(). */
+void runSineVoiceBenchmark();
+
+/** Compares the polynomial, rotator and wavetable oscillators of SineVoiceBank with 8 and 16 lanes
+for block sizes from 16 to 4096 frames. The first column is the old per-sample path of the tone 
+generator (double phasor, float sin, wrap-around branch) as the baseline. The times are in ns per
+voice-sample. Multiply them by the clock rate in GHz to get cycles per sample. */
+void runSineOscillatorBenchmark();
+
+/** Compares the conversion of fractional pitches to phase increments by pitchToFreq (with exp and
+a division) and by the interpolated PitchIncrementTable. */
+void runPitchIncrementBenchmark();
+
+/** Measures the cost of a dense stream of note expression events for 16 to 256 voices, including 
+the per-block ramps that ClapSynthStereo32Bit computes for all active voices. */
+void runNoteExpressionBenchmark();
+
+/** Compares the rendering cost of ClapToneGenerator in the kSubBlocks and kVoiceOffsets note 
+timing modes for various numbers of short notes per block on top of sustained voices. */
+void runNoteTimingBenchmark();
+
+/** Measures the decoding speed of MidiDecoder for a dense MPE-like stream of pitch bends, 
+controllers and pressures in the MIDI 1.0 and 2.0 formats. */
+void runMidiDecoderBenchmark();
+
+/** Compares the throughput of ClapWaveShaper with the shape selected per sample (as 
+applyDistortion does it) and per block (as processBlockStereo does it) for all shapes and block 
+sizes from 16 to 4096 frames. */
+void runWaveShaperBenchmark();
@@ -1,6 +1,10 @@
 
 #include "ClapPluginTests.h"
 #include "GNUPlotter.h"        // For plotting output signals of the plugins when a test fails
+#include <sstream>             // For comparing with the old number-to-string conversion
+#include <iomanip>
+#include <clocale>             // For checking locale independence
+#include <thread>              // For testing the state handoff to the audio thread
 
 bool runAllClapTests(/*bool printResults*/)
 {
@@ -11,9 +15,32 @@ bool runAllClapTests(/*bool printResults*/)
 
   // All tests in order:
   ok &= runStateRecallTest();
+  ok &= runBinaryStateRecallTest();
+  ok &= runSparseStateTest();
+  ok &= runStateStreamingTest();
+  ok &= runCompressionTest();
+  ok &= runStateContextTest();
+  ok &= runAsyncStateLoadTest();
+  ok &= runBulkUpdateTest();
+  ok &= runParameterMappingTest();
+  ok &= runVoiceManagerTest();
+  ok &= runSineVoiceBankTest();
+  ok &= runNoteEndTest();
+  ok &= runVoiceInfoTest();
+  ok &= runNoteTimingTest();
+  ok &= runMidiDecoderTest();
+  ok &= runNoteExpressionTest();
+  ok &= runPitchIncrementTableTest();
+  ok &= runWavetableTest();
+  ok &= runParamCookieTest();
   ok &= runDescriptorReadTest();
   ok &= runNumberToStringTest();
+  ok &= runNumberRoundTripTest();
+  ok &= runTextToValueTest();
+  ok &= runDisplayCacheTest();
+  ok &= runChoiceStringsTest();
   ok &= runIndexIdentifierMapTest();
+  ok &= runConsistencyCheckScalingTest();
   ok &= runWaveShaperTest();
   ok &= runProcessingTest1();
   ok &= runProcessingTest2();
@@ -111,6 +138,1662 @@ bool runStateRecallTest()
   //  values.
 }
 
+bool runBinaryStateRecallTest()
+{
+  bool ok = true;
+
+  using ID = ClapGain::ParamId;
+  double p;
+
+  // Create a ClapGain object and let it use the binary format:
+  clap_plugin_descriptor_t desc = ClapGain::descriptor;
+  ClapGain gain(&desc, nullptr);
+  gain.setStateFormat(ClapGain::kBinaryState);
+
+  // Set up the parameters with numbers that would need all the digits in the text format and 
+  // save the state to a stream:
+  double gainVal = 1.0 / 3.0;
+  double panVal  = -0.1234567890123456789;
+  gain.setParameter(ID::kGain, gainVal);
+  gain.setParameter(ID::kPan,  panVal);
+  ClapStreamData streamData;
+  clap_ostream ostream;
+  ostream.write = clapStreamWrite;
+  ostream.ctx   = &streamData;
+  ok &= gain.stateSave(&ostream);
+  ok &= streamData.data.size() == 20 + 2*12;   // Header + 2 records
+
+  // Mess up the parameters and load the state:
+  gain.setParameter(ID::kGain, 3.14);
+  gain.setParameter(ID::kPan,  0.75);
+  streamData.pos = 0;
+  clap_istream istream;
+  istream.read = clapStreamRead;
+  istream.ctx  = &streamData;
+  ok &= gain.stateLoad(&istream);
+  ok &= gain.paramsValue(ID::kGain, &p); ok &= p == gainVal;
+  ok &= gain.paramsValue(ID::kPan,  &p); ok &= p == panVal;
+
+  // Load the binary state of the "old" version into the "new" version ClapGain2. The parameters 
+  // that did not exist in the old version should get their default values:
+  clap_plugin_descriptor_t desc2 = ClapGain2::descriptor;
+  ClapGain2 gain2(&desc2, nullptr);
+  using ID2 = ClapGain2::ParamId;
+  gain2.setParameter(ID2::kMono,    1.0);
+  gain2.setParameter(ID2::kMidSide, 0.2);
+  streamData.pos = 0;
+  ok &= gain2.stateLoad(&istream);
+  ok &= gain2.paramsValue(ID2::kGain,    &p); ok &= p == gainVal;
+  ok &= gain2.paramsValue(ID2::kPan,     &p); ok &= p == panVal;
+  ok &= gain2.paramsValue(ID2::kMono,    &p); ok &= p == 0.0;
+  ok &= gain2.paramsValue(ID2::kMidSide, &p); ok &= p == 0.5;
+
+  // A text state must still load while the binary format is selected:
+  std::string blob = gain.getStateAsBinary();
+  gain.setStateFormat(ClapGain::kTextState);
+  gain.setParameter(ID::kGain, 6.02);
+  gain.setParameter(ID::kPan, -0.3);
+  ClapStreamData textData;
+  ostream.ctx = &textData;
+  ok &= gain.stateSave(&ostream);
+  ok &= !ClapGain::isBinaryState(std::string(textData.data.begin(), textData.data.end()));
+  gain.setStateFormat(ClapGain::kBinaryState);
+  gain.setParameter(ID::kGain, 3.14);
+  textData.pos = 0;
+  istream.ctx  = &textData;
+  ok &= gain.stateLoad(&istream);
+  ok &= gain.paramsValue(ID::kGain, &p); ok &= p == 6.02;
+  ok &= gain.paramsValue(ID::kPan,  &p); ok &= p == -0.3;
+
+  // Malformed blobs and blobs of other plugins must be rejected without touching the parameters:
+  std::string truncated = blob.substr(0, blob.size()-1);
+  ok &= !gain.setStateFromBinary(truncated);
+  std::string newer = blob;
+  newer[4] = 99;                                         // Version byte
+  ok &= !gain.setStateFromBinary(newer);
+  clap_plugin_descriptor_t desc3 = ClapWaveShaper::descriptor;
+  ClapWaveShaper ws(&desc3, nullptr);
+  ok &= !gain.setStateFromBinary(ws.getStateAsBinary());
+  ok &= gain.paramsValue(ID::kGain, &p); ok &= p == 6.02;
+  ok &= gain.paramsValue(ID::kPan,  &p); ok &= p == -0.3;
+
+  // Blobs of version 1 of the format which had a 16 byte header without the defaults version must
+  // still load:
+  std::string v1 = blob.substr(0, 12) + blob.substr(16);
+  v1[4] = 1;
+  ok &= gain.setStateFromBinary(v1);
+  ok &= gain.paramsValue(ID::kGain, &p); ok &= p == gainVal;
+  ok &= gain.paramsValue(ID::kPan,  &p); ok &= p == panVal;
+
+  return ok;
+}
+
+bool runSparseStateTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+  double p;
+
+  // Create a plugin with many parameters and change only a few of them:
+  clap_plugin_descriptor_t desc = ClapManyParams::descriptor;
+  ClapManyParams plugin(&desc, nullptr, 1000);
+  plugin.setParameter(17,  0.5);
+  plugin.setParameter(500, -0.25);
+  plugin.setParameter(999, -0.0);            // Not the same as the default +0.0
+  std::string fullText = plugin.getStateAsString();
+  std::string fullBin  = plugin.getStateAsBinary();
+
+  // The sparse states should contain only the 3 non-default values:
+  plugin.setSparseState(true);
+  std::string sparseText = plugin.getStateAsString();
+  std::string sparseBin  = plugin.getStateAsBinary();
+  ok &= sparseBin.size() == 20 + 3*12;
+  ok &= sparseText.size() < fullText.size() / 100;
+  ok &= sparseText.find("17:Param 17:0.5") != std::string::npos;
+  ok &= sparseText.find("Defaults: 0\n") != std::string::npos;
+
+  // Loading the sparse states should restore all parameters, those not in the state get their 
+  // defaults:
+  auto checkValues = [&]()
+  {
+    bool ok = true;
+    for(clap_id id = 0; id < 1000; id++)
+    {
+      double target = id == 17 ? 0.5 : (id == 500 ? -0.25 : 0.0);
+      ok &= plugin.paramsValue(id, &p) && p == target;
+    }
+    ok &= plugin.paramsValue(999, &p) && std::signbit(p);
+    return ok;
+  };
+  for(std::string* state : { &sparseText, &sparseBin, &fullText, &fullBin })
+  {
+    for(clap_id id = 0; id < 1000; id++)
+      plugin.setParameter(id, 0.75);
+    if(ClapManyParams::isBinaryState(*state))
+      ok &= plugin.setStateFromBinary(*state);
+    else
+      ok &= plugin.setStateFromString(*state);
+    ok &= checkValues();
+  }
+
+  // A sparse state of a plugin where all parameters are at their defaults has an empty list:
+  plugin.setAllParametersToDefault();
+  sparseText = plugin.getStateAsString();
+  ok &= sparseText.find("Parameters: []") != std::string::npos;
+  plugin.setParameter(3, 0.75);
+  ok &= plugin.setStateFromString(sparseText);
+  ok &= plugin.paramsValue(3, &p) && p == 0.0;
+  ok &= plugin.getStateAsBinary().size() == 20;
+
+  // Sparse states with additional data behind the parameters:
+  clap_plugin_descriptor_t desc2 = ClapBigState::descriptor;
+  ClapBigState big(&desc2, nullptr);
+  big.setSparseState(true);
+  big.data = { 1.f, 2.f, 3.f };
+  std::string bigState;
+  StringOutStream os(&bigState);
+  ok &= big.stateSave(os.getWrappee());
+  big.data.clear();
+  big.setParameter(ClapBigState::kGain, 6.0);
+  StringInStream is(bigState);
+  ok &= big.stateLoad(is.getWrappee());
+  ok &= big.data == std::vector<float>({ 1.f, 2.f, 3.f });
+  ok &= big.paramsValue(ClapBigState::kGain, &p) && p == 0.0;
+
+  // Changed defaults: version 0 of the plugin had a default of 0.5 for parameter A, version 1 
+  // changed it to 0.25. A sparse state of version 0 with A at its default does not store A, so 
+  // when version 1 loads it, it needs to give A the old default of 0.5:
+  clap_plugin_descriptor_t desc3 = ClapVersionedDefaults::descriptor;
+  ClapVersionedDefaults v0(&desc3, nullptr, 0), v1(&desc3, nullptr, 1);
+  using ID = ClapVersionedDefaults::ParamId;
+  v0.setSparseState(true);
+  v0.setParameter(ID::kB, 0.1);
+  std::string v0Text = v0.getStateAsString();
+  std::string v0Bin  = v0.getStateAsBinary();
+  ok &= v1.setStateFromString(v0Text);
+  ok &= v1.paramsValue(ID::kA, &p) && p == 0.5;
+  ok &= v1.paramsValue(ID::kB, &p) && p == 0.1;
+  v1.setAllParametersToDefault();
+  ok &= v1.paramsValue(ID::kA, &p) && p == 0.25;
+  ok &= v1.setStateFromBinary(v0Bin);
+  ok &= v1.paramsValue(ID::kA, &p) && p == 0.5;
+  ok &= v1.paramsValue(ID::kB, &p) && p == 0.1;
+
+  // Old text states without the "Defaults" line are treated as version 0:
+  std::string oldText = v0Text;
+  oldText.erase(oldText.find("Defaults: 0\n"), 12);
+  v1.setAllParametersToDefault();
+  ok &= v1.setStateFromString(oldText);
+  ok &= v1.paramsValue(ID::kA, &p) && p == 0.5;
+
+  return ok;
+}
+
+bool runStateStreamingTest()
+{
+  // Saves and loads the state of a plugin that has a big chunk of data behind its parameters. The
+  // mock streams read and write only a few bytes per call, so the buffering in the stream reader 
+  // and writer gets exercised thoroughly.
+
+  bool ok = true;
+  using ID = ClapBigState::ParamId;
+  double p;
+
+  clap_plugin_descriptor_t desc = ClapBigState::descriptor;
+  ClapBigState plugin(&desc, nullptr);
+
+  auto roundTrip = [&](ClapBigState::StateFormat format, uint32_t size, bool compress)
+  {
+    bool ok = true;
+
+    // Set up the plugin and save its state:
+    plugin.setStateFormat(format);
+    plugin.setCompressedState(compress);
+    plugin.setParameter(ID::kGain, -3.25);
+    plugin.setParameter(ID::kPan,   0.125);
+    plugin.data.resize(size);
+    for(uint32_t i = 0; i < size; i++)
+      plugin.data[i] = (float) i;
+    std::vector<float> data = plugin.data;
+    ClapStreamData streamData;
+    clap_ostream ostream;
+    ostream.write = clapStreamWrite;
+    ostream.ctx   = &streamData;
+    ok &= plugin.stateSave(&ostream);
+    ok &= compress == RobsClapHelpers::CompressedOutStream::isCompressed(
+      (const char*) streamData.data.data(), streamData.data.size());
+
+    // Mess up the state and load it back in:
+    plugin.setParameter(ID::kGain, 1.0);
+    plugin.setParameter(ID::kPan,  1.0);
+    plugin.data.clear();
+    streamData.pos = 0;
+    clap_istream istream;
+    istream.read = clapStreamRead;
+    istream.ctx  = &streamData;
+    ok &= plugin.stateLoad(&istream);
+    ok &= plugin.paramsValue(ID::kGain, &p); ok &= p == -3.25;
+    ok &= plugin.paramsValue(ID::kPan,  &p); ok &= p ==  0.125;
+    ok &= plugin.data == data;
+
+    // Load the state again from a truncated stream. This must fail:
+    streamData.data.resize(streamData.data.size() - 1);
+    streamData.pos = 0;
+    ok &= !plugin.stateLoad(&istream);
+
+    return ok;
+  };
+
+  // Use sizes smaller than, equal to and bigger than the internal buffers of the stream reader
+  // and writer and of the compressor:
+  for(uint32_t size : { 0, 1, 1000, 1024, 5000, 16384, 100000 })
+  {
+    for(bool compress : { false, true })
+    {
+      ok &= roundTrip(ClapBigState::kTextState,   size, compress);
+      ok &= roundTrip(ClapBigState::kBinaryState, size, compress);
+    }
+  }
+
+  return ok;
+}
+
+bool runCompressionTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+
+  // Compresses and decompresses the given data and checks that we get it back. Returns the size
+  // of the compressed data or 0 on failure:
+  auto roundTrip = [](const std::vector<char>& data)
+  {
+    std::vector<char> packed(lzCompressBound(data.size()));
+    size_t packedSize = lzCompress(data.data(), data.size(), packed.data(), packed.size());
+    if(packedSize == 0)
+      return (size_t) 0;
+    std::vector<char> unpacked(data.size());
+    if(!lzDecompress(packed.data(), packedSize, unpacked.data(), unpacked.size()))
+      return (size_t) 0;
+    return unpacked == data ? packedSize : 0;
+  };
+
+  // Produces data of the given size of which the given fraction is noise and the rest is from a 
+  // small alphabet with lots of repetitions:
+  auto makeData = [](size_t size, double noiseFraction)
+  {
+    std::vector<char> data(size);
+    uint32_t state = 12345;
+    for(size_t i = 0; i < size; i++)
+    {
+      state = state * 1664525u + 1013904223u;          // Linear congruential generator
+      if((state >> 8) % 1000 < noiseFraction * 1000)
+        data[i] = (char) (state >> 24);
+      else
+        data[i] = "abcabcabd"[(i/3) % 9];
+    }
+    return data;
+  };
+
+  // Round trips for various sizes, including those that are too small to contain a match:
+  for(size_t size : { 0, 1, 4, 5, 12, 13, 100, 1000, 65535, 65536, 200000 })
+  {
+    ok &= roundTrip(makeData(size, 0.0)) > 0;
+    ok &= roundTrip(makeData(size, 0.1)) > 0;
+    ok &= roundTrip(makeData(size, 1.0)) > 0;
+  }
+
+  // Long runs of equal bytes produce overlapping matches and long length fields:
+  ok &= roundTrip(std::vector<char>(100000, 'x')) < 500;
+
+  // Repetitive data should compress well, noise shouldn't grow by more than the bound:
+  ok &= roundTrip(makeData(65536, 0.0)) < 65536 / 20;
+  ok &= roundTrip(makeData(65536, 1.0)) <= lzCompressBound(65536);
+
+  // Compression must fail gracefully when the destination is too small:
+  std::vector<char> data = makeData(1000, 1.0);
+  std::vector<char> buf(lzCompressBound(data.size()));
+  ok &= lzCompress(data.data(), data.size(), buf.data(), 500) == 0;
+
+  // Malformed data must be rejected. A truncated stream and a wrong size must fail. Garbage may or
+  // may not decode but must never make us access memory outside the buffers (run this with the 
+  // address sanitizer to check that):
+  data = makeData(5000, 0.1);
+  buf.resize(lzCompressBound(data.size()));
+  size_t packedSize = lzCompress(data.data(), data.size(), buf.data(), buf.size());
+  std::vector<char> out(data.size());
+  ok &= lzDecompress(buf.data(), packedSize, out.data(), out.size());
+  ok &= !lzDecompress(buf.data(), packedSize - 1, out.data(), out.size());
+  ok &= !lzDecompress(buf.data(), packedSize, out.data(), out.size() - 1);
+  std::vector<char> garbage = makeData(5000, 1.0);
+  for(size_t n : { 1, 2, 10, 100, 5000 })
+    lzDecompress(garbage.data(), n, out.data(), out.size());
+
+  return ok;
+}
+
+bool runStateContextTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+  using ID = ClapBigState::ParamId;
+
+  clap_plugin_descriptor_t desc = ClapBigState::descriptor;
+  ClapDerivedState plugin(&desc, nullptr);
+  const clap_plugin* plug = plugin.clapPlugin();
+  ok &= plug->init(plug);
+  auto ext = (const clap_plugin_state_context*) plug->get_extension(plug, CLAP_EXT_STATE_CONTEXT);
+  ok &= ext != nullptr;
+  if(!ext)
+    return false;
+
+  plugin.setParameter(ID::kGain, -3.25);
+  plugin.data.resize(1000);
+  for(size_t i = 0; i < plugin.data.size(); i++)
+    plugin.data[i] = (float) i;
+  plugin.updateDerived();
+
+  // Saves the state with the given context through the extension into a string:
+  auto save = [&](uint32_t context)
+  {
+    std::string state;
+    StringOutStream os(&state);
+    ok &= ext->save(plug, os.getWrappee(), context);
+    return state;
+  };
+
+  // Loads the state into a fresh plugin through the extension (or the plain state extension, if
+  // the context is 0) and checks that it has the same data as our plugin:
+  auto loadAndCompare = [&](const std::string& state, uint32_t context, int numUpdates)
+  {
+    ClapDerivedState p2(&desc, nullptr);
+    StringInStream is(state);
+    bool ok = context != 0 ? p2.stateLoadWithContext(is.getWrappee(), context)
+                           : p2.stateLoad(is.getWrappee());
+    ok &= p2.getParameter(ID::kGain) == -3.25;
+    ok &= p2.data    == plugin.data;
+    ok &= p2.derived == plugin.derived;
+    ok &= p2.numDerivedUpdates == numUpdates;
+    ok &= p2.getStateContext() == CLAP_STATE_CONTEXT_FOR_PROJECT;
+    return ok;
+  };
+
+  // Presets leave out the derived data, so they are smaller and recompute it on load:
+  std::string preset  = save(CLAP_STATE_CONTEXT_FOR_PRESET);
+  std::string project = save(CLAP_STATE_CONTEXT_FOR_PROJECT);
+  ok &= preset.size() + 1000 * sizeof(float) == project.size();
+  ok &= plugin.getStateContext() == CLAP_STATE_CONTEXT_FOR_PROJECT;
+  ok &= loadAndCompare(preset,  CLAP_STATE_CONTEXT_FOR_PRESET,  1);
+  ok &= loadAndCompare(project, CLAP_STATE_CONTEXT_FOR_PROJECT, 0);
+
+  // States saved in one context can be loaded in any other and by the plain state extension:
+  ok &= loadAndCompare(preset,  CLAP_STATE_CONTEXT_FOR_PROJECT, 1);
+  ok &= loadAndCompare(project, CLAP_STATE_CONTEXT_FOR_PRESET,  0);
+  ok &= loadAndCompare(preset,  0, 1);
+  std::string plain;
+  StringOutStream os(&plain);
+  ok &= plugin.stateSave(os.getWrappee());
+  ok &= plain == project;
+
+  // Duplicates use the uncompressed binary format, regardless of our settings, and the settings
+  // are still in place afterwards:
+  plugin.setStateFormat(ClapBigState::kTextState);
+  plugin.setCompressedState(true);
+  std::string duplicate = save(CLAP_STATE_CONTEXT_FOR_DUPLICATE);
+  ok &= ClapPluginWithParams::isBinaryState(duplicate);
+  ok &= plugin.getStateFormat() == ClapBigState::kTextState;
+  ok &= plugin.isCompressedState();
+  ok &= loadAndCompare(duplicate, CLAP_STATE_CONTEXT_FOR_DUPLICATE, 0);
+  std::string compressed = save(CLAP_STATE_CONTEXT_FOR_PROJECT);
+  ok &= CompressedOutStream::isCompressed(compressed.data(), compressed.size());
+
+  return ok;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Parameters
+
+bool runAsyncStateLoadTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+  double p;
+
+  clap_plugin_descriptor_t desc = ClapGain::descriptor;
+  ClapGain gain(&desc, nullptr);
+  using ID = ClapGain::ParamId;
+  const clap_plugin* plug = gain.clapPlugin();
+
+  // Create two presets A and B:
+  gain.setParameter(ID::kGain,  6.0);
+  gain.setParameter(ID::kPan,  -0.5);
+  std::string stateA = gain.getStateAsString();
+  gain.setParameter(ID::kGain, -6.0);
+  gain.setParameter(ID::kPan,   0.5);
+  std::string stateB = gain.getStateAsString();
+
+  // When the plugin is not active, the state is applied immediately:
+  ok &= gain.setStateFromString(stateA);
+  ok &= gain.getParameter(ID::kGain) == 6.0;
+
+  // When the plugin is active, the state is applied at the start of the next process call. In the 
+  // meantime, the host already sees the new values via paramsValue:
+  ok &= plug->activate(plug, 44100.0, 1, 64);
+  ok &= gain.setStateFromString(stateB);
+  ok &= gain.getParameter(ID::kGain) == 6.0;             // Not yet applied
+  ok &= gain.paramsValue(ID::kGain, &p) && p == -6.0;    // ...but reported to the host
+  ok &= gain.getStateAsString() == stateB;
+  ClapProcessBuffer_1In_1Out procBuf(2, 2, 64);
+  ok &= gain.process(procBuf.getWrappee()) == CLAP_PROCESS_CONTINUE;
+  ok &= gain.getParameter(ID::kGain) == -6.0;            // Now it's applied
+  ok &= gain.getParameter(ID::kPan)  ==  0.5;
+
+  // Of two loads between two process calls, the later one wins:
+  ok &= gain.setStateFromString(stateA);
+  ok &= gain.setStateFromString(stateB);
+  ok &= gain.setStateFromString(stateA);
+  ok &= gain.process(procBuf.getWrappee()) == CLAP_PROCESS_CONTINUE;
+  ok &= gain.getParameter(ID::kGain) == 6.0;
+
+  // A failed load doesn't destroy a pending one:
+  ok &=  gain.setStateFromString(stateB);
+  ok &= !gain.setStateFromString("");
+  ok &= !gain.setStateFromString("Parameters: [0:Gain:abc]");
+  ok &= gain.process(procBuf.getWrappee()) == CLAP_PROCESS_CONTINUE;
+  ok &= gain.getParameter(ID::kGain) == -6.0;
+
+  // Parameter events that the host sends after the state load are newer and must win over the 
+  // state. The state is applied before the events are handled:
+  ok &= gain.setStateFromString(stateA);
+  procBuf.addInputParamValueEvent(ID::kGain, 3.0, 0);
+  ok &= gain.process(procBuf.getWrappee()) == CLAP_PROCESS_CONTINUE;
+  ok &= gain.getParameter(ID::kGain) == 3.0;
+  ok &= gain.getParameter(ID::kPan)  == -0.5;
+  procBuf.clearInputEvents();
+
+  // A state that is loaded right before deactivation is applied by deactivate:
+  ok &= gain.setStateFromString(stateB);
+  plug->deactivate(plug);
+  ok &= gain.getParameter(ID::kGain) == -6.0;
+  ok &= gain.getParameter(ID::kPan)  ==  0.5;
+  ok &= plug->activate(plug, 44100.0, 1, 64);
+
+  // Now the real thing: an audio thread calls process continuously while the main thread switches
+  // between the presets. After each process call, the audio thread checks that it sees either 
+  // preset A or B as a whole and never a mix of both:
+  ok &= gain.setStateFromString(stateB);
+  ok &= gain.process(procBuf.getWrappee()) == CLAP_PROCESS_CONTINUE;
+  std::atomic<bool> stop { false }, mixed { false };
+  std::atomic<int>  numBlocks { 0 };
+  std::thread audioThread([&]()
+  {
+    ClapProcessBuffer_1In_1Out buf(2, 2, 64);
+    while(!stop.load())
+    {
+      gain.process(buf.getWrappee());
+      double g  = gain.getParameter(ID::kGain);
+      double pa = gain.getParameter(ID::kPan);
+      if(!((g == 6.0 && pa == -0.5) || (g == -6.0 && pa == 0.5)))
+        mixed.store(true);
+      numBlocks++;
+    }
+  });
+  while(numBlocks.load() < 10)
+    std::this_thread::yield();
+  for(int i = 0; i < 2000; i++)
+    ok &= gain.setStateFromString(i % 2 == 0 ? stateA : stateB);
+  int target = numBlocks.load() + 10;
+  while(numBlocks.load() < target)                       // Let it apply the last one
+    std::this_thread::yield();
+  stop.store(true);
+  audioThread.join();
+  ok &= !mixed.load();
+  ok &= gain.getParameter(ID::kGain) == -6.0;            // The last preset was B
+  ok &= gain.getParameter(ID::kPan)  ==  0.5;
+
+  plug->deactivate(plug);
+  return ok;
+}
+
+bool runBulkUpdateTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+
+  clap_plugin_descriptor_t desc = ClapManyParams::descriptor;
+  ClapManyParams plugin(&desc, nullptr, 10);
+  plugin.handleBulk = true;
+
+  // Outside of a bulk update, each setParameter call is reported individually:
+  plugin.setParameter(3, 0.5);
+  ok &= plugin.numSingleCalls == 1 && plugin.numBulkCalls == 0;
+
+  // Inside of a bulk update, the changes are collected and reported once at the end. Parameters 
+  // that are set multiple times are reported only once. The values are already there during the 
+  // update:
+  plugin.beginBulkUpdate();
+  plugin.setParameter(7,  0.25);
+  plugin.setParameter(2, -0.25);
+  plugin.setParameter(7,  0.75);
+  ok &= plugin.getParameter(7) == 0.75;
+  ok &= plugin.numSingleCalls == 1 && plugin.numBulkCalls == 0;
+  plugin.endBulkUpdate();
+  ok &= plugin.numSingleCalls == 1 && plugin.numBulkCalls == 1;
+  ok &= plugin.lastBulkIds == std::vector<clap_id>({ 7, 2 });
+
+  // Nested updates report only at the end of the outermost one:
+  plugin.beginBulkUpdate();
+  plugin.setParameter(1, 0.1);
+  plugin.beginBulkUpdate();
+  plugin.setParameter(4, 0.4);
+  plugin.endBulkUpdate();
+  ok &= plugin.numBulkCalls == 1;
+  plugin.endBulkUpdate();
+  ok &= plugin.numBulkCalls == 2;
+  ok &= plugin.lastBulkIds == std::vector<clap_id>({ 1, 4 });
+
+  // An update without changes doesn't report anything:
+  plugin.beginBulkUpdate();
+  plugin.endBulkUpdate();
+  ok &= plugin.numBulkCalls == 2;
+
+  // Loading a state produces a single notification with only the changed parameters:
+  std::string state = plugin.getStateAsString();
+  plugin.setParameter(5, 0.5);
+  plugin.setParameter(8, 0.8);
+  plugin.numSingleCalls = 0;
+  ok &= plugin.setStateFromString(state);
+  ok &= plugin.numSingleCalls == 0 && plugin.numBulkCalls == 3;
+  ok &= plugin.lastBulkIds == std::vector<clap_id>({ 5, 8 });
+  ok &= plugin.getParameter(5) == 0.0 && plugin.getParameter(8) == 0.0;
+
+  // Resetting to the defaults, too:
+  plugin.setAllParametersToDefault();
+  ok &= plugin.numSingleCalls == 0 && plugin.numBulkCalls == 4;
+  ok &= plugin.lastBulkIds.size() == 10;     // All were set, so all are reported
+
+  // The baseclass implementation of parametersChanged dispatches to parameterChanged:
+  plugin.handleBulk = false;
+  plugin.beginBulkUpdate();
+  plugin.setParameter(0, 0.5);
+  plugin.setParameter(9, 0.5);
+  plugin.endBulkUpdate();
+  ok &= plugin.numSingleCalls == 2 && plugin.numBulkCalls == 5;
+
+  // The ClapGain plugin computes its coefficients once from both parameters:
+  clap_plugin_descriptor_t gainDesc = ClapGain::descriptor;
+  ClapGain gain(&gainDesc, nullptr);
+  gain.setParameter(ClapGain::kGain, -6.0);
+  gain.setParameter(ClapGain::kPan,   0.5);
+  std::string gainState = gain.getStateAsString();
+  ClapGain gain2(&gainDesc, nullptr);
+  ok &= gain2.setStateFromString(gainState);
+  ClapProcessBuffer_1In_1Out buf1(2, 2, 16), buf2(2, 2, 16);
+  for(int c = 0; c < 2; c++)
+    for(int n = 0; n < 16; n++)
+      buf1.getInChannelPointer(c)[n] = buf2.getInChannelPointer(c)[n] = 1.f;
+  ok &= gain.process(buf1.getWrappee())  == CLAP_PROCESS_CONTINUE;
+  ok &= gain2.process(buf2.getWrappee()) == CLAP_PROCESS_CONTINUE;
+  for(int c = 0; c < 2; c++)
+    ok &= buf1.getOutChannelPointer(c)[15] == buf2.getOutChannelPointer(c)[15];
+
+  return ok;
+}
+
+bool runParameterMappingTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+  using Map = ParameterMapping;
+
+  // Returns true, iff x and y are equal up to the given relative tolerance:
+  auto close = [](double x, double y, double tol) 
+  { 
+    return std::abs(x - y) <= tol * std::max(std::abs(x), std::abs(y)); 
+  };
+
+  // The fast exp2 and log2 approximations:
+  double maxErrExp = 0.0, maxErrLog = 0.0;
+  for(float x = -30.f; x <= 30.f; x += 0.001f)
+  {
+    double e = std::exp2((double) x);
+    maxErrExp = std::max(maxErrExp, std::abs(exp2Fast(x) - e) / e);
+    double y = std::exp2(x / 8.0);
+    maxErrLog = std::max(maxErrLog, std::abs(log2Fast((float) y) - std::log2((double) (float) y)));
+  }
+  ok &= maxErrExp < 3.e-7;
+  ok &= maxErrLog < 1.e-6;
+  ok &= exp2Fast(-1000.f) > 0.f && !std::isinf(exp2Fast(1000.f));  // Clipped, no inf
+  ok &= exp2Fast(3.f * log2Fast(0.f)) < 1.e-37f;
+
+  // Single values:
+  Map identity;
+  ok &= identity.map(3.5) == 3.5;
+  Map lin = Map::linear(0.0, 1.0);
+  lin.setInputRange(-1.0, 1.0);
+  ok &= lin.map(-1.0) == 0.0 && lin.map(0.0) == 0.5 && lin.map(1.0) == 1.0;
+  Map ex = Map::exponential(20.0, 20000.0);
+  ex.setInputRange(0.0, 1.0);
+  ok &= close(ex.map(0.0), 20.0, 1.e-14) && close(ex.map(1.0), 20000.0, 1.e-14);
+  ok &= close(ex.map(0.5), sqrt(20.0 * 20000.0), 1.e-14);
+  Map db = Map::decibel();
+  db.setInputRange(-60.0, 20.0);                                  // Doesn't matter
+  ok &= db.map(0.0) == 1.0;
+  ok &= close(db.map(-6.0), dbToAmp(-6.0), 1.e-14);
+  ok &= close(db.map(20.0), 10.0, 1.e-14);
+  Map sk = Map::skewed(0.0, 100.0, 2.0);
+  sk.setInputRange(0.0, 10.0);
+  ok &= sk.map(0.0) == 0.0 && close(sk.map(5.0), 25.0, 1.e-14) && sk.map(10.0) == 100.0;
+  ok &= sk.map(-1.0) == 0.0 && sk.map(11.0) == 100.0;             // Clipped
+
+  // Arrays must match the single values up to single precision. We use inputs that cover the 
+  // input ranges (and exceed it for the skewed mapping to check the clipping):
+  std::vector<float> x(1000), y(1000);
+  auto mapArray = [&](const Map* m, double xMin, double xMax)
+  {
+    bool ok = true;
+    for(int n = 0; n < 1000; n++)
+      x[n] = (float) (xMin + (xMax - xMin) * n / 999);
+    m->mapArray(x.data(), y.data(), 1000);
+    for(int n = 0; n < 1000; n++)
+    {
+      double target = m->map(x[n]);
+      ok &= close(y[n], target, 2.e-6) || std::abs(y[n] - target) < 1.e-6;
+    }
+    m->mapArray(x.data(), x.data(), 1000);                        // In place
+    ok &= x == y;
+    return ok;
+  };
+  ok &= mapArray(&identity, -60.0, 20.0);
+  ok &= mapArray(&lin,       -1.0,  1.0);
+  ok &= mapArray(&ex,         0.0,  1.0);
+  ok &= mapArray(&db,       -60.0, 20.0);
+  ok &= mapArray(&sk,        -1.0, 11.0);
+
+  // Declaring the mappings in addParameter:
+  clap_plugin_descriptor_t desc = ClapGain::descriptor;
+  ClapGain gain(&desc, nullptr);
+  gain.setParameter(ClapGain::kGain, 20.0);
+  gain.setParameter(ClapGain::kPan,  0.5);
+  ok &= close(gain.getMappedParameter(ClapGain::kGain), 10.0, 1.e-14);
+  ok &= gain.getMappedParameter(ClapGain::kPan) == 0.75;
+  ok &= gain.getParameterMapping(ClapGain::kGain).getCurve() == Map::kDecibel;
+  ok &= gain.getParameterMapping(1000).map(2.0) == 2.0;           // Invalid id gives identity
+
+  return ok;
+}
+
+bool runVoiceManagerTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+
+  // Allocation from the free list and stealing of the oldest voice:
+  VoiceManager vm;
+  vm.setCapacity(4);
+  ok &= vm.getNumFreeVoices() == 4 && vm.getNumActiveVoices() == 0;
+  int v0 = vm.noteOn(60, 1.0, 100);
+  int v1 = vm.noteOn(62, 1.0, 101);
+  int v2 = vm.noteOn(64, 1.0, 102);
+  int v3 = vm.noteOn(65, 1.0, 103);
+  ok &= v0 != v1 && v0 != v2 && v0 != v3 && v1 != v2 && v1 != v3 && v2 != v3;
+  ok &= vm.getNumFreeVoices() == 0 && vm.getNumActiveVoices() == 4;
+  ok &= vm.getVoiceToSteal(67, -1) == v0;
+  int v4 = vm.noteOn(67, 1.0, 104);
+  ok &= v4 == v0 && vm.getVoice(v4).key == 67 && vm.getVoice(v4).noteId == 104;
+  ok &= vm.getNumActiveVoices() == 4;
+
+  // Released voices are stolen before held ones even when they are younger:
+  vm.releaseVoice(v2);
+  ok &= vm.getVoiceToSteal(69, -1) == v2;
+
+  // Freeing voices makes them available again without stealing:
+  vm.freeVoice(v1);
+  ok &= vm.getNumFreeVoices() == 1 && vm.getNumActiveVoices() == 3;
+  ok &= vm.getVoiceToSteal(69, -1) == -1;
+  ok &= vm.noteOn(69, 1.0) == v1;
+
+  // Stealing the quietest voice:
+  vm.setStealMode(VoiceManager::kStealQuietest);
+  vm.setLevel(v0, 0.5f); vm.setLevel(v1, 0.7f); vm.setLevel(v2, 0.9f); vm.setLevel(v3, 0.3f);
+  ok &= vm.getVoiceToSteal(70, -1) == v3;
+
+  // In same-key mode, a key that is already playing on the same channel reuses its voice even 
+  // when free voices are available. On other channels, it doesn't:
+  vm.reset();
+  vm.setStealMode(VoiceManager::kStealSameKey);
+  v0 = vm.noteOn(60, 1.0, -1, 0, 0);
+  v1 = vm.noteOn(62, 1.0, -1, 0, 0);
+  ok &= vm.getVoiceToSteal(60, 0) == v0;
+  ok &= vm.getVoiceToSteal(60, 1) == -1;
+  ok &= vm.noteOn(60, 0.5, -1, 0, 0) == v0 && vm.getNumActiveVoices() == 2;
+  ok &= vm.noteOn(60, 0.5, -1, 0, 1) != v0 && vm.getNumActiveVoices() == 3;
+
+  // Wildcard matching:
+  vm.reset();
+  v0 = vm.noteOn(60, 1.0, 7, 0, 3);
+  ok &=  vm.matches(v0, -1, -1, -1, -1);
+  ok &=  vm.matches(v0,  7, -1, -1, -1);
+  ok &=  vm.matches(v0, -1,  0,  3, 60);
+  ok &= !vm.matches(v0,  8, -1, -1, -1);
+  ok &= !vm.matches(v0, -1, -1,  2, -1);
+  ok &= !vm.matches(v0, -1, -1, -1, 61);
+
+  // Now test the dispatch of the note events in the synth baseclass. We use more notes than there
+  // are voices, so the last ones must steal the first ones:
+  int numVoices = 256;
+  int numNotes  = 300;
+  clap_plugin_descriptor_t desc = ClapVoiceRecorder::descriptor;
+  ClapVoiceRecorder synth(&desc, nullptr, numVoices);
+  synth.activate(44100.0, 1, 512);
+  ClapProcessBuffer_1In_1Out buf(2, 2, 512);
+  for(int i = 0; i < numNotes; i++)
+    buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON, i % 128, 0.5, i, 1000 + i, 0, i / 128);
+  synth.process(buf.getWrappee());
+  const VoiceManager& voices = synth.getVoiceManager();
+  ok &= synth.numStarted == numNotes && synth.numNoteOns == numNotes;
+  ok &= synth.numStopped == numNotes - numVoices;
+  ok &= voices.getNumActiveVoices() == numVoices && voices.getNumFreeVoices() == 0;
+
+  // A note-off by note id releases exactly that note (note 299 is on channel 2, key 43):
+  buf.clearInputEvents();
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_OFF, -1, 0.0, 0, 1299);
+  synth.process(buf.getWrappee());
+  ok &= synth.numReleased == 1;
+  ok &= voices.getVoice(synth.lastReleased).noteId == 1299;
+  ok &= voices.getVoice(synth.lastReleased).state  == VoiceManager::kReleased;
+
+  // A note-off by key and channel with wildcards for the rest releases the matching notes:
+  buf.clearInputEvents();
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_OFF, 100, 0.0, 0, -1, -1, 1);
+  synth.process(buf.getWrappee());
+  ok &= synth.numReleased == 2;
+  ok &= voices.getVoice(synth.lastReleased).noteId == 1228;  // 100 + 128
+
+  // The synth finishes the released voices which returns them to the pool:
+  synth.voiceFinished(synth.lastReleased);
+  ok &= voices.getNumFreeVoices() == 1;
+
+  // A choke on channel 0 stops all voices on that channel immediately. Notes 44..127 are still 
+  // playing on channel 0 (0..43 were stolen):
+  int numStopped = synth.numStopped;
+  buf.clearInputEvents();
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_CHOKE, -1, 0.0, 0, -1, -1, 0);
+  synth.process(buf.getWrappee());
+  ok &= synth.numStopped - numStopped == 128 - (numNotes - numVoices);
+  ok &= voices.getNumFreeVoices() == 1 + 128 - (numNotes - numVoices);
+
+  // MIDI note-on and note-off, including the running status note-off with velocity zero:
+  synth.reset();
+  ok &= voices.getNumActiveVoices() == 0;
+  buf.clearInputEvents();
+  buf.addInputMidiEvent(0x91, 60, 100, 0);    // Note-on on channel 2
+  buf.addInputMidiEvent(0x91, 64, 100, 1);
+  buf.addInputMidiEvent(0x81, 60,   0, 2);    // Note-off
+  buf.addInputMidiEvent(0x91, 64,   0, 3);    // Note-on with zero velocity means note-off
+  numStopped = synth.numStopped;
+  int numReleased = synth.numReleased;
+  synth.process(buf.getWrappee());
+  ok &= synth.numReleased - numReleased == 2;
+  ok &= voices.getVoice(synth.lastReleased).key == 64;
+  ok &= voices.getVoice(synth.lastReleased).channel == 1;
+  ok &= fabs(voices.getVoice(synth.lastReleased).velocity - 100.0 / 127.0) < 1.e-7;
+
+  // All-notes-off (controller 123) releases all held notes of the channel:
+  buf.clearInputEvents();
+  buf.addInputMidiEvent(0x91, 60, 100, 0);
+  buf.addInputMidiEvent(0x91, 62, 100, 0);
+  buf.addInputMidiEvent(0x90, 64, 100, 0);    // Channel 1
+  buf.addInputMidiEvent(0xb1, 123,  0, 1);
+  numReleased = synth.numReleased;
+  synth.process(buf.getWrappee());
+  ok &= synth.numReleased - numReleased == 2;
+
+  synth.deactivate();
+  return ok;
+}
+
+bool runSineVoiceBankTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+
+  // Accuracy of the polynomial sine:
+  float maxErr = 0.f;
+  for(int i = -30000; i <= 30000; i++)
+  {
+    float p = i * 0.0001f;
+    maxErr = std::max(maxErr, std::fabs(sinCycleFast(p) - (float) sin(6.283185307179586 * p)));
+  }
+  ok &= maxErr < 1.e-6f;
+
+  // Set up banks with all supported lane counts and the same voices:
+  int capacity = 40, numFrames = 300;
+  std::vector<SineVoiceBank> banks(4);
+  int lanes[4] = { 1, 4, 8, 16 };
+  for(int k = 0; k < 4; k++)
+  {
+    banks[k].setCapacity(capacity);
+    banks[k].setNumLanes(lanes[k]);
+    banks[k].setAttackRelease(20.f, 10.f);
+    for(int v = 0; v < 37; v++)
+      banks[k].startVoice(v, 0.001f + 0.013f * v, 1.f / (1 + v));
+  }
+  std::vector<std::vector<float>> out(4, std::vector<float>(numFrames));
+
+  // Renders all banks and checks that the SIMD paths match the scalar path:
+  auto renderAndCompare = [&]()
+  {
+    for(int k = 0; k < 4; k++)
+      banks[k].render(out[k].data(), numFrames);
+    bool same = true;
+    for(int k = 1; k < 4; k++)
+      for(int n = 0; n < numFrames; n++)
+        same &= std::fabs(out[k][n] - out[0][n]) < 1.e-4f;
+    return same;
+  };
+  ok &= renderAndCompare();
+  ok &= banks[2].getNumActiveVoices() == 37 && banks[2].getNumFinishedVoices() == 0;
+
+  // Removing voices compacts the slots. The remaining voices must keep on playing unaltered:
+  for(int k = 0; k < 4; k++)
+  {
+    banks[k].removeVoice(0);
+    banks[k].removeVoice(17);
+    banks[k].removeVoice(36);
+    banks[k].removeVoice(36);                 // Removing twice does nothing
+  }
+  ok &= banks[0].getNumActiveVoices() == 34;
+  ok &= !banks[0].isActive(17) && banks[0].isActive(18);
+  ok &= renderAndCompare();
+
+  // Released voices are reported as finished at the end of the chunk in which their envelope 
+  // fell below -80 dB. With a release time constant of 10 samples, that takes about 92 samples,
+  // so voices released now finish at the last frame of the second chunk:
+  for(int k = 0; k < 4; k++)
+    for(int v = 1; v < 10; v++)
+      banks[k].releaseVoice(v);
+  ok &= renderAndCompare();
+  for(int k = 0; k < 4; k++)
+  {
+    ok &= banks[k].getNumActiveVoices() == 25;
+    ok &= banks[k].getNumFinishedVoices() == 9;
+    for(int i = 0; i < banks[k].getNumFinishedVoices(); i++)
+    {
+      int v = banks[k].getFinishedVoice(i);
+      ok &= v >= 1 && v < 10 && !banks[k].isActive(v);
+      ok &= banks[k].getFinishedFrame(i) == 2 * SineVoiceBank::maxChunkSize - 1;
+    }
+  }
+
+  // A finished voice can be started again:
+  for(int k = 0; k < 4; k++)
+    banks[k].startVoice(5, 0.01f, 0.5f);
+  ok &= renderAndCompare();
+  ok &= banks[0].getNumActiveVoices() == 26;
+
+  // The rotator oscillators produce the same signals as the polynomial ones, also when we switch
+  // between the two while voices are playing:
+  for(int k = 0; k < 4; k++)
+    banks[k].setOscillator(SineVoiceBank::kRotator);
+  ok &= banks[3].getOscillator() == SineVoiceBank::kRotator;
+  ok &= renderAndCompare();
+  for(int k = 0; k < 4; k++)
+    if(k != 2)
+      banks[k].setOscillator(SineVoiceBank::kPolynomial);
+  ok &= renderAndCompare();
+
+  // Over a long time, the amplitude of the rotator doesn't drift and the phase drifts only a bit 
+  // due to the rounding of the rotation:
+  std::vector<float> mono(numFrames);
+  SineVoiceBank rot;
+  rot.setCapacity(1);
+  rot.setOscillator(SineVoiceBank::kRotator);
+  rot.startVoice(0, 0.01f, 1.f);
+  double maxErr2 = 0.0, minAmp = 2.0, maxAmp = 0.0;
+  int numBlocks = 4000;
+  for(int b = 0; b < numBlocks; b++)
+  {
+    rot.render(mono.data(), numFrames);
+    for(int n = 0; n < numFrames; n++)
+    {
+      double p = 0.01 * (double) (b * numFrames + n);
+      double target = sin(6.283185307179586 * (p - floor(p)));
+      maxErr2 = std::max(maxErr2, fabs(mono[n] - target));
+      if(b == numBlocks-1)
+      {
+        minAmp = std::min(minAmp, (double) mono[n]);
+        maxAmp = std::max(maxAmp, (double) mono[n]);
+      }
+    }
+  }
+  ok &= maxErr2 < 1.e-2;
+  ok &= fabs(maxAmp - 1.0) < 1.e-4 && fabs(minAmp + 1.0) < 1.e-4;
+
+  // The tone generator hands finished voices back to its voice manager:
+  clap_plugin_descriptor_t desc = ClapToneGenerator::descriptor;
+  ClapToneGenerator synth(&desc, nullptr);
+  synth.activate(44100.0, 1, 512);
+  ClapProcessBuffer_1In_1Out buf(2, 2, 512);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON, 69, 1.0, 0);
+  synth.process(buf.getWrappee());
+  float* outL = buf.getOutChannelPointer(0);
+  ok &= outL[511] != 0.f;
+  ok &= synth.getVoiceManager().getNumActiveVoices() == 1;
+  buf.clearInputEvents();
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_OFF, 69, 1.0, 0);
+  for(int i = 0; i < 60; i++)                  // 50 ms release time constant, -80 dB after 0.46 s
+  {
+    synth.process(buf.getWrappee());
+    buf.clearInputEvents();
+  }
+  ok &= synth.getVoiceManager().getNumActiveVoices() == 0;
+  synth.deactivate();
+
+  return ok;
+}
+
+bool runNoteEndTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+
+  // Returns true, iff the output event with given index is a NOTE_END with the given data:
+  auto isNoteEnd = [](ClapProcessBuffer_1In_1Out& buf, uint32_t index, uint32_t time, 
+    int32_t noteId, int16_t key, int16_t channel)
+  {
+    if(index >= buf.getNumOutputEvents())
+      return false;
+    const clap_event_note* ev = (const clap_event_note*) buf.getOutputEvent(index);
+    return ev->header.type == CLAP_EVENT_NOTE_END && ev->header.time == time 
+      && ev->note_id == noteId && ev->key == key && ev->channel == channel && ev->port_index == 0;
+  };
+
+  // Voices that are stolen or choked end at the frame of the event that causes it:
+  clap_plugin_descriptor_t desc = ClapVoiceRecorder::descriptor;
+  ClapVoiceRecorder synth(&desc, nullptr, 2);
+  synth.activate(44100.0, 1, 64);
+  ClapProcessBuffer_1In_1Out buf(2, 2, 64);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON,    60, 1.0,  0, 1, 0, 0);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON,    62, 1.0,  5, 2, 0, 0);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON,    64, 1.0, 10, 3, 0, 0);  // Steals note 1
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_CHOKE, -1, 0.0, 20, 2, 0, 0);  // Chokes note 2
+  synth.process(buf.getWrappee());
+  ok &= buf.getNumOutputEvents() == 2;
+  ok &= isNoteEnd(buf, 0, 10, 1, 60, 0);
+  ok &= isNoteEnd(buf, 1, 20, 2, 62, 0);
+
+  // Releasing a voice doesn't end it. That's up to the synth:
+  buf.clearInputEvents();
+  buf.clearOutputEvents();
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_OFF, 64, 1.0, 0, 3, 0, 0);
+  synth.process(buf.getWrappee());
+  ok &= buf.getNumOutputEvents() == 0;
+
+  // Voices that end outside of process are reported at the start of the next call:
+  synth.voiceFinished(synth.lastReleased);
+  buf.clearInputEvents();
+  buf.clearOutputEvents();
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON, 67, 1.0, 30, 4, 0, 1);
+  synth.process(buf.getWrappee());
+  ok &= buf.getNumOutputEvents() == 1;
+  ok &= isNoteEnd(buf, 0, 0, 3, 64, 0);
+
+  // Likewise for the voices that are killed by reset:
+  synth.reset();
+  buf.clearInputEvents();
+  buf.clearOutputEvents();
+  synth.process(buf.getWrappee());
+  ok &= buf.getNumOutputEvents() == 1;
+  ok &= isNoteEnd(buf, 0, 0, 4, 67, 1);
+
+  // Voices started by MIDI 1.0 and 2.0 events store the port of the event (which is 0 in our 
+  // test buffers), so they end on that port and they can be matched by it:
+  buf.clearInputEvents();
+  buf.clearOutputEvents();
+  buf.addInputMidiEvent(0x90, 60, 100, 0);                   // Note-on, channel 0, key 60
+  buf.addInputMidi2Event(0x40913E00, 0xC0000000, 0);         // Note-on, channel 1, key 62
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_CHOKE, 60, 0.0, 5, -1, 1, 0);  // Other port: no match
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_CHOKE, 60, 0.0, 6, -1, 0, 0);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_CHOKE, 62, 0.0, 7, -1, 0, 1);
+  synth.process(buf.getWrappee());
+  ok &= buf.getNumOutputEvents() == 2;
+  ok &= isNoteEnd(buf, 0, 6, -1, 60, 0);
+  ok &= isNoteEnd(buf, 1, 7, -1, 62, 1);
+  synth.deactivate();
+
+  // The tone generator reports the end at the frame where the release has faded out. That's the
+  // last frame of the chunk of the voice bank in which that happened. With a release time 
+  // constant of 50 ms, the voice takes around 0.46 s to decay by 80 dB, so at 44.1 kHz, we expect
+  // it after around 40 blocks of 512 frames:
+  clap_plugin_descriptor_t toneDesc = ClapToneGenerator::descriptor;
+  ClapToneGenerator tone(&toneDesc, nullptr);
+  tone.activate(44100.0, 1, 512);
+  ClapProcessBuffer_1In_1Out toneBuf(2, 2, 512);
+  toneBuf.addInputNoteEvent(CLAP_EVENT_NOTE_ON,  69, 1.0,  0, 7, 0, 0);
+  toneBuf.addInputNoteEvent(CLAP_EVENT_NOTE_OFF, 69, 1.0, 100, 7, 0, 0);
+  int endBlock = -1;
+  for(int b = 0; b < 60; b++)
+  {
+    tone.process(toneBuf.getWrappee());
+    toneBuf.clearInputEvents();
+    if(toneBuf.getNumOutputEvents() > 0)
+    {
+      ok &= endBlock == -1;                    // Only one NOTE_END
+      endBlock = b;
+      ok &= toneBuf.getNumOutputEvents() == 1;
+      uint32_t frame = toneBuf.getOutputEvent(0)->time;
+      ok &= isNoteEnd(toneBuf, 0, frame, 7, 69, 0);
+      ok &= (frame + 1) % SineVoiceBank::maxChunkSize == 0;
+    }
+    toneBuf.clearOutputEvents();
+  }
+  ok &= endBlock > 30 && endBlock < 45;
+  ok &= tone.getVoiceManager().getNumActiveVoices() == 0;
+  tone.deactivate();
+
+  return ok;
+}
+
+bool runVoiceInfoTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+
+  // Synths that use the voice manager report their voices via the voice-info extension:
+  clap_plugin_descriptor_t desc = ClapVoiceRecorder::descriptor;
+  ClapVoiceRecorder synth(&desc, nullptr, 4);
+  const clap_plugin* plug = synth.clapPlugin();
+  ok &= plug->init(plug);
+  auto ext = (const clap_plugin_voice_info*) plug->get_extension(plug, CLAP_EXT_VOICE_INFO);
+  ok &= ext != nullptr;
+  if(!ext)
+    return false;
+  clap_voice_info info;
+  ok &= ext->get(plug, &info);
+  ok &= info.voice_count == 4 && info.voice_capacity == 4;
+  ok &= info.flags == CLAP_VOICE_INFO_SUPPORTS_OVERLAPPING_NOTES;
+  synth.setVoiceStealMode(VoiceManager::kStealSameKey);
+  ok &= ext->get(plug, &info) && info.flags == 0;
+
+  // Synths without voice manager and effects don't:
+  ClapVoiceRecorder mono(&desc, nullptr, 0);
+  ok &= mono.clapPlugin()->init(mono.clapPlugin());
+  ok &= mono.clapPlugin()->get_extension(mono.clapPlugin(), CLAP_EXT_VOICE_INFO) == nullptr;
+  clap_plugin_descriptor_t gainDesc = ClapGain::descriptor;
+  ClapGain gain(&gainDesc, nullptr);
+  ok &= gain.clapPlugin()->init(gain.clapPlugin());
+  ok &= gain.clapPlugin()->get_extension(gain.clapPlugin(), CLAP_EXT_VOICE_INFO) == nullptr;
+
+  // Released voices whose level is below the silence threshold are retired at the end of the 
+  // block. Held voices are not retired, even when they are silent:
+  synth.setVoiceStealMode(VoiceManager::kStealOldest);
+  synth.setSilenceThreshold(0.001f);
+  synth.keyLevels.resize(128, 0.5f);
+  synth.activate(44100.0, 1, 64);
+  ClapProcessBuffer_1In_1Out buf(2, 2, 64);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON,  60, 1.0,  0, 1, 0, 0);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON,  62, 1.0,  0, 2, 0, 0);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON,  64, 1.0,  0, 3, 0, 0);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_OFF, 60, 1.0, 10, 1, 0, 0);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_OFF, 62, 1.0, 10, 2, 0, 0);
+  synth.process(buf.getWrappee());
+  ok &= buf.getNumOutputEvents() == 0;
+  ok &= synth.getVoiceManager().getNumActiveVoices() == 3;
+  synth.keyLevels[60] = 0.0001f;
+  synth.keyLevels[62] = 0.01f;
+  synth.keyLevels[64] = 0.f;
+  buf.clearInputEvents();
+  buf.clearOutputEvents();
+  int numStopped = synth.numStopped;
+  synth.process(buf.getWrappee());
+  ok &= buf.getNumOutputEvents() == 1;
+  if(buf.getNumOutputEvents() == 1)
+  {
+    const clap_event_note* ev = (const clap_event_note*) buf.getOutputEvent(0);
+    ok &= ev->header.type == CLAP_EVENT_NOTE_END && ev->header.time == 63 && ev->key == 60;
+  }
+  ok &= synth.numStopped == numStopped + 1;
+  ok &= synth.getVoiceManager().getNumActiveVoices() == 2;
+
+  // With the threshold turned off, nothing gets retired:
+  synth.setSilenceThreshold(0.f);
+  synth.keyLevels[62] = 0.f;
+  buf.clearOutputEvents();
+  synth.process(buf.getWrappee());
+  ok &= buf.getNumOutputEvents() == 0;
+  ok &= synth.getVoiceManager().getNumActiveVoices() == 2;
+  synth.deactivate();
+
+  return ok;
+}
+
+bool runNoteTimingTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+
+  // The bank starts and releases voices at frame offsets within the next render call. That must 
+  // give the same signal as splitting the render call at these frames:
+  int numFrames = 300;
+  std::vector<float> split(numFrames), offset(numFrames);
+  for(int lanes : { 1, 16 })
+  {
+    SineVoiceBank a, b;
+    for(SineVoiceBank* bank : { &a, &b })
+    {
+      bank->setCapacity(4);
+      bank->setNumLanes(lanes);
+      bank->setAttackRelease(20.f, 30.f);
+      bank->startVoice(0, 0.01f, 1.f);
+    }
+    a.render(&split[0], 70);
+    a.startVoice(1, 0.02f, 0.5f);
+    a.render(&split[70], 130);
+    a.releaseVoice(0);
+    a.render(&split[200], 100);
+    b.startVoice(1, 0.02f, 0.5f,  70);
+    b.releaseVoice(0,             200);
+    b.render(&offset[0], numFrames);
+    float maxErr = 0.f;
+    for(int n = 0; n < numFrames; n++)
+      maxErr = std::max(maxErr, std::fabs(split[n] - offset[n]));
+    ok &= maxErr < 1.e-5f;
+  }
+
+  // In kVoiceOffsets mode, note-ons and note-offs don't split the block. The hooks can ask for 
+  // the frame of the event:
+  clap_plugin_descriptor_t desc = ClapVoiceRecorder::descriptor;
+  ClapVoiceRecorder synth(&desc, nullptr, 2);
+  synth.setNoteTiming(ClapSynthStereo32Bit::kVoiceOffsets);
+  synth.activate(44100.0, 1, 64);
+  ClapProcessBuffer_1In_1Out buf(2, 2, 64);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON, 60, 1.0,  5, 1, 0, 0);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON, 62, 1.0, 10, 2, 0, 0);
+  synth.process(buf.getWrappee());
+  ok &= synth.numBlocks == 1 && synth.numStarted == 2 && synth.lastEventFrame == 10;
+  buf.clearInputEvents();
+  buf.addInputMidiEvent(0x80, 60, 0, 20);
+  synth.process(buf.getWrappee());
+  ok &= synth.numBlocks == 2 && synth.numReleased == 1 && synth.lastEventFrame == 20;
+
+  // A note-on that steals a voice still splits the block because the old note must end at the 
+  // frame of the event. So do all other events:
+  buf.clearInputEvents();
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON, 64, 1.0, 30, 3, 0, 0);
+  buf.addInputMidiEvent(0xB0, 7, 100, 40);
+  synth.process(buf.getWrappee());
+  ok &= synth.numBlocks == 5 && synth.numStarted == 3 && synth.lastEventFrame == 0;
+  ok &= synth.numControlEvents == 1;
+  ok &= buf.getNumOutputEvents() == 1 && buf.getOutputEvent(0)->time == 30;
+
+  // In kSubBlocks mode, all events split the block:
+  synth.setNoteTiming(ClapSynthStereo32Bit::kSubBlocks);
+  buf.clearInputEvents();
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_OFF, 64, 1.0, 7, 3, 0, 0);
+  synth.process(buf.getWrappee());
+  ok &= synth.numBlocks == 7 && synth.lastEventFrame == 0;
+  synth.deactivate();
+
+  // The tone generator uses kVoiceOffsets. Its output must match the one with sub-blocks up to
+  // the rounding errors from the different chunking:
+  clap_plugin_descriptor_t toneDesc = ClapToneGenerator::descriptor;
+  for(double waveform : { 0.0, 1.0 })
+  {
+    ClapToneGenerator toneA(&toneDesc, nullptr), toneB(&toneDesc, nullptr);
+    toneA.setNoteTiming(ClapSynthStereo32Bit::kSubBlocks);
+    ClapProcessBuffer_1In_1Out bufA(2, 2, 512), bufB(2, 2, 512);
+    float maxErr = 0.f, maxOut = 0.f;
+    for(ClapToneGenerator* t : { &toneA, &toneB })
+      t->activate(44100.0, 1, 512);
+    for(ClapProcessBuffer_1In_1Out* b : { &bufA, &bufB })
+    {
+      b->addInputParamValueEvent(ClapToneGenerator::kWaveform, waveform, 0);
+      b->addInputNoteEvent(CLAP_EVENT_NOTE_ON,  69, 1.0, 100, 1, 0, 0);
+      b->addInputNoteEvent(CLAP_EVENT_NOTE_ON,  72, 1.0, 333, 2, 0, 0);
+      b->addInputNoteEvent(CLAP_EVENT_NOTE_OFF, 69, 1.0, 400, 1, 0, 0);
+    }
+    for(int i = 0; i < 4; i++)
+    {
+      toneA.process(bufA.getWrappee());
+      toneB.process(bufB.getWrappee());
+      for(int n = 0; n < 512; n++)
+      {
+        float yA = bufA.getOutChannelPointer(0)[n], yB = bufB.getOutChannelPointer(0)[n];
+        maxErr = std::max(maxErr, std::fabs(yA - yB));
+        maxOut = std::max(maxOut, std::fabs(yA));
+      }
+      bufA.clearInputEvents();
+      bufB.clearInputEvents();
+    }
+    ok &= maxOut > 0.5f && maxErr < 1.e-4f;
+  }
+
+  return ok;
+}
+
+bool runMidiDecoderTest()
+{
+  using namespace RobsClapHelpers;
+  using MD = MidiDecoder;
+  bool ok = true;
+
+  MD dec;
+  MD::Event ev;
+
+  // Returns true, iff the event has the given data:
+  auto is = [&](MD::EventType type, int channel, int index, float value, uint32_t raw)
+  {
+    return ev.type == type && ev.channel == channel && ev.index == index && ev.value == value
+      && ev.raw == raw;
+  };
+
+  // MIDI 1.0 notes. Velocity zero means note-off:
+  uint8_t m[3];
+  auto midi1 = [&](uint8_t status, uint8_t d1, uint8_t d2)
+  {
+    m[0] = status; m[1] = d1; m[2] = d2;
+    return dec.decodeMidi1(m, ev);
+  };
+  ok &= midi1(0x93, 60, 127) && is(MD::kNoteOn,  3, 60, 1.f, 127);
+  ok &= midi1(0x83, 60,  64) && is(MD::kNoteOff, 3, 60, 64.f/127, 64);
+  ok &= midi1(0x93, 60,   0) && is(MD::kNoteOff, 3, 60, 0.f, 0);
+
+  // Controllers, pressures, program change and pitch bend also update the channel state:
+  ok &= midi1(0xB2, 74, 127) && is(MD::kControlChange, 2, 74, 1.f, 127);
+  ok &= dec.getController(2, 74) == 1.f && dec.getController(3, 74) == 0.f;
+  ok &= midi1(0xA2, 61, 127) && is(MD::kPolyPressure, 2, 61, 1.f, 127);
+  ok &= dec.getPolyPressure(2, 61) == 1.f && dec.getPolyPressure(2, 60) == 0.f;
+  ok &= midi1(0xD2, 127, 0) && is(MD::kChannelPressure, 2, 0, 1.f, 127);
+  ok &= dec.getChannelPressure(2) == 1.f;
+  ok &= midi1(0xC2, 5, 0) && is(MD::kProgramChange, 2, 5, 5.f, 5);
+  ok &= dec.getProgram(2) == 5;
+  ok &= midi1(0xE2, 0x00, 0x40) && is(MD::kPitchBend, 2, 0, 0.f, 0x2000);    // Center
+  ok &= midi1(0xE2, 0x00, 0x00) && is(MD::kPitchBend, 2, 0, -1.f, 0);        // Bottom
+  ok &= midi1(0xE2, 0x7f, 0x7f) && ev.value > 0.9998f && ev.value < 1.f;    // Top
+  ok &= dec.getPitchBend(2) == ev.value;
+
+  // System messages are rejected:
+  ok &= !midi1(0xF8, 0, 0) && ev.type == MD::kNone;
+
+  // Reset all controllers resets the modulation and the pressures but keeps the volume:
+  midi1(0xB2, 1, 100);
+  midi1(0xB2, 7, 30);
+  dec.resetControllers(2);
+  ok &= dec.getController(2, 1) == 0.f && dec.getController(2, 7) == 30.f/127;
+  ok &= dec.getPolyPressure(2, 61) == 0.f && dec.getChannelPressure(2) == 0.f;
+  ok &= dec.getPitchBend(2) == 0.f && dec.getController(2, 11) == 1.f;
+  ok &= dec.getProgram(2) == 5;
+
+  // MIDI 2.0 channel voice messages (UMP message type 4) in group 1:
+  uint32_t u[4] = { 0, 0, 0, 0 };
+  auto midi2 = [&](uint32_t w0, uint32_t w1)
+  {
+    u[0] = w0; u[1] = w1;
+    return dec.decodeMidi2(u, ev);
+  };
+  ok &= midi2(0x41953C00, 0xFFFF0000) && is(MD::kNoteOn, 5, 60, 1.f, 0xFFFF);
+  ok &= ev.group == 1;
+  ok &= midi2(0x41953C00, 0x00000000) && is(MD::kNoteOn, 5, 60, 0.f, 0);     // Still note-on
+  ok &= midi2(0x41853C00, 0x80000000) && ev.type == MD::kNoteOff && ev.raw == 0x8000;
+  ok &= midi2(0x41B54A00, 0xFFFFFFFF) && is(MD::kControlChange, 5, 74, 1.f, 0xFFFFFFFF);
+  ok &= midi2(0x41B54A00, 0x80000000) && ev.raw == 0x80000000;
+  ok &= dec.getController(5, 74) == ev.value && fabs(ev.value - 0.5f) < 1.e-6f;
+  ok &= midi2(0x41E50000, 0x80000000) && is(MD::kPitchBend, 5, 0, 0.f, 0x80000000);
+  ok &= midi2(0x41E50000, 0x00000000) && is(MD::kPitchBend, 5, 0, -1.f, 0);
+  ok &= midi2(0x41D50000, 0xFFFFFFFF) && is(MD::kChannelPressure, 5, 0, 1.f, 0xFFFFFFFF);
+  ok &= midi2(0x41A53D00, 0xFFFFFFFF) && is(MD::kPolyPressure, 5, 61, 1.f, 0xFFFFFFFF);
+  ok &= midi2(0x41C50000, 0x07000000) && is(MD::kProgramChange, 5, 7, 7.f, 7);
+  ok &= dec.getProgram(5) == 7;
+
+  // MIDI 1.0 messages wrapped into UMP (message type 2) and unsupported message types:
+  ok &= midi2(0x23963C40, 0) && is(MD::kNoteOn, 6, 60, 64.f/127, 64) && ev.group == 3;
+  ok &= !midi2(0x10F80000, 0);                           // System real time (clock)
+  ok &= !midi2(0x41653C00, 0x80000000);                  // Per-note pitch bend (not supported)
+
+  // The synth dispatches the decoded messages of both dialects to the voices and the hook:
+  clap_plugin_descriptor_t desc = ClapVoiceRecorder::descriptor;
+  ClapVoiceRecorder synth(&desc, nullptr, 8);
+  clap_note_port_info info;
+  synth.notePortsInfo(0, true, &info);
+  ok &= (info.supported_dialects & CLAP_NOTE_DIALECT_MIDI2) != 0;
+  synth.activate(44100.0, 1, 64);
+  ClapProcessBuffer_1In_1Out buf(2, 2, 64);
+  buf.addInputMidi2Event(0x40903C00, 0xC0000000, 0);     // Note-on, channel 0, key 60
+  buf.addInputMidi2Event(0x40903E00, 0xC0000000, 0);     // Note-on, channel 0, key 62
+  buf.addInputMidiEvent( 0x91, 64, 100, 1);              // Note-on, channel 1, key 64
+  buf.addInputMidi2Event(0x40B04A00, 0x40000000, 2);     // CC 74
+  buf.addInputMidiEvent( 0xE1, 0, 0x60, 3);              // Pitch bend up
+  buf.addInputMidi2Event(0x40803C00, 0x00000000, 4);     // Note-off, key 60
+  synth.process(buf.getWrappee());
+  ok &= synth.numStarted == 3 && synth.numReleased == 1;
+  ok &= synth.numControlEvents == 2;
+  ok &= synth.lastControlEvent.type == MD::kPitchBend && synth.lastControlEvent.channel == 1;
+  ok &= synth.getMidiDecoder().getPitchBend(1) == 0.5f;
+  ok &= synth.getMidiDecoder().getController(0, 74) == 0.25f;
+
+  // All-sound-off chokes the voices of the channel:
+  buf.clearInputEvents();
+  buf.addInputMidiEvent(0xB0, 120, 0, 0);
+  synth.process(buf.getWrappee());
+  ok &= synth.numStopped == 2 && synth.getVoiceManager().getNumActiveVoices() == 1;
+  synth.deactivate();
+
+  return ok;
+}
+
+bool runNoteExpressionTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+
+  // Expressions that arrive right after the start of a voice are taken over without smoothing:
+  NoteExpressions ne;
+  ne.setCapacity(4);
+  ne.setSmoothingTime(10.f);
+  ok &= ne.getStart(0, CLAP_NOTE_EXPRESSION_VOLUME) == 1.f;
+  ok &= ne.getStart(0, CLAP_NOTE_EXPRESSION_PAN)    == 0.5f;
+  ne.resetVoice(0);
+  ne.setTarget(0, CLAP_NOTE_EXPRESSION_VOLUME, 0.5f);
+  ne.advance(16);
+  ok &= ne.getStart(0, CLAP_NOTE_EXPRESSION_VOLUME) == 0.5f;
+  ok &= ne.getEnd(  0, CLAP_NOTE_EXPRESSION_VOLUME) == 0.5f;
+  ok &= ne.hasChanged(0);
+  ne.advance(16);
+  ok &= !ne.hasChanged(0);
+
+  // Later targets are approached by ramps that connect from block to block:
+  ne.setTarget(0, CLAP_NOTE_EXPRESSION_TUNING, 2.f);
+  ne.advance(16);
+  float end = 2.f * (1.f - std::exp(-1.6f));
+  ok &= ne.hasChanged(0);
+  ok &= ne.getStart(0, CLAP_NOTE_EXPRESSION_TUNING) == 0.f;
+  ok &= fabs(ne.getEnd(0, CLAP_NOTE_EXPRESSION_TUNING) - end) < 1.e-6;
+  ok &= fabs(16 * ne.getIncrement(0, CLAP_NOTE_EXPRESSION_TUNING) - end) < 1.e-6;
+  float prevEnd = ne.getEnd(0, CLAP_NOTE_EXPRESSION_TUNING);
+  ne.advance(16);
+  ok &= ne.getStart(0, CLAP_NOTE_EXPRESSION_TUNING) == prevEnd;
+  for(int b = 0; b < 100; b++)
+    ne.advance(16);
+  ok &= ne.getEnd(0, CLAP_NOTE_EXPRESSION_TUNING) == 2.f;
+  ok &= ne.getIncrement(0, CLAP_NOTE_EXPRESSION_TUNING) == 0.f;
+  ok &= !ne.hasChanged(0);
+  ok &= ne.getNumMovingVoices() == 0;
+
+  // Without smoothing, the values jump to the target. Invalid ids are ignored:
+  ne.setSmoothingTime(0.f);
+  ne.setTarget(0, CLAP_NOTE_EXPRESSION_PRESSURE, 0.75f);
+  ne.setTarget(0, -1, 1.f);
+  ne.setTarget(0, NoteExpressions::numExpressions, 1.f);
+  ne.advance(16);
+  ok &= ne.getEnd(0, CLAP_NOTE_EXPRESSION_PRESSURE) == 0.75f;
+  ok &= ne.getStart(0, CLAP_NOTE_EXPRESSION_PRESSURE) == 0.f;
+
+  // The synth routes the expression events to the voices via noteId, key and channel:
+  clap_plugin_descriptor_t desc = ClapVoiceRecorder::descriptor;
+  ClapVoiceRecorder synth(&desc, nullptr, 4);
+  synth.activate(44100.0, 1, 64);
+  synth.setNoteExpressionSmoothing(0.f);
+  auto voiceOf = [&](int16_t key)
+  {
+    const VoiceManager& vm = synth.getVoiceManager();
+    for(int i = 0; i < vm.getNumActiveVoices(); i++)
+      if(vm.getVoice(vm.getActiveVoice(i)).key == key)
+        return vm.getActiveVoice(i);
+    return -1;
+  };
+  auto target = [&](int16_t key, int id) 
+  { 
+    return synth.getNoteExpressions().getEnd(voiceOf(key), id); 
+  };
+  ClapProcessBuffer_1In_1Out buf(2, 2, 64);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON, 60, 1.0, 0, 1, 0, 0);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON, 62, 1.0, 0, 2, 0, 0);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON, 64, 1.0, 0, 3, 0, 1);
+  buf.addInputNoteExpressionEvent(CLAP_NOTE_EXPRESSION_PAN, 0.25, -1, 0, 1);  // By note id
+  synth.process(buf.getWrappee());
+  ok &= target(60, CLAP_NOTE_EXPRESSION_PAN) == 0.25f;
+  ok &= target(62, CLAP_NOTE_EXPRESSION_PAN) == 0.5f;
+  buf.clearInputEvents();
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_OFF, 62, 0.0, 0, 2, 0, 0);
+  buf.addInputNoteExpressionEvent(CLAP_NOTE_EXPRESSION_TUNING,   -1.5, 62,  8);      // By key
+  buf.addInputNoteExpressionEvent(CLAP_NOTE_EXPRESSION_PRESSURE,  0.5, -1, 16, -1, -1, 1);
+  buf.addInputNoteExpressionEvent(CLAP_NOTE_EXPRESSION_VOLUME,    2.0, -1, 24);      // All
+  synth.process(buf.getWrappee());
+  ok &= target(60, CLAP_NOTE_EXPRESSION_TUNING)   ==  0.0f;
+  ok &= target(62, CLAP_NOTE_EXPRESSION_TUNING)   == -1.5f;    // Released but still sounding
+  ok &= target(64, CLAP_NOTE_EXPRESSION_TUNING)   ==  0.0f;
+  ok &= target(60, CLAP_NOTE_EXPRESSION_PRESSURE) ==  0.0f;
+  ok &= target(64, CLAP_NOTE_EXPRESSION_PRESSURE) ==  0.5f;
+  for(int16_t key : { 60, 62, 64 })
+    ok &= target(key, CLAP_NOTE_EXPRESSION_VOLUME) == 2.0f;
+
+  // A new note on a recycled voice starts from the defaults:
+  buf.clearInputEvents();
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_CHOKE, 62, 0.0, 0, 2, 0, 0);
+  buf.addInputNoteEvent(CLAP_EVENT_NOTE_ON,    65, 1.0, 1, 4, 0, 0);
+  synth.process(buf.getWrappee());
+  ok &= target(65, CLAP_NOTE_EXPRESSION_TUNING) == 0.f;
+  ok &= target(65, CLAP_NOTE_EXPRESSION_VOLUME) == 1.f;
+  synth.deactivate();
+
+  return ok;
+}
+
+bool runPitchIncrementTableTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+
+  // Returns the relative error of the given increment with respect to the exact one:
+  auto relErr = [](float inc, double pitch, double sampleRate)
+  {
+    double target = pitchToFreq(pitch) / sampleRate;
+    return fabs(inc - target) / target;
+  };
+
+  // The keys are exact up to float precision, fractional pitches over the whole range are 
+  // accurate to well below a cent (1 cent is a relative error of 5.8e-4):
+  PitchIncrementTable pt;
+  pt.setSampleRate(48000.0);
+  double maxErr = 0.0;
+  for(int k = 0; k < PitchIncrementTable::numKeys; k++)
+    maxErr = std::max(maxErr, relErr(pt.getKeyIncrement(k), k, 48000.0));
+  ok &= maxErr < 1.e-7;
+  maxErr = 0.0;
+  for(double p = -130.0; p < 250.0; p += 0.0371)
+    maxErr = std::max(maxErr, relErr(pt.getIncrement((float) p), p, 48000.0));
+  ok &= maxErr < 1.e-5;
+  ok &= fabs(pt.getIncrement(69.f) * 48000.0 - 440.0) < 1.e-3;
+
+  // Pitches outside the range are clipped:
+  ok &= pt.getIncrement(-1000.f) == pt.getIncrement(PitchIncrementTable::minPitch);
+  ok &= pt.getIncrement( 1000.f) >  pt.getIncrement(250.f);
+
+  // Tuning offsets apply to the keys and to the fractional pitches around them:
+  pt.setKeyTuning(60, 0.5);
+  ok &= relErr(pt.getKeyIncrement(60), 60.5, 48000.0) < 1.e-7;
+  ok &= relErr(pt.getIncrement(60, 0.25f), 60.75, 48000.0) < 1.e-5;
+  ok &= relErr(pt.getIncrement(61, 0.25f), 61.25, 48000.0) < 1.e-5;
+
+  // A change of the sample rate rebuilds the tables and keeps the tuning:
+  pt.setSampleRate(96000.0);
+  ok &= relErr(pt.getKeyIncrement(60), 60.5, 96000.0) < 1.e-7;
+  ok &= relErr(pt.getIncrement(33.3f), 33.3, 96000.0) < 1.e-5;
+  pt.resetTuning();
+  ok &= relErr(pt.getKeyIncrement(60), 60.0, 96000.0) < 1.e-7;
+
+  return ok;
+}
+
+bool runWavetableTest()
+{
+  using namespace RobsClapHelpers;
+  using WT = MipMappedWavetable;
+  bool ok = true;
+
+  // The tables are created once and shared:
+  const WT& saw = WT::getShared(WT::kSaw);
+  ok &= &saw == &WT::getShared(WT::kSaw);
+  ok &= saw.getWaveform() == WT::kSaw;
+  ok &= WT::getShared(WT::kTriangle).getWaveform() == WT::kTriangle;
+
+  // The level is the lowest one whose highest harmonic is at or below the Nyquist frequency:
+  ok &= WT::getLevel(0.f) == 0 && WT::getLevel(1.f / WT::tableSize) == 0;
+  ok &= WT::getLevel(1.01f / WT::tableSize) == 1;
+  ok &= WT::getLevel(0.25f) == 9 && WT::getLevel(0.26f) == 10 && WT::getLevel(0.5f) == 10;
+  for(float inc = 1.e-5f; inc < 0.5f; inc *= 1.01f)
+  {
+    int l = WT::getLevel(inc);
+    ok &= WT::getNumHarmonics(l) * inc <= 0.5f;
+    ok &= l == 0 || WT::getNumHarmonics(l-1) * inc > 0.5f;
+  }
+
+  // The highest level is a sine with the amplitude of the fundamental. In the lowest level, the 
+  // waveforms are close to the ideal ones away from the jumps:
+  static const double pi = 3.1415926535897932385;
+  double a1[3] = { -2.0 / pi, 4.0 / pi, 8.0 / (pi * pi) };  // The saw has inverted sines
+  double maxErr[3] = { };
+  for(int w = 0; w < WT::numWaveforms; w++)
+  {
+    const WT& wt = WT::getShared((WT::Waveform) w);
+    for(double p = 0.0; p < 1.0; p += 0.0013)
+    {
+      double s = a1[w] * sin(2.0 * pi * p);
+      maxErr[0] = std::max(maxErr[0], fabs(wt.getValue((float) p, WT::numLevels-1) - s));
+    }
+  }
+  for(double p = 0.1; p < 0.9; p += 0.0013)
+  {
+    double q = p - 0.5;
+    maxErr[1] = std::max(maxErr[1], fabs(saw.getValue((float) p, 0) - 2.0 * q));
+    double tri = 1.0 - 4.0 * fabs(p < 0.75 ? p - 0.25 : p - 1.25);
+    maxErr[2] = std::max(maxErr[2], 
+      fabs(WT::getShared(WT::kTriangle).getValue((float) p, 0) - tri));
+  }
+  ok &= maxErr[0] < 1.e-5 && maxErr[1] < 2.e-3 && maxErr[2] < 1.e-3;
+
+  // Play a saw whose period is a whole fraction of the length of the DFT. Then all harmonics fall 
+  // exactly onto multiples of the bin of the fundamental and everything else is aliasing. The 
+  // naive saw, computed from the same phase, aliases a lot:
+  int N = 4096, k0 = 37;
+  float inc = (float) k0 / N;                    // Exact, so the phase is exactly periodic
+  std::vector<float> x(N), naive(N);
+  SineVoiceBank bank;
+  bank.setCapacity(1);
+  bank.setWavetable(&saw);
+  bank.setOscillator(SineVoiceBank::kWavetable);
+  bank.startVoice(0, inc, 1.f);
+  bank.render(x.data(), N);
+  for(int n = 0; n < N; n++)
+  {
+    float p = (float) ((n * k0) % N) / N;
+    naive[n] = 2.f * p - 1.f;
+  }
+  std::vector<double> c(N), s(N);
+  for(int n = 0; n < N; n++)
+  {
+    c[n] = cos(2.0 * pi * n / N);
+    s[n] = sin(2.0 * pi * n / N);
+  }
+  auto aliasingRatio = [&](const std::vector<float>& y)
+  {
+    double harmonic = 0.0, alias = 0.0;
+    for(int k = 1; k < N/2; k++)
+    {
+      double re = 0.0, im = 0.0;
+      for(int n = 0; n < N; n++)
+      {
+        re += y[n] * c[(k * n) % N];
+        im += y[n] * s[(k * n) % N];
+      }
+      (k % k0 == 0 ? harmonic : alias) += re * re + im * im;
+    }
+    return alias / harmonic;
+  };
+  ok &= aliasingRatio(x)     < 1.e-8;            // Below -80 dB
+  ok &= aliasingRatio(naive) > 1.e-3;
+
+  // The SIMD lanes match the scalar path, also after switching over from the rotator while the 
+  // voices are playing:
+  int numFrames = 300;
+  std::vector<SineVoiceBank> banks(3);
+  int lanes[3] = { 1, 8, 16 };
+  std::vector<std::vector<float>> out(3, std::vector<float>(numFrames));
+  for(int k = 0; k < 3; k++)
+  {
+    banks[k].setCapacity(20);
+    banks[k].setNumLanes(lanes[k]);
+    banks[k].setWavetable(&WT::getShared(WT::kSquare));
+    banks[k].setOscillator(SineVoiceBank::kRotator);
+    for(int v = 0; v < 19; v++)
+      banks[k].startVoice(v, 0.0007f + 0.011f * v, 1.f / (1 + v));
+    banks[k].render(out[k].data(), numFrames);
+    banks[k].setOscillator(SineVoiceBank::kWavetable);
+    banks[k].setVoiceParameters(3, 0.2f, 0.5f);  // Switches to a higher level
+    banks[k].setVoiceParameters(5, 2.3f, 0.5f);  // Above the sample rate, e.g. by tuning
+    banks[k].render(out[k].data(), numFrames);
+  }
+  for(int k = 1; k < 3; k++)
+    for(int n = 0; n < numFrames; n++)
+      ok &= fabs(out[k][n] - out[0][n]) < 1.e-4f;
+
+  // The tone generator selects the waveforms via a choice parameter:
+  clap_plugin_descriptor_t desc = ClapToneGenerator::descriptor;
+  ClapToneGenerator tone(&desc, nullptr);
+  double value = 0.0;
+  ok &= tone.paramsTextToValue(ClapToneGenerator::kWaveform, "square", &value) && value == 2.0;
+  ok &= tone.paramsCount() == ClapToneGenerator::numParams;
+
+  return ok;
+}
+
+bool runParamCookieTest()
+{
+  bool ok = true;
+  using namespace RobsClapHelpers;
+
+  // We use ClapGain2 because there, the indices and ids of the parameters do not match:
+  clap_plugin_descriptor_t desc = ClapGain2::descriptor;
+  ClapGain2 gain2(&desc, nullptr);
+  using ID = ClapGain2::ParamId;
+
+  // Retrieve the cookies via the infos just like a host would do it. Along the way, check that 
+  // each cookie matches the one we get directly by id:
+  std::vector<void*> cookies(ID::numParams);       // Indexed by id
+  clap_param_info info;
+  for(uint32_t i = 0; i < gain2.paramsCount(); i++)
+  {
+    ok &= gain2.paramsInfo(i, &info);
+    ok &= info.cookie != nullptr;
+    ok &= info.cookie == gain2.getParameterCookie(info.id);
+    cookies[info.id] = info.cookie;
+  }
+  ok &= gain2.getParameterCookie(ID::numParams) == nullptr;
+
+  // Set the parameters via the cookies and check, if the values end up in the right slots:
+  double p;
+  gain2.setParameterViaCookie(cookies[ID::kGain],    -7.5);
+  gain2.setParameterViaCookie(cookies[ID::kPan],      0.4);
+  gain2.setParameterViaCookie(cookies[ID::kMidSide],  0.9);
+  gain2.setParameterViaCookie(cookies[ID::kMono],     1.0);
+  ok &= gain2.paramsValue(ID::kGain,    &p); ok &= p == -7.5;
+  ok &= gain2.paramsValue(ID::kPan,     &p); ok &= p ==  0.4;
+  ok &= gain2.paramsValue(ID::kMidSide, &p); ok &= p ==  0.9;
+  ok &= gain2.paramsValue(ID::kMono,    &p); ok &= p ==  1.0;
+
+  // Now do the same through the event handling in process(). We send the event for the gain with
+  // a cookie and the one for the pan without a cookie:
+  ClapProcessBuffer_1In_1Out procBuf(2, 2, 16);
+  procBuf.addInputParamValueEvent(ID::kGain, 3.5, 0, cookies[ID::kGain]);
+  procBuf.addInputParamValueEvent(ID::kPan, -0.6, 8);
+  clap_process_status status = gain2.process(procBuf.getWrappee());
+  ok &= status == CLAP_PROCESS_CONTINUE;
+  ok &= gain2.paramsValue(ID::kGain, &p); ok &= p ==  3.5;
+  ok &= gain2.paramsValue(ID::kPan,  &p); ok &= p == -0.6;
+
+  return ok;
+}
+
 //-------------------------------------------------------------------------------------------------
 // Instantiation
 
@@ -257,8 +1940,335 @@ bool runNumberToStringTest()
   // -Check if automatic switch to exponential notation works as intended
   // -Use an empty string as suffix
   // -Check if numbers are correctly rounded for display with limited precision.
-  // -Test double-string-double and float-string-float roundtrips with toStringExact and atof. The
-  //  clap-validator already does such things, but it would be nice to have it here, too.
+}
+
+/** Helper function for runNumberRoundTripTest. Converts x to a string, parses it back and checks
+whether we get exactly the same bit pattern back. It also checks that the string is not longer 
+than the one produced by the old ostringstream based implementation and parses to the same value 
+when "compareWithOld" is true (we don't do it for all numbers because it's slow). */
+template<class T>
+bool checkRoundTrip(T x, bool compareWithOld = false)
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+  char buf[32];
+  int  length = toStringExact(x, buf, 32);
+  ok &= length > 0 && length == (int) strlen(buf);
+  T y;
+  ok &= fromStringExact(buf, &y);
+  ok &= memcmp(&x, &y, sizeof(T)) == 0;  // Compare bits to distinguish -0 from +0
+  ok &= toStringExact(x) == std::string(buf);
+  if(compareWithOld)
+  {
+    std::ostringstream os;
+    os.imbue(std::locale::classic());
+    os << std::setprecision(std::numeric_limits<T>::max_digits10) << x;
+    std::string oldStr = os.str();
+    ok &= length <= (int) oldStr.size();
+    T z;
+    ok &= fromStringExact(oldStr.c_str(), &z);
+    ok &= memcmp(&x, &z, sizeof(T)) == 0;
+  }
+  return ok;
+}
+
+bool runNumberRoundTripTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+  auto Str = [](const char *cStr) { return std::string(cStr); };
+
+  // Some special numbers for doubles and floats:
+  using LD = std::numeric_limits<double>;
+  for(double x : { 0.0, -0.0, 1.0, -1.0, 0.1, 1.0/3.0, 3.141592653589793, 2673.2512891, 1.e20, 
+    -1.e-20, 1.e-300, 1.e300, LD::min(), LD::max(), LD::lowest(), LD::epsilon(), LD::denorm_min(), 
+    LD::min() - LD::denorm_min(), LD::infinity(), -LD::infinity() })
+    ok &= checkRoundTrip(x, true);
+  using LF = std::numeric_limits<float>;
+  for(float x : { 0.f, -0.f, 1.f, 0.1f, 1.f/3.f, 16777217.f, LF::min(), LF::max(), LF::lowest(),
+    LF::epsilon(), LF::denorm_min(), LF::infinity() })
+    ok &= checkRoundTrip(x, true);
+
+  // The shortest representation should be used:
+  char buf[32];
+  toStringExact(0.1,  buf, 32); ok &= Str(buf) == Str("0.1");
+  toStringExact(0.1f, buf, 32); ok &= Str(buf) == Str("0.1");
+  toStringExact(-0.0, buf, 32); ok &= Str(buf) == Str("-0");
+  toStringExact(1.e20, buf, 32); ok &= Str(buf) == Str("1e+20");
+
+  // Error handling for too short buffers and invalid strings:
+  ok &= toStringExact(0.1, buf, 3) == -1 && Str(buf) == Str("");
+  ok &= toStringExact(0.1, buf, 4) ==  3 && Str(buf) == Str("0.1");
+  ok &= toStringExact(0.1, nullptr, 32) == -1;
+  double y = 1.0;
+  ok &= !fromStringExact("",       &y) && y == 0.0;
+  ok &= !fromStringExact("abc",    &y);
+  ok &= !fromStringExact("0.5abc", &y);
+  ok &= !fromStringExact("0,5",    &y);
+  ok &=  fromStringExact("0.5",    &y) && y == 0.5;
+
+  // Random bit patterns for doubles. These cover the whole range including denormals. We skip the
+  // NaNs because they don't compare equal bitwise after a roundtrip:
+  uint64_t state = 12345;
+  for(int i = 0; i < 1000000; i++)
+  {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;  // 64 bit LCG
+    double x;
+    memcpy(&x, &state, sizeof(double));
+    if(x != x)
+      continue;
+    ok &= checkRoundTrip(x, i % 100 == 0);
+  }
+
+  // A strided sweep through all float bit patterns. The stride is prime so we hit all exponents
+  // and lots of different mantissas:
+  for(uint64_t bits = 0; bits <= 0xFFFFFFFF; bits += 4099)
+  {
+    uint32_t b = (uint32_t) bits;
+    float x;
+    memcpy(&x, &b, sizeof(float));
+    if(x != x)
+      continue;
+    ok &= checkRoundTrip(x, b % 100 == 0);
+  }
+
+  // Doubles that were produced from floats as it happens in parameter handling:
+  for(int i = -1000; i <= 1000; i++)
+    ok &= checkRoundTrip((double) (0.01f * (float) i));
+
+  // The results must not depend on the locale. We try to set a locale that uses a comma as 
+  // decimal separator. If that locale is not available, the test is trivially passed:
+  std::string oldLocale = setlocale(LC_ALL, nullptr);
+  if(setlocale(LC_ALL, "de_DE.UTF-8") || setlocale(LC_ALL, "de_DE") || setlocale(LC_ALL, "German"))
+  {
+    toStringExact(0.5, buf, 32);
+    ok &= Str(buf) == Str("0.5");
+    toStringWithSuffix(0.5, buf, 32, 2, nullptr);
+    ok &= Str(buf) == Str("0.50");
+    ok &= fromStringExact("0.25", &y) && y == 0.25;
+    setlocale(LC_ALL, oldLocale.c_str());
+  }
+
+  return ok;
+}
+
+bool runTextToValueTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+  auto Str = [](const char *cStr) { return std::string(cStr); };
+
+  // Helper function to check if parsing the string "str" with the given suffix succeeds and 
+  // produces the "target" value:
+  auto check = [](const char* str, const char* suffix, double target)
+  {
+    double value = -1234.0;
+    bool parsed = fromStringWithSuffix(str, &value, suffix);
+    return parsed && value == target;
+  };
+
+  // Helper function to check that parsing fails and the value is set to zero:
+  auto checkFail = [](const char* str, const char* suffix)
+  {
+    double value = -1234.0;
+    bool parsed = fromStringWithSuffix(str, &value, suffix);
+    return !parsed && value == 0.0;
+  };
+
+  // Plain numbers with and without unit:
+  ok &= check("-6",        nullptr, -6.0);
+  ok &= check("  -6.5  ",  nullptr, -6.5);
+  ok &= check("+3",        nullptr,  3.0);
+  ok &= check("1e3",       nullptr,  1000.0);
+  ok &= check("-6 dB",     " dB",   -6.0);
+  ok &= check("-6dB",      " dB",   -6.0);
+  ok &= check("-6 db",     " dB",   -6.0);
+  ok &= check("-6",        " dB",   -6.0);
+  ok &= check("-6.00 dB ", " dB",   -6.0);
+
+  // SI prefixes:
+  ok &= check("2.5k Hz",   " Hz",    2500.0);
+  ok &= check("2.5kHz",    " Hz",    2500.0);
+  ok &= check("2.5 kHz",   " Hz",    2500.0);
+  ok &= check("2.5k",      " Hz",    2500.0);
+  ok &= check("2.5k",      nullptr,  2500.0);
+  ok &= check("1.5M Hz",   " Hz",    1500000.0);
+  ok &= check("50 ms",     " s",     0.05);
+  ok &= check("20u s",     " s",     20.e-6);
+  ok &= check("20\xC2\xB5s", " s",     20.e-6);  // Micro sign in UTF-8
+  ok &= check("3 m",       " m",     3.0);     // "m" is the unit (meters), not the prefix
+  ok &= check("3 mm",      " m",     0.003);
+
+  // Invalid strings:
+  ok &= checkFail("",            " dB");
+  ok &= checkFail("   ",         " dB");
+  ok &= checkFail("dB",          " dB");
+  ok &= checkFail("abc",         nullptr);
+  ok &= checkFail("-6 dB",       nullptr);
+  ok &= checkFail("-6 Hz",       " dB");
+  ok &= checkFail("2.5 kk Hz",   " Hz");
+  ok &= checkFail("2.5x Hz",     " Hz");
+  ok &= checkFail("1,5",         nullptr);
+  ok &= checkFail("inf",         nullptr);
+  ok &= checkFail("nan",         nullptr);
+  ok &= checkFail("++3",         nullptr);
+  ok &= checkFail("+-3",         nullptr);
+  ok &= checkFail(nullptr,       nullptr);
+
+  // Check the value-to-text-to-value roundtrip through the plugin's params API:
+  clap_plugin_descriptor_t desc = ClapGain::descriptor;
+  ClapGain gain(&desc, nullptr);
+  char buf[32];
+  double value;
+  for(double dB : { -40.0, -6.0, -0.25, 0.0, 3.5, 20.0 })
+  {
+    ok &= gain.paramsValueToText(ClapGain::kGain, dB, buf, 32);
+    ok &= gain.paramsTextToValue(ClapGain::kGain, buf, &value);
+    ok &= value == dB;
+  }
+  ok &= Str(buf) == "20.00 dB";
+  ok &=  gain.paramsTextToValue(ClapGain::kGain, "-6", &value) && value == -6.0;
+  ok &= !gain.paramsTextToValue(ClapGain::kGain, "loud", &value);
+  ok &= !gain.paramsTextToValue(ClapGain::kPan,  "-6 dB", &value);
+
+  return ok;
+}
+
+bool runDisplayCacheTest()
+{
+  bool ok = true;
+  auto Str = [](const char *cStr) { return std::string(cStr); };
+
+  clap_plugin_descriptor_t desc = ClapGain::descriptor;
+  ClapGain gain(&desc, nullptr);
+  using ID = ClapGain::ParamId;
+  char buf[32], ref[32];
+
+  // Helper function to request the string from the plugin in the way the host does it and to 
+  // compare it with the uncached result:
+  auto check = [&](clap_id id, double value)
+  {
+    bool r1 = gain.paramsValueToTextForHost(id, value, buf, 32);
+    bool r2 = gain.paramsValueToText(       id, value, ref, 32);
+    return r1 == r2 && strcmp(buf, ref) == 0;
+  };
+
+  // With the cache disabled, the counters should not count anything:
+  ok &= check(ID::kGain, -6.0);
+  ok &= gain.getDisplayCacheHits() == 0 && gain.getDisplayCacheMisses() == 0;
+
+  // Enable the cache with 4 slots per parameter. The first request for each value should be a 
+  // miss, the following ones should be hits:
+  gain.setDisplayCacheSize(4);
+  for(int n = 0; n < 10; n++)
+    for(double v : { -6.0, -3.0, 0.0, 6.0 })
+      ok &= check(ID::kGain, v);
+  ok &= gain.getDisplayCacheMisses() == 4;
+  ok &= gain.getDisplayCacheHits()   == 36;
+
+  // The parameters have their own slots and the key is the exact value:
+  ok &= check(ID::kPan,  -6.0);
+  ok &= check(ID::kGain, -6.0 + 1.e-12);                 // Looks the same but is a different key
+  ok &= check(ID::kGain, -0.0);                          // Different bit pattern than +0
+  ok &= gain.getDisplayCacheMisses() == 7;
+  ok &= Str(buf) == "-0.00 dB";
+
+  // The 3 new gain values have evicted the 3 oldest entries, i.e. -6, -3, 0 but not 6:
+  gain.resetDisplayCacheCounters();
+  ok &= check(ID::kGain, 6.0);
+  ok &= gain.getDisplayCacheHits() == 1 && gain.getDisplayCacheMisses() == 0;
+  ok &= check(ID::kGain, -3.0);
+  ok &= gain.getDisplayCacheHits() == 1 && gain.getDisplayCacheMisses() == 1;
+
+  // Buffers too short for the cached string must be handled by paramsValueToText:
+  gain.resetDisplayCacheCounters();
+  ok &= gain.paramsValueToTextForHost(ID::kGain, 6.0, buf, 4);
+  ok &= Str(buf) == "6.0";
+  ok &= gain.getDisplayCacheHits() == 0 && gain.getDisplayCacheMisses() == 1;
+  ok &= check(ID::kGain, 6.0);                           // Truncated string wasn't cached
+  ok &= gain.getDisplayCacheHits() == 1;
+
+  // After invalidation, all requests are misses again:
+  gain.invalidateDisplayCache();
+  gain.resetDisplayCacheCounters();
+  ok &= check(ID::kGain, 6.0);
+  ok &= gain.getDisplayCacheHits() == 0 && gain.getDisplayCacheMisses() == 1;
+
+  // Out of range ids bypass the cache:
+  gain.paramsValueToTextForHost(1000, 0.0, buf, 32);
+  ok &= gain.getDisplayCacheMisses() == 1;
+
+  // Disable the cache again:
+  gain.setDisplayCacheSize(0);
+  gain.resetDisplayCacheCounters();
+  ok &= check(ID::kGain, 6.0);
+  ok &= gain.getDisplayCacheHits() == 0 && gain.getDisplayCacheMisses() == 0;
+
+  return ok;
+}
+
+bool runChoiceStringsTest()
+{
+  using namespace RobsClapHelpers;
+  bool ok = true;
+  auto Str = [](const char *cStr) { return std::string(cStr); };
+
+  // Create a big list of strings like they may occur in a wavetable list:
+  int N = 1000;
+  std::vector<std::string> names(N);
+  for(int i = 0; i < N; i++)
+    names[i] = "Wavetable " + std::to_string(i);
+  ChoiceStrings cs(names);
+  ok &= cs.getNumStrings() == N;
+  ok &= cs.isConsistent();
+  ok &= cs.isCaseSensitive();
+
+  // All strings must be found at their index and the results must agree with findString:
+  for(int i = 0; i < N; i++)
+  {
+    ok &= cs.find(names[i].c_str()) == i;
+    ok &= findString(names, names[i].c_str()) == i;
+    ok &= Str(cs.getString(i)) == names[i];
+  }
+
+  // Strings that are not in the list:
+  ok &= cs.find("Wavetable 1000") == -1;
+  ok &= cs.find("wavetable 5")    == -1;           // Lookup is case sensitive
+  ok &= cs.find("Wavetable 5 ")   == -1;
+  ok &= cs.find("")               == -1;
+  ok &= cs.find(nullptr)          == -1;
+  ok &= cs.getString(-1)          == nullptr;
+  ok &= cs.getString(N)           == nullptr;
+
+  // Case-insensitive lookup:
+  ChoiceStrings ci({ "Sine", "Saw", "Square", "Triangle" }, false);
+  ok &= ci.isConsistent();
+  ok &= ci.find("saw")      == 1;
+  ok &= ci.find("SQUARE")   == 2;
+  ok &= ci.find("Triangle") == 3;
+  ok &= ci.find("Noise")    == -1;
+  ok &= Str(ci.getString(1)) == "Saw";             // The original spelling is kept
+
+  // Duplicates make the list inconsistent. With case-insensitive lookup, strings that differ only
+  // in case are duplicates as well:
+  ok &= !ChoiceStrings({ "A", "B", "A" }).isConsistent();
+  ok &=  ChoiceStrings({ "A", "a" }, true ).isConsistent();
+  ok &= !ChoiceStrings({ "A", "a" }, false).isConsistent();
+
+  // An empty list:
+  ChoiceStrings empty({});
+  ok &= empty.isConsistent();
+  ok &= empty.find("A") == -1;
+
+  // The WaveShaper's shape names use case-insensitive lookup:
+  clap_plugin_descriptor_t desc = ClapWaveShaper::descriptor;
+  ClapWaveShaper ws(&desc, nullptr);
+  double value;
+  ok &=  ws.paramsTextToValue(ClapWaveShaper::kShape, "tanh", &value) && value == 1.0;
+  ok &=  ws.paramsTextToValue(ClapWaveShaper::kShape, "ERF",  &value) && value == 3.0;
+  ok &= !ws.paramsTextToValue(ClapWaveShaper::kShape, "Fold", &value) && value == 0.0;
+
+  return ok;
 }
 
 bool runIndexIdentifierMapTest()
@@ -307,6 +2317,40 @@ bool runIndexIdentifierMapTest()
   return ok;
 }
 
+bool runConsistencyCheckScalingTest()
+{
+  // Runs the consistency checks of IndexIdentifierMap and ClapPluginWithParams for increasing 
+  // numbers of entries/parameters. With the old O(N^2) implementations, the 100k case would take 
+  // minutes. Now, the whole test should finish in a fraction of a second.
+
+  bool ok = true;
+  using namespace RobsClapHelpers;
+
+  clap_plugin_descriptor_t desc = ClapManyParams::descriptor;
+  for(uint32_t N = 10; N <= 100000; N *= 10)
+  {
+    // Create a pseudo-random index-to-identifier mapping and fill the map with it:
+    std::vector<uint32_t> perm(N);
+    createPermutation(perm, N);
+    IndexIdentifierMap map;
+    for(uint32_t i = 0; i < N; i++)
+      map.addIndexIdentifierPair(i, perm[i]);
+    ok &= map.isConsistent();
+
+    // Map an additional index to an identifier that was already used. Now, one identifier occurs
+    // twice and the map should be flagged as inconsistent:
+    map.addIndexIdentifierPair(N, perm[N/2]);
+    ok &= !map.isConsistent();
+
+    // Check the parameter consistency of a plugin with N parameters:
+    ClapManyParams plugin(&desc, nullptr, N);
+    ok &= plugin.paramsCount() == N;
+    ok &= plugin.areParamsConsistent();
+  }
+
+  return ok;
+}
+
 bool runWaveShaperTest()
 {
   bool ok = true;
@@ -353,18 +2397,50 @@ bool runWaveShaperTest()
   ok &= checkShapeString(Shape::kErf,  "Erf");
 
 
-  // Under construction - Test audio processing:
-  Shape  shape = Shape::kTanh;
+  // Test audio processing. The block kernels must give the same results as the per-sample 
+  // function and as a direct evaluation of the formulas:
   double drive = 7.0;
   double dc    = 0.25;
   double gain  = -5.0;
-  ws.setParameter(ID::kShape, shape);
   ws.setParameter(ID::kDrive, drive);
   ws.setParameter(ID::kDC,    dc);
   ws.setParameter(ID::kGain,  gain);
-  //std::string stateString = ws.getStateAsString();
-  // ...more to do....
-
+  double inAmp  = pow(10.0, drive / 20.0);
+  double outAmp = pow(10.0, gain  / 20.0);
+  static const double pi2 = 1.5707963267948966192;
+  auto shapeFunc = [&](int shape, double x)
+  {
+    double y = inAmp * x + dc;
+    switch(shape)
+    {
+    case Shape::kClip: y = std::min(std::max(y, -1.0), 1.0); break;
+    case Shape::kTanh: y = tanh(y);                         break;
+    case Shape::kAtan: y = atan(pi2 * y) / pi2;             break;
+    case Shape::kErf:  y = erf(y);                          break;
+    }
+    return outAmp * y;
+  };
+  int numFrames = 37;                          // Odd length to cover the loop remainders
+  std::vector<float> inL(numFrames), inR(numFrames), outL(numFrames), outR(numFrames);
+  for(int n = 0; n < numFrames; n++)
+  {
+    inL[n] = -1.5f + 3.f * n / (numFrames-1);
+    inR[n] = 0.5f * inL[numFrames-1-(n/2)];
+  }
+  for(int shape = 0; shape < Shape::numShapes; shape++)
+  {
+    ws.setParameter(ID::kShape, shape);
+    ws.processBlockStereo(&inL[0], &inR[0], &outL[0], &outR[0], numFrames);
+    float maxErr = 0.f;
+    for(int n = 0; n < numFrames; n++)
+    {
+      maxErr = std::max(maxErr, std::fabs(outL[n] - ws.applyDistortion(inL[n])));
+      maxErr = std::max(maxErr, std::fabs(outR[n] - ws.applyDistortion(inR[n])));
+      maxErr = std::max(maxErr, std::fabs(outL[n] - (float) shapeFunc(shape, inL[n])));
+      maxErr = std::max(maxErr, std::fabs(outR[n] - (float) shapeFunc(shape, inR[n])));
+    }
+    ok &= maxErr < 1.e-6f;
+  }
 
   return ok;
 
@@ -374,8 +2450,6 @@ bool runWaveShaperTest()
   //    ws.paramsValueToText(ClapWaveShaper::Params::kShape, ...
   //  The desired behavior is that it behaves like rounding, i.e. 0..0.5 should give the same 
   //  result as the integer 0, 0.5..1.5 the same result as 1, etc.
-  // -Check that the waveshaper prodcues the correct outputs, i.e. that we we really get a
-  //  tanh shaping when we select tanh, etc.
 }
 
 //-------------------------------------------------------------------------------------------------
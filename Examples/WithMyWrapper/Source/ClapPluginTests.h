@@ -12,9 +12,32 @@ bool runStateRecallTest();
 // Maybe rename to testParameterStateRecall. We may later have states that contain more than just
 // numerical parameters (like strings for audiofile locations, maybe other data)
 
+bool runBinaryStateRecallTest();
+bool runSparseStateTest();
+bool runStateStreamingTest();
+bool runCompressionTest();            // The LZ block compressor for states
+bool runStateContextTest();
+bool runAsyncStateLoadTest();
+bool runBulkUpdateTest();             // One change notification for many parameter changes
+bool runParameterMappingTest();       // Mapping curves, fast exp2/log2
+bool runVoiceManagerTest();           // Voice allocation, stealing and note event dispatch
+bool runSineVoiceBankTest();          // SoA voice rendering, SIMD lanes vs scalar path
+bool runNoteEndTest();                // NOTE_END reporting at the frame where voices end
+bool runVoiceInfoTest();              // Voice-info extension, retiring of silent voices
+bool runNoteTimingTest();             // Note events as voice offsets without block splitting
+bool runMidiDecoderTest();            // MIDI 1.0 and 2.0 decoding and channel state
+bool runNoteExpressionTest();         // Per-voice note expressions, smoothing and routing
+bool runPitchIncrementTableTest();    // Table-based pitch to phase increment conversion, tuning
+bool runWavetableTest();              // Shared band-limited mip-mapped wavetables
+bool runParamCookieTest();
 bool runDescriptorReadTest();
 bool runNumberToStringTest();
+bool runNumberRoundTripTest();         // Exact double/float-string-double/float roundtrips
+bool runTextToValueTest();             // Parsing of display strings with units and SI prefixes
+bool runDisplayCacheTest();
+bool runChoiceStringsTest();
 bool runIndexIdentifierMapTest();
+bool runConsistencyCheckScalingTest();
 bool runWaveShaperTest();
 bool runProcessingTest1();             // Maybe rename to runProcessTestGain1
 bool runProcessingTest2();
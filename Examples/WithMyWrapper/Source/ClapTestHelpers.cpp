@@ -79,7 +79,8 @@ void initClapOutEventBuffer(clap_output_events* b)
                           // -> bool
 }
 
-clap_event_param_value createParamValueEvent(clap_id paramId, double value, uint32_t time)
+clap_event_param_value createParamValueEvent(clap_id paramId, double value, uint32_t time,
+  void* cookie)
 {
   // Create event and set up the header:
   clap_event_param_value ev;
@@ -89,7 +90,7 @@ clap_event_param_value createParamValueEvent(clap_id paramId, double value, uint
 
   // Set up the param_value specific fields and return the event:
   ev.param_id   = paramId;    // clap_id
-  ev.cookie     = nullptr;    // void*
+  ev.cookie     = cookie;     // void*
   ev.note_id    = -1;         // int32_t, -1 means: wildcard/unspecified/doesn't-matter/all
   ev.port_index = -1;         // int16_t
   ev.channel    = -1;         // int16_t
@@ -98,10 +99,100 @@ clap_event_param_value createParamValueEvent(clap_id paramId, double value, uint
   return ev;
 }
 
-void ClapEventBuffer::addParamValueEvent(clap_id paramId, double value, uint32_t time)
+clap_event_note createNoteEvent(uint16_t type, int16_t key, double velocity, uint32_t time,
+  int32_t noteId, int16_t port, int16_t channel)
+{
+  clap_event_note ev;
+  initEventHeader(&ev.header, time);
+  ev.header.type = type;
+  ev.header.size = sizeof(clap_event_note);
+  ev.note_id     = noteId;     // int32_t
+  ev.port_index  = port;       // int16_t
+  ev.channel     = channel;    // int16_t
+  ev.key         = key;        // int16_t
+  ev.velocity    = velocity;   // double
+  return ev;
+}
+
+clap_event_midi createMidiEvent(uint8_t status, uint8_t data1, uint8_t data2, uint32_t time)
+{
+  clap_event_midi ev;
+  initEventHeader(&ev.header, time);
+  ev.header.type = CLAP_EVENT_MIDI;
+  ev.header.size = sizeof(clap_event_midi);
+  ev.port_index  = 0;          // uint16_t
+  ev.data[0]     = status;
+  ev.data[1]     = data1;
+  ev.data[2]     = data2;
+  return ev;
+}
+
+clap_event_midi2 createMidi2Event(uint32_t word0, uint32_t word1, uint32_t time)
+{
+  clap_event_midi2 ev;
+  initEventHeader(&ev.header, time);
+  ev.header.type = CLAP_EVENT_MIDI2;
+  ev.header.size = sizeof(clap_event_midi2);
+  ev.port_index  = 0;          // uint16_t
+  ev.data[0]     = word0;
+  ev.data[1]     = word1;
+  ev.data[2]     = 0;
+  ev.data[3]     = 0;
+  return ev;
+}
+
+clap_event_note_expression createNoteExpressionEvent(int32_t expressionId, double value, 
+  int16_t key, uint32_t time, int32_t noteId, int16_t port, int16_t channel)
+{
+  clap_event_note_expression ev;
+  initEventHeader(&ev.header, time);
+  ev.header.type   = CLAP_EVENT_NOTE_EXPRESSION;
+  ev.header.size   = sizeof(clap_event_note_expression);
+  ev.expression_id = expressionId;
+  ev.note_id       = noteId;     // int32_t
+  ev.port_index    = port;       // int16_t
+  ev.channel       = channel;    // int16_t
+  ev.key           = key;        // int16_t
+  ev.value         = value;      // double
+  return ev;
+}
+
+void ClapEventBuffer::addParamValueEvent(clap_id paramId, double value, uint32_t time, 
+  void* cookie)
+{
+  ClapEvent ev;
+  ev.paramValue = createParamValueEvent(paramId, value, time, cookie);
+  events.push_back(ev);
+}
+
+void ClapEventBuffer::addNoteEvent(uint16_t type, int16_t key, double velocity, uint32_t time,
+  int32_t noteId, int16_t port, int16_t channel)
+{
+  ClapEvent ev;
+  ev.note = createNoteEvent(type, key, velocity, time, noteId, port, channel);
+  events.push_back(ev);
+}
+
+void ClapEventBuffer::addMidiEvent(uint8_t status, uint8_t data1, uint8_t data2, uint32_t time)
+{
+  ClapEvent ev;
+  ev.midi = createMidiEvent(status, data1, data2, time);
+  events.push_back(ev);
+}
+
+void ClapEventBuffer::addMidi2Event(uint32_t word0, uint32_t word1, uint32_t time)
+{
+  ClapEvent ev;
+  ev.midi2 = createMidi2Event(word0, word1, time);
+  events.push_back(ev);
+}
+
+void ClapEventBuffer::addNoteExpressionEvent(int32_t expressionId, double value, int16_t key, 
+  uint32_t time, int32_t noteId, int16_t port, int16_t channel)
 {
   ClapEvent ev;
-  ev.paramValue = createParamValueEvent(paramId, value, time);
+  ev.noteExpression = 
+    createNoteExpressionEvent(expressionId, value, key, time, noteId, port, channel);
   events.push_back(ev);
 }
 
@@ -241,6 +332,233 @@ ClapGain2::ClapGain2(const clap_plugin_descriptor* desc, const clap_host* host)
 
 //-------------------------------------------------------------------------------------------------
 
+const char* const ClapManyParams::features[2] = 
+{ 
+  CLAP_PLUGIN_FEATURE_AUDIO_EFFECT,
+  NULL 
+};
+
+const clap_plugin_descriptor_t ClapManyParams::descriptor = 
+{
+  .clap_version = CLAP_VERSION_INIT,
+  .id           = "RS-MET.ManyParams",
+  .name         = "ManyParams",
+  .vendor       = "",
+  .url          = "",
+  .manual_url   = "",
+  .support_url  = "",
+  .version      = "0.0.0",
+  .description  = "Plugin with a configurable number of parameters",
+  .features     = ClapManyParams::features,
+};
+
+ClapManyParams::ClapManyParams(const clap_plugin_descriptor* desc, const clap_host* host,
+  uint32_t numParams) : ClapPluginStereo32Bit(desc, host) 
+{
+  clap_param_info_flags automatable = CLAP_PARAM_IS_AUTOMATABLE;
+  std::vector<uint32_t> ids(numParams);
+  createPermutation(ids);
+  for(uint32_t i = 0; i < numParams; i++)
+  {
+    clap_id id = ids[i];
+    addParameter(id, "Param " + std::to_string(id), -1.0, +1.0, 0.0, automatable);
+  }
+}
+
+void ClapManyParams::parametersChanged(const clap_id* ids, uint32_t numIds)
+{
+  numBulkCalls++;
+  lastBulkIds.assign(ids, ids + numIds);
+  if(!handleBulk)
+    ClapPluginStereo32Bit::parametersChanged(ids, numIds);
+}
+
+//-------------------------------------------------------------------------------------------------
+
+const char* const ClapBigState::features[2] = 
+{ 
+  CLAP_PLUGIN_FEATURE_AUDIO_EFFECT,
+  NULL 
+};
+
+const clap_plugin_descriptor_t ClapBigState::descriptor = 
+{
+  .clap_version = CLAP_VERSION_INIT,
+  .id           = "RS-MET.BigState",
+  .name         = "BigState",
+  .vendor       = "",
+  .url          = "",
+  .manual_url   = "",
+  .support_url  = "",
+  .version      = "0.0.0",
+  .description  = "Plugin with a big chunk of data in its state",
+  .features     = ClapBigState::features,
+};
+
+ClapBigState::ClapBigState(const clap_plugin_descriptor* desc, const clap_host* host)
+  : ClapPluginStereo32Bit(desc, host) 
+{
+  clap_param_info_flags automatable = CLAP_PARAM_IS_AUTOMATABLE;
+  addParameter(kGain, "Gain", -40.0, +40.0, 0.0, automatable);
+  addParameter(kPan,  "Pan",   -1.0,  +1.0, 0.0, automatable);
+}
+
+bool ClapBigState::writeState(RobsClapHelpers::ClapStreamWriter& w) const
+{
+  if(!Base::writeState(w))
+    return false;
+  w.writeUint32((uint32_t) data.size());
+  return w.write(data.data(), data.size() * sizeof(float));
+
+  // Notes:
+  //
+  // -Writing the floats in their native byte order is not portable but good enough for a test.
+}
+
+bool ClapBigState::readState(RobsClapHelpers::ClapStreamReader& r)
+{
+  if(!Base::readState(r))
+    return false;
+  uint32_t size;
+  if(!r.readUint32(&size))
+    return false;
+  data.resize(size);
+  return r.read(data.data(), size * sizeof(float));
+}
+
+//-------------------------------------------------------------------------------------------------
+
+bool ClapDerivedState::writeState(RobsClapHelpers::ClapStreamWriter& w) const
+{
+  if(!Base::writeState(w))
+    return false;
+  if(getStateContext() == CLAP_STATE_CONTEXT_FOR_PRESET)
+    return w.writeUint32(0);          // Flag: derived data not included
+  w.writeUint32(1);
+  return w.write(derived.data(), derived.size() * sizeof(float));
+}
+
+bool ClapDerivedState::readState(RobsClapHelpers::ClapStreamReader& r)
+{
+  uint32_t hasDerived;
+  if(!Base::readState(r) || !r.readUint32(&hasDerived))
+    return false;
+  if(hasDerived == 0)
+  {
+    updateDerived();
+    return true;
+  }
+  derived.resize(data.size());
+  return r.read(derived.data(), derived.size() * sizeof(float));
+}
+
+void ClapDerivedState::updateDerived()
+{
+  derived.resize(data.size());
+  for(size_t i = 0; i < data.size(); i++)
+    derived[i] = data[i] * data[i];
+  numDerivedUpdates++;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+const char* const ClapVersionedDefaults::features[2] = 
+{ 
+  CLAP_PLUGIN_FEATURE_AUDIO_EFFECT,
+  NULL 
+};
+
+const clap_plugin_descriptor_t ClapVersionedDefaults::descriptor = 
+{
+  .clap_version = CLAP_VERSION_INIT,
+  .id           = "RS-MET.VersionedDefaults",
+  .name         = "VersionedDefaults",
+  .vendor       = "",
+  .url          = "",
+  .manual_url   = "",
+  .support_url  = "",
+  .version      = "0.0.0",
+  .description  = "Plugin whose default values have changed between versions",
+  .features     = ClapVersionedDefaults::features,
+};
+
+ClapVersionedDefaults::ClapVersionedDefaults(const clap_plugin_descriptor* desc, 
+  const clap_host* host, uint32_t version) : ClapPluginStereo32Bit(desc, host) 
+{
+  clap_param_info_flags automatable = CLAP_PARAM_IS_AUTOMATABLE;
+  addParameter(kA, "A", 0.0, 1.0, version == 0 ? 0.5 : 0.25, automatable);
+  addParameter(kB, "B", 0.0, 1.0, 0.0,                       automatable);
+  setDefaultsVersion(version);
+}
+
+double ClapVersionedDefaults::getDefaultValue(const clap_param_info& info, uint32_t version) const
+{
+  if(info.id == kA && version == 0)
+    return 0.5;                              // Default of A before it was changed in version 1
+  return info.default_value;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+const char* const ClapVoiceRecorder::features[3] = 
+{ 
+  CLAP_PLUGIN_FEATURE_INSTRUMENT,
+  CLAP_PLUGIN_FEATURE_SYNTHESIZER,
+  NULL 
+};
+
+const clap_plugin_descriptor_t ClapVoiceRecorder::descriptor = 
+{
+  .clap_version = CLAP_VERSION_INIT,
+  .id           = "RS-MET.VoiceRecorder",
+  .name         = "VoiceRecorder",
+  .vendor       = "",
+  .url          = "",
+  .manual_url   = "",
+  .support_url  = "",
+  .version      = "0.0.0",
+  .description  = "Silent synth that records the voice management calls",
+  .features     = ClapVoiceRecorder::features,
+};
+
+ClapVoiceRecorder::ClapVoiceRecorder(const clap_plugin_descriptor* desc, const clap_host* host,
+  int numVoices) : ClapSynthStereo32Bit(desc, host) 
+{
+  setMaxNumVoices(numVoices);
+}
+
+void ClapVoiceRecorder::processBlockStereo(
+  const float* inL, const float* inR, float* outL, float* outR, uint32_t numFrames)
+{
+  numBlocks++;
+  advanceNoteExpressions(numFrames);
+  if(keyLevels.empty())
+    return;
+  for(int i = 0; i < getVoiceManager().getNumActiveVoices(); i++)
+  {
+    int v = getVoiceManager().getActiveVoice(i);
+    setVoiceLevel(v, keyLevels[getVoiceManager().getVoice(v).key]);
+  }
+}
+
+void createPermutation(std::vector<uint32_t>& perm, uint32_t seed)
+{
+  uint32_t N = (uint32_t) perm.size();
+  for(uint32_t i = 0; i < N; i++)
+    perm[i] = i;
+
+  // Fisher-Yates shuffle with a simple linear congruential generator:
+  uint32_t state = seed;
+  for(uint32_t i = N; i > 1; i--)
+  {
+    state = 1664525 * state + 1013904223;
+    uint32_t j = state % i;
+    std::swap(perm[i-1], perm[j]);
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+
 const char* const ClapChannelMixer2In3Out::features[6] = 
 { 
   CLAP_PLUGIN_FEATURE_AUDIO_EFFECT,
@@ -49,14 +49,31 @@ void initClapInEventBuffer(clap_input_events* b);
 
 void initClapOutEventBuffer(clap_output_events* b);
 
-clap_event_param_value createParamValueEvent(clap_id paramId, double value, uint32_t time = 0);
+clap_event_param_value createParamValueEvent(clap_id paramId, double value, uint32_t time = 0,
+  void* cookie = nullptr);
+
+/** Creates a note event of the given type which should be one of CLAP_EVENT_NOTE_ON/OFF/CHOKE. */
+clap_event_note createNoteEvent(uint16_t type, int16_t key, double velocity, uint32_t time = 0,
+  int32_t noteId = -1, int16_t port = -1, int16_t channel = -1);
+
+/** Creates a 3-byte MIDI event. */
+clap_event_midi createMidiEvent(uint8_t status, uint8_t data1, uint8_t data2, uint32_t time = 0);
+
+/** Creates a MIDI 2.0 event from the first two UMP words. The other two are zero. */
+clap_event_midi2 createMidi2Event(uint32_t word0, uint32_t word1, uint32_t time = 0);
+
+/** Creates a note expression event with one of the CLAP_NOTE_EXPRESSION_... ids. */
+clap_event_note_expression createNoteExpressionEvent(int32_t expressionId, double value, 
+  int16_t key, uint32_t time = 0, int32_t noteId = -1, int16_t port = -1, int16_t channel = -1);
 
 
 union ClapEvent
 {
-  clap_event_midi        midi;
-  clap_event_note        note;
-  clap_event_param_value paramValue;
+  clap_event_midi            midi;
+  clap_event_midi2           midi2;
+  clap_event_note            note;
+  clap_event_note_expression noteExpression;
+  clap_event_param_value     paramValue;
 
   // ...more to come...
 };
@@ -94,7 +111,17 @@ public:
 
   void addEvent(const ClapEvent& newEvent) { events.push_back(newEvent); }
 
-  void addParamValueEvent(clap_id paramId, double value, uint32_t time);
+  void addParamValueEvent(clap_id paramId, double value, uint32_t time, void* cookie = nullptr);
+
+  void addNoteEvent(uint16_t type, int16_t key, double velocity, uint32_t time, 
+    int32_t noteId = -1, int16_t port = -1, int16_t channel = -1);
+
+  void addMidiEvent(uint8_t status, uint8_t data1, uint8_t data2, uint32_t time);
+
+  void addMidi2Event(uint32_t word0, uint32_t word1, uint32_t time);
+
+  void addNoteExpressionEvent(int32_t expressionId, double value, int16_t key, uint32_t time, 
+    int32_t noteId = -1, int16_t port = -1, int16_t channel = -1);
 
 private:
 
@@ -171,8 +198,16 @@ private:
 
   static bool tryPushEvent(const struct clap_output_events *list, const clap_event_header_t *ev)
   {
-    RobsClapHelpers::clapError("Not yet implemented");
-    return false;
+    ClapOutEventBuffer* self = (ClapOutEventBuffer*) list->ctx;
+    if(ev->size > sizeof(ClapEvent))
+    {
+      RobsClapHelpers::clapError("Event type not supported by ClapEvent");
+      return false;
+    }
+    ClapEvent e;
+    memcpy(&e, ev, ev->size);
+    self->addEvent(e);
+    return true;
   }
 
 };
@@ -266,13 +301,35 @@ public:
   // \name Setup
 
   /** Adds a parameter value change event to our buffer of input events. */
-  void addInputParamValueEvent(clap_id paramId, double value, uint32_t time)
-  { inEvs.addParamValueEvent(paramId, value, time); }
+  void addInputParamValueEvent(clap_id paramId, double value, uint32_t time, 
+    void* cookie = nullptr)
+  { inEvs.addParamValueEvent(paramId, value, time, cookie); }
 
 
+  /** Adds a note event of the given type (CLAP_EVENT_NOTE_ON/OFF/CHOKE) to our input events. */
+  void addInputNoteEvent(uint16_t type, int16_t key, double velocity, uint32_t time, 
+    int32_t noteId = -1, int16_t port = -1, int16_t channel = -1)
+  { inEvs.addNoteEvent(type, key, velocity, time, noteId, port, channel); }
+
+  /** Adds a 3-byte MIDI event to our input events. */
+  void addInputMidiEvent(uint8_t status, uint8_t data1, uint8_t data2, uint32_t time)
+  { inEvs.addMidiEvent(status, data1, data2, time); }
+
+  /** Adds a MIDI 2.0 event to our input events. */
+  void addInputMidi2Event(uint32_t word0, uint32_t word1, uint32_t time)
+  { inEvs.addMidi2Event(word0, word1, time); }
+
+  /** Adds a note expression event to our input events. */
+  void addInputNoteExpressionEvent(int32_t expressionId, double value, int16_t key, 
+    uint32_t time, int32_t noteId = -1, int16_t port = -1, int16_t channel = -1)
+  { inEvs.addNoteExpressionEvent(expressionId, value, key, time, noteId, port, channel); }
+
   /** Cleasr out buffer of input events. */
   void clearInputEvents() { inEvs.clear(); }
 
+  /** Clears the buffer of events that the plugin has produced. */
+  void clearOutputEvents() { outEvs.clear(); }
+
   /** Sets up the map that determines how the input buffers are mapped to output buffers in case of 
   in-place processing. In general, we should not assume that ins[i] == outs[i] in case of in-place 
   processing but just that in[i] == outs[j] for some permutation map i -> j where i,j = 0..k-1 and
@@ -303,6 +360,12 @@ public:
   /** Returns the number of output channels. */
   uint32_t getNumOutChannels() const { return outBuf.getNumChannels(); }
 
+  /** Returns the number of events that the plugin has produced. */
+  uint32_t getNumOutputEvents() { return outEvs.getNumEvents(); }
+
+  /** Returns the header of the output event with given index. */
+  const clap_event_header_t* getOutputEvent(uint32_t index) { return outEvs.getEventHeader(index); }
+
   /** Returns a pointer to the wrapped clap_process struct. */
   clap_process* getWrappee() { return &_process; }
   // Maybe try to return a const pointer?
@@ -379,6 +442,190 @@ public:
 
 //-------------------------------------------------------------------------------------------------
 
+/** A plugin with a configurable (and potentially very large) number of parameters. It's used to
+test the scaling behavior of the parameter handling with respect to the number of parameters. The 
+parameters are added in a shuffled order, so the ids are a nontrivial permutation of the 
+indices. */
+
+class ClapManyParams : public RobsClapHelpers::ClapPluginStereo32Bit
+{
+
+public:
+
+  ClapManyParams(const clap_plugin_descriptor* desc, const clap_host* host, uint32_t numParams);
+
+  static const char* const features[2];
+  static const clap_plugin_descriptor_t descriptor;
+
+  // Dummy functions:
+  void processBlockStereo(const float* inL, const float* inR, float* outL, float* outR,
+    uint32_t numFrames) override {}
+  void parameterChanged(clap_id id, double newValue) override { numSingleCalls++; }
+
+  /** Counts the calls and records the reported ids. If handleBulk is false, it lets the baseclass 
+  dispatch to parameterChanged for each id. */
+  void parametersChanged(const clap_id* ids, uint32_t numIds) override;
+
+  // Counters for the change notifications to be inspected by the tests:
+  int  numSingleCalls = 0;
+  int  numBulkCalls   = 0;
+  bool handleBulk     = false;
+  std::vector<clap_id> lastBulkIds;
+
+};
+
+//-------------------------------------------------------------------------------------------------
+
+/** A plugin that stores a big chunk of data (think of a wavetable or sample map) in its state in
+addition to its parameters. It's used to test and benchmark the streaming of large states. The data
+is appended behind the parameters as a 32 bit length field followed by the raw floats. */
+
+class ClapBigState : public RobsClapHelpers::ClapPluginStereo32Bit
+{
+
+  using Base = ClapPluginStereo32Bit;
+
+public:
+
+  enum ParamId
+  {
+    kGain,
+    kPan,
+
+    numParams
+  };
+
+  ClapBigState(const clap_plugin_descriptor* desc, const clap_host* host);
+
+  static const char* const features[2];
+  static const clap_plugin_descriptor_t descriptor;
+
+  bool writeState(RobsClapHelpers::ClapStreamWriter& writer) const override;
+  bool readState(RobsClapHelpers::ClapStreamReader& reader) override;
+
+  // Dummy functions:
+  void processBlockStereo(const float* inL, const float* inR, float* outL, float* outR,
+    uint32_t numFrames) override {}
+  void parameterChanged(clap_id id, double newValue) override {}
+
+  std::vector<float> data;  // The big chunk of data
+
+};
+
+/** A plugin that has, in addition to the big chunk of data of ClapBigState, some data that is 
+derived from it and expensive to compute (think of the mip-maps of a wavetable). The derived data 
+is stored in project and duplicate states but left out of presets in which case it is recomputed 
+on load. It's used to test the state-context extension. */
+
+class ClapDerivedState : public ClapBigState
+{
+
+  using Base = ClapBigState;
+
+public:
+
+  ClapDerivedState(const clap_plugin_descriptor* desc, const clap_host* host) 
+    : ClapBigState(desc, host) {}
+
+  bool writeState(RobsClapHelpers::ClapStreamWriter& writer) const override;
+  bool readState(RobsClapHelpers::ClapStreamReader& reader) override;
+
+  /** Recomputes the derived data from the data. */
+  void updateDerived();
+
+  std::vector<float> derived;         // The derived data
+  int numDerivedUpdates = 0;          // Counts the calls to updateDerived()
+
+};
+
+//-------------------------------------------------------------------------------------------------
+
+/** A plugin that simulates a change of default values between plugin versions. The "version" that
+is passed to the constructor determines which defaults the plugin uses: in version 0, parameter A 
+has a default of 0.5, in version 1, it was changed to 0.25. Parameter B has a default of 0 in both 
+versions. It's used to test the recall of sparse states. */
+
+class ClapVersionedDefaults : public RobsClapHelpers::ClapPluginStereo32Bit
+{
+
+public:
+
+  enum ParamId
+  {
+    kA,
+    kB,
+
+    numParams
+  };
+
+  ClapVersionedDefaults(const clap_plugin_descriptor* desc, const clap_host* host, 
+    uint32_t version);
+
+  static const char* const features[2];
+  static const clap_plugin_descriptor_t descriptor;
+
+  double getDefaultValue(const clap_param_info& info, uint32_t version) const override;
+
+  // Dummy functions:
+  void processBlockStereo(const float* inL, const float* inR, float* outL, float* outR,
+    uint32_t numFrames) override {}
+  void parameterChanged(clap_id id, double newValue) override {}
+
+};
+
+//-------------------------------------------------------------------------------------------------
+
+/** A polyphonic synth that produces no sound but records the calls to the voice management hooks
+of ClapSynthStereo32Bit. Released voices keep sounding until the test calls voiceFinished(). */
+
+class ClapVoiceRecorder : public RobsClapHelpers::ClapSynthStereo32Bit
+{
+
+public:
+
+  ClapVoiceRecorder(const clap_plugin_descriptor* desc, const clap_host* host, int numVoices);
+
+  static const char* const features[3];
+  static const clap_plugin_descriptor_t descriptor;
+
+  void voiceStarted( int voice) override 
+  { numStarted++;  lastStarted  = voice; lastEventFrame = getNoteEventFrame(); }
+  void voiceReleased(int voice) override 
+  { numReleased++; lastReleased = voice; lastEventFrame = getNoteEventFrame(); }
+  void voiceStopped( int voice) override { numStopped++;  lastStopped  = voice; }
+
+  void noteOn(int key, double velocity) override { numNoteOns++;  }
+  void noteOff(int key)                 override { numNoteOffs++; }
+
+  void midiControlEvent(const RobsClapHelpers::MidiDecoder::Event& ev) override 
+  { numControlEvents++; lastControlEvent = ev; }
+
+  // Produces no sound but keeps the note expressions going and reports the voice levels:
+  void processBlockStereo(const float* inL, const float* inR, float* outL, float* outR,
+    uint32_t numFrames) override;
+
+  // Dummy function:
+  void parameterChanged(clap_id id, double newValue) override {}
+
+  // Counters and last voice indices to be inspected by the tests:
+  int numStarted = 0, numReleased = 0, numStopped = 0, numNoteOns = 0, numNoteOffs = 0;
+  int lastStarted = -1, lastReleased = -1, lastStopped = -1;
+  int numControlEvents = 0;
+  int numBlocks = 0;                 // Number of calls to processBlockStereo
+  uint32_t lastEventFrame = 0;       // getNoteEventFrame() in the last start or release
+  RobsClapHelpers::MidiDecoder::Event lastControlEvent;
+
+  // The levels that are reported for the voices, indexed by key. Empty means not to report any:
+  std::vector<float> keyLevels;
+
+};
+
+/** Fills the given vector with a pseudo-random permutation of the numbers 0...N-1 where N is the 
+size of the vector. The same seed gives the same permutation. */
+void createPermutation(std::vector<uint32_t>& perm, uint32_t seed = 0);
+
+//-------------------------------------------------------------------------------------------------
+
 /** A simple plugin to distribute the 2 left/right channels (inL, inR) of a stereo signal into 3 
 left/center/right output channels (outL, outC, outR). It uses the rule:
 
@@ -50,9 +50,10 @@ ClapGain::ClapGain(const clap_plugin_descriptor *desc, const clap_host *host)
   // Flags for our parameters - they are automatable:
   clap_param_info_flags automatable = CLAP_PARAM_IS_AUTOMATABLE;
 
-  // Add the parameters:
-  addParameter(kGain, "Gain", -40.0, +40.0, 0.0, automatable);  // in dB
-  addParameter(kPan,  "Pan",   -1.0,  +1.0, 0.0, automatable);  // -1: left, 0: center, +1: right
+  // Add the parameters. The gain is mapped from dB to a raw amplitude and the pan to 0..1:
+  using Map = RobsClapHelpers::ParameterMapping;
+  addParameter(kGain, "Gain", -40.0, +40.0, 0.0, automatable, Map::decibel());
+  addParameter(kPan,  "Pan",   -1.0,  +1.0, 0.0, automatable, Map::linear(0.0, 1.0));
   RobsClapHelpers::clapAssert(areParamsConsistent());
 
   // Notes:
@@ -84,8 +85,18 @@ void ClapGain::processBlockStereo(const float* inL, const float* inR, float* out
 
 void ClapGain::parameterChanged(clap_id id, double newValue)
 {
-  float amp   = (float) RobsClapHelpers::dbToAmp(getParameter(kGain)); // dB to linear scaler
-  float pan01 = (float) (0.5 * (getParameter(kPan) + 1.0));            // -1..+1  ->  0..1
+  updateCoeffs();
+}
+
+void ClapGain::parametersChanged(const clap_id* ids, uint32_t numIds)
+{
+  updateCoeffs();
+}
+
+void ClapGain::updateCoeffs()
+{
+  float amp   = (float) getMappedParameter(kGain);   // dB to linear scaler
+  float pan01 = (float) getMappedParameter(kPan);    // -1..+1  ->  0..1
   ampL = 2.f * (amp * (1.f - pan01));
   ampR = 2.f * (amp * pan01);
 }
@@ -100,6 +111,16 @@ bool ClapGain::paramsValueToText(clap_id id, double val, char *buf, uint32_t len
   return Base::paramsValueToText(id, val, buf, len);
 }
 
+bool ClapGain::paramsTextToValue(clap_id id, const char* display, double* value) noexcept
+{
+  switch(id)
+  {
+  case kGain: { return toValue(display, value, " dB"); }
+  case kPan:  { return toValue(display, value       ); }
+  }
+  return Base::paramsTextToValue(id, display, value);
+}
+
 //=================================================================================================
 // WaveShaperDemo
 
@@ -124,6 +145,9 @@ const clap_plugin_descriptor_t ClapWaveShaper::descriptor =
   .features     = ClapWaveShaper::features,
 };
 
+const RobsClapHelpers::ChoiceStrings ClapWaveShaper::shapeNames(
+  { "Clip", "Tanh", "Atan", "Erf" }, false);                 // Case-insensitive lookup
+
 ClapWaveShaper::ClapWaveShaper(const clap_plugin_descriptor *desc, const clap_host *host) 
   : ClapPluginStereo32Bit(desc, host) 
 {
@@ -132,13 +156,15 @@ ClapWaveShaper::ClapWaveShaper(const clap_plugin_descriptor *desc, const clap_ho
 
   //reserveParameters(numParams);
   addParameter(kShape, "Shape",   0.0, numShapes-1, 0.0, choice);        // Clip, Tanh, etc.
-  shapeNames = { "Clip", "Tanh", "Atan", "Erf" };
 
-  addParameter(kDrive, "Drive", -20.0, +60.0,       0.0, automatable);   // In dB
+  using Map = RobsClapHelpers::ParameterMapping;
+  addParameter(kDrive, "Drive", -20.0, +60.0,       0.0, automatable, Map::decibel()); // In dB
   addParameter(kDC,    "DC",    -10.0, +10.0,       0.0, automatable);   // As raw offset
-  addParameter(kGain,  "Gain",  -60.0, +20.0,       0.0, automatable);   // In dB
+  addParameter(kGain,  "Gain",  -60.0, +20.0,       0.0, automatable, Map::decibel()); // In dB
 
   RobsClapHelpers::clapAssert(areParamsConsistent());
+  RobsClapHelpers::clapAssert(shapeNames.getNumStrings() == numShapes);
+  RobsClapHelpers::clapAssert(shapeNames.isConsistent());
 
   // Notes:
   //
@@ -161,9 +187,9 @@ void ClapWaveShaper::parameterChanged(clap_id id, double newValue)
   switch(id)
   {
   case kShape: { shape  = (Shape)(int) round(  newValue); } break;  // use roundToInt(newValue)
-  case kDrive: { inAmp  = (float)      dbToAmp(newValue); } break;
+  case kDrive: { inAmp  = (float) getMappedParameter(id); } break;
   case kDC:    { dc     = (float)              newValue;  } break;
-  case kGain:  { outAmp = (float)      dbToAmp(newValue); } break;
+  case kGain:  { outAmp = (float) getMappedParameter(id); } break;
   default:
   {
     // error("Unknown parameter id in ClapWaveShaper::setParameter");
@@ -185,8 +211,12 @@ bool ClapWaveShaper::paramsValueToText(clap_id id, double val, char *buf, uint32
 bool ClapWaveShaper::paramsTextToValue(
   clap_id id, const char* display, double* value) noexcept
 {
-  if(id == kShape)
-    return toValue(display, value, shapeNames);
+  switch(id)
+  {
+  case kShape: { return toValue(display, value, shapeNames); }
+  case kDrive: { return toValue(display, value, " dB");      }
+  case kGain:  { return toValue(display, value, " dB");      }
+  }
   return Base::paramsTextToValue(id, display, value);
 
   // Notes:
@@ -199,27 +229,56 @@ bool ClapWaveShaper::paramsTextToValue(
 void ClapWaveShaper::processBlockStereo(
   const float* inL, const float* inR, float* outL, float* outR, uint32_t numFrames)
 {
-  for(uint32_t n = 0; n < numFrames; ++n)
+  // Select the kernel for the shape once for the whole (sub) block:
+  switch(shape)
   {
-    outL[n] = applyDistortion(inL[n]);
-    outR[n] = applyDistortion(inR[n]);
+  case kClip: processBlockWith<ClipShape>(inL, inR, outL, outR, numFrames); break;
+  case kTanh: processBlockWith<TanhShape>(inL, inR, outL, outR, numFrames); break;
+  case kAtan: processBlockWith<AtanShape>(inL, inR, outL, outR, numFrames); break;
+  case kErf:  processBlockWith<ErfShape >(inL, inR, outL, outR, numFrames); break;
+  default:    processBlockWith<NullShape>(inL, inR, outL, outR, numFrames); break;  // Error!
   }
+
+  // Notes:
+  //
+  // -The shape can only change between sub-blocks because the block is split at parameter 
+  //  events, so it's constant here.
+  // -See runWaveShaperBenchmark for a comparison with the switch per sample.
 }
 
-float ClapWaveShaper::applyDistortion(float x)
+template<class F>
+void ClapWaveShaper::processBlockWith(
+  const float* inL, const float* inR, float* outL, float* outR, uint32_t numFrames) const noexcept
 {
-  using namespace RobsClapHelpers;                   // Needed for clip
-  static const float pi2  = 1.5707963267948966192f;  // pi/2, needed for atan
-  static const float pi2r = 1.f / pi2;               // Reciprocal of pi/2
+  F f;
+  const float a = inAmp, b = dc, g = outAmp;
+  for(uint32_t n = 0; n < numFrames; ++n)
+  {
+    outL[n] = g * f(a * inL[n] + b);
+    outR[n] = g * f(a * inR[n] + b);
+  }
+
+  // Notes:
+  //
+  // -The coefficients are copied into local variables because the compiler must otherwise assume
+  //  that writing to the outputs may change the members and would reload them per sample. 
+  // -The loop over both channels has the same trip count, so the compiler can vectorize it as 
+  //  one for the cheap shapes like ClipShape. It needs runtime checks for that because hosts may 
+  //  process in place, so we can't declare the pointers as restrict. GCC does that at -O3 but not
+  //  at -O2. The other shapes are dominated by the calls to the math library which are not 
+  //  vectorized without something like -ffast-math.
+}
 
+float ClapWaveShaper::applyDistortion(float x) const noexcept
+{
   float y = inAmp * x + dc;                          // Intermediate
   switch(shape)
   {
-  case kClip: y = clip(y, -1.f, +1.f); break;
-  case kTanh: y = tanh(y);             break;
-  case kAtan: y = pi2r * atan(pi2*y);  break;
-  case kErf:  y = erf(y);              break;
-  default:    y = 0.f;                 break;        // Error! Unknown shape. Return 0.
+  case kClip: y = ClipShape()(y); break;
+  case kTanh: y = TanhShape()(y); break;
+  case kAtan: y = AtanShape()(y); break;
+  case kErf:  y = ErfShape()(y);  break;
+  default:    y = 0.f;            break;             // Error! Unknown shape. Return 0.
   }
   return outAmp * y;
 }
@@ -243,22 +302,54 @@ const clap_plugin_descriptor_t ClapToneGenerator::descriptor =
   .manual_url   = urlRsMet,
   .support_url  = urlRsMet,
   .version      = version,
-  .description  = "MIDI-controlled sinusoidal tone generator",
+  .description  = "MIDI-controlled tone generator with basic waveforms",
   .features     = ClapToneGenerator::features,
 };
 
+const RobsClapHelpers::ChoiceStrings ClapToneGenerator::waveformNames(
+  { "Sine", "Saw", "Square", "Triangle" }, false);
+
 ClapToneGenerator::ClapToneGenerator(const clap_plugin_descriptor *desc, const clap_host *host) 
   : ClapSynthStereo32Bit(desc, host) 
 {
+  clap_param_info_flags choice = CLAP_PARAM_IS_AUTOMATABLE | CLAP_PARAM_IS_STEPPED 
+                                 | CLAP_PARAM_IS_ENUM;
+  addParameter(kWaveform, "Waveform", 0.0, numWaveforms-1, 0.0, choice);  // Sine, Saw, etc.
+
+  RobsClapHelpers::clapAssert(areParamsConsistent());
+  RobsClapHelpers::clapAssert(waveformNames.getNumStrings() == numWaveforms);
+  RobsClapHelpers::clapAssert(waveformNames.isConsistent());
+
+  using WT = RobsClapHelpers::MipMappedWavetable;
+  for(int i = 0; i < numWaveforms-1; i++)
+    wavetables[i] = &WT::getShared((WT::Waveform) i);
+
+  setMaxNumVoices(maxNumVoices);
+  setNoteTiming(kVoiceOffsets);
+  bank.setCapacity(maxNumVoices);
+  bank.setOscillator(RobsClapHelpers::SineVoiceBank::kRotator);
+  bank.setNumLanes(16);
 
   // ToDo:
   //
-  // -Add parameters
+  // -Add more parameters
+  //
+  // Notes:
+  //
+  // -The rotator with 16 lanes was the fastest combination across compilers and optimization 
+  //  settings in runSineOscillatorBenchmark. With 8 lanes, GCC at -O3 produced poor code for it.
+  // -The wavetables are created by the first instance. We fetch them here rather than when the 
+  //  waveform is switched because that may happen on the audio thread.
+  // -With kVoiceOffsets, the bank starts and releases the voices at their exact frames, so note 
+  //  events don't chop the blocks into short pieces that would make the lane loops inefficient.
 }
 
 bool ClapToneGenerator::activate(
   double newSampleRate, uint32_t minFrameCount, uint32_t maxFrameCount) noexcept
 {
+  bank.setAttackRelease(float(0.005 * newSampleRate), float(0.05 * newSampleRate));
+  setNoteExpressionSmoothing(float(0.005 * newSampleRate));
+  pitchTable.setSampleRate(newSampleRate);
   reset();
   return true;
 
@@ -270,6 +361,7 @@ bool ClapToneGenerator::activate(
 
 void ClapToneGenerator::deactivate() noexcept
 {
+  Base::deactivate();
   reset();
 
   // Notes:
@@ -282,46 +374,105 @@ void ClapToneGenerator::deactivate() noexcept
 
 void ClapToneGenerator::reset() noexcept
 {
-  phasor = 0.0;
-  currentKey = -1;
+  Base::reset();
+  bank.reset();
 }
 
 void ClapToneGenerator::processBlockStereo(
   const float* inL, const float* inR, float* outL, float* outR, uint32_t numFrames)
 {
+  // Apply the note expressions for tuning and volume to the voices whose expressions have moved:
+  advanceNoteExpressions(numFrames);
+  const RobsClapHelpers::NoteExpressions& ne = getNoteExpressions();
+  for(int i = 0; i < getVoiceManager().getNumActiveVoices(); i++)
+  {
+    int v = getVoiceManager().getActiveVoice(i);
+    if(!ne.hasChanged(v))
+      continue;
+    int   key = getVoiceManager().getVoice(v).key;
+    float inc = pitchTable.getIncrement(key, ne.getEnd(v, CLAP_NOTE_EXPRESSION_TUNING));
+    bank.setVoiceParameters(v, inc, ne.getEnd(v, CLAP_NOTE_EXPRESSION_VOLUME));
+  }
+
+  bank.render(outL, (int) numFrames);
   for(uint32_t n = 0; n < numFrames; ++n)
-    outL[n] = outR[n] = getSample();
+    outR[n] = outL[n];
+
+  // Give the voices that have faded out back to the voice manager which also reports their end 
+  // to the host:
+  for(int i = 0; i < bank.getNumFinishedVoices(); i++)
+    voiceFinished(bank.getFinishedVoice(i), (uint32_t) bank.getFinishedFrame(i));
+
+  // ToDo:
+  //
+  // -The bank applies the expressions as steps at the block boundaries. Let it take the ramps 
+  //  from the NoteExpressions directly. That would also need per-voice panning in the bank.
 }
 
 void ClapToneGenerator::parameterChanged(clap_id id, double newValue)
 {
-  // We don't have any parameters yet, but this function is a mandatory override (i.e. purely 
-  // virtual) ...and we want to add parameters later anyway...
+  using Bank = RobsClapHelpers::SineVoiceBank;
+  switch(id)
+  {
+  case kWaveform:
+  {
+    int w = RobsClapHelpers::clip((int) round(newValue), 0, numWaveforms-1);
+    if(w == kSine)
+      bank.setOscillator(Bank::kRotator);
+    else
+    {
+      bank.setWavetable(wavetables[w-1]);
+      bank.setOscillator(Bank::kWavetable);
+    }
+  } break;
+  }
+
+  // Notes:
+  //
+  // -Playing voices switch to the new waveform seamlessly without restarting.
+}
+
+bool ClapToneGenerator::paramsValueToText(
+  clap_id id, double val, char *buf, uint32_t len) noexcept
+{
+  switch(id)
+  {
+  case kWaveform: { return toDisplay(val, buf, len, waveformNames); }
+  }
+  return Base::paramsValueToText(id, val, buf, len);
+}
+
+bool ClapToneGenerator::paramsTextToValue(
+  clap_id id, const char* display, double* value) noexcept
+{
+  switch(id)
+  {
+  case kWaveform: { return toValue(display, value, waveformNames); }
+  }
+  return Base::paramsTextToValue(id, display, value);
 }
 
-void ClapToneGenerator::noteOn(int key, double vel)
+void ClapToneGenerator::voiceStarted(int voice)
 {
-  currentKey = key;
-  double freq = RobsClapHelpers::pitchToFreq((double) currentKey);
-  increment = freq / getSampleRate();
+  int key = getVoiceManager().getVoice(voice).key;
+  bank.startVoice(voice, pitchTable.getKeyIncrement(key), 1.f, (int) getNoteEventFrame());
 
   // ToDo:
   //
   // -Use vel and ampByVel to compute an amplitude scaler.
-  // -Maybe factor out an calcIncrement function that takes into account more variables like a 
-  //  detune parameter and pitch-bend
+  // -Take into account more variables like a detune parameter and pitch-bend. The pitchTable 
+  //  handles fractional offsets from the key via getIncrement(key, offset).
   // -Maybe clip the increment to the range 0..0.5. That should translate to frequencies in
   //  0..sampleRate/2
-  // -What if sampleRate == 0? That should be the case only in deactivated state in which we 
-  //  probably should not receive calls to noteOn anyway, but still...
 }
 
-void ClapToneGenerator::noteOff(int key)
+void ClapToneGenerator::voiceReleased(int voice)
 {
-  if(key == currentKey)
-  {
-    reset();          // Sets currentKey = -1 and phasor = 0.0
-    increment = 0.0;  // Not really relevant (I think) but let's be tidy
-  }
+  bank.releaseVoice(voice, (int) getNoteEventFrame());  // voiceFinished is called when faded out
+}
+
+void ClapToneGenerator::voiceStopped(int voice)
+{
+  bank.removeVoice(voice);
 }
 
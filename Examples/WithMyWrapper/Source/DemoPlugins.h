@@ -57,11 +57,19 @@ public:
   needs to override to take appropriate actions like recalculating internal DSP coefficients. */
   void parameterChanged(clap_id id, double newValue) override;
 
+  /** Overriden to recompute our coefficients only once when several parameters change at once, 
+  for example, when a preset is loaded. */
+  void parametersChanged(const clap_id* ids, uint32_t numIds) override;
+
   /** Converts a parameter value to text for display on the generic GUI that the host provides for
   GUI-less plugins. */
   bool paramsValueToText(clap_id paramId, double value, char *display, 
     uint32_t size) noexcept override;
 
+  /** Converts a text that was typed in by the user (or produced by paramsValueToText) back into a 
+  parameter value. The unit is optional, i.e. "-6 dB" and "-6" both work for the gain. */
+  bool paramsTextToValue(clap_id paramId, const char *display, double *value) noexcept override;
+
   /** Overrides the sub-block processing function to do the actual signal processing. */
   void processBlockStereo(const float* inL, const float* inR, float* outL, float* outR, 
     uint32_t numFrames) override;
@@ -75,6 +83,9 @@ public:
 
 protected:
 
+  /** Computes our internal coefficients from the current parameter values. */
+  void updateCoeffs();
+
 
   // Internal algorithm coefficients:
   float ampL = 1.f, ampR = 1.f;          // Gain factors for left and right channel
@@ -157,19 +168,41 @@ public:
   // origin. This is achieved by scaling input and output appropriately.
 
 
-  float applyDistortion(float x);
-  // ToDo: declare as noexcept, maybe inline
+  /** Applies the distortion to a single sample. This selects the shape per call, so for blocks, 
+  processBlockStereo is more efficient. */
+  float applyDistortion(float x) const noexcept;
 
 protected:
 
+  // The shape functions as functors. They receive the driven input and return the normalized 
+  // output. Being types rather than function pointers, they can be inlined into the kernel. The 
+  // clipper uses the branchless clipFast, so its loop can be vectorized:
+  struct ClipShape 
+  { float operator()(float y) const noexcept { return RobsClapHelpers::clipFast(y, -1.f, 1.f); } };
+  struct TanhShape { float operator()(float y) const noexcept { return std::tanh(y); } };
+  struct AtanShape 
+  { 
+    static constexpr float pi2  = 1.5707963267948966192f;  // pi/2
+    static constexpr float pi2r = 1.f / pi2;               // Reciprocal of pi/2
+    float operator()(float y) const noexcept { return pi2r * std::atan(pi2*y); } 
+  };
+  struct ErfShape  { float operator()(float y) const noexcept { return std::erf(y); } };
+  struct NullShape { float operator()(float y) const noexcept { return 0.f; } };  // For errors
+
+  /** The kernel for processBlockStereo, statically specialized for the shape function F. It 
+  processes both channels in one loop without any branches. */
+  template<class F>
+  void processBlockWith(const float* inL, const float* inR, float* outL, float* outR, 
+    uint32_t numFrames) const noexcept;
+
   // Internal algorithm parameters/coeffs:
   Shape shape  = kClip;
   float inAmp  = 1.f;
   float outAmp = 1.f;
   float dc     = 0.f;
 
-  // Holds the strings for the shape names for GUI display:
-  std::vector<std::string> shapeNames;
+  // Holds the strings for the shape names for GUI display. They are shared among all instances:
+  static const RobsClapHelpers::ChoiceStrings shapeNames;
 
 };
 
@@ -180,7 +213,11 @@ protected:
 A simple tone generator to demonstrate usage of class ClapSynthStereo32Bit. It demonstrates how
 to respond to midi note events and how to deal with a sample-rate dependent and stateful DSP 
 algorithm. To handle all this correctly, we need to override a few more methods like de/activate, 
-reset, noteOn/Off, etc. */
+reset, voiceStarted/Released, etc. It's polyphonic and uses the voice manager of the baseclass.
+The voices are rendered by a SineVoiceBank which keeps the per-voice state in arrays that are 
+allocated once in the constructor and are indexed by the voice indices that the voice manager 
+hands out. The waveforms other than the sine are played from the band-limited wavetables that all 
+instances share. */
 
 class ClapToneGenerator : public RobsClapHelpers::ClapSynthStereo32Bit
 {
@@ -192,6 +229,25 @@ public:
   //-----------------------------------------------------------------------------------------------
   // \name Boilerplate
 
+  enum ParamId
+  {
+    kWaveform,  // Selects the waveform
+
+    numParams
+  };
+
+  /** The indices for the waveforms. New waveforms can only be added at the end (see the comment 
+  at ClapWaveShaper::Shape). */
+  enum Waveform
+  {
+    kSine,      // Rendered by the rotator of the bank
+    kSaw,       // Rendered from the shared wavetables like all that follow
+    kSquare,
+    kTriangle,
+
+    numWaveforms
+  };
+
   ClapToneGenerator(const clap_plugin_descriptor *desc, const clap_host *host);
 
   bool activate(double sampleRate, uint32_t minFrameCount, uint32_t maxFrameCount) 
@@ -206,54 +262,33 @@ public:
 
   void parameterChanged(clap_id id, double newValue) override;
 
-  void noteOn( int key, double velocity) override;
+  bool paramsValueToText(clap_id paramId, double value, char *display, 
+    uint32_t size) noexcept override;
+
+  bool paramsTextToValue(clap_id paramId, const char *display, double *value) noexcept override;
+
+  void voiceStarted(int voice) override;
+
+  void voiceReleased(int voice) override;
 
-  void noteOff(int key) override;
+  void voiceStopped(int voice) override;
 
   static const char* const features[3];
   static const clap_plugin_descriptor_t descriptor;
 
+  static const int maxNumVoices = 256;
 
-  //-----------------------------------------------------------------------------------------------
-  // \name ToneGenerator specific stuff
 
-  inline float getSample()
-  {
-    // Produce silence when no note is being held:
-    if(currentKey == -1)
-      return 0.f;
-
-    // Compute output:
-    static const double pi2 = 6.2831853071795864769;  // 2*pi
-    float out = sin((float) (pi2 * phasor));          // Our phasor is in 0..1, sin wants 0..2pi
-
-    // Update state:
-    phasor += increment;
-    if(phasor > 1.0)
-      phasor -= 1.0;
-
-    // Return output:
-    return out;
-
-    // ToDo:
-    //
-    // -Check, if it is safe to use "if" rather than "while" for the wrap-around. With extremely 
-    //  high frequencies, we may need a "while". But that happens only above (twice?) the Nyquist 
-    //  limit. Can we get such high frequencies? That should probably be made impossible anyway.
-    // -Check, if we need also a wrap around for phasor < 0.0. This may happen only when the 
-    //  increment is negative. Make sure that this doesn't occur.
-    // -If we don't need any of that, document, why not i.e. explain why the situations mentioned 
-    //  above cannot occur. There must be a safety net on a higher level (like clipping frequencies
-    //  to 0..sampleRate/2 in noteOn, for example - I think that corresponds to clipping the 
-    //  increment to 0..0.5).
-    // -Maybe make the thing stereo by giving the user a stereo phase parameter
-  }
+protected:
 
+  RobsClapHelpers::SineVoiceBank       bank;
+  RobsClapHelpers::PitchIncrementTable pitchTable;  // Rebuilt in activate()
 
-protected:
+  // The shared tables for the waveforms kSaw, kSquare, ... in that order:
+  const RobsClapHelpers::MipMappedWavetable* wavetables[numWaveforms-1];
 
-  // Parameters:
-  double increment  = 0.0;   // Per sample increment for our phasor
+  // Holds the strings for the waveform names. They are shared among all instances:
+  static const RobsClapHelpers::ChoiceStrings waveformNames;
 
   // ToDo:
   //float amplitude   = 1.0;
@@ -263,9 +298,7 @@ protected:
   //float ampByKey    = 0.0;
   //float ampByVel    = 0.0;
   //float pitchWheel  = 0.0;
-
-  // State:
-  double phasor     = 0.0;   // Current sine phase in 0..1
-  int    currentKey = -1;    // Currently held note. -1 means "none".
+  //float attack      = 0.0;
+  //float release     = 0.0;
 
 };
\ No newline at end of file
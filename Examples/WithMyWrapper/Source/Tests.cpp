@@ -2,6 +2,7 @@
 #include <iostream>  // cout
 
 #include "ClapPluginTests.h"
+#include "ClapBenchmarks.h"
 
 int main()
 {  
@@ -15,5 +16,9 @@ int main()
     std::cout << "Unit tests passed.";
   else
     std::cout << "!!! UNIT TESTS FAILED !!!";
+  std::cout << "\n\n";
+
+  // Run the benchmarks:
+  runAllClapBenchmarks();
   getchar();
 }
\ No newline at end of file
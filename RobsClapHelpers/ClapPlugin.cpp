@@ -19,12 +19,23 @@ const clap_plugin_state ClapPlugin::_pluginState =
   clapStateLoad
 };
 
+const clap_plugin_state_context ClapPlugin::_pluginStateContext = 
+{
+  clapStateContextSave,
+  clapStateContextLoad
+};
+
 // Line 84
 const clap_plugin_latency ClapPlugin::_pluginLatency = 
 {
   clapLatencyGet
 };
 
+const clap_plugin_voice_info ClapPlugin::_pluginVoiceInfo = 
+{
+  clapVoiceInfoGet
+};
+
 // Line 64:
 const clap_plugin_params ClapPlugin::_pluginParams = 
 {
@@ -121,10 +132,13 @@ const void* ClapPlugin::clapExtension(const clap_plugin *plugin, const char *id)
 
   self.ensureInitialized("extension");
   if(!strcmp(id, CLAP_EXT_STATE)       && self.implementsState())      return &_pluginState;
+  if(!strcmp(id, CLAP_EXT_STATE_CONTEXT) && self.implementsState() 
+    && self.implementsStateContext())                                     return &_pluginStateContext;
   if(!strcmp(id, CLAP_EXT_LATENCY)     && self.implementsLatency())    return &_pluginLatency;
   if(!strcmp(id, CLAP_EXT_AUDIO_PORTS) && self.implementsAudioPorts()) return &_pluginAudioPorts;
   if(!strcmp(id, CLAP_EXT_PARAMS)      && self.implementsParams())     return &_pluginParams;
   if(!strcmp(id, CLAP_EXT_NOTE_PORTS)  && self.implementsNotePorts())  return &_pluginNotePorts;
+  if(!strcmp(id, CLAP_EXT_VOICE_INFO)  && self.implementsVoiceInfo())  return &_pluginVoiceInfo;
 
   return self.extension(id);
 }
@@ -294,6 +308,20 @@ bool ClapPlugin::clapStateLoad(const clap_plugin *plugin, const clap_istream *st
   self.ensureMainThread("clap_plugin_state.load");
   return self.stateLoad(stream);
 }
+bool ClapPlugin::clapStateContextSave(const clap_plugin *plugin, const clap_ostream *stream, 
+  uint32_t contextType) noexcept 
+{
+  auto &self = from(plugin);
+  self.ensureMainThread("clap_plugin_state_context.save");
+  return self.stateSaveWithContext(stream, contextType);
+}
+bool ClapPlugin::clapStateContextLoad(const clap_plugin *plugin, const clap_istream *stream, 
+  uint32_t contextType) noexcept 
+{
+  auto &self = from(plugin);
+  self.ensureMainThread("clap_plugin_state_context.load");
+  return self.stateLoadWithContext(stream, contextType);
+}
 
 // Line 507, report latency to host:
 uint32_t ClapPlugin::clapLatencyGet(const clap_plugin *plugin) noexcept 
@@ -312,6 +340,20 @@ uint32_t ClapPlugin::clapLatencyGet(const clap_plugin *plugin) noexcept
   //  -> Figure this out. Maybe file a bug report.
 }
 
+bool ClapPlugin::clapVoiceInfoGet(const clap_plugin *plugin, clap_voice_info *info) noexcept 
+{
+  auto &self = from(plugin);
+  self.ensureMainThread("clap_plugin_voice_info.get");
+  clapAssert(info != nullptr);
+  return self.voiceInfoGet(info);
+
+  // Notes:
+  //
+  // -The spec says [main-thread && active] but we don't assert that we are active because the 
+  //  voice info of our synths doesn't depend on the sample rate or anything else that is set up in
+  //  activate.
+}
+
 // Line 776:
 uint32_t ClapPlugin::clapParamsCount(const clap_plugin *plugin) noexcept 
 {
@@ -346,7 +388,7 @@ bool ClapPlugin::clapParamsValueToText(const clap_plugin* plugin, clap_id param_
 {
   auto &self = from(plugin);
   self.ensureMainThread("clap_plugin_params.value_to_text");
-  return self.paramsValueToText(param_id, value, display, size);
+  return self.paramsValueToTextForHost(param_id, value, display, size);
 
   // Notes:
   // -The original code had a lot more error checks
@@ -159,6 +159,16 @@ public:
     return false;
   }
 
+  /** This is what actually gets called when the host calls clap_plugin_params.value_to_text. By 
+  default, it just calls paramsValueToText. Intermediate baseclasses may override it to add a layer
+  on top of the actual formatting (like caching, see ClapPluginWithParams) that keeps working when
+  the final plugin class overrides paramsValueToText. */
+  virtual bool paramsValueToTextForHost(
+    clap_id paramId, double value, char *display, uint32_t size) noexcept 
+  {
+    return paramsValueToText(paramId, value, display, size);
+  }
+
 
   /** Maps to clap_plugin_params.flush. [active ? audio-thread : main-thread]
 
@@ -193,6 +203,24 @@ public:
   // { return false; }
 
 
+  /** Override this to return true, if you want to save and load states differently depending on
+  the context, i.e. whether the state is a preset, part of a project or used to duplicate the 
+  plugin. The state-context extension will only be reported to the host, if implementsState() 
+  returns true as well. */
+  virtual bool implementsStateContext() const noexcept { return false; }
+
+  /** Saves the state for the given context which is one of the values in the 
+  clap_plugin_state_context_type enum. The default implementation ignores the context and calls 
+  stateSave(). Note that the state must be loadable in any context, including by stateLoad(). */
+  virtual bool stateSaveWithContext(const clap_ostream *stream, uint32_t contextType) noexcept
+  { return stateSave(stream); }
+
+  /** Loads the state for the given context. The state may have been saved in a different context
+  or by stateSave(). The default implementation ignores the context and calls stateLoad(). */
+  virtual bool stateLoadWithContext(const clap_istream *stream, uint32_t contextType) noexcept
+  { return stateLoad(stream); }
+
+
 
 
 
@@ -207,6 +235,19 @@ public:
 
 
 
+  //-----------------------------------------------------------------------------------------------
+  // \name Voice Info
+
+  /** Override this to return true, if you want to report the number of voices to the host via the
+  voice-info extension. Hosts use that to set up their per-voice modulation. */
+  virtual bool implementsVoiceInfo() const noexcept { return false; }
+
+  /** Fills out the number of usable voices, the number of allocated voices and the flags (see 
+  clap_voice_info). C-API: clap_plugin_voice_info.get [main-thread && active] */
+  virtual bool voiceInfoGet(clap_voice_info *info) const noexcept { return false; }
+
+
+
   //-----------------------------------------------------------------------------------------------
   // \name GUI
 
@@ -340,9 +381,11 @@ private:
   // Interfaces/extensions
   static const clap_plugin_audio_ports _pluginAudioPorts;
   static const clap_plugin_state       _pluginState;
+  static const clap_plugin_state_context _pluginStateContext;
   static const clap_plugin_params      _pluginParams;
   static const clap_plugin_note_ports  _pluginNotePorts;
   static const clap_plugin_latency     _pluginLatency;
+  static const clap_plugin_voice_info  _pluginVoiceInfo;
 
 
   // Static member fuctions to be assigned to the function pointers in the C-struct, i.e. the glue 
@@ -365,9 +408,15 @@ private:
   // Callbacks for extensions:
   static bool clapStateSave(const clap_plugin *plugin, const clap_ostream *stream) noexcept;
   static bool clapStateLoad(const clap_plugin *plugin, const clap_istream *stream) noexcept;
+  static bool clapStateContextSave(const clap_plugin *plugin, const clap_ostream *stream, 
+                                   uint32_t contextType) noexcept;
+  static bool clapStateContextLoad(const clap_plugin *plugin, const clap_istream *stream, 
+                                   uint32_t contextType) noexcept;
 
   static uint32_t clapLatencyGet(const clap_plugin *plugin) noexcept;
 
+  static bool clapVoiceInfoGet(const clap_plugin *plugin, clap_voice_info *info) noexcept;
+
   static uint32_t clapAudioPortsCount(const clap_plugin *plugin, bool is_input) noexcept;
   static bool clapAudioPortsInfo(const clap_plugin *plugin, uint32_t index, bool is_input,
     clap_audio_port_info *info) noexcept;
@@ -2,6 +2,8 @@
 //=================================================================================================
 // class ClapPluginWithParams
 
+const char ClapPluginWithParams::binaryStateMagic[4] = { 'R', 'C', 'S', 'B' };
+
 bool ClapPluginWithParams::paramsInfo(uint32_t index, clap_param_info* info) const noexcept
 {
   if(index >= (uint32_t) infos.size())
@@ -19,11 +21,15 @@ bool ClapPluginWithParams::paramsInfo(uint32_t index, clap_param_info* info) con
   else
   {
     *info = infos[index];
+    info->cookie = getParameterCookie(info->id);
     return true;
   }
 
   // Notes:
   //
+  // -The cookie is assigned here rather than in addParameter because during the sequence of 
+  //  addParameter calls, the values array may get reallocated which would invalidate pointers into
+  //  it. By the time the host asks for the infos, the array has its final size.
   // -If we end up in the first branch where we return false, the plugin will crash due to an 
   //  assert in the outlying wrapper code that asserts that we return true here.
   // -Bitwig seems to call this function twice for each parameter when the plugin is plugged in 
@@ -35,7 +41,7 @@ bool ClapPluginWithParams::paramsValue(clap_id id, double* value) const noexcept
 {
   if(id < values.size())
   {
-    *value = values[id];
+    *value = isStateStaged() ? stagedValues[id] : values[id];
     return true; 
   }
   else
@@ -50,6 +56,10 @@ bool ClapPluginWithParams::paramsValueToText(
 {
   return toDisplay(value, display, size, 2);
 
+  // Notes:
+  //
+  // -The formatting is done directly into the host's buffer without any heap allocations. 
+  //
   // ToDo: 
   //
   // -Maybe let the ClapPluginParameter struct have a function pointer member that does the 
@@ -61,18 +71,85 @@ bool ClapPluginWithParams::paramsValueToText(
 bool ClapPluginWithParams::paramsTextToValue(
   clap_id paramId, const char *display, double *value) noexcept
 {
-  *value = strtod(display, nullptr);
-  return true;
+  return toValue(display, value);
 
-  // ToDo:
+  // Notes:
+  //
+  // -The default implementation doesn't know about units, so it accepts only a plain number, 
+  //  optionally followed by an SI prefix. Subclasses that use a suffix in paramsValueToText should
+  //  override this and call toValue with the same suffix. In case of a parse error, we return 
+  //  false. We used to use strtod which silently returned 0 for unparsable strings.
+}
+
+bool ClapPluginWithParams::paramsValueToTextForHost(
+  clap_id paramId, double value, char* display, uint32_t size) noexcept
+{
+  uint32_t numSlots = (uint32_t) displayCacheSlots;
+  if(numSlots == 0 || paramId >= (uint32_t) displayCacheNext.size())
+    return paramsValueToText(paramId, value, display, size);
+
+  // Look for the value in the slots of the parameter. We may serve the request from the cache only
+  // if the whole cached string fits into the host's buffer because paramsValueToText may handle 
+  // too short buffers in other ways than by truncation:
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(double));
+  DisplayCacheEntry* slots = &displayCache[paramId * numSlots];
+  for(uint32_t k = 0; k < numSlots; k++)
+  {
+    DisplayCacheEntry& e = slots[k];
+    if(e.valid && e.valueBits == bits && strlen(e.text) < size)
+    {
+      copyString(e.text, display, (int) size);
+      displayCacheHits++;
+      return e.result;
+    }
+  }
+
+  // Cache miss. Produce the string and store it in the next slot in round-robin order, if it 
+  // fits. A string that fills the host's buffer completely may have been truncated, so we don't 
+  // store it:
+  displayCacheMisses++;
+  bool result = paramsValueToText(paramId, value, display, size);
+  size_t length = size > 0 ? strlen(display) : 0;
+  if(size > 0 && length+1 < size && length+1 < displayCacheTextSize)
+  {
+    uint32_t& next = displayCacheNext[paramId];
+    DisplayCacheEntry& e = slots[next];
+    e.valueBits = bits;
+    e.result    = result;
+    e.valid     = true;
+    copyString(display, e.text, displayCacheTextSize);
+    next = (next + 1) % numSlots;
+  }
+  return result;
+
+  // Notes:
   //
-  // -Figure out what happens in case of a parse-error. It would be nice to have a parser that 
-  //  returns a bool (true in case of success, false in case of failure).
+  // -The key is the bit pattern rather than the double itself such that -0 and +0 are different 
+  //  keys (they may be displayed differently) and NaNs can be found, too.
+  // -The round-robin replacement evicts the oldest entry. That is a good fit for the typical 
+  //  pattern of hosts which redraw the same handful of values over and over again.
+}
+
+void ClapPluginWithParams::setDisplayCacheSize(int numSlots)
+{
+  displayCacheSlots = std::max(numSlots, 0);
+  size_t numIds = values.size();
+  displayCache.assign(numIds * displayCacheSlots, DisplayCacheEntry());
+  displayCacheNext.assign(displayCacheSlots > 0 ? numIds : 0, 0);
+}
+
+void ClapPluginWithParams::invalidateDisplayCache()
+{
+  for(DisplayCacheEntry& e : displayCache)
+    e.valid = false;
+  std::fill(displayCacheNext.begin(), displayCacheNext.end(), 0);
 }
 
 void ClapPluginWithParams::paramsFlush(
   const clap_input_events* in, const clap_output_events* out) noexcept
 {
+  applyStagedState();                    // Must come first, the events are newer than the state
   const uint32_t numEvents = in->size(in);
   for(uint32_t i = 0; i < numEvents; ++i)
   {
@@ -90,45 +167,92 @@ void ClapPluginWithParams::paramsFlush(
 
 bool ClapPluginWithParams::stateSave(const clap_ostream *stream) noexcept
 { 
-  std::string stateString = getStateAsString();
-  size_t size    = stateString.size();
-  size_t written = 0;
-  while(written < size)
-    written += stream->write(stream, &stateString[written], size-written);
-  return true;
-
-  // ToDo:
-  //
-  // -Maybe factor out the string-to-stream writing into a function 
-  //  writeStringToStream(const clap_ostream *stream, const string& str). Likewise
-  //  for readStreamToString(const clap_istream* stream) which should return a string
+  return stateSaveWithContext(stream, CLAP_STATE_CONTEXT_FOR_PROJECT);
 }
 
 bool ClapPluginWithParams::stateLoad(const clap_istream* stream) noexcept 
 { 
-  size_t bufSize = 8192;   // May be tweaked - not yet sure what's best here
-  //size_t bufSize  = 19;  // May be used for test/debug to actually make it a limiting factor.
-  std::string total;       // Total string
-  std::string buf;         // Partial string - rename to part..or chunk
+  return stateLoadWithContext(stream, CLAP_STATE_CONTEXT_FOR_PROJECT);
+}
 
-  bool endReached = false;
-  while(!endReached)
+bool ClapPluginWithParams::stateSaveWithContext(const clap_ostream *stream, 
+  uint32_t contextType) noexcept
+{ 
+  // For duplication, temporarily switch to the fastest format:
+  StateFormat oldFormat     = stateFormat;
+  bool        oldCompressed = compressedState;
+  if(contextType == CLAP_STATE_CONTEXT_FOR_DUPLICATE)
   {
-    buf.resize(bufSize);
-    size_t numBytes = stream->read(stream, &buf[0], bufSize);
-    buf.resize(numBytes);
-    total += buf;
-    endReached = numBytes == 0;
+    stateFormat     = kBinaryState;
+    compressedState = false;
   }
 
-  return setStateFromString(total);
+  stateContext = contextType;
+  bool ok = writeStateToStream(stream);
+  stateContext    = CLAP_STATE_CONTEXT_FOR_PROJECT;
+  stateFormat     = oldFormat;
+  compressedState = oldCompressed;
+  return ok;
+}
 
-  // ToDo:
+bool ClapPluginWithParams::stateLoadWithContext(const clap_istream *stream, 
+  uint32_t contextType) noexcept
+{ 
+  stateContext = contextType;
+  bool ok = readStateFromStream(stream);
+  stateContext = CLAP_STATE_CONTEXT_FOR_PROJECT;
+  return ok;
+}
+
+bool ClapPluginWithParams::writeStateToStream(const clap_ostream *stream) const
+{ 
+  if(compressedState)
+  {
+    CompressedOutStream compressor(stream);
+    ClapStreamWriter writer(compressor.getWrappee());
+    bool ok = writeState(writer);
+    ok &= writer.flush();
+    ok &= compressor.finish();
+    return ok;
+  }
+
+  ClapStreamWriter writer(stream);
+  bool ok = writeState(writer);
+  ok &= writer.flush();
+  return ok;
+
+  // Notes:
   //
-  // -Maybe the bufSize should depend on the number of parameters. Ideally, it should be large 
-  //  enough to hold the whole state string but not much larger. We can roughly predict this based
-  //  on the number of parameters. If it's shorter, we'll need more calls to stream->read which is 
-  //  not the end of the world, but still...
+  // -The state is written piecewise through the writer which collects the data in a fixed-size
+  //  buffer and passes it on to the stream whenever the buffer is full. We used to build the whole
+  //  state as a string first and write that string into the stream. For big states, that doubled
+  //  the peak memory usage.
+  // -With compression, the writer passes its data on to the compressor which holds one block of
+  //  data at a time. So the state is still never materialized as a whole.
+}
+
+bool ClapPluginWithParams::readStateFromStream(const clap_istream* stream)
+{ 
+  ClapStreamReader reader(stream);
+  beginStaging();
+  char magic[4];
+  if(reader.peek(magic, 4) && CompressedOutStream::isCompressed(magic, 4))
+  {
+    CompressedInStream decompressor(&reader);
+    ClapStreamReader innerReader(decompressor.getWrappee());
+    bool ok = readState(innerReader);
+    ok &= decompressor.finish();         // Detects truncated or corrupted data
+    return endStaging(ok);
+  }
+  return endStaging(readState(reader));
+
+  // Notes:
+  //
+  // -We used to read the whole stream in chunks of 8 KB and append them to a string that was 
+  //  parsed after the end was reached. Now, we parse directly from the stream through a reader 
+  //  with a fixed-size buffer. 
+  // -The parameters are not set directly. They are parsed into the staging buffer which is handed
+  //  over to the audio thread when we are active. See beginStaging().
 }
 
 void ClapPluginWithParams::addParameter(clap_id id, const std::string& name, double minValue, 
@@ -141,7 +265,7 @@ void ClapPluginWithParams::addParameter(clap_id id, const std::string& name, dou
   info.default_value = defaultValue;
   info.flags         = flags;
   info.id            = id;
-  info.cookie        = nullptr;                   // We currently don't use the cookie facility.
+  info.cookie        = nullptr;                   // Assigned later in paramsInfo()
   strcpy_s(info.name,   CLAP_NAME_SIZE, name.c_str());
   strcpy_s(info.module, CLAP_PATH_SIZE, "");
   infos.push_back(info);
@@ -151,6 +275,31 @@ void ClapPluginWithParams::addParameter(clap_id id, const std::string& name, dou
   size_t newSize = std::max((size_t) id+1, values.size());
   values.resize(newSize);
   values[id] = defaultValue;
+
+  // Make room for the bookkeeping of bulk updates such that it never needs to allocate later:
+  bulkChanged.resize(newSize, 0);
+  bulkChangedIds.reserve(newSize);
+
+  // Parameters use the identity mapping unless they declare a different one:
+  mappings.resize(newSize);
+}
+
+void ClapPluginWithParams::addParameter(clap_id id, const std::string& name, double minValue, 
+  double maxValue, double defaultValue, clap_param_info_flags flags, 
+  const ParameterMapping& mapping)
+{
+  addParameter(id, name, minValue, maxValue, defaultValue, flags);
+  mappings[id] = mapping;
+  mappings[id].setInputRange(minValue, maxValue);
+}
+
+const ParameterMapping& ClapPluginWithParams::getParameterMapping(clap_id id) const
+{
+  static const ParameterMapping identity;
+  if((size_t) id < mappings.size())
+    return mappings[id];
+  else
+    return identity;
 }
 
 void ClapPluginWithParams::setParameter(clap_id id, double newValue)
@@ -158,7 +307,7 @@ void ClapPluginWithParams::setParameter(clap_id id, double newValue)
   if((size_t) id < values.size())
   {
     values[id] = newValue;
-    parameterChanged(id, newValue);
+    notifyParameterChanged(id, newValue);
   }
   else
   {
@@ -186,10 +335,172 @@ double ClapPluginWithParams::getParameter(clap_id id) const
   }
 }
 
+void ClapPluginWithParams::setParameterViaCookie(void* cookie, double newValue)
+{
+  double* slot = (double*) cookie;
+  clapAssert(slot >= &values[0] && slot < &values[0] + values.size()); // Not one of our cookies
+  *slot = newValue;
+  notifyParameterChanged((clap_id) (slot - &values[0]), newValue);
+}
+
+void* ClapPluginWithParams::getParameterCookie(clap_id id) const
+{
+  if((size_t) id < values.size())
+    return (void*) &values[id];
+  else
+    return nullptr;
+}
+
 void ClapPluginWithParams::setAllParametersToDefault()
 {
+  beginBulkUpdate();
   for(size_t i = 0; i < infos.size(); ++i)
     setParameter(infos[i].id, infos[i].default_value);
+  endBulkUpdate();
+}
+
+void ClapPluginWithParams::beginBulkUpdate()
+{
+  bulkDepth++;
+}
+
+void ClapPluginWithParams::endBulkUpdate()
+{
+  clapAssert(bulkDepth > 0);             // Unbalanced call
+  if(bulkDepth == 0 || --bulkDepth > 0)
+    return;
+  if(bulkChangedIds.empty())
+    return;
+  parametersChanged(bulkChangedIds.data(), (uint32_t) bulkChangedIds.size());
+  for(clap_id id : bulkChangedIds)
+    bulkChanged[id] = 0;
+  bulkChangedIds.clear();                // Keeps the capacity, so push_back won't allocate
+
+  // Notes:
+  //
+  // -Bulk updates may be nested. Only the outermost endBulkUpdate() sends the notification.
+}
+
+void ClapPluginWithParams::parametersChanged(const clap_id* ids, uint32_t numIds)
+{
+  for(uint32_t i = 0; i < numIds; ++i)
+    parameterChanged(ids[i], values[ids[i]]);
+}
+
+void ClapPluginWithParams::notifyParameterChanged(clap_id id, double newValue)
+{
+  if(bulkDepth == 0)
+    parameterChanged(id, newValue);
+  else if(!bulkChanged[id])
+  {
+    bulkChanged[id] = 1;
+    bulkChangedIds.push_back(id);
+  }
+}
+
+void ClapPluginWithParams::stageDefaultValues(uint32_t version)
+{
+  for(size_t i = 0; i < infos.size(); ++i)
+    parsedValues[infos[i].id] = getDefaultValue(infos[i], version);
+}
+
+void ClapPluginWithParams::stageParameter(clap_id id, double value)
+{
+  if((size_t) id < parsedValues.size())
+    parsedValues[id] = value;                      // Ignores ids that we don't know
+}
+
+void ClapPluginWithParams::beginStaging()
+{
+  parsedValues.resize(values.size());
+}
+
+bool ClapPluginWithParams::endStaging(bool success)
+{
+  if(!success)
+    return false;                                  // Parameters and pending states untouched
+
+  // Take ownership of the staging buffer. If a staged set is still pending, we take it back and
+  // overwrite it. If the audio thread is just applying one, we wait until it's done:
+  while(true)
+  {
+    int state = stagingState.load(std::memory_order_acquire);
+    if(state == kStagingApplying)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    if(stagingState.compare_exchange_weak(state, kStagingWriting, std::memory_order_acq_rel))
+      break;
+  }
+  stagedValues = parsedValues;                     // Sizes match, so this doesn't allocate
+
+  // Hand it over to the audio thread or apply it directly, if there's no audio thread running:
+  if(isActive())
+    stagingState.store(kStagingPending, std::memory_order_release);
+  else
+  {
+    applyStagedValues();
+    stagingState.store(kStagingIdle, std::memory_order_release);
+  }
+  return true;
+
+  // Notes:
+  //
+  // -The wait can only happen when the audio thread is in the middle of applyStagedState() which
+  //  takes a bounded (short) amount of time. The audio thread itself never waits.
+  // -We parse into a separate buffer first (rather than directly into the staging buffer) such 
+  //  that a failed load doesn't destroy a pending state that was loaded successfully before.
+}
+
+void ClapPluginWithParams::deactivate() noexcept
+{
+  applyStagedState();
+
+  // Notes:
+  //
+  // -Without this, a state that the host loads right before deactivating would stay pending and 
+  //  getParameter() would report the old values until the next process() call after the next 
+  //  activation. The host doesn't call process() during deactivate(), so we can apply it here on 
+  //  the main thread.
+}
+
+void ClapPluginWithParams::applyStagedState()
+{
+  int expected = kStagingPending;
+  if(!stagingState.compare_exchange_strong(expected, kStagingApplying, std::memory_order_acq_rel))
+    return;                                        // Nothing pending
+  applyStagedValues();
+  stagingState.store(kStagingIdle, std::memory_order_release);
+}
+
+void ClapPluginWithParams::applyStagedValues()
+{
+  beginBulkUpdate();
+  for(size_t id = 0; id < values.size(); ++id)
+  {
+    if(memcmp(&values[id], &stagedValues[id], sizeof(double)) != 0)
+      setParameter((clap_id) id, stagedValues[id]);
+  }
+  endBulkUpdate();
+
+  // Notes:
+  //
+  // -We only report the values that have actually changed and we do it with a single call to 
+  //  parametersChanged. That keeps the work on the audio thread small when switching presets.
+}
+
+bool ClapPluginWithParams::isStateStaged() const
+{
+  int state = stagingState.load(std::memory_order_acquire);
+  return state == kStagingPending || state == kStagingApplying;
+}
+
+bool ClapPluginWithParams::shouldStoreParameter(const clap_param_info& info, double value) const
+{
+  if(!sparseState)
+    return true;
+  return memcmp(&value, &info.default_value, sizeof(double)) != 0;  // Exact, distinguishes -0
 }
 
 bool ClapPluginWithParams::areParamsConsistent()
@@ -198,125 +509,323 @@ bool ClapPluginWithParams::areParamsConsistent()
     return false;
 
   // Check, if each id in 0...numParams-1 occurs exactly once in our infos array:
+  std::vector<clap_id> ids(infos.size());
   for(size_t i = 0; i < infos.size(); i++)
-  {
-    clap_id id = (clap_id) i;
-    size_t cnt = std::count_if(infos.begin(), infos.end(),
-                               [&](const clap_param_info& info){ return info.id == id; });
-    if(cnt != 1)
-      return false;
-  }
+    ids[i] = infos[i].id;
+  return isPermutation(ids.data(), (int) ids.size());
 
-  return true;
-
-  // ToDo:
+  // Notes:
   //
-  // -Check, if this is the right capture mode for the lambda
+  // -This used to count the occurrences of each id in the infos array which made the check 
+  //  O(N^2). For plugins with thousands of parameters, that made the instantiation of debug builds
+  //  painfully slow. isPermutation is O(N).
+}
+
+bool ClapPluginWithParams::writeState(ClapStreamWriter& writer) const
+{
+  if(stateFormat == kBinaryState)
+    return writeStateBinary(writer);
+  else
+    return writeStateText(writer);
+}
+
+bool ClapPluginWithParams::readState(ClapStreamReader& reader)
+{
+  char magic[4];
+  if(reader.peek(magic, 4) && memcmp(magic, binaryStateMagic, 4) == 0)
+    return readStateBinary(reader);
+  else
+    return readStateText(reader);
 }
 
 std::string ClapPluginWithParams::getStateAsString() const
 {
   std::string s;
+  StringOutStream stream(&s);
+  ClapStreamWriter writer(stream.getWrappee());
+  writeStateText(writer);
+  writer.flush();
+  return s;
+}
 
-  // Store some general info:
-  s += "CLAP Plugin State\n\n";
-  s += "Identifier: " + std::string(getPluginIdentifier()) + '\n';
-  s += "Version: "    + std::string(getPluginVersion())    + '\n';
-  s += "Vendor: "     + std::string(getPluginVendor())     + '\n';
+bool ClapPluginWithParams::setStateFromString(const std::string& stateStr)
+{
+  StringInStream stream(stateStr);
+  ClapStreamReader reader(stream.getWrappee());
+  beginStaging();
+  return endStaging(readStateText(reader));
+}
+
+std::string ClapPluginWithParams::getStateAsBinary() const
+{
+  std::string s;
+  s.reserve(binaryStateHeaderSize + paramsCount() * binaryStateRecordSize);
+  StringOutStream stream(&s);
+  ClapStreamWriter writer(stream.getWrappee());
+  writeStateBinary(writer);
+  writer.flush();
+  return s;
+}
 
-  // Store the parameters:
+bool ClapPluginWithParams::setStateFromBinary(const std::string& blob)
+{
+  // Here, we know the size of the whole blob upfront (unlike when reading from a stream), so we 
+  // can reject truncated or otherwise malformed blobs before touching any parameter:
+  if(blob.size() < binaryStateHeaderSizeV1)
+    return false;
+  uint32_t version    = decodeUint32(&blob[4]);
+  size_t   headerSize = version >= 2 ? binaryStateHeaderSize : binaryStateHeaderSizeV1;
+  if(blob.size() < headerSize)
+    return false;
+  uint32_t numParams = decodeUint32(&blob[headerSize-4]);   // Last field of the header
+  if(blob.size() != headerSize + (size_t) numParams * binaryStateRecordSize)
+    return false;
+
+  StringInStream stream(blob);
+  ClapStreamReader reader(stream.getWrappee());
+  beginStaging();
+  return endStaging(readStateBinary(reader));
+}
+
+bool ClapPluginWithParams::writeStateText(ClapStreamWriter& w) const
+{
+  // Store some general info:
+  w.write("CLAP Plugin State\n\n");
+  w.write("Identifier: "); w.write(getPluginIdentifier()); w.writeChar('\n');
+  w.write("Version: ");    w.write(getPluginVersion());    w.writeChar('\n');
+  w.write("Vendor: ");     w.write(getPluginVendor());     w.writeChar('\n');
+  char numStr[16];
+  snprintf(numStr, sizeof(numStr), "%u", (unsigned) defaultsVersion);
+  w.write("Defaults: ");   w.write(numStr);                w.writeChar('\n');
+
+  // Store the parameters. In sparse states, we skip those that are at their default values:
   uint32_t numParams = paramsCount();
   if(numParams > 0)
   {
     clap_param_info info;
     double value = 0.0;
-    s += "Parameters: [";
+    char   idStr[16], valStr[32];
+    bool   first = true;
+    w.write("Parameters: [");
     for(uint32_t i = 0; i < numParams; ++i)
     {
       bool infoOK  = paramsInfo(i, &info);
       clapAssert(infoOK);
       bool valueOK = paramsValue(info.id, &value);
       clapAssert(valueOK);
-      s += std::to_string(info.id) + ':';
-      s += std::string(info.name)  + ':';   // Maybe store the name optionally
-      s += toStringExact(value)    + ',';   // Roundtrip-safe double-to-string conversion
+      if(!shouldStoreParameter(info, value))
+        continue;
+      if(!first)
+        w.writeChar(',');
+      first = false;
+      snprintf(idStr, sizeof(idStr), "%u", (unsigned) info.id);
+      w.write(idStr);             w.writeChar(':');
+      w.write(info.name);         w.writeChar(':');  // Maybe store the name optionally
+      toStringExact(value, valStr, 32);              // Roundtrip-safe double-to-string conversion
+      w.write(valStr);
     }
-    s[s.size()-1] = ']';                    // Replace last comma with closing bracket
+    w.writeChar(']');
   }
    
-  return s;
+  return !w.hasError();
 
   // Notes:
   //
   // -We use a custom double-to-string conversion function to ensure roundtrip safety, i.e. exact
   //  restoring of the number when the string is parsed in state recall. Using std::to_string with
-  //  floats or doubles just isn't good enough for that.
+  //  floats or doubles just isn't good enough for that. It produces the shortest exact 
+  //  representation, so states written by older versions (which always used 17 digits) look a bit
+  //  different but they parse to the same values.
   //
   // ToDo:
   //
   // -Maybe store some optional information like the host with which it was saved
   // -Maybe store the parameter names optionally. Maybe have a "verbose" flag to control this. But
-  //  this will also complicate the implementation of setStateFromString - so maybe don't.
-  // -Maybe give the function a bool parameter "includeDefaultValues" or "skipDefaultValues" that 
-  //  decides whether or not the state string should also store parameter values when they are at 
-  //  their default value. But this has the problem of potential false state recall when default
-  //  values are changed later - so maybe don't.
+  //  this will also complicate the implementation of readStateText - so maybe don't.
+  // -The "Defaults" line stores the version of the table of default values. It's needed for the
+  //  correct recall of sparse states when default values have been changed in the meantime. See 
+  //  setSparseState() and setDefaultsVersion().
 }
 
-bool ClapPluginWithParams::setStateFromString(const std::string& stateStr)
+bool ClapPluginWithParams::readStateText(ClapStreamReader& r)
 {
-  setAllParametersToDefault();
-
-  if(stateStr.empty())
+  if(r.isAtEnd())
     return false;
 
-  // Extract the substring that contains the parameters, i.e. anything in between '[' and ']',
-  // excluding the opening bracket and including the closing bracket. The closing bracket ']' is 
-  // included and then replaced by a comma ',' to avoid the need for a special case for last 
-  // parameter in the subsequent loop:
-  size_t start, end;
-  start = stateStr.find("Parameters: [", 0) + 13;
-  end   = stateStr.find(']', start);
-  std::string paramsStr = stateStr.substr(start, end-start+1);
-  paramsStr[paramsStr.size()-1] = ',';         // Replace closing bracket with comma to avoid 
-                                               // special case for last parameter
-
-  uint32_t numParamsFound = 0;
-  size_t i = 0;                                // Index into paramsStr
-  while(i < paramsStr.size())
+  // Read the header line by line up to and including the "Parameters: [" tag. We only keep the 
+  // beginning of each line in a small buffer which is enough to recognize the tags. If there is no
+  // parameters tag, the state was saved by a plugin without parameters:
+  static const char paramsTag[]    = "Parameters: [";
+  static const char defaultsTag[]  = "Defaults: ";
+  static const int  paramsTagLength   = sizeof(paramsTag)   - 1;
+  static const int  defaultsTagLength = sizeof(defaultsTag) - 1;
+  uint32_t stateDefaultsVersion = 0;               // Old states have no "Defaults" line
+  char line[32];
+  int  n = 0;
+  char c;
+  while(true)
   {
-    size_t j = paramsStr.find(':', i+1);
-    size_t k = paramsStr.find(':', j+1);
-    size_t m = paramsStr.find(',', k+1);
+    if(!r.readChar(&c))
+    {
+      stageDefaultValues(stateDefaultsVersion);
+      return !r.hasError();
+    }
+    if(c == '\n')
+    {
+      if(n > defaultsTagLength && memcmp(line, defaultsTag, defaultsTagLength) == 0)
+        std::from_chars(line + defaultsTagLength, line + n, stateDefaultsVersion);
+      n = 0;
+      continue;
+    }
+    if(n < (int) sizeof(line))
+      line[n++] = c;
+    if(n == paramsTagLength && memcmp(line, paramsTag, paramsTagLength) == 0)
+      break;
+  }
 
-    std::string idStr  = paramsStr.substr(i,   j-i  );
-    std::string valStr = paramsStr.substr(k+1, m-k-1);
+  // Parameters that are not in the state (because it's sparse or was saved by an older version 
+  // with fewer parameters) get the defaults that were valid when the state was saved:
+  stageDefaultValues(stateDefaultsVersion);
+  if(r.peek(&c, 1) && c == ']')                    // Empty list, e.g. sparse with all defaults
+    return r.readChar(&c);
+
+  // Parse the id:name:value entries which are separated by commas. The list is terminated by a 
+  // closing bracket. The names are skipped. We collect the id and value strings in small 
+  // fixed-size buffers:
+  char idStr[16], valStr[64];
+  while(true)
+  {
+    int n = 0;
+    while(r.readChar(&c) && c != ':')
+    {
+      if(n == sizeof(idStr)-1) return false;       // Too long for an id - malformed state
+      idStr[n++] = c;
+    }
+    idStr[n] = '\0';
+    if(c != ':')
+      return false;                                // Stream ended prematurely
+    while(r.readChar(&c) && c != ':')              // Skip the name
+      ;
+    if(c != ':')
+      return false;
+    n = 0;
+    while(r.readChar(&c) && c != ',' && c != ']')
+    {
+      if(n == sizeof(valStr)-1) return false;      // Too long for a value - malformed state
+      valStr[n++] = c;
+    }
+    valStr[n] = '\0';
+    if(c != ',' && c != ']')
+      return false;
 
-    clap_id id  = std::atoi(idStr.c_str());
-    double  val = std::atof(valStr.c_str());   // Maybe use strtod as in the function above?
-    setParameter(id, val);
+    clap_id id  = std::atoi(idStr);
+    double  val;
+    if(!fromStringExact(valStr, &val))             // Locale independent, unlike atof
+      return false;
+    stageParameter(id, val);
 
-    numParamsFound++;
-    i = m+1;
+    if(c == ']')                                   // The closing bracket ends the list
+      return true;
   }
 
-  return true;
-
   // Notes:
   //
-  // -The call to setAllParametersToDefault() at the beginning is important when the state string 
+  // -The call to stageDefaultValues() before parsing the list is important when the state string
   //  does not contain values for all of our parameters. This may happen if the state was created 
   //  with an older version of the plugin that did not yet have certain parameters because they 
   //  were added later. In such a case, the parameters which have no value in the state should be 
-  //  set to their default value. Without the call at the beginning, they would just be left at 
-  //  whatever values they are currently at - which is wrong behavior.
+  //  set to their default value. Without the call before the list, they would just be left at 
+  //  whatever values they are currently at - which is wrong behavior. The same applies to sparse 
+  //  states which deliberately leave out the parameters that are at their defaults.
+  // -We stop reading directly after the closing bracket, so subclasses may store more data behind
+  //  it. See writeState().
   //
   // ToDo:
   //
   // -Check if the "Identifier" in the stateString matches our identifier. If not, it means that
   //  the host has called our state recall with the wrong kind of state (or that we changed our 
   //  plugin identifier between save and recall - which we probably should never do)
-  // -Detect parse errors and return false in such cases
+}
+
+bool ClapPluginWithParams::writeStateBinary(ClapStreamWriter& w) const
+{
+  // Count the records. In sparse states, we skip the parameters that are at their defaults:
+  uint32_t numParams  = paramsCount();
+  uint32_t numRecords = 0;
+  clap_param_info info;
+  double value = 0.0;
+  for(uint32_t i = 0; i < numParams; ++i)
+  {
+    paramsInfo(i, &info);
+    paramsValue(info.id, &value);
+    numRecords += shouldStoreParameter(info, value);
+  }
+
+  // Write the header:
+  w.write(binaryStateMagic, 4);
+  w.writeUint32(binaryStateVersion);
+  w.writeUint32(hashString(getPluginIdentifier()));
+  w.writeUint32(defaultsVersion);
+  w.writeUint32(numRecords);
+
+  // Write the (id, value) records in the order of the parameter indices:
+  for(uint32_t i = 0; i < numParams; ++i)
+  {
+    bool infoOK  = paramsInfo(i, &info);
+    clapAssert(infoOK);
+    bool valueOK = paramsValue(info.id, &value);
+    clapAssert(valueOK);
+    if(!shouldStoreParameter(info, value))
+      continue;
+    w.writeUint32(info.id);
+    w.writeDouble(value);          // Exact, no roundtrip issues as with text
+  }
+
+  return !w.hasError();
+}
+
+bool ClapPluginWithParams::readStateBinary(ClapStreamReader& r)
+{
+  // Validate the header before touching any parameter:
+  char     magic[4];
+  uint32_t version, idHash, stateDefaultsVersion = 0, numParams;
+  if(!r.read(magic, 4) || memcmp(magic, binaryStateMagic, 4) != 0)
+    return false;
+  if(!r.readUint32(&version) || !r.readUint32(&idHash))
+    return false;
+  if(version > binaryStateVersion)                  // Written by a newer version of the format
+    return false;
+  if(idHash != hashString(getPluginIdentifier()))   // State belongs to some other plugin
+    return false;
+  if(version >= 2 && !r.readUint32(&stateDefaultsVersion))
+    return false;
+  if(!r.readUint32(&numParams))
+    return false;
+
+  // Apply the records. Parameters that have no record get the default values that were valid 
+  // when the state was saved:
+  stageDefaultValues(stateDefaultsVersion);
+  for(uint32_t i = 0; i < numParams; ++i)
+  {
+    uint32_t id;
+    double   val;
+    if(!r.readUint32(&id) || !r.readDouble(&val))
+      return false;                                 // Truncated
+    stageParameter(id, val);
+  }
+
+  return true;
+
+  // Notes:
+  //
+  // -When reading from a stream, we don't know its length upfront, so a truncated state can only
+  //  be detected when we run out of data. Because we only parse into the staging buffer here, the
+  //  truncated state is discarded as a whole and the parameters are left untouched.
+}
+
+bool ClapPluginWithParams::isBinaryState(const std::string& state)
+{
+  return state.size() >= 4 && memcmp(state.data(), binaryStateMagic, 4) == 0;
 }
 
 void ClapPluginWithParams::processEvent(const clap_event_header_t* hdr)
@@ -330,8 +839,11 @@ void ClapPluginWithParams::processEvent(const clap_event_header_t* hdr)
 
     const clap_id param_id = paramValueEvent->param_id;
     const double  value    = paramValueEvent->value;
-    //const void* cookie   = paramValueEvent->cookie; // We currently don't use the cookie facility
-    setParameter(param_id, value);
+    void*         cookie   = paramValueEvent->cookie;
+    if(cookie != nullptr)
+      setParameterViaCookie(cookie, value);  // Fast path without id validation
+    else
+      setParameter(param_id, value);         // Host didn't pass the cookie, so we use the id
   }
 
   // Notes:
@@ -340,6 +852,10 @@ void ClapPluginWithParams::processEvent(const clap_event_header_t* hdr)
   //  processEvent method, implement your handling for the other kinds of events and if the event 
   //  is not of that kind, just call this basesclass method to get the default behavior for the 
   //  event types that we handle here.
+  // -The cookie is the pointer that we have handed out to the host in paramsInfo(). Hosts are 
+  //  supposed to pass it along with parameter change events (or pass a nullptr when they don't 
+  //  support cookies) so we can skip the id validation and address the storage slot directly. See
+  //  the comment for the cookie field of clap_param_info in params.h.
   // -The first check of the space_id is required to make the validator pass all tests and it is
   //  also what the official plugin-template.c and the nakst example do. I don't really know the
   //  purpose of that, though. What is an "event space" anyhow? What other event spaces besides the
@@ -358,6 +874,9 @@ clap_process_status ClapPluginWithAudio::process(const clap_process* p) noexcept
 {
   bool useFloat64 = isDoublePrecision(p);
 
+  // Apply a state that was loaded on the main thread since the last call, if any:
+  applyStagedState();
+
   // Process the sub-blocks with interleaved event handling:
   const uint32_t numFrames      = p->frames_count;
   const uint32_t numEvents      = p->in_events->size(p->in_events);
@@ -390,7 +909,7 @@ void ClapPluginWithAudio::handleProcessEvents(const clap_process* p, uint32_t fr
   while(eventIndex < numEvents && nextEventFrame == frameIndex) 
   {
     const clap_event_header_t *hdr = p->in_events->get(p->in_events, eventIndex);
-    if(hdr->time != frameIndex) 
+    if(hdr->time != frameIndex && needsBlockSplit(hdr))
     {
       nextEventFrame = hdr->time; 
       break;  
@@ -412,6 +931,9 @@ void ClapPluginWithAudio::handleProcessEvents(const clap_process* p, uint32_t fr
   //  and the handling will spawn a callback to parameterChanged(). If subclasses wnat to handle 
   //  other types of events as well, they will need to override processEvent.
   // -This event handling code had been adapted from plugin-template.c from the CLAP repo
+  // -Events for which needsBlockSplit() returns false are handled before the sub-block that 
+  //  contains them is processed. They can't be later than the next splitting event because the 
+  //  events are sorted by time.
 }
 
 void ClapPluginWithAudio::processSubBlock32(const clap_process* p, uint32_t begin, uint32_t end)
@@ -474,6 +996,9 @@ clap_process_status ClapPluginStereo32Bit::process(const clap_process *p) noexce
   if(!isProcessConfigSupported(p))
     return CLAP_PROCESS_ERROR;
 
+  // Apply a state that was loaded on the main thread since the last call, if any:
+  applyStagedState();
+
   // Process the sub-blocks with interleaved event handling:
   const uint32_t numFrames      = p->frames_count;
   const uint32_t numEvents      = p->in_events->size(p->in_events);
@@ -483,6 +1008,7 @@ clap_process_status ClapPluginStereo32Bit::process(const clap_process *p) noexce
   while(frameIndex < numFrames)
   {
     // Handle all events that happen at the current frame:
+    subBlockStart = frameIndex;
     handleProcessEvents(p, frameIndex, numFrames, eventIndex, numEvents, nextEventFrame);
 
     // Process the sub-block until the next event. This is a call to the overriden implementation
@@ -521,7 +1047,8 @@ bool ClapSynthStereo32Bit::notePortsInfo(
   if(isInput)
   {
     info->id = 0;
-    info->supported_dialects = CLAP_NOTE_DIALECT_MIDI | CLAP_NOTE_DIALECT_CLAP;
+    info->supported_dialects = 
+      CLAP_NOTE_DIALECT_CLAP | CLAP_NOTE_DIALECT_MIDI | CLAP_NOTE_DIALECT_MIDI2;
     info->preferred_dialect  = CLAP_NOTE_DIALECT_CLAP;
     strcpy_s(info->name, CLAP_NAME_SIZE, "Note In");
     //strncpy(info->name, "Note In", CLAP_NAME_SIZE);  // From clap-saw-demo - compile error in VS
@@ -531,7 +1058,6 @@ bool ClapSynthStereo32Bit::notePortsInfo(
 
   // ToDo:
   //
-  // -Maybe support MIDI 2.0 later
   // -Maybe use midi as preferred dialect...not sure about this, though
   // -Figure out if there is a reason why clap-saw-demo uses 1 rather than 0 for the id, see here:
   //  https://github.com/free-audio/clap-saw-demo-imgui/blob/main/src/clap-saw-demo.h#L152
@@ -543,76 +1069,109 @@ bool ClapSynthStereo32Bit::notePortsInfo(
   //  use 1, I'd rather use 0.
 }
 
-void ClapSynthStereo32Bit::handleMidiEvent(const uint8_t data[3])
+bool ClapSynthStereo32Bit::voiceInfoGet(clap_voice_info* info) const noexcept
 {
-  // Convert all messages to corresponding messages on MIDI channel 1:
-  uint8_t status = data[0] & 0xf0;
+  info->voice_count    = (uint32_t) voices.getCapacity();
+  info->voice_capacity = (uint32_t) voices.getCapacity();
+  info->flags          = 0;
+  if(voices.getStealMode() != VoiceManager::kStealSameKey)
+    info->flags |= CLAP_VOICE_INFO_SUPPORTS_OVERLAPPING_NOTES;
+  return voices.getCapacity() > 0;
 
-  if( status == 0x90 || status == 0x80 )
-  {
-    // Respond to note-on and note-off on channel 1
-
-    // Bitwise and with 0x7f=01111111 sets the first bit of an 8-bit word to zero, allowing
-    // only numbers from 0 to 127 to pass unchanged, higher numbers (128-255) will be mapped
-    // into this range by subtracting 128:
-    uint8_t key = data[1] & 0x7f;
-    uint8_t vel = data[2] & 0x7f;
+  // Notes:
+  //
+  // -Overlapping notes are notes on the same key that are told apart by their note ids. The voice
+  //  manager gives each of them its own voice and matches the note-offs by note id, except in the
+  //  kStealSameKey mode, where a note cuts off the previous one on the same key.
+  // -With a capacity of 1, the host may switch its modulation to mono.
+  //
+  // ToDo:
+  //
+  // -When the capacity changes after the host has asked for the voice info, the host should be 
+  //  told via clap_host_voice_info.changed. Currently, setMaxNumVoices is meant to be called only 
+  //  in the constructor, so that's not needed yet.
+}
 
-    // Call noteOn or noteOff which subclasses will override:
-    if(status == 0x80 || vel == 0)    // 0x80: "proper" note-off, vel=0: "running status" note-off
-      noteOff((int)key);
-    else
-      noteOn((int)key, (double)vel / 127.0);
-  }
-  else if( (status) == 0xb0 && (data[1] == 0x7b) )
-  {
-    // Respond to "all notes off" event:
-    // (status=0xb0: controller on ch 1, midiData[1]=0x7b: control 123: all notes off):
-    for(int i = 0; i <= 127; i++)
-      noteOff(i);
-  }
+void ClapSynthStereo32Bit::handleMidiEvent(const uint8_t data[3], int16_t port)
+{
+  MidiDecoder::Event ev;
+  if(midi.decodeMidi1(data, ev))
+    handleMidiMessage(ev, port);
 
   // Notes:
   //
-  // -The code for the midi event handling was adopted from Open303VST::handleEvent.
+  // -The code for the midi event handling was originally adopted from Open303VST::handleEvent. 
+  //  Now the decoding is done by the table-driven MidiDecoder.
   // -Subclasses can override this function if they want to to handle more types of midi messages
+  //  (e.g. system messages which the decoder rejects)
   //
   // ToDo:
   //
-  // -Maybe implement responses to control-change and pitch-wheel events by calling hooks that 
-  //  subclasses can override - just like with noteOn/Off - but provide empty default 
-  //  implementations for those other event handlers. Subclasses may want ignore these types of 
-  //  events. See Open303VST::handleEvent for how to identify these events and convert the data 
-  //  into more easily digestible formats.
   // -Maybe handle all-notes-off events by a different callback/hook like allNotesOff where the 
-  //  default implementation just does what we do above but subclasses can override it. Rationale:
-  //  the "all-notes-off" event is (I think) some sort of more aggressive "reset" command like 
-  //  "midi-panic" (if I remember correctly), so subclasses may want to handle such an event in
-  //  a more aggressive way - like making a full blown midi status reset or something. Such events
-  //  are typically used to deal with hanging notes.
-  // -We should probably not convert all messages to channel-1 messages. That's good enough for my
-  //  personal use cases but for a published library, we may want to retain the channel info.
-  // -Implement unit tests to test the midi responses.
+  //  default implementation just does what we do in handleMidiMessage but subclasses can 
+  //  override it. Rationale: the "all-notes-off" event is (I think) some sort of more aggressive 
+  //  "reset" command like "midi-panic" (if I remember correctly), so subclasses may want to 
+  //  handle such an event in a more aggressive way - like making a full blown midi status reset 
+  //  or something. Such events are typically used to deal with hanging notes.
+  // -The noteOn/noteOff hooks still don't get the channel. The voice manager does.
+  // -MIDI events don't have note ids, so voices started by MIDI have noteId = -1. They match 
+  //  CLAP events only via key, port and channel.
+}
+
+void ClapSynthStereo32Bit::handleMidiMessage(const MidiDecoder::Event& ev, int16_t port)
+{
+  int16_t channel = ev.channel;
+  switch(ev.type)
+  {
+  case MidiDecoder::kNoteOn:  startNote(ev.index, ev.value, -1, port, channel); return;
+  case MidiDecoder::kNoteOff: releaseNotes(ev.index, -1, port, channel);        return;
+  case MidiDecoder::kControlChange:
+  {
+    if(ev.index == 120)                   // All sound off
+      chokeNotes(-1, -1, port, channel);
+    else if(ev.index == 121)              // Reset all controllers
+      midi.resetControllers(channel);
+    else if(ev.index == 123)              // All notes off
+      releaseNotes(-1, -1, port, channel);
+  } break;
+  default: break;
+  }
+  midiControlEvent(ev);
 }
 
 void ClapSynthStereo32Bit::processEvent(const clap_event_header_t* hdr)
 {
+  noteEventFrame = hdr->time - subBlockStart;
   if(hdr->space_id != CLAP_CORE_EVENT_SPACE_ID)
     return;
 
   switch(hdr->type)
   {
   case CLAP_EVENT_NOTE_ON: {
-    const clap_event_note* note = (const clap_event_note*) hdr;
-    noteOn(note->key, note->velocity);
+    const clap_event_note* n = (const clap_event_note*) hdr;
+    startNote(n->key, n->velocity, n->note_id, n->port_index, n->channel);
   } break;
   case CLAP_EVENT_NOTE_OFF: {
-    const clap_event_note* note = (const clap_event_note*) hdr;
-    noteOff(note->key);
+    const clap_event_note* n = (const clap_event_note*) hdr;
+    releaseNotes(n->key, n->note_id, n->port_index, n->channel);
+  } break;
+  case CLAP_EVENT_NOTE_CHOKE: {
+    const clap_event_note* n = (const clap_event_note*) hdr;
+    chokeNotes(n->key, n->note_id, n->port_index, n->channel);
+  } break;
+  case CLAP_EVENT_NOTE_EXPRESSION: {
+    const clap_event_note_expression* e = (const clap_event_note_expression*) hdr;
+    setNoteExpression(e->expression_id, e->value, e->key, e->note_id, e->port_index, e->channel);
   } break;
   case CLAP_EVENT_MIDI: {
-    const clap_event_midi* midi = (const clap_event_midi*)(hdr);
-    handleMidiEvent(midi->data); // midi->data is the array of 3 midi bytes.
+    const clap_event_midi* m = (const clap_event_midi*)(hdr);
+    handleMidiEvent(m->data, (int16_t) m->port_index);   // m->data is the array of 3 midi bytes
+  } break;
+  case CLAP_EVENT_MIDI2: {
+    const clap_event_midi2* m = (const clap_event_midi2*)(hdr);
+    MidiDecoder::Event ev;
+    if(midi.decodeMidi2(m->data, ev))  // m->data is the array of 4 UMP words
+      handleMidiMessage(ev, (int16_t) m->port_index);
   } break;
   default: {
     Base::processEvent(hdr);     // Baseclass implementation handles parameter changes.
@@ -624,13 +1183,17 @@ void ClapSynthStereo32Bit::processEvent(const clap_event_header_t* hdr)
   // -Note-on/off events may arrive in different flavors: CLAP_EVENT_NOTE_ON/OFF, 
   //  CLAP_EVENT_MIDI, CLAP_EVENT_MIDI2. We need to be able to handle the ..._NOTE_ON/OFF and the 
   //  _MIDI variants because we said that we support these "dialects" in our implementation of 
-  //  notePortsInfo(). We didn't say to support MIDI2, so we ignore these types of events here.
+  //  notePortsInfo(). We also support MIDI2 via the MidiDecoder.
+  // -Note expressions only set the targets in the per-voice expression slots. The subclass picks
+  //  them up as smoothed ramps once per block via advanceNoteExpressions(). There are no 
+  //  per-event callbacks because MPE controllers can produce thousands of these events per 
+  //  second.
   // -There are also NOTE_CHOKE and NOTE_END event types. 
   // -If I get it right, the NOTE_CHOKE event is meant for ducking a voice by another voice like in
   //  mutually exclusive sounds like open and closed hihats in a drum machine. But it will also be 
   //  sent when the user double-clicks on the stop button in the DAW which should stop all sounds 
-  //  immediately (like in "midi-panic"?). Soo...maybe we should respond to such choke events by
-  //  a hard switch-off and reset?
+  //  immediately (like in "midi-panic"?). We respond to it by a hard switch-off of the matching 
+  //  voices via voiceStopped(). The monophonic noteOff hook gets a regular note-off.
   // -The NOTE_END event is an event type to be sent from the plugin to the host to inform the host
   //  that a note has ended such that the host can turn off any modulators for that voice. Maybe we
   //  should have a member function noteEnded/reportNoteEndToHost/notifyHostNoteEnded that 
@@ -640,4 +1203,226 @@ void ClapSynthStereo32Bit::processEvent(const clap_event_header_t* hdr)
   // See also:
   //
   // https://github.com/free-audio/clap-saw-demo-imgui/blob/main/src/clap-saw-demo.cpp#L492
-}
\ No newline at end of file
+}
+
+bool ClapSynthStereo32Bit::needsBlockSplit(const clap_event_header_t* hdr) const
+{
+  if(noteTiming == kSubBlocks || hdr->space_id != CLAP_CORE_EVENT_SPACE_ID)
+    return true;
+
+  switch(hdr->type)
+  {
+  case CLAP_EVENT_NOTE_OFF:
+  case CLAP_EVENT_NOTE_EXPRESSION: return false;
+  case CLAP_EVENT_NOTE_ON: {
+    const clap_event_note* n = (const clap_event_note*) hdr;
+    return wouldSteal(n->key, n->channel);
+  }
+  case CLAP_EVENT_MIDI: {
+    const uint8_t* d = ((const clap_event_midi*) hdr)->data;
+    uint8_t status = d[0] & 0xF0;
+    if(status == 0x80 || (status == 0x90 && d[2] == 0))
+      return false;
+    return status != 0x90 || wouldSteal(d[1] & 0x7F, d[0] & 0x0F);
+  }
+  case CLAP_EVENT_MIDI2: {
+    uint32_t w      = ((const clap_event_midi2*) hdr)->data[0];
+    uint32_t type   = w >> 28;                  // 2: MIDI 1.0 in UMP, 4: MIDI 2.0
+    uint32_t status = (w >> 20) & 0xF;
+    if(type != 2 && type != 4)
+      return true;
+    if(status == 0x8 || (status == 0x9 && type == 2 && (w & 0x7F) == 0))
+      return false;
+    return status != 0x9 || wouldSteal((w >> 8) & 0x7F, (w >> 16) & 0xF);
+  }
+  default: return true;
+  }
+
+  // Notes:
+  //
+  // -The check for stealing uses the state of the voice manager after all earlier events have 
+  //  been handled, which is the state in which the note-on will be handled.
+  // -A stolen voice or a choked one has to stop at the frame of the event. We can't express that
+  //  with an offset because the voice stops right away when voiceStopped() is called. Also, a 
+  //  stolen voice gets reused for the new note, so it can't play the old and the new note in the
+  //  same block. So for these, we fall back to splitting the block.
+  // -MIDI controllers etc. also split the block because subclasses may respond to them in 
+  //  midiControlEvent() in ways that need the split. Only the notes are handled ahead of time.
+}
+
+clap_process_status ClapSynthStereo32Bit::process(const clap_process *p) noexcept
+{
+  outEvents          = p->out_events;
+  numFramesInProcess = p->frames_count;
+
+  // Send the note ends that have accumulated since the last call:
+  for(int i = 0; i < numPendingNoteEnds; i++)
+    outEvents->try_push(outEvents, &pendingNoteEnds[i].header);
+  numPendingNoteEnds = 0;
+
+  clap_process_status status = Base::process(p);
+  if(silenceThreshold > 0.f && p->frames_count > 0)
+    retireSilentVoices(p->frames_count - 1);
+  outEvents = nullptr;
+  return status;
+}
+
+void ClapSynthStereo32Bit::reset() noexcept
+{
+  for(int i = 0; i < voices.getNumActiveVoices(); i++)
+    sendNoteEnd(voices.getActiveVoice(i), 0);
+  voices.reset();
+}
+
+void ClapSynthStereo32Bit::setMaxNumVoices(int newMaxNumVoices)
+{
+  voices.setCapacity(newMaxNumVoices);
+  expressions.setCapacity(newMaxNumVoices);
+  pendingNoteEnds.resize(newMaxNumVoices);
+  numPendingNoteEnds = 0;
+}
+
+void ClapSynthStereo32Bit::voiceFinished(int voice, uint32_t frame)
+{
+  sendNoteEnd(voice, subBlockStart + frame);
+  voices.freeVoice(voice);
+}
+
+void ClapSynthStereo32Bit::retireSilentVoices(uint32_t frame)
+{
+  for(int i = voices.getNumActiveVoices()-1; i >= 0; i--)
+  {
+    int v = voices.getActiveVoice(i);
+    const VoiceManager::Voice& voice = voices.getVoice(v);
+    if(voice.state == VoiceManager::kReleased && voice.level < silenceThreshold)
+    {
+      voiceStopped(v);
+      sendNoteEnd(v, frame);
+      voices.freeVoice(v);
+    }
+  }
+
+  // Notes:
+  //
+  // -Only released voices are retired. Held voices may be silent for legitimate reasons, e.g. 
+  //  during a slow attack or when the sound has a pause, and the note-off would then find no 
+  //  voice anymore.
+  // -The check is done once per process call, so a voice may play up to one block longer than 
+  //  necessary. The frame of the NOTE_END is the last one of the block.
+}
+
+void ClapSynthStereo32Bit::sendNoteEnd(int voice, uint32_t frame)
+{
+  const VoiceManager::Voice& v = voices.getVoice(voice);
+  clap_event_note ev;
+  ev.header.size     = sizeof(clap_event_note);
+  ev.header.time     = 0;
+  ev.header.space_id = CLAP_CORE_EVENT_SPACE_ID;
+  ev.header.type     = CLAP_EVENT_NOTE_END;
+  ev.header.flags    = 0;
+  ev.note_id         = v.noteId;
+  ev.port_index      = v.port;
+  ev.channel         = v.channel;
+  ev.key             = v.key;
+  ev.velocity        = 0.0;
+
+  if(outEvents != nullptr)
+  {
+    ev.header.time = std::min(frame, numFramesInProcess - 1);
+    outEvents->try_push(outEvents, &ev.header);
+  }
+  else if(numPendingNoteEnds < (int) pendingNoteEnds.size())
+    pendingNoteEnds[numPendingNoteEnds++] = ev;
+  else
+    clapError("Too many pending note ends");
+
+  // Notes:
+  //
+  // -The events are pushed in the order in which the voices end. Because we process the block 
+  //  from left to right, that's also sorted by time, as required for the output event queue, as
+  //  long as the subclass reports the voices that end within one processBlockStereo call in the 
+  //  order of their frames. 
+  // -The clipping of the frame guards against subclasses that report the end of a voice at the
+  //  frame one past the end of the block.
+  // -If try_push fails (the host's queue is full), the event is lost. There is not much we could
+  //  do about it anyway.
+}
+
+void ClapSynthStereo32Bit::startNote(
+  int16_t key, double vel, int32_t noteId, int16_t port, int16_t channel)
+{
+  noteOn(key, vel);
+  if(voices.getCapacity() == 0)
+    return;
+  int stolen = voices.getVoiceToSteal(key, channel);
+  if(stolen != -1)
+  {
+    voiceStopped(stolen);
+    sendNoteEnd(stolen, subBlockStart);
+    voices.freeVoice(stolen);
+  }
+  int v = voices.noteOn(key, vel, noteId, port, channel);
+  expressions.resetVoice(v);
+  voiceStarted(v);
+}
+
+void ClapSynthStereo32Bit::releaseNotes(int16_t key, int32_t noteId, int16_t port, int16_t channel)
+{
+  // The noteOff hook doesn't know about wildcards, so we call it for all keys in this case:
+  if(key == -1)
+    for(int k = 0; k <= 127; k++)
+      noteOff(k);
+  else
+    noteOff(key);
+
+  // We iterate backwards because voiceReleased() may call voiceFinished() which reorders the 
+  // active voices array (see VoiceManager):
+  for(int i = voices.getNumActiveVoices()-1; i >= 0; i--)
+  {
+    int v = voices.getActiveVoice(i);
+    bool held = voices.getVoice(v).state == VoiceManager::kHeld;
+    if(held && voices.matches(v, noteId, port, channel, key))
+    {
+      voices.releaseVoice(v);
+      voiceReleased(v);
+    }
+  }
+}
+
+void ClapSynthStereo32Bit::chokeNotes(int16_t key, int32_t noteId, int16_t port, int16_t channel)
+{
+  if(key == -1)
+    for(int k = 0; k <= 127; k++)
+      noteOff(k);
+  else
+    noteOff(key);
+  for(int i = voices.getNumActiveVoices()-1; i >= 0; i--)
+  {
+    int v = voices.getActiveVoice(i);
+    if(voices.matches(v, noteId, port, channel, key))
+    {
+      voiceStopped(v);
+      sendNoteEnd(v, subBlockStart);
+      voices.freeVoice(v);
+    }
+  }
+}
+
+void ClapSynthStereo32Bit::setNoteExpression(int32_t expressionId, double value, int16_t key, 
+  int32_t noteId, int16_t port, int16_t channel)
+{
+  for(int i = 0; i < voices.getNumActiveVoices(); i++)
+  {
+    int v = voices.getActiveVoice(i);
+    if(voices.matches(v, noteId, port, channel, key))
+      expressions.setTarget(v, expressionId, (float) value);
+  }
+
+  // Notes:
+  //
+  // -Released voices still receive expressions because they are still sounding. Hosts typically
+  //  keep sending e.g. tuning for a note during its release when the player slides after lifting
+  //  the finger.
+  // -Expressions for notes that don't have a voice (yet) are dropped. The CLAP spec says that 
+  //  the note-on comes first, so that should not happen.
+}
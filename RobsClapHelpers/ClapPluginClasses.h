@@ -66,6 +66,11 @@ public:
   ClapPluginWithParams(const clap_plugin_descriptor* desc, const clap_host* host)
     : ClapPlugin(desc, host) { }
 
+  /** Applies a state that was loaded while we were active and that no process() or paramsFlush()
+  call has picked up yet. Subclasses that override deactivate() should call this baseclass 
+  version. */
+  void deactivate() noexcept override;
+
 
   //-----------------------------------------------------------------------------------------------
   // \name Parameter handling
@@ -84,7 +89,9 @@ public:
   may assign to its parameters. The id is actually a field in the info struct. When the host wants 
   to set a parameter, it will use this id to identify the parameter. The index is just used here to 
   inquire the info (I guess, once, when the plugin is loaded (VERIFY!)). The id is used whenever a 
-  parameter is set. */
+  parameter is set. The info's cookie field will be filled with a pointer to the storage slot of
+  the parameter's value such that the host can pass it back to us in parameter change events. 
+  @see setParameterViaCookie(). */
   bool paramsInfo(uint32_t index, clap_param_info* info) const noexcept override;
 
   /** Assigns the output variable "value" to the value of the parameter with the given parameter 
@@ -107,6 +114,11 @@ public:
   default implementation). */
   bool paramsTextToValue(clap_id paramId, const char *display, double *value) noexcept override;
 
+  /** Overrides the entry point for the host's value-to-text requests to consult the display cache
+  before calling paramsValueToText, if the cache is enabled. @see setDisplayCacheSize(). */
+  bool paramsValueToTextForHost(clap_id paramId, double value, char *display, 
+    uint32_t size) noexcept override;
+
   /** Overrides the paramsFlush method to call processEvent for all the passed input events. */
   void paramsFlush(const clap_input_events *in, const clap_output_events *out) noexcept override;
 
@@ -117,9 +129,42 @@ public:
     double defaultValue, clap_param_info_flags flags);
   // ToDo: maybe include a path/module string (e.g. Osc2/WaveTable/Spectrum/ )
 
-  /** Sets all the parameters to their default values by calling setParameter for each. */
+  /** Adds a parameter like the function above and additionally declares a mapping curve for it. 
+  The input range of the mapping is set to the range of the parameter. The mapped value can then be
+  retrieved by getMappedParameter(). Parameters without a declared mapping use the identity. 
+  @see ParameterMapping */
+  void addParameter(clap_id identifier, const std::string& name, double minValue, double maxValue, 
+    double defaultValue, clap_param_info_flags flags, const ParameterMapping& mapping);
+
+  /** Returns the current value of the parameter with the given id after it has been mapped through
+  the curve that was declared in addParameter(). Subclasses can call this in parameterChanged() to 
+  get the value that their DSP code needs, e.g. the raw amplitude for a parameter in dB. */
+  double getMappedParameter(clap_id id) const
+  {
+    return getParameterMapping(id).map(getParameter(id));
+  }
+
+  /** Returns the mapping of the parameter with the given id. The mapping can also be used to map 
+  arrays of values, e.g. when a parameter is smoothed or modulated per sample. 
+  @see ParameterMapping::mapArray() */
+  const ParameterMapping& getParameterMapping(clap_id id) const;
+
+  /** Sets all the parameters to their default values by calling setParameter for each. The calls
+  are wrapped into a bulk update, so there will be only one call to parametersChanged. */
   void setAllParametersToDefault();
 
+  /** Starts a bulk update of parameters. Until the matching call to endBulkUpdate(), the calls to
+  setParameter() will only store the new values and remember which parameters have changed. The 
+  endBulkUpdate() call will then notify the subclass about all the changes at once via a single 
+  call to parametersChanged(). That's useful when many parameters are set at once (like in a preset
+  load) and the plugin would otherwise recompute its coefficients over and over again. The calls 
+  may be nested. The bookkeeping doesn't allocate memory, so bulk updates can be done on the audio
+  thread. */
+  void beginBulkUpdate();
+
+  /** Ends a bulk update. @see beginBulkUpdate() */
+  void endBulkUpdate();
+
   /** Sets the parameter with the given id to the new value. After storing the new value in our 
   params array, this will invoke a call to parameterChanged which your subclass should override, if
   it needs to respond to parameter change events. The method is not virtual because it is not 
@@ -131,6 +176,44 @@ public:
   will return zero. */
   double getParameter(clap_id id) const;
 
+  /** Sets a parameter via the "cookie" that we have handed out to the host in paramsInfo(). The 
+  cookie is a pointer to the storage slot of the parameter's value inside our values array, so we 
+  can write the new value directly into that slot without validating the id first. The id that is
+  passed to parameterChanged() is recovered from the position of the slot within the array. The 
+  cookie is only valid after all parameters have been added because each call to addParameter() 
+  may reallocate the values array. That's why addParameter() should only ever be called in the 
+  constructor (as it was intended anyway). */
+  void setParameterViaCookie(void* cookie, double newValue);
+
+  /** Returns the cookie for the parameter with the given id. This is the same pointer that is 
+  written into the cookie field of the clap_param_info by paramsInfo(). If the id doesn't exist, 
+  it will return a nullptr. */
+  void* getParameterCookie(clap_id id) const;
+
+  /** Enables the display cache with the given number of slots per parameter or disables it when 
+  zero is passed (which is the default). Hosts tend to ask repeatedly for the display strings of 
+  the same values when they draw automation lanes and generic editors. With the cache enabled, the
+  strings that were produced by paramsValueToText are remembered for the last "numSlots" distinct 
+  values per parameter (keyed on the exact bit pattern of the double) and returned from there when
+  the same value is asked for again. The cache is only accessed from the main thread (as is 
+  value_to_text), so it needs no locking. Call this after all parameters have been added. */
+  void setDisplayCacheSize(int numSlots);
+
+  /** Clears all the cached display strings. Subclasses must call this when the output of their 
+  paramsValueToText changes for the same values, e.g. when the user switches between display units.
+  The hit and miss counters are not reset. */
+  void invalidateDisplayCache();
+
+  /** Returns the number of value-to-text requests that have been served from the display cache. */
+  uint64_t getDisplayCacheHits() const { return displayCacheHits; }
+
+  /** Returns the number of value-to-text requests that had to call paramsValueToText while the 
+  cache was enabled. The hit-rate is given by hits / (hits + misses). */
+  uint64_t getDisplayCacheMisses() const { return displayCacheMisses; }
+
+  /** Resets the hit and miss counters to zero. */
+  void resetDisplayCacheCounters() { displayCacheHits = displayCacheMisses = 0; }
+
   /** Subclasses should override this to respond to parameter changes. For example, they may want 
   to recalculate some coefficients for the DSP algorithm when a parameter was changed. It has been 
   made purely virtual because in most cases, you will really want to override this and it would be 
@@ -138,6 +221,12 @@ public:
   to respond to parameter changes, you can just override it with an empty implementation. */
   virtual void parameterChanged(clap_id id, double newValue) = 0;
 
+  /** This is called at the end of a bulk update with the ids of all parameters that have changed 
+  during the update, see beginBulkUpdate(). The baseclass implementation calls parameterChanged()
+  for each of them, so it behaves as if the parameters were set one by one. Subclasses that compute
+  their coefficients from several parameters can override this to do the computation only once. */
+  virtual void parametersChanged(const clap_id* ids, uint32_t numIds);
+
   /** Function to produce a string from a parameter value for display on the host-generated GUI. 
   You may pass a desired "precision", i.e. number of decimal digits after the dot and an optional
   suffix which can be used for displaying a physical unit such as " Hz" or " dB". If you want a 
@@ -162,6 +251,23 @@ public:
     return copyString(strings, (int) round(value), destination, size);
   }
 
+  /** Like the function above but uses a ChoiceStrings object to hold the strings. This is the
+  recommended way for choice parameters. @see ChoiceStrings. */
+  bool toDisplay(double value, char* destination, int size, const ChoiceStrings& strings)
+  {
+    const char* str = strings.getString((int) round(value));
+    return str != nullptr && copyString(str, destination, size) > 0;
+  }
+
+  /** Function to convert a display string back into a parameter value. It's the counterpart of 
+  the toDisplay function for numeric parameters and should be called with the same suffix. It 
+  accepts the number with or without the unit and also understands SI prefixes like in "2.5k Hz". 
+  It returns false, if the string can't be parsed. See fromStringWithSuffix for the details. */
+  bool toValue(const char* displayString, double* value, const char* suffix = nullptr)
+  {
+    return fromStringWithSuffix(displayString, value, suffix);
+  }
+
   /** Tries to find the "displayString" in the array of "strings". If it was found, the index where
   it was found will be assigned to the "value" and "true" will be returned. If it was not found,
   "value" will be assigned to zero and "false" will be returned. The purpose of the this function 
@@ -178,6 +284,15 @@ public:
     else        { *value = (double) i; return true;  }
   }
 
+  /** Like the function above but uses the hash index of the ChoiceStrings object to find the 
+  string in O(1) rather than by a linear search. */
+  bool toValue(const char* displayString, double* value, const ChoiceStrings& strings)
+  {
+    int i = strings.find(displayString);
+    if(i == -1) { *value = 0.0;        return false; }
+    else        { *value = (double) i; return true;  }
+  }
+
   /** This is a self-check for internal consistency. It is recommended to verify this after all 
   your addParameter calls in some sort of assertion in debug builds to catch bugs in your parameter
   setup code. */
@@ -194,27 +309,220 @@ public:
   extension. */
   bool implementsState() const noexcept override { return true; }
 
-  /** Overrides stateSave to write the values of all our parameters in a simple textual format into
-  the stream. It also stores information about the plugin and version which may be used on recall
-  to do some checks and facilitate conversions when the format has changed between plugin 
-  versions. */
+  /** Overrides stateSave to write the values of all our parameters into the stream. By default, 
+  it uses a simple textual format. It also stores information about the plugin and version which 
+  may be used on recall to do some checks and facilitate conversions when the format has changed 
+  between plugin versions. @see setStateFormat() for switching to the compact binary format. */
   bool stateSave(const clap_ostream *stream) noexcept override;
 
   /** Restores the values of all of our parameters from a stream that was supposedly created 
   previously via the stateSave function. If the stream does not have values for all of our 
   parameters stored (perhaps because the state was saved with an older version of the plugin which
-  had less parameters), then the missing ones will be assigned to their default values. */
+  had less parameters), then the missing ones will be assigned to their default values. The format
+  (text or binary) is detected automatically, so states that were saved in one format can still be
+  loaded after switching to the other. When we are active, the new values are not applied here but
+  at the start of the next process() call on the audio thread. @see beginStaging(). If the state 
+  can't be parsed, the parameters are left untouched. */
   bool stateLoad(const clap_istream* stream) noexcept override;
 
+  /** We implement the state-context extension, so subclasses can save and load their states 
+  differently depending on the context. See getStateContext(). */
+  bool implementsStateContext() const noexcept override { return true; }
+
+  /** Saves the state for the given context. For CLAP_STATE_CONTEXT_FOR_DUPLICATE, the state is 
+  only handed over to a fresh instance of our plugin and never ends up in a file. So we always use
+  the uncompressed binary format then because that's the fastest, regardless of the settings made
+  by setStateFormat() and setCompressedState(). For the other contexts, this works like 
+  stateSave() which, in turn, uses CLAP_STATE_CONTEXT_FOR_PROJECT. */
+  bool stateSaveWithContext(const clap_ostream *stream, uint32_t contextType) noexcept override;
+
+  /** Loads the state for the given context. stateLoad() uses CLAP_STATE_CONTEXT_FOR_PROJECT. */
+  bool stateLoadWithContext(const clap_istream *stream, uint32_t contextType) noexcept override;
+
+  /** Returns the context (one of the values of clap_plugin_state_context_type) of the state that is
+  currently being saved or loaded. Subclasses that override writeState() and readState() can 
+  inspect this to leave out some of their data in certain contexts. For example, caches or other 
+  derived data that is expensive to store can be left out of presets and recomputed on load. The 
+  state must still be loadable in every context, so if you leave something out, write a flag that
+  tells readState() about it. Outside of stateSaveWithContext() and stateLoadWithContext(), this
+  returns CLAP_STATE_CONTEXT_FOR_PROJECT. */
+  uint32_t getStateContext() const { return stateContext; }
+
+  /** The formats that stateSave() can produce. */
+  enum StateFormat
+  {
+    kTextState,     // Human readable, see getStateAsString()
+    kBinaryState    // Compact, see getStateAsBinary()
+  };
+
+  /** Selects the format that is used by stateSave(). The default is kTextState. */
+  void setStateFormat(StateFormat newFormat) { stateFormat = newFormat; }
+
+  /** Returns the format that is used by stateSave(). */
+  StateFormat getStateFormat() const { return stateFormat; }
+
+  /** Switches between full and sparse states. A full state (the default) contains the values of 
+  all parameters. A sparse state contains only the values of those parameters that are not at 
+  their default values. For big plugins where most parameters sit at their defaults, that makes 
+  the states much smaller. On load, the parameters that are missing in the state are set to their 
+  defaults. This works for both formats (text and binary). Sparse states rely on the defaults not 
+  changing between save and load - if you change the default value of a parameter in a later 
+  version of your plugin, you must increment the defaults version. @see setDefaultsVersion(). */
+  void setSparseState(bool shouldBeSparse) { sparseState = shouldBeSparse; }
+
+  /** Returns true, iff stateSave() writes sparse states. */
+  bool isSparseState() const { return sparseState; }
+
+  /** Switches compression of the states that stateSave() writes on or off. When it's on, the whole
+  state (including the additional data of subclasses, see writeState()) goes through an LZ-style
+  block compressor before it's passed on to the host. That's worthwhile for plugins with big 
+  states (sample data, wavetables, etc.) which otherwise bloat the host's project files. The 
+  compressed data is marked by a header, so stateLoad() detects compressed states automatically 
+  and uncompressed states can still be loaded after switching compression on (and vice versa). 
+  The default is off. @see CompressedOutStream */
+  void setCompressedState(bool shouldCompress) { compressedState = shouldCompress; }
+
+  /** Returns true, iff stateSave() writes compressed states. */
+  bool isCompressedState() const { return compressedState; }
+
+  /** Sets the version number of the table of default values. It starts at zero and should be 
+  incremented (in the constructor of your plugin, after adding the parameters) whenever a later 
+  version of your plugin changes the default value of an existing parameter. The version is stored
+  in the state and passed to getDefaultValue() when the state is loaded, so you can give the 
+  parameters that are missing in an old sparse state the defaults that were valid when the state 
+  was saved. */
+  void setDefaultsVersion(uint32_t newVersion) { defaultsVersion = newVersion; }
+
+  /** Returns the version number of the table of default values. */
+  uint32_t getDefaultsVersion() const { return defaultsVersion; }
+
+  /** Returns the default value that the parameter with the given info had in the given version of
+  the table of default values. This is used on state recall for all parameters that are missing in
+  the state. The baseclass implementation returns the current default from the info. If you have 
+  changed default values and incremented the defaults version, you need to override this to return
+  the old defaults for the old versions. For parameters that didn't exist in the old version, just
+  return the current default. */
+  virtual double getDefaultValue(const clap_param_info& info, uint32_t defaultsVersion) const
+  {
+    return info.default_value;
+  }
+
+  /** Writes the state into the given writer in the format selected by setStateFormat(). This is
+  called by stateSave() and works directly on the host's stream, so the state is never materialized
+  as a whole in memory. Subclasses that need to store more than just the parameter values (sample 
+  maps, wavetables, etc.) can override this, call the baseclass implementation first and then 
+  write their additional data. They will then also need to override readState() accordingly. */
+  virtual bool writeState(ClapStreamWriter& writer) const;
+
+  /** Reads a state that was written by writeState() from the given reader. The format is detected
+  automatically. This is called by stateLoad(). When the parameters have been read, the reader is 
+  positioned directly behind them, so subclasses can continue reading their additional data. The 
+  parameters are parsed into the staging buffer rather than set directly, see beginStaging(). 
+  Additional data of subclasses is read on the main thread, so subclasses are responsible for 
+  handing it over to their audio thread safely. */
+  virtual bool readState(ClapStreamReader& reader);
+
   /** This creates a string that represents the state which is given by the values of all of our 
-  parameters. */
-  virtual std::string getStateAsString() const;
+  parameters. It uses the textual format, regardless of the setting of setStateFormat(). This 
+  used to be the hook for saving the state. It's final now because stateSave() doesn't call it 
+  anymore. Override writeState() instead. */
+  virtual std::string getStateAsString() const final;
   // ToDo: document the format of the string
 
   /** Restores the state, i.e. the values of all parameters, from the given string which was 
-  presumably created by calling getStateAsString at some time before. */
-  virtual bool setStateFromString(const std::string& stateString);
+  presumably created by calling getStateAsString at some time before. It's final for the same 
+  reason as getStateAsString(). Override readState() instead. */
+  virtual bool setStateFromString(const std::string& stateString) final;
+
+  /** Creates a binary blob (stored in a std::string used as byte container) that represents the 
+  state. It consists of a 20 byte header followed by one 12 byte record per parameter. The header 
+  contains the 4 magic bytes "RCSB", the format version, a hash of the plugin identifier, the 
+  defaults version and the number of records. Version 1 of the format had a 16 byte header without
+  the defaults version. Such states can still be loaded. Each record contains the parameter id as 
+  32 bit integer followed by the value as 64 bit double. All numbers are stored in little endian 
+  byte order. Compared to the textual format, this is smaller and much faster to produce and to 
+  parse. */
+  std::string getStateAsBinary() const;
+
+  /** Restores the state from the given binary blob which was presumably created by calling 
+  getStateAsBinary at some time before. Returns false and leaves the parameters untouched, if the
+  blob is malformed, was written by a newer format version or belongs to a different plugin. */
+  bool setStateFromBinary(const std::string& stateBlob);
+
+  /** Returns true, iff the given state blob or string starts with the magic bytes of our binary 
+  format. This is used by stateLoad to decide which parser to use. */
+  static bool isBinaryState(const std::string& state);
+
+
+protected:
+
+  /** Writes the state into the given stream, compressed or not, depending on the setting of 
+  setCompressedState(). This is the implementation of stateSaveWithContext(). */
+  bool writeStateToStream(const clap_ostream *stream) const;
+
+  /** Reads the state from the given stream, compressed or not. This is the implementation of 
+  stateLoadWithContext(). */
+  bool readStateFromStream(const clap_istream *stream);
+
+  /** Writes the parameters in the textual format. */
+  bool writeStateText(ClapStreamWriter& writer) const;
+
+  /** Parses the parameters in the textual format. */
+  bool readStateText(ClapStreamReader& reader);
+
+  /** Writes the parameters in the binary format. */
+  bool writeStateBinary(ClapStreamWriter& writer) const;
+
+  /** Parses the parameters in the binary format. */
+  bool readStateBinary(ClapStreamReader& reader);
+
+  /** Writes the default values that the parameters had in the given version of the table of 
+  default values into the buffer for the parsed values. Used in state recall. 
+  @see getDefaultValue() */
+  void stageDefaultValues(uint32_t defaultsVersion);
 
+  /** Writes the given value for the parameter with the given id into the buffer for the parsed 
+  values. Used in state recall. Unknown ids are ignored. */
+  void stageParameter(clap_id id, double value);
+
+  /** Prepares the buffer for the parsed values, so the state parsers can write into it. State 
+  recall does not set the parameters directly because that would call parameterChanged on the main
+  thread while the audio thread may be processing and reading the same values. Instead, the new 
+  parameter set is parsed into a buffer which is then copied into the staging buffer and handed 
+  over to the audio thread lock-free by endStaging(). The audio thread applies it at the start of 
+  the next call to process() (or paramsFlush()) via applyStagedState(). When we are not active, 
+  there is no audio thread, so endStaging() applies it directly. */
+  void beginStaging();
+
+  /** Hands the parsed values over to the audio thread (or applies them directly when we are not 
+  active) when "success" is true, or discards them otherwise. Returns "success". */
+  bool endStaging(bool success);
+
+  /** Calls parameterChanged() or, if a bulk update is in progress, marks the parameter as changed
+  for the notification at the end of the update. */
+  void notifyParameterChanged(clap_id id, double newValue);
+
+  /** Applies a staged parameter set, if there is one pending. Called at the start of process() and
+  paramsFlush(). It reports only the parameters whose values have changed, in one bulk update. 
+  This never blocks. */
+  void applyStagedState();
+
+  /** Copies the staged values into the values array and calls parameterChanged for those that 
+  have changed. */
+  void applyStagedValues();
+
+  /** Returns true, iff there is a staged parameter set that has not yet been fully applied. In this
+  case, paramsValue() reports the staged values because that's what the host expects to see after
+  a state load. */
+  bool isStateStaged() const;
+
+  /** Returns true, iff the parameter with the given info should be written into the state. That 
+  is always the case for full states and for sparse states, it's the case when the value differs 
+  from the default. */
+  bool shouldStoreParameter(const clap_param_info& info, double value) const;
+
+
+public:
 
   //-----------------------------------------------------------------------------------------------
   // \name Processing
@@ -226,8 +534,9 @@ public:
 
   /** This is called from within our implementation of process to handle one event at a time. In 
   our implementation here, we currently handle only parameter change events by calling 
-  setParameter which in turn will trigger a call to the purely virtual parameterChanged() callback
-  which you need to override, to implement your responses to parameter changes. */
+  setParameter (or setParameterViaCookie, if the host has passed the cookie along with the event)
+  which in turn will trigger a call to the purely virtual parameterChanged() callback which you 
+  need to override, to implement your responses to parameter changes. */
   virtual void processEvent(const clap_event_header_t* hdr);
   // ...well...actually, we do not yet have an implementation of process() here in this class. We 
   // have one in ClapPluginStereo32Bit, though.
@@ -235,8 +544,49 @@ public:
 
 private:
 
-  std::vector<double>          values;  // Current values, indexed by id
-  std::vector<clap_param_info> infos;   // Parameter informations, indexed by index
+  std::vector<double>           values;   // Current values, indexed by id
+  std::vector<clap_param_info>  infos;    // Parameter informations, indexed by index
+  std::vector<ParameterMapping> mappings; // Mapping curves for the values, indexed by id
+
+  // Bookkeeping for bulk updates:
+  std::vector<char>    bulkChanged;     // Flags for the changed parameters, indexed by id
+  std::vector<clap_id> bulkChangedIds;  // Ids of the changed parameters, in order of change
+  int                  bulkDepth = 0;   // Nesting depth of beginBulkUpdate() calls
+
+  // Staging of loaded states for the handoff to the audio thread. The stagingState is one of the 
+  // values of the enum below and determines which thread currently owns the stagedValues:
+  enum StagingState { kStagingIdle, kStagingWriting, kStagingPending, kStagingApplying };
+  std::vector<double> parsedValues;                 // Values of a state being parsed, by id
+  std::vector<double> stagedValues;                 // Values of a loaded state, indexed by id
+  std::atomic<int>    stagingState { kStagingIdle };
+
+  StateFormat stateFormat     = kTextState; // Format used in stateSave()
+  bool        sparseState     = false;      // Store only non-default values in stateSave()
+  bool        compressedState = false;      // Compress the state in stateSave()
+  uint32_t    stateContext    = CLAP_STATE_CONTEXT_FOR_PROJECT; // Context of current save/load
+  uint32_t    defaultsVersion = 0;          // Version of the table of default values
+
+  static const int displayCacheTextSize = 64;       // Maximum length of cached strings plus 1
+
+  struct DisplayCacheEntry
+  {
+    uint64_t valueBits = 0;                         // Bit pattern of the value, used as key
+    bool     valid     = false;                     // Entry holds a string
+    bool     result    = false;                     // Return value of paramsValueToText
+    char     text[displayCacheTextSize];
+  };
+
+  std::vector<DisplayCacheEntry> displayCache;      // numSlots entries per parameter, by id
+  std::vector<uint32_t>          displayCacheNext;  // Next slot to be overwritten, by id
+  int      displayCacheSlots  = 0;                  // Slots per parameter, 0 means disabled
+  uint64_t displayCacheHits   = 0;
+  uint64_t displayCacheMisses = 0;
+
+  static const char     binaryStateMagic[4];        // "RCSB" for "Rob's CLAP State, Binary"
+  static const uint32_t binaryStateVersion      = 2;  // Increment when the format changes
+  static const size_t   binaryStateHeaderSize   = 20;
+  static const size_t   binaryStateHeaderSizeV1 = 16; // Version 1 had no defaults version
+  static const size_t   binaryStateRecordSize = 12;
 
 };
 
@@ -285,6 +635,12 @@ protected:
   //  call site that the values can be modified by the function.
   // -Make protected
 
+  /** Decides whether the block must be split at the given event, which happens later than the 
+  start of the current sub-block. By default, every event splits the block, so all events are 
+  handled at the frame at which they occur. Subclasses can return false for events that they want
+  to handle ahead of time, e.g. to schedule them at a frame offset within the sub-block. */
+  virtual bool needsBlockSplit(const clap_event_header_t* hdr) const { return true; }
+
 
   // To be overriden by subclasses. The default implementations here do nothing:
   virtual void processSubBlock32(const clap_process* process, uint32_t begin, uint32_t end);
@@ -362,6 +718,15 @@ public:
       &&   hasSinglePrecision(p);
   }
 
+
+protected:
+
+  /** The frame within the current process call at which the sub-block that is currently being 
+  processed starts. During the event handling, that's also the time of the current event. 
+  Subclasses can use it to compute absolute frame offsets of things that happen inside 
+  processBlockStereo. */
+  uint32_t subBlockStart = 0;
+
 };
 
 //=================================================================================================
@@ -371,7 +736,17 @@ public:
 This class can serve as baseclass for instrument plugins, provided that they want to work with 
 stereo I/O for audio in 32 bit. In addition to the baseclass ClapPluginStereo32Bit, this class
 handles muscial events like note-on/off. Subclasses should respond to such events by overriding
-the appropriate virtual functions such as noteOn, noteOff, etc. ...TBC... */
+the appropriate virtual functions such as noteOn, noteOff, etc. ...TBC... 
+
+For polyphonic instruments, there is a built-in VoiceManager. To use it, call setMaxNumVoices() in 
+your constructor and override voiceStarted(), voiceReleased() and optionally voiceStopped(). The
+incoming note events (CLAP or MIDI) are then mapped to voice indices which you can use to index
+your own preallocated arrays of per-voice DSP state. When a voice has faded out after its release,
+call voiceFinished() to return it to the pool. Alternatively, report the levels of the voices via
+setVoiceLevel() and set a silence threshold. Then, released voices that have become silent are 
+retired automatically. To render, iterate over the active voices as reported by 
+getVoiceManager(). The noteOn/noteOff hooks are called in either case, so simple monophonic synths
+can ignore the voice management and just override those. */
 
 class ClapSynthStereo32Bit : public ClapPluginStereo32Bit
 {
@@ -381,6 +756,16 @@ class ClapSynthStereo32Bit : public ClapPluginStereo32Bit
 
 public:
 
+  /** Selects how note events are timed within a block. In kSubBlocks mode, each note event splits 
+  the block like a parameter change, so processBlockStereo() is called for the pieces between the 
+  events and the notes start and end at the first frame of a piece. In kVoiceOffsets mode, note-on
+  and note-off events (in all dialects) and note expressions don't split the block. They are 
+  handled ahead of time and the hooks can inquire the frame within the next processBlockStereo() 
+  call at which the event happens via getNoteEventFrame(). Events that need to cut off a sounding 
+  voice, i.e. note-ons that steal a voice and chokes, still split the block as do all other 
+  events. */
+  enum NoteTiming { kSubBlocks, kVoiceOffsets };
+
 
   bool implementsNotePorts() const noexcept override { return true; }
 
@@ -389,19 +774,25 @@ public:
 
 
   uint32_t notePortsCount(bool isInput) const noexcept override { return isInput ? 1 : 0; }
-  // One input note port, no output note ports. Do we need an output port when we want to send
-  // NOTE_END events to the host? Figure out!
+  // One input note port, no output note ports. We don't need an output port to send NOTE_END 
+  // events to the host because they refer to the notes of the input port.
 
   bool notePortsInfo(uint32_t index, bool isInput,
     clap_note_port_info *info) const noexcept override;
 
+  /** We report the voices of the built-in voice manager to the host, if it's used. */
+  bool implementsVoiceInfo() const noexcept override { return voices.getCapacity() > 0; }
+
+  /** Reports the capacity of the voice manager as voice count and capacity. */
+  bool voiceInfoGet(clap_voice_info *info) const noexcept override;
+
   /** This is hook function that subclasses should override to respond to noteOn events. The key is
   in 0..127 like in MIDI 1.0, the velocity in 0..1 because this is the way, the CLAP_EVENT_NOTE_ON
   dialect communicates velocity via the clap_event_note struct. MIDI velocities in 1..127 can be
   easily translated by dividing by 127.0 but the CLAP velocity has higher resolution which we may 
   want to take advantage of someday.
   */
-  virtual void noteOn(int key, double velocity) = 0;
+  virtual void noteOn(int key, double velocity) {}
   // Maybe have also optional parameters for channel, port_index, note_id (defaulting to -1 
   // indicating "unspecified" or "all")
   // The data type int16_t is taken from the clap-saw-example. I think it might be for 
@@ -421,23 +812,165 @@ public:
   // Maybe note on events should have an additional data field for the frequency. We'll see...
 
 
-  virtual void noteOff(int key) = 0;
+  virtual void noteOff(int key) {}
   // Maybe let noteOff also have an (optional) off-velocity
 
 
 
-  virtual void handleMidiEvent(const uint8_t midiDataBytes[3]);
+  /** Decodes a MIDI 1.0 message and dispatches it via handleMidiMessage. The port is the 
+  port_index of the event and is stored in the voices started by the message. */
+  virtual void handleMidiEvent(const uint8_t midiDataBytes[3], int16_t port);
+
+  /** Hook that is called for all decoded MIDI messages that are not notes, i.e. controllers, 
+  pressures, pitch bend and program changes, from both MIDI 1.0 and 2.0 dialects. The channel 
+  state in getMidiDecoder() has already been updated when this is called, so subclasses can 
+  either respond to the event or just read the state when they need it. */
+  virtual void midiControlEvent(const MidiDecoder::Event& event) {}
+
+  /** Gives access to the controller state of the MIDI channels. */
+  const MidiDecoder& getMidiDecoder() const { return midi; }
 
 
 
 
   void processEvent(const clap_event_header_t* hdr) override;
 
+  /** Sets up the reporting of NOTE_END events, calls the baseclass implementation and retires
+  the voices that have become silent. */
+  clap_process_status process(const clap_process *process) noexcept override;
+
+  /** Frees all voices. The NOTE_END events for them will be sent at the start of the next call to
+  process. Subclasses that override this should call the baseclass implementation. */
+  void reset() noexcept override;
+
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Voice management
+
+  /** Sets the number of voices for the built-in voice manager. The default is zero which means 
+  that the voice management is not used. This allocates memory, so call it in the constructor or
+  in activate() but never on the audio thread. */
+  void setMaxNumVoices(int newMaxNumVoices);
+
+  /** Selects what to do when a note arrives while all voices are busy. */
+  void setVoiceStealMode(VoiceManager::StealMode newMode) { voices.setStealMode(newMode); }
+
+  /** Selects how note events are timed, see NoteTiming. Use kVoiceOffsets only when your voices 
+  can start and release at frame offsets given by getNoteEventFrame(). */
+  void setNoteTiming(NoteTiming newTiming) { noteTiming = newTiming; }
+
+  /** Sets the level below which released voices are considered to be silent. At the end of each
+  process call, such voices are retired, i.e. voiceStopped() is called for them, their end is 
+  reported to the host and they are returned to the pool. That only works, if the subclass keeps 
+  the levels of the voices up to date via setVoiceLevel() in every processBlockStereo() call. A 
+  new voice has level zero until then. The default threshold of zero turns this off. */
+  void setSilenceThreshold(float newThreshold) { silenceThreshold = newThreshold; }
+
+  /** Gives read access to the voice manager, e.g. for iterating over the active voices. */
+  const VoiceManager& getVoiceManager() const { return voices; }
+
+  NoteTiming getNoteTiming() const { return noteTiming; }
+
+  /** Returns the frame within the next processBlockStereo() call at which the event that is 
+  currently being handled happens. Valid in the note and voice hooks. In kSubBlocks mode, this is
+  always zero because the sub-block starts at the event. */
+  uint32_t getNoteEventFrame() const { return noteEventFrame; }
 
+  /** Hook that is called when the given voice has been assigned to a new note. The note's key, 
+  velocity, etc. can be retrieved via getVoiceManager().getVoice(voice). */
+  virtual void voiceStarted(int voice) {}
+
+  /** Hook that is called when the note played by the given voice was released. The voice should 
+  enter its release phase and call voiceFinished() when it's done. */
+  virtual void voiceReleased(int voice) {}
+
+  /** Hook that is called when the given voice is cut off immediately because it gets stolen by 
+  another note or because of a CLAP_EVENT_NOTE_CHOKE. The voice is freed right after this call 
+  and, in case of stealing, voiceStarted() will follow soon for the same index. */
+  virtual void voiceStopped(int voice) {}
+
+  /** Subclasses must call this when a voice has finished its release phase and has become 
+  silent. It returns the voice to the pool of free voices and reports the end of the note to the
+  host via a CLAP_EVENT_NOTE_END. The frame is the sample offset within the buffer of the current
+  processBlockStereo call at which the voice has ended. */
+  void voiceFinished(int voice, uint32_t frame = 0);
+
+  /** Subclasses that use the silence threshold or the kStealQuietest mode should report the 
+  current output level of their voices via this function, e.g. once per block. The level can be
+  anything that's proportional to the loudness like the envelope times the amplitude. */
+  void setVoiceLevel(int voice, float level) { voices.setLevel(voice, level); }
+
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Note expressions
+
+  /** Sets the smoothing time for the note expressions in samples. Call it in activate(). */
+  void setNoteExpressionSmoothing(float samples) { expressions.setSmoothingTime(samples); }
+
+  /** Gives read access to the per-voice note expressions. Their values are valid after 
+  advanceNoteExpressions() was called for the current block. */
+  const NoteExpressions& getNoteExpressions() const { return expressions; }
 
 
 protected:
 
+  /** Dispatches note-on, note-off and choke events from all dialects to the noteOn/noteOff hooks 
+  and to the voice manager. Values of -1 are wildcards in the off and choke functions. */
+  void startNote(int16_t key, double velocity, int32_t noteId, int16_t port, int16_t channel);
+  void releaseNotes(int16_t key, int32_t noteId, int16_t port, int16_t channel);
+  void chokeNotes(int16_t key, int32_t noteId, int16_t port, int16_t channel);
+
+  /** Dispatches a decoded MIDI message to the note functions above or to midiControlEvent. The 
+  channel mode messages all-sound-off (120), reset-all-controllers (121) and all-notes-off (123) 
+  are handled here before they are passed on. The port is the port_index of the MIDI event. */
+  void handleMidiMessage(const MidiDecoder::Event& event, int16_t port);
+
+  /** Reports the end of the note played by the given voice to the host at the given frame within
+  the current process call. Outside of process, the event is queued and sent at frame 0 of the 
+  next call. */
+  void sendNoteEnd(int voice, uint32_t frame);
+
+  /** In kVoiceOffsets mode, we don't split the block at the note events that can be scheduled at
+  a frame offset. */
+  bool needsBlockSplit(const clap_event_header_t* hdr) const override;
+
+  /** Returns true, if a note-on with the given key and channel would steal a voice. */
+  bool wouldSteal(int key, int channel) const
+  {
+    return voices.getCapacity() > 0 && voices.getVoiceToSteal(key, channel) != -1;
+  }
+
+  /** Retires all released voices whose level is below the silence threshold. Their ends are 
+  reported at the given frame. */
+  void retireSilentVoices(uint32_t frame);
+
+  /** Computes the ramps of the note expressions for the current block. Subclasses that want to 
+  respond to CLAP_EVENT_NOTE_EXPRESSION should call this at the start of processBlockStereo and 
+  then read the ramps from getNoteExpressions(). */
+  void advanceNoteExpressions(uint32_t numFrames) { expressions.advance((int) numFrames); }
+
+  /** Sets the target of the given expression for all voices that match the given note. */
+  void setNoteExpression(int32_t expressionId, double value, int16_t key, int32_t noteId, 
+    int16_t port, int16_t channel);
+
+  VoiceManager    voices;
+  MidiDecoder     midi;
+  NoteExpressions expressions;
+
+
+private:
+
+  // For the NOTE_END events. The queue is for voices that end outside of process (e.g. in reset).
+  // No voice can start outside of process, so it never needs more entries than we have voices:
+  const clap_output_events* outEvents = nullptr;
+  uint32_t numFramesInProcess = 0;
+  std::vector<clap_event_note> pendingNoteEnds;
+  int numPendingNoteEnds = 0;
+
+  float silenceThreshold = 0.f;
+
+  NoteTiming noteTiming     = kSubBlocks;
+  uint32_t   noteEventFrame = 0;
 
 };
 
@@ -9,12 +9,16 @@ the code, you need to exclude them from the build. */
 // Standard library includes:
 #include <vector>
 #include <string>
-#include <sstream>       // ostringstream
-#include <iomanip>       // setprecision
+#include <initializer_list>
+#include <charconv>      // to_chars, from_chars
 #include <limits>        // numeric_limits
 #include <algorithm>     // min, max
 //#include <cassert>       // assert - obsoloete now - we now use clapAssert
 #include <cstring>       // strcmp
+#include <cmath>         // isfinite
+#include <cctype>        // tolower
+#include <atomic>        // atomic, for the lock-free state handoff
+#include <thread>        // this_thread::yield
 
 // The CLAP SDK:
 #include "../clap/include/clap/clap.h"   // Only the stable API, no draft extensions.
@@ -4,46 +4,136 @@ int toStringWithSuffix(double value, char* dest, int size, int numDigits, const
   if(dest == nullptr || size < 1)
     return -1;   // -1 indicates error just like in sprintf_s
 
-  // Crate a temporary std::string using ostringstream:
-  std::ostringstream os;
-  os.precision(numDigits);
-  if(abs(value) <= 1.e15)         // Use fixed point notation for numbers with abs <= 10^15
-    os << std::fixed;
-  os << value;
-  std::string str = os.str(); 
-  if(suffix != nullptr)
-    str += suffix;
+  // Write the number into a temporary buffer on the stack. It's big enough for up to 16 digits
+  // before the dot (we switch to exponential notation for numbers with abs > 10^15), a sign, the 
+  // dot and up to 30 digits after the dot:
+  char tmp[64];
+  numDigits = clip(numDigits, 0, 30);
+  std::to_chars_result res;
+  if(std::abs(value) <= 1.e15)       // Use fixed point notation for numbers with abs <= 10^15
+    res = std::to_chars(tmp, tmp + 64, value, std::chars_format::fixed,   numDigits);
+  else
+    res = std::to_chars(tmp, tmp + 64, value, std::chars_format::general, numDigits);
+  int length = res.ec == std::errc() ? (int) (res.ptr - tmp) : 0;
 
-  // Copy (an initial section of) the temporary string into the destination buffer:
-  const char* cStr = str.c_str();
-  int nullPos = std::min(size-1, (int)str.size());  // Position of terminating null
-  for(int i = 0; i < nullPos; i++)
-    dest[i] = cStr[i];
+  // Copy (an initial section of) the number and the suffix into the destination buffer:
+  int nullPos = 0;                // Position of terminating null
+  for(int i = 0; i < length && nullPos < size-1; i++)
+    dest[nullPos++] = tmp[i];
+  if(suffix != nullptr)
+    for(int i = 0; suffix[i] != '\0' && nullPos < size-1; i++)
+      dest[nullPos++] = suffix[i];
   dest[nullPos] = '\0';
   return nullPos;
 
   // Notes:
   //
-  // -The use of std::ostringstream makes the implementation somewhat slow compared to a less safe
-  //  solution using a function from the sprintf family. In the future with C++20, we may switch to
-  //  std::format. For the time being, I think, this is OK. Conversion of doubles to strings is 
-  //  typically not performance critical in the context of audio plugins.
+  // -We used to create a temporary std::string using std::ostringstream. That was slow, allocated
+  //  memory and the formatting potentially depended on the locale. std::to_chars does none of 
+  //  that. The "general" format with the given precision produces the same output as the 
+  //  ostringstream did without std::fixed, e.g. 1e+20.
 
   // See:
-  // https://learn.microsoft.com/en-us/cpp/c-runtime-library/reference/sprintf-s-sprintf-s-l-swprintf-s-swprintf-s-l?view=msvc-170
-  // https://stackoverflow.com/questions/76029660/what-is-the-difference-between-sprintf-s-and-snprintf
-  // Whoa!:
-  // snprintf will truncate but sprintf_s will call a handler which, by default, will raise an 
-  // exception and (most likely) terminate the program.
-  //
+  // https://en.cppreference.com/w/cpp/utility/to_chars
   // https://stackoverflow.com/questions/1505986/sprintf-s-with-a-buffer-too-small
   // https://www.ryanjuckett.com/printing-floating-point-numbers/
+}
+
+/** Returns the power of 10 (divided by 3) for the given SI prefix, e.g. 1 for k (kilo) and -1 for
+m (milli), or zero if the character is not an SI prefix. */
+static int siPrefixExponent(char c)
+{
+  switch(c)
+  {
+  case 'p': return -4;
+  case 'n': return -3;
+  case 'u': return -2;
+  case 'm': return -1;
+  case 'k': return +1;
+  case 'K': return +1;
+  case 'M': return +2;
+  case 'G': return +3;
+  case 'T': return +4;
+  }
+  return 0;
+}
+
+/** Returns true, iff the first n characters of the two strings match case-insensitively. */
+static bool equalsIgnoreCase(const char* a, const char* b, size_t n)
+{
+  for(size_t i = 0; i < n; i++)
+    if(std::tolower((unsigned char) a[i]) != std::tolower((unsigned char) b[i]))
+      return false;
+  return true;
+}
+
+bool fromStringWithSuffix(const char* str, double* value, const char* suffix)
+{
+  auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; };
+  auto fail    = [&]() { *value = 0.0; return false; };
+  if(str == nullptr)
+    return fail();
 
-  // This says something about stringstream using locale information - could that mean that on some
-  // machines, we get commas instead of dots? That would break state recall!!
-  // http://cplusplus.bordoon.com/speeding_up_string_conversions.html
-  // https://mariusbancila.ro/blog/2023/09/12/formatting-text-in-c-the-old-and-the-new-ways/
-  // https://iq.opengenus.org/convert-double-to-string-in-cpp/
+  // Trim the string and the unit, i.e. the suffix without its spaces:
+  const char* end = str + strlen(str);
+  while(str < end && isSpace(*str))     str++;
+  while(end > str && isSpace(end[-1]))  end--;
+  const char* unit    = suffix != nullptr ? suffix : "";
+  const char* unitEnd = unit + strlen(unit);
+  while(unit < unitEnd && isSpace(*unit))        unit++;
+  while(unitEnd > unit && isSpace(unitEnd[-1]))  unitEnd--;
+  size_t unitLength = unitEnd - unit;
+
+  // Parse the number. std::from_chars doesn't accept a leading plus sign, so we skip it:
+  if(str < end && *str == '+' && str+1 < end && str[1] != '-')
+    str++;
+  double x;
+  std::from_chars_result res = std::from_chars(str, end, x);
+  if(res.ec != std::errc() || !std::isfinite(x))
+    return fail();
+
+  // Parse the remainder which may consist of an optional SI prefix and the optional unit. We 
+  // first check for the unit alone such that a unit like "m" (meters) isn't mistaken for a prefix:
+  const char* p = res.ptr;
+  while(p < end && isSpace(*p))
+    p++;
+  auto isUnit = [&](const char* q)
+  { 
+    return q == end || ((size_t)(end-q) == unitLength && equalsIgnoreCase(q, unit, unitLength));
+  };
+  if(isUnit(p))
+  {
+    *value = x;
+    return true;
+  }
+  int exponent = siPrefixExponent(*p);
+  int prefixLength = 1;
+  if(end-p >= 2 && (unsigned char) p[0] == 0xC2 && (unsigned char) p[1] == 0xB5)
+  {
+    exponent = -2;                      // The micro sign in UTF-8
+    prefixLength = 2;
+  }
+  p += prefixLength;
+  while(p < end && isSpace(*p))
+    p++;
+  if(exponent == 0 || !isUnit(p))
+    return fail();
+  static const double powers[5] = { 1.0, 1.e3, 1.e6, 1.e9, 1.e12 };
+  if(exponent > 0) *value = x * powers[ exponent];
+  else             *value = x / powers[-exponent];
+  return true;
+
+  // Notes:
+  //
+  // -Spaces between number, prefix and unit are optional, i.e. "2.5kHz", "2.5 kHz", "2.5k Hz" 
+  //  all work. The latter is what toStringWithSuffix would produce for a value 2.5 with suffix 
+  //  "k Hz".
+  // -Without a unit, a trailing "m" is interpreted as milli which may be surprising in contexts 
+  //  where the unit is e.g. meters and the user leaves out the space. Plugins with such units 
+  //  should pass the unit as suffix.
+  // -For the small prefixes, we divide by a power of 10 rather than multiplying by the inverse 
+  //  because the inverse isn't exactly representable. That way, "50 ms" gives the same double as
+  //  "0.05 s".
 }
 
 int copyString(const char* src, char* dst, int dstSize)
@@ -80,6 +170,547 @@ int findString(const std::vector<std::string>& strings, const char* stringToFind
   return -1;  // -1 Encodes "not found".
 }
 
+uint32_t hashString(const char* str)
+{
+  uint32_t hash = 2166136261u;          // FNV offset basis
+  while(*str != '\0')
+  {
+    hash ^= (uint8_t) *str++;
+    hash *= 16777619u;                  // FNV prime
+  }
+  return hash;
+}
+
+//=================================================================================================
+
+void encodeUint32(uint32_t value, char* dst)
+{
+  for(int i = 0; i < 4; i++)
+    dst[i] = (char) ((value >> (8*i)) & 0xff);
+}
+
+void encodeDouble(double value, char* dst)
+{
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));  // Type punning without violating strict aliasing
+  for(int i = 0; i < 8; i++)
+    dst[i] = (char) ((bits >> (8*i)) & 0xff);
+}
+
+uint32_t decodeUint32(const char* src)
+{
+  uint32_t value = 0;
+  for(int i = 0; i < 4; i++)
+    value |= ((uint32_t) (uint8_t) src[i]) << (8*i);
+  return value;
+}
+
+double decodeDouble(const char* src)
+{
+  uint64_t bits = 0;
+  for(int i = 0; i < 8; i++)
+    bits |= ((uint64_t) (uint8_t) src[i]) << (8*i);
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+//=================================================================================================
+
+// Constants of the compressed format. A compressed block is a sequence of "sequences". Each of them
+// consists of a token byte, the literals (i.e. bytes that are copied verbatim) and a match (i.e. a 
+// back reference to earlier output). The high nibble of the token is the number of literals and 
+// the low nibble is the match length minus lzMinMatch. A nibble value of 15 means that more length 
+// bytes follow: each of them adds its value and a value of 255 means that yet another one follows.
+// The match is given by a 16 bit offset which is stored after the literals. The last sequence of a
+// block has only literals.
+static const size_t   lzMinMatch     = 4;
+static const size_t   lzLastLiterals = 5;       // The last bytes of a block are always literals
+static const size_t   lzMaxOffset    = 65535;
+static const int      lzHashBits     = 12;
+static const uint32_t lzHashSize     = 1 << lzHashBits;
+
+static inline uint32_t lzRead32(const uint8_t* p)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static inline uint32_t lzHash(uint32_t sequence)
+{
+  return (sequence * 2654435761u) >> (32 - lzHashBits);
+}
+
+static inline bool lzWriteLength(size_t length, uint8_t*& out, const uint8_t* outEnd)
+{
+  while(length >= 255)
+  {
+    if(out >= outEnd) return false;
+    *out++ = 255;
+    length -= 255;
+  }
+  if(out >= outEnd) return false;
+  *out++ = (uint8_t) length;
+  return true;
+}
+
+static inline bool lzReadLength(size_t* length, const uint8_t*& in, const uint8_t* inEnd)
+{
+  uint8_t b;
+  do
+  {
+    if(in >= inEnd) return false;
+    b = *in++;
+    *length += b;
+  } while(b == 255);
+  return true;
+}
+
+/** Writes a sequence with the given literals and match. A matchLength of 0 means no match. */
+static bool lzWriteSequence(const uint8_t* literals, size_t numLiterals, size_t offset, 
+  size_t matchLength, uint8_t*& out, const uint8_t* outEnd)
+{
+  if(out >= outEnd) return false;
+  uint8_t* token = out++;
+  *token = (uint8_t) (std::min(numLiterals, (size_t) 15) << 4);
+  if(numLiterals >= 15 && !lzWriteLength(numLiterals - 15, out, outEnd))
+    return false;
+  if((size_t) (outEnd - out) < numLiterals)
+    return false;
+  if(numLiterals > 0)
+    memcpy(out, literals, numLiterals);
+  out += numLiterals;
+  if(matchLength == 0)
+    return true;
+
+  if(outEnd - out < 2) return false;
+  *out++ = (uint8_t) (offset & 0xff);
+  *out++ = (uint8_t) (offset >> 8);
+  size_t m = matchLength - lzMinMatch;
+  *token |= (uint8_t) std::min(m, (size_t) 15);
+  if(m >= 15 && !lzWriteLength(m - 15, out, outEnd))
+    return false;
+  return true;
+}
+
+size_t lzCompress(const char* src, size_t srcSize, char* dst, size_t dstCapacity)
+{
+  const uint8_t* in     = (const uint8_t*) src;
+  uint8_t*       out    = (uint8_t*) dst;
+  const uint8_t* outEnd = out + dstCapacity;
+
+  uint32_t table[lzHashSize];            // Positions plus 1 of recent sequences, 0 means empty
+  memset(table, 0, sizeof(table));
+
+  size_t pos    = 0;                     // Current read position
+  size_t anchor = 0;                     // Start of the pending literals
+  size_t limit  = srcSize > lzLastLiterals ? srcSize - lzLastLiterals : 0;
+  while(pos + lzMinMatch <= limit)
+  {
+    uint32_t seq  = lzRead32(&in[pos]);
+    uint32_t h    = lzHash(seq);
+    size_t   cand = table[h];
+    table[h] = (uint32_t) pos + 1;
+    if(cand == 0 || pos - (cand-1) > lzMaxOffset || lzRead32(&in[cand-1]) != seq)
+    {
+      pos += 1 + ((pos - anchor) >> 6);  // Skip faster through incompressible data
+      continue;
+    }
+
+    // We have found a match. Extend it as far as possible and emit the sequence:
+    size_t match  = cand - 1;
+    size_t length = lzMinMatch;
+    while(pos + length < limit && in[match + length] == in[pos + length])
+      length++;
+    if(!lzWriteSequence(&in[anchor], pos - anchor, pos - match, length, out, outEnd))
+      return 0;
+    pos   += length;
+    anchor = pos;
+  }
+
+  // Emit the remaining bytes as literals:
+  if(!lzWriteSequence(&in[anchor], srcSize - anchor, 0, 0, out, outEnd))
+    return 0;
+  return (size_t) (out - (uint8_t*) dst);
+
+  // Notes:
+  //
+  // -The hash table has only one entry per slot, i.e. we only ever try the most recent occurrence
+  //  of a 4 byte sequence. That finds fewer and shorter matches than a search through a chain of 
+  //  candidates but it's much faster.
+  // -When we don't find matches for a while, we increase the step size. That makes compressing 
+  //  incompressible data (like noise) cheap. The step size resets after each match.
+  // -The table lives on the stack (16 KB), so the function is reentrant and doesn't allocate.
+}
+
+bool lzDecompress(const char* src, size_t srcSize, char* dst, size_t dstSize)
+{
+  const uint8_t* in     = (const uint8_t*) src;
+  const uint8_t* inEnd  = in + srcSize;
+  uint8_t*       out    = (uint8_t*) dst;
+  uint8_t*       outEnd = out + dstSize;
+
+  while(in < inEnd)
+  {
+    uint8_t token = *in++;
+
+    // Copy the literals:
+    size_t numLiterals = token >> 4;
+    if(numLiterals == 15 && !lzReadLength(&numLiterals, in, inEnd))
+      return false;
+    if((size_t) (inEnd - in) < numLiterals || (size_t) (outEnd - out) < numLiterals)
+      return false;
+    if(numLiterals > 0)
+      memcpy(out, in, numLiterals);
+    in  += numLiterals;
+    out += numLiterals;
+    if(in == inEnd)
+      break;                             // The last sequence has no match
+
+    // Copy the match:
+    if(inEnd - in < 2)
+      return false;
+    size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    size_t length = token & 15;
+    if(length == 15 && !lzReadLength(&length, in, inEnd))
+      return false;
+    length += lzMinMatch;
+    if(offset == 0 || offset > (size_t) (out - (uint8_t*) dst) || (size_t)(outEnd - out) < length)
+      return false;
+    const uint8_t* match = out - offset;
+    if(offset >= length)
+      memcpy(out, match, length);
+    else
+      for(size_t i = 0; i < length; i++) // Overlapping copy, repeats the last "offset" bytes
+        out[i] = match[i];
+    out += length;
+  }
+  return out == outEnd;
+}
+
+//=================================================================================================
+
+bool ClapStreamWriter::write(const void* data, size_t size)
+{
+  if(size == 0)
+    return !error;     // data may be a nullptr then, e.g. from an empty std::vector
+  const char* src = (const char*) data;
+  if(numUsed + size <= bufSize)
+  {
+    // The data fits into our buffer - just collect it there:
+    memcpy(&buf[numUsed], src, size);
+    numUsed += size;
+    return !error;
+  }
+
+  // The data doesn't fit. Pass on what we have so far and then either collect the new data in the
+  // now empty buffer or, if it's too big for that, pass it on directly:
+  if(!flush())
+    return false;
+  if(size < bufSize)
+  {
+    memcpy(buf, src, size);
+    numUsed = size;
+    return true;
+  }
+  return writeToStream(src, size);
+}
+
+bool ClapStreamWriter::flush()
+{
+  bool ok = writeToStream(buf, numUsed);
+  numUsed = 0;
+  return ok;
+}
+
+bool ClapStreamWriter::writeToStream(const char* data, size_t size)
+{
+  size_t written = 0;
+  while(written < size && !error)
+  {
+    int64_t n = stream->write(stream, &data[written], size-written);
+    if(n <= 0)
+      error = true;      // -1 indicates an error. 0 would make us loop forever, so we bail out
+    else
+      written += (size_t) n;
+  }
+  return !error;
+
+  // Notes:
+  //
+  // -Hosts may limit the number of bytes that can be written per call, so we need the loop. See 
+  //  the comment at the top of stream.h.
+}
+
+//-------------------------------------------------------------------------------------------------
+
+bool ClapStreamReader::read(void* dst, size_t size)
+{
+  char* d = (char*) dst;
+
+  // Deliver what we have in our buffer:
+  size_t numBuffered = std::min(size, numValid - readPos);
+  if(numBuffered > 0)  // d may be a nullptr when size is zero, e.g. from an empty std::vector
+    memcpy(d, &buf[readPos], numBuffered);
+  readPos += numBuffered;
+  d       += numBuffered;
+  size    -= numBuffered;
+  if(size == 0)
+    return true;
+
+  // The buffer is exhausted. Big requests go directly to the stream, small ones through the 
+  // buffer:
+  if(size >= bufSize)
+  {
+    while(size > 0 && !endOfStream && !error)
+    {
+      int64_t n = stream->read(stream, d, size);
+      if(n < 0)       error = true;
+      else if(n == 0) endOfStream = true;
+      else          { d += n; size -= (size_t) n; }
+    }
+    return size == 0;
+  }
+  if(!fill(size))
+    return false;
+  memcpy(d, &buf[readPos], size);
+  readPos += size;
+  return true;
+}
+
+bool ClapStreamReader::readUint32(uint32_t* value)
+{
+  char b[4];
+  if(!read(b, 4))
+    return false;
+  *value = decodeUint32(b);
+  return true;
+}
+
+bool ClapStreamReader::readDouble(double* value)
+{
+  char b[8];
+  if(!read(b, 8))
+    return false;
+  *value = decodeDouble(b);
+  return true;
+}
+
+bool ClapStreamReader::peek(void* dst, size_t size)
+{
+  clapAssert(size <= bufSize);
+  if(!fill(size))
+    return false;
+  memcpy(dst, &buf[readPos], size);
+  return true;
+}
+
+bool ClapStreamReader::isAtEnd()
+{
+  return !fill(1);
+}
+
+bool ClapStreamReader::fill(size_t size)
+{
+  if(numValid - readPos >= size)
+    return true;
+  if(size > bufSize)
+    return false;
+
+  // Move the unconsumed bytes to the front and top the buffer up from the stream:
+  numValid -= readPos;
+  memmove(buf, &buf[readPos], numValid);
+  readPos = 0;
+  while(numValid < size && !endOfStream && !error)
+  {
+    int64_t n = stream->read(stream, &buf[numValid], bufSize - numValid);
+    if(n < 0)       error = true;
+    else if(n == 0) endOfStream = true;    // 0 indicates the end of the stream
+    else            numValid += (size_t) n;
+  }
+  return numValid >= size;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+int64_t StringOutStream::writeToString(
+  const clap_ostream* stream, const void* buffer, uint64_t size)
+{
+  StringOutStream* self = (StringOutStream*) stream->ctx;
+  self->str->append((const char*) buffer, (size_t) size);
+  return (int64_t) size;
+}
+
+int64_t StringInStream::readFromString(const clap_istream* stream, void* buffer, uint64_t size)
+{
+  StringInStream* self = (StringInStream*) stream->ctx;
+  size_t numToRead = std::min((size_t) size, self->str.size() - self->pos);
+  memcpy(buffer, &self->str[self->pos], numToRead);
+  self->pos += numToRead;
+  return (int64_t) numToRead;
+}
+
+//-------------------------------------------------------------------------------------------------
+
+const char CompressedOutStream::magic[4] = { 'R', 'C', 'S', 'Z' };
+
+CompressedOutStream::CompressedOutStream(const clap_ostream* streamToWriteTo) 
+  : writer(streamToWriteTo)
+{
+  _stream.ctx   = this;
+  _stream.write = CompressedOutStream::writeToBlock;
+  block.resize(blockSize);
+  packed.resize(lzCompressBound(blockSize));
+}
+
+bool CompressedOutStream::finish()
+{
+  bool ok = true;
+  if(numUsed > 0 || !headerWritten)
+    ok &= writeBlock();
+  ok &= writer.writeUint32(0);           // The empty block terminates the data
+  ok &= writer.writeUint32(0);
+  ok &= writer.flush();
+  return ok;
+}
+
+bool CompressedOutStream::isCompressed(const char* data, size_t size)
+{
+  return size >= 4 && memcmp(data, magic, 4) == 0;
+}
+
+int64_t CompressedOutStream::writeToBlock(
+  const clap_ostream* stream, const void* buffer, uint64_t size)
+{
+  CompressedOutStream* self = (CompressedOutStream*) stream->ctx;
+  const char* src = (const char*) buffer;
+  uint64_t remaining = size;
+  while(remaining > 0)
+  {
+    size_t n = std::min((size_t) remaining, blockSize - self->numUsed);
+    memcpy(&self->block[self->numUsed], src, n);
+    self->numUsed += n;
+    src           += n;
+    remaining     -= n;
+    if(self->numUsed == blockSize && !self->writeBlock())
+      return -1;
+  }
+  return (int64_t) size;
+}
+
+bool CompressedOutStream::writeBlock()
+{
+  if(!headerWritten)
+  {
+    writer.write(magic, 4);
+    writer.writeUint32(version);
+    headerWritten = true;
+  }
+  if(numUsed == 0)
+    return !writer.hasError();
+
+  size_t packedSize = lzCompress(block.data(), numUsed, packed.data(), numUsed - 1);
+  writer.writeUint32((uint32_t) numUsed);
+  if(packedSize > 0)
+  {
+    writer.writeUint32((uint32_t) packedSize);
+    writer.write(packed.data(), packedSize);
+  }
+  else
+  {
+    writer.writeUint32((uint32_t) numUsed); // Didn't get smaller - store it uncompressed
+    writer.write(block.data(), numUsed);
+  }
+  numUsed = 0;
+  return !writer.hasError();
+
+  // Notes:
+  //
+  // -We give lzCompress a buffer that is one byte smaller than the block, so it fails when the 
+  //  compressed data doesn't get smaller. That's what makes the equal sizes unambiguous.
+}
+
+//-------------------------------------------------------------------------------------------------
+
+CompressedInStream::CompressedInStream(ClapStreamReader* readerToReadFrom) 
+  : reader(readerToReadFrom)
+{
+  _stream.ctx  = this;
+  _stream.read = CompressedInStream::readFromBlock;
+}
+
+bool CompressedInStream::finish()
+{
+  while(!atEnd && !error)
+  {
+    readPos = numValid;
+    if(!readBlock() && !atEnd)
+      error = true;
+  }
+  return !error;
+}
+
+int64_t CompressedInStream::readFromBlock(const clap_istream* stream, void* buffer, uint64_t size)
+{
+  CompressedInStream* self = (CompressedInStream*) stream->ctx;
+  while(self->readPos == self->numValid)
+  {
+    if(self->error)
+      return -1;
+    if(self->atEnd)
+      return 0;
+    if(!self->readBlock() && !self->atEnd)
+      self->error = true;
+  }
+  size_t n = std::min((size_t) size, self->numValid - self->readPos);
+  memcpy(buffer, &self->block[self->readPos], n);
+  self->readPos += n;
+  return (int64_t) n;
+}
+
+bool CompressedInStream::readBlock()
+{
+  if(!headerRead)
+  {
+    char m[4];
+    uint32_t v;
+    if(!reader->read(m, 4) || !CompressedOutStream::isCompressed(m, 4) || !reader->readUint32(&v)
+      || v > CompressedOutStream::version)
+      return false;
+    headerRead = true;
+  }
+
+  uint32_t rawSize, storedSize;
+  if(!reader->readUint32(&rawSize) || !reader->readUint32(&storedSize))
+    return false;
+  if(rawSize == 0 && storedSize == 0)
+  {
+    atEnd = true;
+    return false;
+  }
+  if(rawSize == 0 || rawSize > CompressedOutStream::blockSize || storedSize > rawSize)
+    return false;                        // Malformed - don't let it make us allocate any memory
+
+  block.resize(CompressedOutStream::blockSize);
+  readPos  = 0;
+  numValid = 0;
+  if(storedSize == rawSize)
+  {
+    if(!reader->read(block.data(), rawSize))
+      return false;
+  }
+  else
+  {
+    packed.resize(CompressedOutStream::blockSize);
+    if(!reader->read(packed.data(), storedSize) 
+      || !lzDecompress(packed.data(), storedSize, block.data(), rawSize))
+      return false;
+  }
+  numValid = rawSize;
+  return true;
+}
 
 //=================================================================================================
 
@@ -105,21 +736,18 @@ bool IndexIdentifierMap::isConsistent() const
   if(indices.size() != identifiers.size())
     return false;
 
-  // Check the consistency conditions for defining a bijective map:
+  // In both of our arrays, each number from 0 to N-1 must occur exactly once:
   int N = getNumEntries();
+  if(!isPermutation(indices.data(), N) || !isPermutation(identifiers.data(), N))
+    return false;
+
+  // When mapping from index to id and back (or vice versa), we should get our original number
+  // back for every i in 0..N-1:
   for(int i = 0; i < N; i++)
   {
-    // In both of our arrays, each number from 0 to N-1 must occur exactly once:
-    int count1 = countOccurrences(&indices[0],     N, (uint32_t) i);
-    int count2 = countOccurrences(&identifiers[0], N, (clap_id)  i);
-    if(count1 != 1 || count2 != 1)
-      return false;
-
-    // When mapping from index to id and back (or vice versa), we should get our original number
-    // back for every i in 0..N-1:
     int j = identifiers[indices[i]];
     int k = indices[identifiers[i]];
-    if(j != i || j != i)
+    if(j != i || k != i)
       return false;
   }
   
@@ -127,7 +755,1158 @@ bool IndexIdentifierMap::isConsistent() const
 }
 
 
+//=================================================================================================
+
+ChoiceStrings::ChoiceStrings(std::initializer_list<const char*> initStrings, bool caseSens)
+  : caseSensitive(caseSens)
+{
+  for(const char* str : initStrings)
+    strings.push_back(str);
+  buildIndex();
+}
+
+ChoiceStrings::ChoiceStrings(const std::vector<std::string>& initStrings, bool caseSens)
+  : strings(initStrings), caseSensitive(caseSens)
+{
+  buildIndex();
+}
+
+int ChoiceStrings::find(const char* str) const
+{
+  if(str == nullptr || slots.empty())
+    return -1;
+  uint32_t h = hash(str);
+  for(uint32_t i = h & mask; ; i = (i+1) & mask)
+  {
+    const Slot& s = slots[i];
+    if(s.index == -1)
+      return -1;                        // An empty slot ends the probe sequence
+    if(s.hash == h && equals(strings[s.index].c_str(), str))
+      return s.index;
+  }
+
+  // Notes:
+  //
+  // -The loop always terminates because the table is at most half full, so there are always 
+  //  empty slots.
+  // -The full hash is stored in the slots such that we only need to do the string comparison when
+  //  the hashes match, which is usually only the case for the string that we are looking for.
+}
+
+bool ChoiceStrings::isConsistent() const
+{
+  for(int i = 0; i < getNumStrings(); i++)
+    if(find(strings[i].c_str()) != i)   // Fails also when an earlier string is equal
+      return false;
+  return true;
+}
+
+void ChoiceStrings::buildIndex()
+{
+  // Use a table size that is a power of 2 and at least twice the number of strings to keep the 
+  // probe sequences short:
+  size_t size = 4;
+  while(size < 2 * strings.size())
+    size *= 2;
+  slots.assign(size, Slot());
+  mask = (uint32_t) size - 1;
+
+  for(int k = 0; k < getNumStrings(); k++)
+  {
+    uint32_t h = hash(strings[k].c_str());
+    uint32_t i = h & mask;
+    while(slots[i].index != -1)
+      i = (i+1) & mask;
+    slots[i].hash  = h;
+    slots[i].index = k;
+  }
+}
+
+uint32_t ChoiceStrings::hash(const char* str) const
+{
+  if(caseSensitive)
+    return hashString(str);
+  uint32_t h = 2166136261u;             // FNV-1a as in hashString but on lowercase characters
+  while(*str != '\0')
+  {
+    h ^= (uint8_t) std::tolower((unsigned char) *str++);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+bool ChoiceStrings::equals(const char* a, const char* b) const
+{
+  if(caseSensitive)
+    return strcmp(a, b) == 0;
+  size_t n = strlen(a);
+  return n == strlen(b) && equalsIgnoreCase(a, b, n);
+}
+
+
 
+//=================================================================================================
+
+ParameterMapping::ParameterMapping(Curve newCurve, double newOutMin, double newOutMax, 
+  double newSkew) : curve(newCurve), outMin(newOutMin), outMax(newOutMax), skew(newSkew)
+{
+  clapAssert(curve != kExponential || (outMin > 0.0 && outMax > 0.0)); // Needs positive range
+  clapAssert(curve != kSkewed || skew > 0.0);
+  updateCoeffs();
+}
+
+void ParameterMapping::setInputRange(double newInMin, double newInMax)
+{
+  inMin = newInMin;
+  inMax = newInMax;
+  updateCoeffs();
+}
+
+double ParameterMapping::map(double x) const
+{
+  switch(curve)
+  {
+  case kLinear:      return a * x + b;
+  case kExponential: return std::exp2(a * x + b);
+  case kDecibel:     return std::exp2(a * x);
+  case kSkewed:      return c + d * std::pow(clip(a * x + b, 0.0, 1.0), skew);
+  }
+  return x;
+}
+
+void ParameterMapping::mapArray(const float* x, float* y, int N) const
+{
+  float fa = (float) a, fb = (float) b, fc = (float) c, fd = (float) d, fs = (float) skew;
+  switch(curve)
+  {
+  case kLinear:
+  {
+    for(int n = 0; n < N; n++)
+      y[n] = fa * x[n] + fb;
+  } break;
+  case kExponential:
+  {
+    for(int n = 0; n < N; n++)
+      y[n] = exp2Fast(fa * x[n] + fb);
+  } break;
+  case kDecibel:
+  {
+    for(int n = 0; n < N; n++)
+      y[n] = exp2Fast(fa * x[n]);
+  } break;
+  case kSkewed:
+  {
+    for(int n = 0; n < N; n++)
+    {
+      float t = clipFast(fa * x[n] + fb, 0.f, 1.f);
+      y[n] = fc + fd * exp2Fast(fs * log2Fast(t));
+    }
+  } break;
+  }
+
+  // Notes:
+  //
+  // -The switch is outside of the loops such that each loop is a simple, branch-free kernel that
+  //  the compiler can vectorize.
+}
+
+void ParameterMapping::updateCoeffs()
+{
+  double inScale = inMax != inMin ? 1.0 / (inMax - inMin) : 0.0;
+  switch(curve)
+  {
+  case kLinear:
+  {
+    a = (outMax - outMin) * inScale;
+    b = outMin - a * inMin;
+  } break;
+  case kExponential:
+  {
+    a = std::log2(outMax / outMin) * inScale;
+    b = std::log2(outMin) - a * inMin;
+  } break;
+  case kDecibel:
+  {
+    a = 0.16609640474436811739351597147447;  // log2(10) / 20
+    b = 0.0;
+  } break;
+  case kSkewed:
+  {
+    a = inScale;
+    b = -inMin * inScale;
+    c = outMin;
+    d = outMax - outMin;
+  } break;
+  }
+}
+
+
+//=================================================================================================
+
+void VoiceManager::setCapacity(int newCapacity)
+{
+  clapAssert(newCapacity >= 0, "Capacity must be non-negative");
+  voices.resize(newCapacity);
+  freeStack.resize(newCapacity);
+  active.resize(newCapacity);
+  activePos.resize(newCapacity);
+  reset();
+}
+
+void VoiceManager::reset()
+{
+  int N = getCapacity();
+  for(int i = 0; i < N; i++)
+  {
+    voices[i]    = Voice();
+    freeStack[i] = N-1-i;       // Voice 0 is on top of the stack and will be used first
+    activePos[i] = -1;
+  }
+  numFree    = N;
+  numActive  = 0;
+  ageCounter = 0;
+}
+
+int VoiceManager::getVoiceToSteal(int16_t key, int16_t channel) const
+{
+  // In kStealSameKey mode, a voice that plays the same key on the same channel is reused even 
+  // when there are free voices. If there are several such voices (which can happen when they were
+  // started in another mode), we take the oldest:
+  int best = -1;
+  if(stealMode == kStealSameKey)
+  {
+    for(int i = 0; i < numActive; i++)
+    {
+      const Voice& v = voices[active[i]];
+      if(v.key == key && v.channel == channel && (best == -1 || v.age < voices[best].age))
+        best = active[i];
+    }
+    if(best != -1)
+      return best;
+  }
+
+  // Nothing needs to be stolen when we have free voices:
+  if(numFree > 0 || numActive == 0)
+    return -1;
+
+  // Find the quietest voice, resolving ties by age:
+  if(stealMode == kStealQuietest)
+  {
+    best = active[0];
+    for(int i = 1; i < numActive; i++)
+    {
+      const Voice& v = voices[active[i]];
+      const Voice& b = voices[best];
+      if(v.level < b.level || (v.level == b.level && v.age < b.age))
+        best = active[i];
+    }
+    return best;
+  }
+
+  // Find the oldest voice, preferring released voices over held ones:
+  best = active[0];
+  for(int i = 1; i < numActive; i++)
+  {
+    const Voice& v = voices[active[i]];
+    const Voice& b = voices[best];
+    bool vReleased = v.state == kReleased;
+    bool bReleased = b.state == kReleased;
+    if((vReleased && !bReleased) || (vReleased == bReleased && v.age < b.age))
+      best = active[i];
+  }
+  return best;
+
+  // Notes:
+  //
+  // -The scans are O(numActive) but they happen only once per note-on and only when the pool is
+  //  exhausted (or in kStealSameKey mode). For a few hundred voices, that's negligible compared to
+  //  rendering them. The per-sample work never depends on this.
+}
+
+int VoiceManager::noteOn(int16_t key, double velocity, int32_t noteId, int16_t port, 
+  int16_t channel)
+{
+  int stolen = getVoiceToSteal(key, channel);
+  if(stolen != -1)
+    freeVoice(stolen);           // Puts it on top of the free stack so we grab it right below
+  if(numFree == 0)
+    return -1;
+
+  // Pop a voice from the free stack and append it to the active array:
+  int i = freeStack[--numFree];
+  activePos[i] = numActive;
+  active[numActive++] = i;
+
+  // Record the note information:
+  Voice& v   = voices[i];
+  v.noteId   = noteId;
+  v.port     = port;
+  v.channel  = channel;
+  v.key      = key;
+  v.velocity = velocity;
+  v.age      = ageCounter++;
+  v.level    = 0.f;
+  v.state    = kHeld;
+  return i;
+}
+
+void VoiceManager::freeVoice(int i)
+{
+  int pos = activePos[i];
+  clapAssert(pos != -1, "Voice is already free");
+  if(pos == -1)
+    return;
+
+  // Move the last active voice into the gap and push the freed voice onto the free stack:
+  int last = active[--numActive];
+  active[pos]     = last;
+  activePos[last] = pos;
+  activePos[i]    = -1;
+  freeStack[numFree++] = i;
+  voices[i].state = kFree;
+}
+
+
+//=================================================================================================
+
+MipMappedWavetable::MipMappedWavetable(Waveform newWaveform) : waveform(newWaveform)
+{
+  static const double pi = 3.1415926535897932385;
+  std::vector<double> sinTable(tableSize), sum(tableSize, 0.0);
+  for(int n = 0; n < tableSize; n++)
+    sinTable[n] = std::sin(2.0 * pi * n / tableSize);
+
+  // Start at the highest level which has only the fundamental. Each level below adds the 
+  // harmonics that it has in addition to the level above it:
+  data.resize(numLevels * levelSize);
+  int h = 1;
+  for(int l = numLevels-1; l >= 0; l--)
+  {
+    for(; h <= getNumHarmonics(l); h++)
+    {
+      double a = getHarmonicAmplitude(waveform, h);
+      if(a == 0.0)
+        continue;
+      for(int n = 0; n < tableSize; n++)
+        sum[n] += a * sinTable[(h * n) & (tableSize-1)];
+    }
+    float* t = &data[l * levelSize];
+    for(int n = 0; n < tableSize; n++)
+      t[n] = (float) sum[n];
+    t[tableSize] = t[0];
+  }
+
+  // Notes:
+  //
+  // -The phase of harmonic h at sample n is h*n/tableSize cycles, so we can take the sines from a
+  //  single table and wrap the index with a mask because tableSize is a power of 2. This makes 
+  //  the generation of all 3 waveforms take a few milliseconds rather than being dominated by the
+  //  millions of calls to sin that a naive additive synthesis would need.
+  // -We don't apply any window (like Lanczos sigma factors) to the harmonics, so the waveforms 
+  //  with jumps have the Gibbs ripple with an overshoot of about 9%. That's what a band-limited 
+  //  saw or square wave actually looks like.
+}
+
+const MipMappedWavetable& MipMappedWavetable::getShared(Waveform waveform)
+{
+  static const MipMappedWavetable tables[numWaveforms] = 
+  { 
+    MipMappedWavetable(kSaw), MipMappedWavetable(kSquare), MipMappedWavetable(kTriangle) 
+  };
+  return tables[waveform];
+
+  // Notes:
+  //
+  // -The initialization of function-local statics is thread-safe since C++11, so instances that
+  //  are created concurrently on different threads wait for the first one to finish generating 
+  //  the tables. They are destroyed when the process exits or the plugin library is unloaded.
+  // -We could also create the tables in clap_entry.init but the CLAP docs say that it should be 
+  //  fast. Creating them lazily also means that we don't spend the time and memory at all, if no
+  //  plugin that needs them is ever instantiated.
+}
+
+int MipMappedWavetable::getLevel(float increment)
+{
+  int   e;
+  float m = std::frexp(increment * (float) tableSize, &e);  // x = m * 2^e with m in [0.5, 1)
+  int   l = m == 0.5f ? e-1 : e;                            // ceil(log2(x))
+  return std::min(std::max(l, 0), numLevels-1);
+
+  // Notes:
+  //
+  // -Level l has tableSize/2 >> l harmonics, so its highest harmonic has the frequency 
+  //  increment * tableSize/2 / 2^l. For this to be <= 0.5, we need 2^l >= increment * tableSize.
+}
+
+double MipMappedWavetable::getHarmonicAmplitude(Waveform waveform, int h)
+{
+  static const double pi = 3.1415926535897932385;
+  switch(waveform)
+  {
+  case kSaw:      return -2.0 / (pi * h);                               // Rising from -1 to +1
+  case kSquare:   return h % 2 == 1 ?  4.0 / (pi * h) : 0.0;            // +1 first, then -1
+  case kTriangle: return h % 2 == 1 ? (h % 4 == 1 ? 8.0 : -8.0) / (pi * pi * h * h) : 0.0;
+  default:        return 0.0;
+  }
+
+  // Notes:
+  //
+  // -All waveforms start at phase 0 with a zero crossing (or the middle of the jump) like a sine,
+  //  so switching between a sine and these waveforms doesn't shift the phase. The triangle has 
+  //  its peak at phase 0.25 like the sine.
+}
+
+
+//=================================================================================================
+
+void SineVoiceBank::setCapacity(int newCapacity)
+{
+  clapAssert(newCapacity >= 0, "Capacity must be non-negative");
+  int numSlots = (newCapacity + maxLanes - 1) / maxLanes * maxLanes;
+  for(auto* v : { &phase, &increment, &amplitude, &envelope, &envTarget, &envCoeff, &rotRe, &rotIm,
+                  &rotCos, &rotSin })
+    v->resize(numSlots);
+  tableOffset.resize(numSlots);
+  startFrame.resize(numSlots);
+  releaseFrame.resize(numSlots);
+  pendingSlots.resize(numSlots);
+  stage.resize(numSlots);
+  slotToVoice.resize(numSlots);
+  voiceToSlot.resize(newCapacity);
+  finishedVoices.resize(newCapacity);
+  finishedFrames.resize(newCapacity);
+  reset();
+}
+
+void SineVoiceBank::setNumLanes(int newNumLanes)
+{
+  clapAssert(newNumLanes == 1 || newNumLanes == 4 || newNumLanes == 8 || newNumLanes == 16, 
+    "Unsupported number of lanes");
+  numLanes = newNumLanes;
+}
+
+void SineVoiceBank::setAttackRelease(float attackSamples, float releaseSamples)
+{
+  attackCoeff  = attackSamples  > 0.f ? std::exp(-1.f / attackSamples)  : 0.f;
+  releaseCoeff = releaseSamples > 0.f ? std::exp(-1.f / releaseSamples) : 0.f;
+}
+
+void SineVoiceBank::setOscillator(Oscillator newOscillator)
+{
+  clapAssert(newOscillator != kWavetable || wavetable != nullptr, "No wavetable set");
+  if(newOscillator == oscillator)
+    return;
+  static const double pi2 = 6.2831853071795864769;
+  for(int s = 0; s < numActive; s++)
+  {
+    if(newOscillator == kRotator)
+    {
+      rotRe[s] = (float) std::cos(pi2 * phase[s]);
+      rotIm[s] = (float) std::sin(pi2 * phase[s]);
+    }
+    else if(oscillator == kRotator)
+    {
+      double p = std::atan2(rotIm[s], rotRe[s]) / pi2;
+      phase[s] = (float) (p < 0.0 ? p + 1.0 : p);
+    }
+  }
+  oscillator = newOscillator;
+
+  // Notes:
+  //
+  // -kPolynomial and kWavetable both use the phase accumulator, so switching between them needs
+  //  no conversion.
+}
+
+void SineVoiceBank::updateIncrement(int slot)
+{
+  static const double pi2 = 6.2831853071795864769;
+  rotCos[slot] = (float) std::cos(pi2 * increment[slot]);
+  rotSin[slot] = (float) std::sin(pi2 * increment[slot]);
+  tableOffset[slot] = MipMappedWavetable::getLevel(increment[slot]) * MipMappedWavetable::levelSize;
+
+  // Notes:
+  //
+  // -We use the accurate library functions in double precision here because the frequency error 
+  //  of the rotator is directly the error of the angle of the rotation. For low frequencies, the 
+  //  absolute error of sinCycleFast would be a sizeable relative error of the angle. This is 
+  //  called only when a voice is started or changes its frequency, not per sample.
+}
+
+void SineVoiceBank::reset()
+{
+  for(size_t i = 0; i < phase.size(); i++)
+  {
+    phase[i] = increment[i] = amplitude[i] = envelope[i] = envTarget[i] = envCoeff[i] = 0.f;
+    rotRe[i] = rotIm[i] = rotCos[i] = rotSin[i] = 0.f;
+    tableOffset[i] = 0;
+    startFrame[i]   =  0;
+    releaseFrame[i] = -1;
+    stage[i] = kRelease;
+    slotToVoice[i] = -1;
+  }
+  for(size_t i = 0; i < voiceToSlot.size(); i++)
+    voiceToSlot[i] = -1;
+  numActive   = 0;
+  numFinished = 0;
+  numPending  = 0;
+  lastPendingFrame = -1;
+}
+
+void SineVoiceBank::startVoice(int voice, float inc, float amp, int frame)
+{
+  int slot = voiceToSlot[voice];
+  if(slot == -1)
+  {
+    slot = numActive++;
+    slotToVoice[slot]  = voice;
+    voiceToSlot[voice] = slot;
+    phase[slot]    = 0.f;
+    rotRe[slot]    = 1.f;
+    rotIm[slot]    = 0.f;
+    envelope[slot] = 0.f;
+    if(frame > 0)
+    {
+      startFrame[slot] = frame;
+      lastPendingFrame = std::max(lastPendingFrame, frame);
+    }
+  }
+  releaseFrame[slot] = -1;
+  increment[slot] = inc;
+  amplitude[slot] = amp;
+  updateIncrement(slot);
+  envTarget[slot] = 1.f;
+  envCoeff[slot]  = attackCoeff;
+  stage[slot]     = kAttack;
+}
+
+void SineVoiceBank::setVoiceParameters(int voice, float inc, float amp)
+{
+  int slot = voiceToSlot[voice];
+  if(slot == -1)
+    return;
+  amplitude[slot] = amp;
+  if(inc != increment[slot])
+  {
+    increment[slot] = inc;
+    updateIncrement(slot);
+  }
+}
+
+void SineVoiceBank::releaseVoice(int voice, int frame)
+{
+  int slot = voiceToSlot[voice];
+  if(slot == -1)
+    return;
+  if(frame > 0)
+  {
+    releaseFrame[slot] = frame;
+    lastPendingFrame   = std::max(lastPendingFrame, frame);
+  }
+  else
+    applyRelease(slot);
+}
+
+void SineVoiceBank::removeVoice(int voice)
+{
+  int slot = voiceToSlot[voice];
+  if(slot != -1)
+    removeSlot(slot);
+}
+
+void SineVoiceBank::removeSlot(int slot)
+{
+  int last = --numActive;
+  voiceToSlot[slotToVoice[slot]] = -1;
+  if(slot != last)
+  {
+    phase[slot]     = phase[last];
+    increment[slot] = increment[last];
+    amplitude[slot] = amplitude[last];
+    envelope[slot]  = envelope[last];
+    envTarget[slot] = envTarget[last];
+    envCoeff[slot]  = envCoeff[last];
+    rotRe[slot]     = rotRe[last];
+    rotIm[slot]     = rotIm[last];
+    rotCos[slot]    = rotCos[last];
+    rotSin[slot]    = rotSin[last];
+    tableOffset[slot] = tableOffset[last];
+    startFrame[slot]   = startFrame[last];
+    releaseFrame[slot] = releaseFrame[last];
+    stage[slot]     = stage[last];
+    slotToVoice[slot] = slotToVoice[last];
+    voiceToSlot[slotToVoice[slot]] = slot;
+  }
+
+  // Clear the last slot such that it contributes silence when it's rendered as padding lane:
+  phase[last] = increment[last] = amplitude[last] = envelope[last] = envTarget[last] = 0.f;
+  envCoeff[last]    = 0.f;
+  rotRe[last] = rotIm[last] = rotCos[last] = rotSin[last] = 0.f;
+  tableOffset[last] = 0;
+  startFrame[last]  = 0;
+  releaseFrame[last] = -1;
+  stage[last]       = kRelease;
+  slotToVoice[last] = -1;
+}
+
+void SineVoiceBank::render(float* out, int numFrames)
+{
+  numFinished = 0;
+  int start = 0;
+  while(start < numFrames)
+  {
+    int n = std::min(numFrames - start, maxChunkSize);
+    numPending = 0;
+    if(start <= lastPendingFrame)
+      collectPendingVoices(start, n);
+    switch(oscillator)
+    {
+    case kRotator:   renderChunkLanes<kRotator>(  &out[start], n, start); break;
+    case kWavetable: renderChunkLanes<kWavetable>(&out[start], n, start); break;
+    default:         renderChunkLanes<kPolynomial>(&out[start], n, start);
+    }
+    collectFinishedVoices(start + n - 1);
+    start += n;
+  }
+
+  // The frames refer to this call only. Releases that were scheduled beyond its end happen now:
+  if(lastPendingFrame >= 0)
+  {
+    for(int s = 0; s < numActive; s++)
+    {
+      if(releaseFrame[s] >= numFrames)
+        applyRelease(s);
+      startFrame[s]   =  0;
+      releaseFrame[s] = -1;
+    }
+    lastPendingFrame = -1;
+  }
+}
+
+template<SineVoiceBank::Oscillator O>
+void SineVoiceBank::renderChunkLanes(float* out, int numFrames, int chunkStart)
+{
+  // A group costs the same, no matter how many of its lanes are used. So when the voices fill 
+  // less than half of a group, narrower groups are faster:
+  int lanes = numLanes;
+  while(lanes > 4 && numActive <= lanes / 2)
+    lanes /= 2;
+
+  switch(lanes)
+  {
+  case  4: renderChunk< 4, O>(out, numFrames, chunkStart); break;
+  case  8: renderChunk< 8, O>(out, numFrames, chunkStart); break;
+  case 16: renderChunk<16, O>(out, numFrames, chunkStart); break;
+  default: renderChunkScalar(out, numFrames, chunkStart); return;  // Handles the offsets itself
+  }
+  if(numPending > 0)
+    renderPendingVoices<O>(out, numFrames, chunkStart);
+}
+
+template<int L, SineVoiceBank::Oscillator O>
+void SineVoiceBank::renderChunk(float* out, int numFrames, int chunkStart)
+{
+  for(int i = 0; i < numFrames * L; i++)
+    mix[i] = 0.f;
+
+  const float* tbl = O == kWavetable ? wavetable->getData() : nullptr;
+  for(int g = 0; g < numActive; g += L)
+  {
+    // Load the state of the group into local arrays which the compiler can keep in registers:
+    float ph[L], inc[L], amp[L], env[L], tgt[L], cf[L];
+    float re[L], im[L], rc[L], rs[L];
+    int   ofs[L];
+    for(int j = 0; j < L; j++)
+    {
+      ph[j]  = phase[g+j];     inc[j] = increment[g+j];  amp[j] = amplitude[g+j];
+      env[j] = envelope[g+j];  tgt[j] = envTarget[g+j];  cf[j]  = envCoeff[g+j];
+      re[j]  = rotRe[g+j];     im[j]  = rotIm[g+j];
+      rc[j]  = rotCos[g+j];    rs[j]  = rotSin[g+j];    ofs[j] = tableOffset[g+j];
+      if(isFrozen(g+j, chunkStart, numFrames))          // See renderPendingVoices
+      {
+        amp[j] = 0.f; inc[j] = 0.f; rc[j] = 1.f; rs[j] = 0.f; cf[j] = 1.f; tgt[j] = env[j];
+      }
+    }
+
+    // Render all lanes of the group side by side:
+    for(int n = 0; n < numFrames; n++)
+    {
+      float* m = &mix[n*L];
+      for(int j = 0; j < L; j++)
+      {
+        env[j] = tgt[j] + cf[j] * (env[j] - tgt[j]);
+        if constexpr(O == kRotator)
+        {
+          m[j] += amp[j] * env[j] * im[j];
+          float tmp = re[j] * rc[j] - im[j] * rs[j];
+          im[j]     = re[j] * rs[j] + im[j] * rc[j];
+          re[j]     = tmp;
+        }
+        else
+        {
+          if constexpr(O == kWavetable)
+            m[j] += amp[j] * env[j] * MipMappedWavetable::interpolate(&tbl[ofs[j]], ph[j]);
+          else
+            m[j] += amp[j] * env[j] * sinCycleFast(ph[j]);
+          ph[j] += inc[j];
+          ph[j] -= (float) (int) ph[j];
+        }
+      }
+    }
+
+    // Store the state back:
+    for(int j = 0; j < L; j++)
+    {
+      envelope[g+j] = env[j];
+      if constexpr(O == kRotator)
+      {
+        float k = 1.5f - 0.5f * (re[j] * re[j] + im[j] * im[j]);  // ~1/sqrt(re^2 + im^2)
+        rotRe[g+j] = k * re[j];
+        rotIm[g+j] = k * im[j];
+      }
+      else
+        phase[g+j] = ph[j];
+    }
+  }
+
+  // Sum the lanes:
+  for(int n = 0; n < numFrames; n++)
+  {
+    float sum = 0.f;
+    for(int j = 0; j < L; j++)
+      sum += mix[n*L + j];
+    out[n] = sum;
+  }
+
+  // Notes:
+  //
+  // -The last group may read up to L-1 slots beyond numActive. That's fine because the arrays 
+  //  are padded to a multiple of maxLanes and unused slots are kept at zero amplitude.
+  // -The wrap-around of the phase subtracts the integer part via a conversion to int rather than
+  //  using a comparison, see clipFast. The increment must be in 0..1.
+  // -For the rotator, the amplitude of the pair drifts by a few float epsilons per chunk. A single
+  //  Newton step for 1/sqrt around 1 (i.e. 1.5 - 0.5*x) removes that almost completely, so the 
+  //  amplitude can't run away over long notes. The rotation angle is exact to float precision, so
+  //  there is no pitch drift.
+  // -The wavetable lookups are gathers from different places in the table in each lane. Without 
+  //  gather instructions, the compiler will do them one by one, but the arithmetic around them 
+  //  still runs across the lanes.
+  // -A voice that starts or releases within the chunk or starts after it is frozen in its lane by
+  //  giving it zero amplitude and increment, a rotation by zero and an envelope that stays where 
+  //  it is. So it contributes silence and its state is left as is (up to the renormalization). 
+  //  The voices that start or release within the chunk are rendered by renderPendingVoices.
+}
+
+void SineVoiceBank::renderChunkScalar(float* out, int numFrames, int chunkStart)
+{
+  for(int n = 0; n < numFrames; n++)
+    out[n] = 0.f;
+
+  static const double pi2 = 6.2831853071795864769;
+  for(int s = 0; s < numActive; s++)
+  {
+    // The voice starts at frame n0 and releases at frame nr of this chunk, if any:
+    int n0 = std::max(startFrame[s] - chunkStart, 0);
+    int nr = releaseFrame[s] - chunkStart;
+    if(oscillator == kRotator)
+    {
+      for(int n = n0; n < numFrames; n++)
+      {
+        if(n == nr)
+          applyRelease(s);
+        envelope[s] = envTarget[s] + envCoeff[s] * (envelope[s] - envTarget[s]);
+        out[n] += amplitude[s] * envelope[s] * rotIm[s];
+        float tmp = rotRe[s] * rotCos[s] - rotIm[s] * rotSin[s];
+        rotIm[s]  = rotRe[s] * rotSin[s] + rotIm[s] * rotCos[s];
+        rotRe[s]  = tmp;
+      }
+      float k = 1.5f - 0.5f * (rotRe[s] * rotRe[s] + rotIm[s] * rotIm[s]);
+      rotRe[s] *= k;
+      rotIm[s] *= k;
+    }
+    else
+    {
+      const float* t = oscillator == kWavetable ? wavetable->getData() + tableOffset[s] : nullptr;
+      for(int n = n0; n < numFrames; n++)
+      {
+        if(n == nr)
+          applyRelease(s);
+        envelope[s] = envTarget[s] + envCoeff[s] * (envelope[s] - envTarget[s]);
+        float y = t ? MipMappedWavetable::interpolate(t, phase[s]) : (float)std::sin(pi2*phase[s]);
+        out[n] += amplitude[s] * envelope[s] * y;
+        phase[s] += increment[s];
+        phase[s] -= (float) (int) phase[s];    // Like in renderChunk, works also for increments > 1
+      }
+    }
+  }
+}
+
+template<SineVoiceBank::Oscillator O>
+void SineVoiceBank::renderPendingVoices(float* out, int numFrames, int chunkStart)
+{
+  const float* tbl = O == kWavetable ? wavetable->getData() : nullptr;
+  for(int i = 0; i < numPending; i++)
+  {
+    int s  = pendingSlots[i];
+    int n0 = std::max(startFrame[s] - chunkStart, 0);
+    int nr = releaseFrame[s] - chunkStart;
+    float ph = phase[s], inc = increment[s], amp = amplitude[s], env = envelope[s];
+    float re = rotRe[s], im = rotIm[s], rc = rotCos[s], rs = rotSin[s];
+    for(int n = n0; n < numFrames; n++)
+    {
+      if(n == nr)
+        applyRelease(s);
+      env = envTarget[s] + envCoeff[s] * (env - envTarget[s]);
+      if constexpr(O == kRotator)
+      {
+        out[n]   += amp * env * im;
+        float tmp = re * rc - im * rs;
+        im        = re * rs + im * rc;
+        re        = tmp;
+      }
+      else
+      {
+        if constexpr(O == kWavetable)
+          out[n] += amp * env * MipMappedWavetable::interpolate(&tbl[tableOffset[s]], ph);
+        else
+          out[n] += amp * env * sinCycleFast(ph);
+        ph += inc;
+        ph -= (float) (int) ph;
+      }
+    }
+    envelope[s] = env;
+    phase[s]    = ph;
+    float k  = 1.5f - 0.5f * (re * re + im * im);
+    rotRe[s] = k * re;
+    rotIm[s] = k * im;
+  }
+
+  // Notes:
+  //
+  // -The arithmetic per sample is the same as in renderChunk, so a voice sounds the same, no 
+  //  matter whether a chunk is rendered here or in the lanes.
+  // -This runs one voice at a time, but only for the few voices that have a note event in the 
+  //  chunk. All other voices keep running in the lanes over the full chunk.
+}
+
+void SineVoiceBank::collectPendingVoices(int chunkStart, int numFrames)
+{
+  for(int s = 0; s < numActive; s++)
+  {
+    if(releaseFrame[s] == chunkStart)
+      applyRelease(s);
+    bool startsInChunk   = startFrame[s]   > chunkStart && startFrame[s]   < chunkStart + numFrames;
+    bool releasesInChunk = releaseFrame[s] > chunkStart && releaseFrame[s] < chunkStart + numFrames;
+    if(startsInChunk || releasesInChunk)
+      pendingSlots[numPending++] = s;
+  }
+}
+
+void SineVoiceBank::applyRelease(int slot)
+{
+  envTarget[slot]    = 0.f;
+  envCoeff[slot]     = releaseCoeff;
+  stage[slot]        = kRelease;
+  releaseFrame[slot] = -1;
+}
+
+void SineVoiceBank::collectFinishedVoices(int frame)
+{
+  static const float threshold = 1.e-4f;   // -80 dB
+  for(int s = numActive-1; s >= 0; s--)
+  {
+    if(stage[s] == kRelease && envelope[s] < threshold)
+    {
+      finishedVoices[numFinished] = slotToVoice[s];
+      finishedFrames[numFinished] = frame;
+      numFinished++;
+      removeSlot(s);
+    }
+  }
+
+  // Notes:
+  //
+  // -We iterate backwards because removeSlot() moves the last slot into the gap, which then has 
+  //  already been checked.
+  // -The reported frame is the last one of the chunk, so it may be up to maxChunkSize-1 frames 
+  //  later than the exact sample at which the envelope crossed the threshold. 
+}
+
+
+//=================================================================================================
+
+// The columns of the rule tables are: event type, index mask, raw index mask, value shift, value 
+// mask, scale, offset, state base and state stride (see MidiDecoder::Rule).
+
+// Value word: d1 | (d2 << 7), message index: d1
+const MidiDecoder::Rule MidiDecoder::midi1Rules[16] =
+{
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNoteOff,          0x7f, 0x00,  7, 0x7f,       1.0/127,        0.0,  kScratch,              0 },
+  { kNoteOn,           0x7f, 0x00,  7, 0x7f,       1.0/127,        0.0,  kScratch,              0 },
+  { kPolyPressure,     0x7f, 0x00,  7, 0x7f,       1.0/127,        0.0,  kPolyPressures,        1 },
+  { kControlChange,    0x7f, 0x00,  7, 0x7f,       1.0/127,        0.0,  kControllers,          1 },
+  { kProgramChange,    0x00, 0x7f,  0, 0x7f,       1.0,            0.0,  kProgram,              0 },
+  { kChannelPressure,  0x00, 0x00,  0, 0x7f,       1.0/127,        0.0,  kChannelPressureState, 0 },
+  { kPitchBend,        0x00, 0x00,  0, 0x3fff,     1.0/8192,       -1.0, kPitchBendState,       0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+};
+
+// Value word: the 2nd UMP word, message index: bits 8..14 of the 1st word
+const MidiDecoder::Rule MidiDecoder::midi2Rules[16] =
+{
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+  { kNoteOff,          0x7f, 0x00, 16, 0xffff,     1.0/65535,      0.0,  kScratch,              0 },
+  { kNoteOn,           0x7f, 0x00, 16, 0xffff,     1.0/65535,      0.0,  kScratch,              0 },
+  { kPolyPressure,     0x7f, 0x00,  0, 0xffffffff, 1.0/4294967295, 0.0,  kPolyPressures,        1 },
+  { kControlChange,    0x7f, 0x00,  0, 0xffffffff, 1.0/4294967295, 0.0,  kControllers,          1 },
+  { kProgramChange,    0x00, 0x7f, 24, 0x7f,       1.0,            0.0,  kProgram,              0 },
+  { kChannelPressure,  0x00, 0x00,  0, 0xffffffff, 1.0/4294967295, 0.0,  kChannelPressureState, 0 },
+  { kPitchBend,        0x00, 0x00,  0, 0xffffffff, 1.0/2147483648, -1.0, kPitchBendState,       0 },
+  { kNone,             0x00, 0x00,  0, 0,          0.0,            0.0,  kScratch,              0 },
+};
+
+void MidiDecoder::reset()
+{
+  for(int c = 0; c < 16; c++)
+  {
+    for(int i = 0; i < kStateSize; i++)
+      state[c][i] = 0.f;
+    state[c][7]  = 100.f / 127.f;     // Volume
+    state[c][10] =  64.f / 127.f;     // Pan center
+    resetControllers(c);
+  }
+}
+
+void MidiDecoder::resetControllers(int c)
+{
+  float* s = state[c];
+  s[1]  = 0.f;                        // Modulation
+  s[11] = 1.f;                        // Expression
+  for(int i = 64; i <= 67; i++)       // Sustain, portamento, sostenuto and soft pedals
+    s[i] = 0.f;
+  for(int i = 98; i <= 101; i++)      // NRPN and RPN numbers are set to "null"
+    s[i] = 1.f;
+  for(int k = 0; k < 128; k++)
+    s[kPolyPressures + k] = 0.f;
+  s[kPitchBendState]       = 0.f;
+  s[kChannelPressureState] = 0.f;
+}
+
+inline bool MidiDecoder::apply(const Rule& r, uint8_t group, uint8_t channel, uint8_t index, 
+  uint32_t word, Event& ev)
+{
+  uint32_t raw = (word >> r.valueShift) & r.valueMask;
+  index = (index & r.indexMask) | ((uint8_t) raw & r.rawIndexMask);
+  float value = (float) (raw * r.scale + r.offset);
+  state[channel][r.stateBase + index * r.stateStride] = value;
+  ev.type    = r.type;
+  ev.group   = group;
+  ev.channel = channel;
+  ev.index   = index;
+  ev.value   = value;
+  ev.raw     = raw;
+  return r.type != kNone;
+
+  // Notes:
+  //
+  // -There are no branches here. All differences between the message types are in the table.
+  //  When the message types come in an unpredictable order, as they do from MPE controllers, 
+  //  branches on the type would be mispredicted a lot.
+}
+
+bool MidiDecoder::decodeMidi1(const uint8_t data[3], Event& ev)
+{
+  const Rule& r = midi1Rules[data[0] >> 4];
+  uint8_t  d1   = data[1] & 0x7f;
+  uint32_t word = d1 | ((data[2] & 0x7f) << 7);
+  bool ok = apply(r, 0, data[0] & 0x0f, d1, word, ev);
+  ev.type = (EventType) (ev.type - (ev.type == kNoteOn && ev.raw == 0));  // Note-on with zero 
+  return ok;                                                              // velocity -> note-off
+}
+
+bool MidiDecoder::decodeMidi2(const uint32_t data[4], Event& ev)
+{
+  uint32_t w0 = data[0];
+  uint32_t messageType = w0 >> 28;
+  uint8_t  group       = (w0 >> 24) & 0x0f;
+  if(messageType == 0x2)                                 // MIDI 1.0 channel voice message
+  {
+    uint8_t bytes[3] = { (uint8_t) (w0 >> 16), (uint8_t) (w0 >> 8), (uint8_t) w0 };
+    bool ok = decodeMidi1(bytes, ev);
+    ev.group = group;
+    return ok;
+  }
+  if(messageType != 0x4)                                 // Not a MIDI 2.0 channel voice message
+  {
+    ev.type = kNone;
+    return false;
+  }
+  const Rule& r = midi2Rules[(w0 >> 20) & 0x0f];
+  return apply(r, group, (w0 >> 16) & 0x0f, (w0 >> 8) & 0x7f, data[1], ev);
+
+  // ToDo:
+  //
+  // -Decode the bank of program change messages (when bit 0 of the flags byte is set, the bank 
+  //  MSB and LSB are in the low bytes of the second word).
+  // -Decode per-note pitch bend (status 0x6) and per-note controllers (0x0, 0x1). They would map
+  //  nicely to CLAP's note expressions.
+}
+
+
+
+//=================================================================================================
+
+void NoteExpressions::setCapacity(int newCapacity)
+{
+  clapAssert(newCapacity >= 0, "Capacity must be non-negative");
+  slots.resize(newCapacity);
+  fresh.resize(newCapacity);
+  changed.resize(newCapacity);
+  moving.resize(newCapacity);
+  reset();
+}
+
+void NoteExpressions::setSmoothingTime(float newSmoothingSamples)
+{
+  clapAssert(newSmoothingSamples >= 0.f, "Smoothing time must be non-negative");
+  smoothingSamples = newSmoothingSamples;
+}
+
+void NoteExpressions::reset()
+{
+  numMoving = 0;
+  for(int v = 0; v < getCapacity(); v++)
+  {
+    changed[v] = 0;
+    resetVoice(v);
+  }
+}
+
+void NoteExpressions::resetVoice(int voice)
+{
+  Slot& s = slots[voice];
+  for(int k = 0; k < slotSize; k++)
+  {
+    float d = k < numExpressions ? getDefaultValue(k) : 0.f;
+    s.start[k] = s.end[k] = s.target[k] = d;
+    s.inc[k]   = 0.f;
+  }
+  fresh[voice] = 1;
+  startMoving(voice);
+}
+
+void NoteExpressions::advance(int numFrames)
+{
+  if(numFrames <= 0)
+    return;
+
+  // The one-pole smoother over numFrames samples boils down to a single multiplication of the 
+  // distance to the target. This is the only exp() per block, shared by all voices:
+  float c = smoothingSamples > 0.f ? std::exp(-(float) numFrames / smoothingSamples) : 0.f;
+  float s = 1.f / (float) numFrames;
+
+  // We iterate backwards because voices that have come to rest are removed from the list by 
+  // moving the last entry into their place:
+  for(int i = numMoving-1; i >= 0; i--)
+  {
+    int   v = moving[i];
+    Slot& x = slots[v];
+    uint32_t moved = 0;
+    for(int k = 0; k < slotSize; k++)
+    {
+      float t = x.target[k];
+      float a = x.end[k];
+      float b = t + (a - t) * c;
+      b = std::fabs(b - t) < 1.e-5f ? t : b;     // Snap when (almost) arrived
+      x.start[k] = a;
+      x.end[k]   = b;
+      x.inc[k]   = (b - a) * s;
+      moved     |= (uint32_t) (a != b);
+    }
+    if((moved | fresh[v]) == 0)
+    {
+      changed[v] = 0;
+      moving[i]  = moving[--numMoving];
+    }
+    fresh[v] = 0;
+  }
+
+  // Notes:
+  //
+  // -A voice leaves the list in the first block in which none of its values moves. In the block 
+  //  before, it has snapped to its targets, so its ramps are flat from then on. 
+  // -The snapping threshold is absolute. That's fine for all CLAP expressions because they all 
+  //  live in ranges of order 1 where a step of 1.e-5 is inaudible. Snapping also avoids that the
+  //  distances to the targets decay into the denormal range.
+  // -The loop over the 8 values of a slot compiles to a couple of SIMD instructions. The loop 
+  //  over the voices can't be vectorized because the voices are scattered in memory.
+}
+
+//=================================================================================================
+
+PitchIncrementTable::PitchIncrementTable()
+{
+  for(int i = 0; i < tableSize; i++)
+    octaveTable[i] = (float) std::exp2(i / (12.0 * stepsPerSemitone));
+  for(int k = 0; k < numKeys; k++)
+    keyTuning[k] = 0.f;
+  setSampleRate(44100.0);
+}
+
+void PitchIncrementTable::setSampleRate(double newSampleRate)
+{
+  clapAssert(newSampleRate > 0.0, "Sample rate must be positive");
+  if(newSampleRate == sampleRate)
+    return;
+  sampleRate = newSampleRate;
+  for(int o = 0; o < numOctaves; o++)
+    octaveIncrements[o] = (float) (pitchToFreq(minPitch + 12.0 * o) / sampleRate);
+  for(int k = 0; k < numKeys; k++)
+    updateKey(k);
+}
+
+void PitchIncrementTable::setKeyTuning(int key, double semitones)
+{
+  keyTuning[key] = (float) semitones;
+  updateKey(key);
+
+  // ToDo:
+  //
+  // -Offer an option to fill the key tunings from the host via the tuning extension. That's a 
+  //  draft extension (clap/ext/draft/tuning.h) and we build against the stable API only, so that
+  //  has to wait until it's stable. Then, the plugin would call clap_host_tuning::get_relative 
+  //  for the 128 keys when it receives a tuning event or when the tuning changes. The relative 
+  //  tunings that the host returns are exactly our tuning offsets.
+}
+
+void PitchIncrementTable::resetTuning()
+{
+  for(int k = 0; k < numKeys; k++)
+  {
+    keyTuning[k] = 0.f;
+    updateKey(k);
+  }
+}
+
+void PitchIncrementTable::updateKey(int k)
+{
+  keyIncrements[k] = (float) (pitchToFreq((double) k + keyTuning[k]) / sampleRate);
+}
 
 /*
 
@@ -96,6 +96,89 @@ inline T pitchToFreq(T pitch)
   //return 440.0*( pow(2.0, (pitch-69.0)/12.0) ); // naive, slower but numerically more precise
 }
 
+/** Clips x into the range min..max like clip() but without branches, such that loops that call 
+it can be vectorized by the compiler. The input must be finite. */
+inline float clipFast(float x, float min, float max)
+{
+  float lo = (float) (x < min), hi = (float) (x > max);
+  return lo * min + hi * max + (1.f - lo - hi) * x;
+
+  // Notes:
+  //
+  // -Compilers don't turn the conditional assignments of clip() into min/max instructions when 
+  //  they must assume that floating point comparisons may trap (which is the default). The 
+  //  multiplications by 0 or 1 are exact, so this gives the same results as clip().
+}
+
+/** Computes 2^x with a relative error below 3.e-7 for x in -126..+127. Outside that range, the 
+input is clipped. The input must be finite. The function has no branches and calls no library 
+functions, so loops over arrays that call it can be vectorized by the compiler. */
+inline float exp2Fast(float x)
+{
+  x = clipFast(x, -126.f, 127.f);
+  float xi = (float) (int) (x + 127.5f) - 127.f;  // round(x), exact for the clipped range
+  float f  = x - xi;                              // -0.5..+0.5
+  float p  = 1.f + f * (0.69314718f + f * (0.24022651f + f * (0.05550411f + f * (0.00961813f 
+           + f * (0.00133336f + f * 0.00015403f)))));
+  int32_t bits = ((int32_t) xi + 127) << 23;      // 2^xi as float
+  float scale;
+  memcpy(&scale, &bits, 4);
+  return p * scale;
+
+  // Notes:
+  //
+  // -The polynomial is the Taylor series of 2^f up to the 6th power. With |f| <= 0.5 that's good
+  //  enough for single precision.
+  // -We round via the conversion to int of a positive number because that truncates towards zero,
+  //  i.e. acts as floor. std::round or std::floor would prevent vectorization with some compilers.
+}
+
+/** Computes log2(x) with an absolute error below 1.e-6 for positive, normal x. For zero, the 
+result is -126 (i.e. the log of the smallest normal number) such that exp2Fast(c * log2Fast(0)) 
+gives zero (or nearly so) for c >= 1. Negative inputs are treated like zero. Non-finite inputs 
+give garbage. Like exp2Fast, it's vectorizable. */
+inline float log2Fast(float x)
+{
+  int32_t bits;
+  memcpy(&bits, &x, 4);
+  bits = bits < 0x00800000 ? 0x00800000 : bits;  // Smallest normal number, maps zero to -126
+  int32_t mant = bits & 0x007fffff;
+  int32_t big  = mant > 0x003504f3;                // Mantissa > sqrt(2)?
+  int32_t e    = (bits >> 23) - 127 + big;
+  bits = mant | (0x3f800000 - (big << 23));        // m in sqrt(1/2)..sqrt(2)
+  float m;
+  memcpy(&m, &bits, 4);
+  float s  = (m - 1.f) / (m + 1.f);                // ln(m) = 2*atanh(s)
+  float s2 = s * s;
+  float ln = 2.f * s * (1.f + s2 * (1.f/3 + s2 * (1.f/5 + s2 * (1.f/7 + s2 * (1.f/9)))));
+  return (float) e + 1.44269504f * ln;
+
+  // Notes:
+  //
+  // -All the case distinctions are done on the bits as integers because the compiler refuses to 
+  //  vectorize conditional expressions with floating point comparisons (see clipFast).
+}
+
+/** Computes sin(2*pi*p), i.e. the sine for a phase p given in cycles rather than radians, with an 
+absolute error below 1.e-6 for |p| < 1000. Like exp2Fast, it's branchless and vectorizable. It's 
+meant for oscillators whose phases run in 0..1. */
+inline float sinCycleFast(float p)
+{
+  float x = p - ((float) (int) (p + 1024.5f) - 1024.f);        // p - round(p), in -0.5..+0.5
+  float t = std::copysign(0.25f - std::fabs(std::fabs(x) - 0.25f), x);  // Fold into -0.25..+0.25
+  float z  = 6.28318531f * t;                                  // -pi/2..+pi/2
+  float z2 = z * z;
+  return z * (1.f + z2 * (-1.f/6 + z2 * (1.f/120 + z2 * (-1.f/5040 + z2 * (1.f/362880 
+           + z2 * (-1.f/39916800))))));
+
+  // Notes:
+  //
+  // -The folding uses the symmetry sin(2*pi*x) = sin(2*pi*(0.5-x)) for x > 0.25 (and likewise 
+  //  for x < -0.25). Doing it with fabs and copysign avoids conditionals (see clipFast).
+  // -The polynomial is the Taylor series of sin(z) up to the 11th power. At z = pi/2, the 
+  //  truncation error is around 6.e-8, so the error is dominated by the float rounding.
+}
+
 //=================================================================================================
 // Arrays
 
@@ -111,6 +194,24 @@ inline int countOccurrences(const T* buffer, int length, const T& element)
   return count;
 }
 
+/** Returns true, iff the given "buffer" with given "length" contains a permutation of the numbers 
+0...length-1, i.e. iff each of these numbers occurs exactly once. The check uses a temporary array 
+of flags to mark the numbers that were already seen, so it runs in linear time (as opposed to 
+calling countOccurrences for each number which would be quadratic). */
+template<class T>
+inline bool isPermutation(const T* buffer, int length)
+{
+  std::vector<bool> seen(length, false);
+  for(int i = 0; i < length; i++)
+  {
+    size_t k = (size_t) buffer[i];
+    if(k >= (size_t) length || seen[k])  // Out of range or occurs more than once
+      return false;
+    seen[k] = true;
+  }
+  return true;  // All numbers were in range and there were no duplicates
+}
+
 /** Compares the two given buffers with given length for equality in the sense that all entries
 must be equal. */
 template<class T>
@@ -128,42 +229,86 @@ inline bool equals(const T* buf1, const T* buf2, int length)
 // Strings
 
 /** Function to convert a float or double to a string in a roundtrip safe way. That means, when 
-parsing the produced string with e.g. std::atof, we get the original value back exactly. Can be 
-used as replacement for std::to_string when an exact roundtrip is required. This is used in the
-implementation of the state save/load functionality. */
+parsing the produced string with fromStringExact (or std::atof in the "C" locale), we get the 
+original value back exactly. This is used in the implementation of the state save/load 
+functionality. The string is written into the caller's buffer "dst" of given "size" (including the
+place for the terminating null). It uses std::to_chars which produces the shortest string that 
+roundtrips exactly (e.g. "0.1" rather than "0.10000000000000001"), doesn't depend on the locale and 
+doesn't allocate memory. A buffer size of 32 is always sufficient. The return value is the length 
+of the produced string (excluding the null) or -1 in case of an error (i.e. when the buffer is too
+small or a nullptr). */
 template<class T>
-inline std::string toStringExact(T x)
+inline int toStringExact(T x, char* dst, int size)
 {
-  std::ostringstream oss;
-  //oss.imbue(std::locale("C")); // Figure out, if we need that!
-  oss << std::setprecision(std::numeric_limits<T>::max_digits10) << x;
-  return oss.str();
+  if(dst == nullptr || size < 1)
+    return -1;
+  std::to_chars_result res = std::to_chars(dst, dst + size - 1, x);
+  if(res.ec != std::errc())
+  {
+    dst[0] = '\0';
+    return -1;
+  }
+  *res.ptr = '\0';
+  return (int) (res.ptr - dst);
 
   // Notes:
   //
-  // -The implementation is taken from:
-  //  https://possiblywrong.wordpress.com/2015/06/21/floating-point-round-trips/
-  //
-  // ToDo:
-  //
-  // -The function needs some unit tests with some more extreme values (close to 0, near the 
-  //  range-max, denormals, etc.)
-  // -Check, if the formatting depends on the std::locale settings. If it does, we need to do 
-  //  something about it because this function is used for double-string-double roundtrips. See
+  // -We used to use an std::ostringstream with setprecision(max_digits10). That always produced 
+  //  17 digits for doubles, allocated memory and was potentially affected by the std::locale. See
   //  https://github.com/surge-synthesizer/clap-saw-demo/blob/main/src/clap-saw-demo.cpp#L924
   //  https://www.gnu.org/software/libc/manual/html_node/Standard-Locales.html
 }
 
+/** Convenience function that returns the result of toStringExact(x, dst, size) as std::string. 
+Can be used as replacement for std::to_string when an exact roundtrip is required. */
+template<class T>
+inline std::string toStringExact(T x)
+{
+  char buf[32];
+  int length = toStringExact(x, buf, 32);
+  return std::string(buf, std::max(length, 0));
+}
+
+/** Parses the number in the given null-terminated string in a locale independent way and reports
+success or failure. It's the counterpart of toStringExact, i.e. strings produced by that function
+will give the exact original value back. The whole string must be consumed for the parsing to be 
+considered successful. In case of failure, the value will be assigned to zero. */
+template<class T>
+inline bool fromStringExact(const char* str, T* value)
+{
+  const char* end = str + strlen(str);
+  std::from_chars_result res = std::from_chars(str, end, *value);
+  if(res.ec != std::errc() || res.ptr != end || str == end)
+  {
+    *value = T(0);
+    return false;
+  }
+  return true;
+}
+
 /** Function to convert a double to a string with a suffix (for a physical unit) for display on 
 the GUI. It can be used without suffix as well. You may just pass a nullptr for the suffix in such 
 a case. The "size" is the total size of the "destination" buffer, i.e. including the place for the 
-terminating null. */
+terminating null. If the buffer is too small, an initial section of the string is written. Like 
+toStringExact, it uses std::to_chars, so it doesn't allocate and doesn't depend on the locale. The
+number of digits after the dot is limited to 30. */
 int toStringWithSuffix(double value, char* destination, int size, int numDigitsAfterDot,
   const char* suffix = nullptr);
 // ToDo: Document the return value. It's the index of the null-terminator, so it's the length of 
 // the string excluding the null-terminator or -1 in case of failure. This is consistent with the
 // behavior of sprintf.
 
+/** Function to parse a display string as produced by toStringWithSuffix (or typed in by the user)
+back into a number. It is the counterpart of toStringWithSuffix and is meant to be used in 
+paramsTextToValue. Leading and trailing whitespace is ignored and the number may be followed by an
+SI prefix (p, n, u, m, k, M, G, T) and/or the unit given by the "suffix". For example, with suffix 
+" Hz", the strings "2500", "2500 Hz", "2500Hz", "2.5k Hz", "2.5 kHz" and "2.5k" all parse to 2500.
+Leading and trailing spaces in the suffix don't matter and the unit is compared case-insensitively,
+so "-6 db" works for a suffix " dB". The function returns false if the string can't be parsed, 
+i.e. if it's not a finite number or followed by anything else than a prefix and the unit. In this 
+case, the value is assigned to zero. Parsing is locale independent and doesn't allocate memory. */
+bool fromStringWithSuffix(const char* str, double* value, const char* suffix = nullptr);
+
 int copyString(const char* src, char* dst, int dstSize);
 // ToDo: add documentation
 
@@ -173,6 +318,303 @@ bool copyString(const std::vector<std::string>& strings, int index, char* dst, i
 int findString(const std::vector<std::string>& strings, const char* stringToFind);
 // ToDo: add documentation
 
+/** Computes a 32 bit hash value of the given null-terminated string using the FNV-1a algorithm. 
+It's used for a compact representation of the plugin identifier in the binary state format. */
+uint32_t hashString(const char* str);
+
+
+//=================================================================================================
+// Serialization
+//
+// Functions to encode numbers into and decode them from byte buffers in little endian byte order,
+// regardless of the byte order of the machine. Used for the binary state format. The functions 
+// assume that the buffers have enough room - the caller has to ensure that.
+
+/** Writes the 4 bytes of the given 32 bit integer into "dst" in little endian order. */
+void encodeUint32(uint32_t value, char* dst);
+
+/** Writes the 8 bytes of the given double into "dst" in little endian order. */
+void encodeDouble(double value, char* dst);
+
+/** Reads a 32 bit integer in little endian order from the given buffer. */
+uint32_t decodeUint32(const char* src);
+
+/** Reads a double in little endian order from the given buffer. */
+double decodeDouble(const char* src);
+
+
+//=================================================================================================
+// Compression
+//
+// A simple and fast block compressor from the LZ family (LZ77 with a hash table for the match 
+// search, the byte format is similar to LZ4). It's used for compressed states. Speed is favored 
+// over ratio, so compressing a state should cost not much more than writing it uncompressed.
+
+/** Returns the maximum size that the compressed data for a block of the given size may have. A 
+destination buffer of that size is always big enough for lzCompress(). */
+inline size_t lzCompressBound(size_t srcSize) { return srcSize + srcSize / 255 + 16; }
+
+/** Compresses the "srcSize" bytes from "src" into "dst" which has room for "dstCapacity" bytes. 
+Returns the size of the compressed data or 0, if it didn't fit into the destination buffer. The 
+block must be smaller than 4 GB. */
+size_t lzCompress(const char* src, size_t srcSize, char* dst, size_t dstCapacity);
+
+/** Decompresses the "srcSize" bytes of compressed data from "src" into "dst". The data must 
+decompress to exactly "dstSize" bytes, so the caller must know the original size. Returns false, if
+the data is malformed. Malformed data never makes us read or write outside of the buffers. */
+bool lzDecompress(const char* src, size_t srcSize, char* dst, size_t dstSize);
+
+
+//=================================================================================================
+// Streams
+
+/** A writer for clap_ostream objects that collects the written data in a fixed-size internal 
+buffer and passes it on to the stream whenever the buffer is full. This avoids calling the stream's
+write function for every tiny piece of data and it also avoids having to build the whole state in 
+memory before writing it into the stream. Larger chunks of data (at least as large as the buffer) 
+are passed on directly without copying them into the buffer. Writing errors are sticky, i.e. after
+an error, all subsequent writes will fail, too. Don't forget to call flush() at the end. */
+
+class ClapStreamWriter
+{
+
+public:
+
+  ClapStreamWriter(const clap_ostream* streamToWriteTo) : stream(streamToWriteTo) {}
+
+  /** Writes "size" bytes from "data" and reports success or failure. */
+  bool write(const void* data, size_t size);
+
+  /** Writes the given null-terminated string (without the terminating null). */
+  bool write(const char* str) { return write(str, strlen(str)); }
+
+  /** Writes a single character. */
+  bool writeChar(char c) { return write(&c, 1); }
+
+  /** Writes a 32 bit integer in little endian order. */
+  bool writeUint32(uint32_t value) { char b[4]; encodeUint32(value, b); return write(b, 4); }
+
+  /** Writes a double in little endian order. */
+  bool writeDouble(double value) { char b[8]; encodeDouble(value, b); return write(b, 8); }
+
+  /** Passes all the data that is still held in our buffer on to the stream. */
+  bool flush();
+
+  /** Returns true, iff an error occurred in one of the writes to the stream. */
+  bool hasError() const { return error; }
+
+
+protected:
+
+  bool writeToStream(const char* data, size_t size);
+
+  static const size_t bufSize = 4096;
+  char   buf[bufSize];
+  size_t numUsed = 0;                    // Number of bytes in buf waiting to be written
+  bool   error   = false;
+  const clap_ostream* stream;
+
+};
+
+//-------------------------------------------------------------------------------------------------
+
+/** A reader for clap_istream objects that reads the data chunk-wise into a fixed-size internal 
+buffer from where it can be consumed in small pieces. That allows to parse a state directly from
+the stream without reading it into one big string first. Larger reads are passed on directly to 
+the stream without going through the buffer. */
+
+class ClapStreamReader
+{
+
+public:
+
+  ClapStreamReader(const clap_istream* streamToReadFrom) : stream(streamToReadFrom) {}
+
+  /** Reads "size" bytes into "dst". Returns false, if the stream ended before enough bytes could 
+  be read or if there was an error. */
+  bool read(void* dst, size_t size);
+
+  /** Reads a single character. */
+  bool readChar(char* c) { return read(c, 1); }
+
+  /** Reads a 32 bit integer in little endian order. */
+  bool readUint32(uint32_t* value);
+
+  /** Reads a double in little endian order. */
+  bool readDouble(double* value);
+
+  /** Copies the next "size" bytes into "dst" without consuming them. The size must not exceed the
+  size of our internal buffer. Returns false, if the stream doesn't have that many bytes left. */
+  bool peek(void* dst, size_t size);
+
+  /** Returns true, iff all the data of the stream has been consumed. */
+  bool isAtEnd();
+
+  /** Returns true, iff an error occurred in one of the reads from the stream. */
+  bool hasError() const { return error; }
+
+
+protected:
+
+  /** Tries to have at least "size" unconsumed bytes in the buffer by reading more data from the 
+  stream. Returns true, if that succeeded. */
+  bool fill(size_t size);
+
+  static const size_t bufSize = 4096;
+  char   buf[bufSize];
+  size_t readPos  = 0;                   // Position of the next unconsumed byte in buf
+  size_t numValid = 0;                   // Number of valid bytes in buf
+  bool   endOfStream = false;
+  bool   error       = false;
+  const clap_istream* stream;
+
+};
+
+//-------------------------------------------------------------------------------------------------
+
+/** Wraps a clap_ostream around a std::string such that everything that is written into the stream
+gets appended to the string. This is used to produce a state string by the same code that writes
+a state into the host's stream. */
+
+class StringOutStream
+{
+
+public:
+
+  StringOutStream(std::string* stringToAppendTo) : str(stringToAppendTo)
+  {
+    _stream.ctx   = this;
+    _stream.write = StringOutStream::writeToString;
+  }
+
+  /** Returns a const pointer to our wrapped C-struct. */
+  const clap_ostream* getWrappee() const { return &_stream; }
+
+private:
+
+  static int64_t writeToString(const clap_ostream* stream, const void* buffer, uint64_t size);
+
+  clap_ostream _stream;
+  std::string* str;
+
+};
+
+/** Wraps a clap_istream around a std::string such that reading from the stream delivers the 
+content of the string. This is used to parse a state string by the same code that reads a state 
+from the host's stream. */
+
+class StringInStream
+{
+
+public:
+
+  StringInStream(const std::string& stringToReadFrom) : str(stringToReadFrom)
+  {
+    _stream.ctx  = this;
+    _stream.read = StringInStream::readFromString;
+  }
+
+  /** Returns a const pointer to our wrapped C-struct. */
+  const clap_istream* getWrappee() const { return &_stream; }
+
+private:
+
+  static int64_t readFromString(const clap_istream* stream, void* buffer, uint64_t size);
+
+  clap_istream       _stream;
+  const std::string& str;
+  size_t             pos = 0;
+
+};
+
+//-------------------------------------------------------------------------------------------------
+
+/** Wraps a clap_ostream around another clap_ostream and compresses everything that is written into
+it. The data is collected into blocks of blockSize bytes which are compressed with lzCompress() 
+and passed on to the target stream. Blocks that don't get smaller are passed on uncompressed. The
+compressed data starts with the 4 magic bytes "RCSZ" and a 32 bit format version. Each block is 
+preceded by its uncompressed and stored sizes as 32 bit integers in little endian order. The sizes
+are equal for uncompressed blocks. An empty block terminates the data. Don't forget to call 
+finish() at the end. */
+
+class CompressedOutStream
+{
+
+public:
+
+  CompressedOutStream(const clap_ostream* streamToWriteTo);
+
+  /** Compresses and writes the last block and the terminator. Returns false, if any of the writes
+  to the target stream failed. */
+  bool finish();
+
+  /** Returns a const pointer to our wrapped C-struct. */
+  const clap_ostream* getWrappee() const { return &_stream; }
+
+  /** Returns true, iff the given data starts with the magic bytes of the compressed format. */
+  static bool isCompressed(const char* data, size_t size);
+
+  static const char     magic[4];          // "RCSZ" for "Rob's CLAP State, Zipped"
+  static const uint32_t version   = 1;
+  static const size_t   blockSize = 65536;
+
+
+private:
+
+  static int64_t writeToBlock(const clap_ostream* stream, const void* buffer, uint64_t size);
+
+  /** Compresses the data in our block buffer and writes it to the target. */
+  bool writeBlock();
+
+  clap_ostream      _stream;
+  ClapStreamWriter  writer;                // Writes to the target stream
+  std::vector<char> block;                 // Uncompressed data of the current block
+  std::vector<char> packed;                // Compressed data of the current block
+  size_t            numUsed       = 0;     // Number of bytes in block
+  bool              headerWritten = false;
+
+};
+
+/** Wraps a clap_istream around a ClapStreamReader that reads data which was written through a 
+CompressedOutStream. Reading from the wrapper delivers the decompressed data. The reader must be 
+positioned at the magic bytes. If the data is malformed, the read function of the wrapped stream
+will report an error. */
+
+class CompressedInStream
+{
+
+public:
+
+  CompressedInStream(ClapStreamReader* readerToReadFrom);
+
+  /** Reads the rest of the compressed data up to the terminator, discarding it. Returns false, if
+  the data is malformed or truncated. Call this after reading what you need to make sure that the 
+  data was complete. */
+  bool finish();
+
+  /** Returns a const pointer to our wrapped C-struct. */
+  const clap_istream* getWrappee() const { return &_stream; }
+
+
+private:
+
+  static int64_t readFromBlock(const clap_istream* stream, void* buffer, uint64_t size);
+
+  /** Reads and decompresses the next block. Returns false on malformed data or at the end. */
+  bool readBlock();
+
+  clap_istream      _stream;
+  ClapStreamReader* reader;
+  std::vector<char> block;                 // Decompressed data of the current block
+  std::vector<char> packed;                // Compressed data of the current block
+  size_t            numValid   = 0;        // Number of valid bytes in block
+  size_t            readPos    = 0;        // Position of the next unconsumed byte in block
+  bool              headerRead = false;
+  bool              atEnd      = false;
+  bool              error      = false;
+
+};
+
 
 //=================================================================================================
 
@@ -257,3 +699,914 @@ protected:
 //  -Rename to PermutationMap (or better: BidirectionalMap, InvertibleMap, BijectiveMap) because
 //   a permutation assumes that "keys" and "values" are of the same type.
 //  and for usage in clap plugins, instantiate
+
+
+//=================================================================================================
+
+/** A list of strings for the options of a choice/enum parameter together with a hash index that 
+allows to find the index of a given string in O(1). This is used for the conversion from display 
+strings back to values in paramsTextToValue. The findString function does the same thing with a 
+linear search over a std::vector<std::string> which is fine for a handful of options but becomes 
+slow for choice parameters with hundreds of options (wavetable lists, preset names, etc.). 
+
+The hash index is built once in the constructor and the object is immutable afterwards, so it can 
+(and should) be shared among all instances of a plugin by making it a static const member of the 
+plugin class. The lookup can optionally be case-insensitive (for ASCII letters) which is handy when
+the strings are typed in by the user. The strings are supposed to be unique (with respect to the 
+selected case sensitivity) which can be checked by isConsistent(). */
+
+class ChoiceStrings
+{
+
+public:
+
+  /** Creates the list from the given strings. */
+  explicit ChoiceStrings(std::initializer_list<const char*> strings, bool caseSensitive = true);
+
+  /** Creates the list from the given strings. */
+  explicit ChoiceStrings(const std::vector<std::string>& strings, bool caseSensitive = true);
+
+  /** Returns the index of the given string or -1, if it isn't in the list. */
+  int find(const char* str) const;
+
+  /** Returns the number of strings, i.e. the number of options of the parameter. */
+  int getNumStrings() const { return (int) strings.size(); }
+
+  /** Returns the string at the given index or a nullptr, if the index is out of range. */
+  const char* getString(int index) const
+  {
+    if(index < 0 || index >= getNumStrings())
+      return nullptr;
+    return strings[index].c_str();
+  }
+
+  /** Returns true, iff the lookup via find() is case-sensitive. */
+  bool isCaseSensitive() const { return caseSensitive; }
+
+  /** Checks that the strings are unique and that the hash index finds each of them at its 
+  index. It is recommended to verify this in an assertion after construction. */
+  bool isConsistent() const;
+
+
+protected:
+
+  /** Builds the hash index. Called from the constructors. */
+  void buildIndex();
+
+  /** Computes the hash of the given string taking into account the case sensitivity. */
+  uint32_t hash(const char* str) const;
+
+  /** Compares the strings taking into account the case sensitivity. */
+  bool equals(const char* a, const char* b) const;
+
+  struct Slot
+  {
+    uint32_t hash  = 0;
+    int      index = -1;             // -1 encodes an empty slot
+  };
+
+  std::vector<std::string> strings;
+  std::vector<Slot>        slots;    // Open addressing with linear probing, size is a power of 2
+  uint32_t                 mask = 0; // slots.size() - 1
+  bool                     caseSensitive;
+
+};
+
+
+//=================================================================================================
+
+/** A mapping from the values of a parameter (as the host sees them) to the values that are needed 
+by the DSP code. For example, a gain parameter is shown in dB to the user but the DSP needs a raw 
+amplitude factor and a cutoff parameter should feel exponential on a knob but the DSP needs Hz. The
+supported curves are:
+
+  kLinear:       y = outMin + (outMax-outMin) * t
+  kExponential:  y = outMin * (outMax/outMin)^t             (outMin and outMax must be > 0)
+  kDecibel:      y = 10^(x/20)                              (ignores the ranges)
+  kSkewed:       y = outMin + (outMax-outMin) * t^skew      (skew must be > 0)
+
+where t = (x-inMin) / (inMax-inMin) is the input normalized to 0..1 (clipped for kSkewed) and 
+x is the parameter value. The input range is usually set by ClapPluginWithParams::addParameter to 
+the range of the parameter. All the constants are precomputed when the range is set, such that 
+mapping a value needs only one or two multiply-adds plus one exp2 (and one log2 for kSkewed).
+
+The mapping of single values via map() is done in double precision with the library functions. 
+For arrays of values (e.g. for smoothed or modulated parameters that change per sample), there is 
+mapArray() which works in single precision with exp2Fast and log2Fast. Its inner loops have no 
+branches or library calls, so they get vectorized by the compiler. */
+
+class ParameterMapping
+{
+
+public:
+
+  enum Curve { kLinear, kExponential, kDecibel, kSkewed };
+
+  /** Creates an identity mapping. Note that setting an input range turns it into a linear 
+  mapping to 0..1. */
+  ParameterMapping() {}
+
+  /** Creates a linear mapping to the given output range. */
+  static ParameterMapping linear(double outMin, double outMax)
+  { return ParameterMapping(kLinear, outMin, outMax, 1.0); }
+
+  /** Creates an exponential mapping to the given output range which must be strictly positive. */
+  static ParameterMapping exponential(double outMin, double outMax)
+  { return ParameterMapping(kExponential, outMin, outMax, 1.0); }
+
+  /** Creates a mapping from decibels to raw amplitudes. */
+  static ParameterMapping decibel()
+  { return ParameterMapping(kDecibel, 0.0, 1.0, 1.0); }
+
+  /** Creates a mapping that raises the normalized input to the power of "skew" before mapping it 
+  linearly to the given output range. A skew > 1 gives more resolution to the low end of the 
+  range. */
+  static ParameterMapping skewed(double outMin, double outMax, double skew)
+  { return ParameterMapping(kSkewed, outMin, outMax, skew); }
+
+  /** Sets the range of the input values (i.e. of the parameter) and recomputes the constants. */
+  void setInputRange(double inMin, double inMax);
+
+  /** Maps a single value. */
+  double map(double x) const;
+
+  /** Maps the N values in "x" and writes the results into "y". The arrays may be the same. */
+  void mapArray(const float* x, float* y, int N) const;
+
+  Curve getCurve() const { return curve; }
+
+
+private:
+
+  ParameterMapping(Curve curve, double outMin, double outMax, double skew);
+
+  /** Recomputes our constants from the ranges. */
+  void updateCoeffs();
+
+  Curve  curve  = kLinear;
+  double inMin  = 0.0, inMax  = 1.0;
+  double outMin = 0.0, outMax = 1.0;
+  double skew   = 1.0;
+
+  // The precomputed constants. The meaning depends on the curve:
+  //   kLinear:      y = a*x + b
+  //   kExponential: y = 2^(a*x + b)
+  //   kDecibel:     y = 2^(a*x)
+  //   kSkewed:      y = c + d * 2^(skew * log2(clip(a*x + b, 0, 1)))
+  double a = 1.0, b = 0.0, c = 0.0, d = 1.0;
+
+};
+
+//=================================================================================================
+
+/** A preallocated pool of voices for polyphonic instruments. It keeps track of which voice plays 
+which note and decides which voice shall play a new note. The voices themselves, i.e. their DSP 
+state, are not part of this class. The voice manager just hands out voice indices in the range 
+0..capacity-1 which the instrument can use to index its own arrays of per-voice state.
+
+All memory is allocated in setCapacity() which should be called from the main thread, e.g. in the
+constructor or in activate(). None of the other functions allocates, so they can be called on the 
+audio thread. The free voices are kept on a stack such that grabbing one is O(1). The playing 
+voices are kept in a dense array of voice indices which the instrument can iterate over when it 
+renders its output. Removing a voice from that array is also O(1) because we just move the last
+entry into the gap. That means that freeing a voice reorders the array, so when you free voices
+while iterating over the array, iterate backwards. Only finding a voice to steal and matching 
+voices to note events scan the array.
+
+A note is identified by the same fields as in clap_event_note: noteId, port, channel and key. In
+the matching done in matches(), a value of -1 is a wildcard, just like in the note events. When 
+all voices are in use, a new note steals a playing voice according to the steal mode:
+
+  kStealOldest:   Steals the voice that was started first, preferring voices that are already in 
+                  their release phase over held ones.
+  kStealQuietest: Steals the voice with the lowest level. The instrument must keep the levels up
+                  to date via setLevel(). Ties are resolved by age.
+  kStealSameKey:  A note on a key that is already sounding on the same channel always reuses the 
+                  voice of that key (even when there are free voices). Otherwise, like 
+                  kStealOldest. This is the behavior of a piano where a struck key cuts off its 
+                  own previous note. */
+
+class VoiceManager
+{
+
+public:
+
+  enum StealMode { kStealOldest, kStealQuietest, kStealSameKey };
+
+  enum State { kFree, kHeld, kReleased };
+
+  /** The information about the note that a voice is playing. */
+  struct Voice
+  {
+    int32_t  noteId   = -1;
+    int16_t  port     = -1;
+    int16_t  channel  = -1;
+    int16_t  key      = -1;
+    double   velocity = 0.0;
+    uint64_t age      = 0;       // Serial number of the note-on, smaller values are older
+    float    level    = 0.f;     // Loudness as reported by the instrument for kStealQuietest
+    State    state    = kFree;
+  };
+
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Setup
+
+  /** Allocates the given number of voices and frees all of them. Must not be called from the 
+  audio thread. */
+  void setCapacity(int newCapacity);
+
+  /** Selects the policy to use when a note needs a voice and all voices are busy. */
+  void setStealMode(StealMode newMode) { stealMode = newMode; }
+
+  /** Sets the level of the given voice to be used by the kStealQuietest mode. */
+  void setLevel(int voice, float newLevel) { voices[voice].level = newLevel; }
+
+  /** Frees all voices. */
+  void reset();
+
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Note handling
+
+  /** Returns the index of the voice that would have to be stolen to play a new note with the 
+  given key and channel or -1 when the note can be played by a free voice. The caller may use this 
+  to wind down the stolen voice before calling noteOn(). */
+  int getVoiceToSteal(int16_t key, int16_t channel) const;
+
+  /** Assigns a voice to the given note and returns its index. If necessary, a playing voice will
+  be stolen (see getVoiceToSteal). Returns -1 only when the capacity is zero. */
+  int noteOn(int16_t key, double velocity, int32_t noteId = -1, int16_t port = -1, 
+    int16_t channel = -1);
+
+  /** Puts the given voice into its release phase. The voice remains in use until freeVoice() is
+  called which is typically done by the instrument when the release has finished. */
+  void releaseVoice(int voice) { voices[voice].state = kReleased; }
+
+  /** Returns the given voice to the pool of free voices. */
+  void freeVoice(int voice);
+
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Inquiry
+
+  /** Returns true, iff the note played by the given voice matches the given pattern in which -1 
+  acts as wildcard. */
+  bool matches(int voice, int32_t noteId, int16_t port, int16_t channel, int16_t key) const
+  {
+    const Voice& v = voices[voice];
+    return (noteId  == -1 || noteId  == v.noteId)
+      &&   (port    == -1 || port    == v.port)
+      &&   (channel == -1 || channel == v.channel)
+      &&   (key     == -1 || key     == v.key);
+  }
+
+  /** Returns the number of voices that are currently in use (held or released). */
+  int getNumActiveVoices() const { return numActive; }
+
+  /** Returns the voice index stored at position i in our dense array of active voices. */
+  int getActiveVoice(int i) const { return active[i]; }
+
+  /** Returns the number of voices that are currently available for new notes. */
+  int getNumFreeVoices() const { return numFree; }
+
+  /** Returns the total number of voices. */
+  int getCapacity() const { return (int) voices.size(); }
+
+  /** Returns the note information for the given voice index. */
+  const Voice& getVoice(int voice) const { return voices[voice]; }
+
+  /** Returns the current steal mode. */
+  StealMode getStealMode() const { return stealMode; }
+
+
+private:
+
+  std::vector<Voice> voices;         // Note information, indexed by voice
+  std::vector<int>   freeStack;      // Indices of free voices. The top is at numFree-1.
+  std::vector<int>   active;         // Indices of active voices in the range 0..numActive-1
+  std::vector<int>   activePos;      // Position of each voice in "active" or -1 if it's free
+  int       numFree   = 0;
+  int       numActive = 0;
+  uint64_t  ageCounter = 0;
+  StealMode stealMode = kStealOldest;
+
+};
+
+//=================================================================================================
+
+/** Band-limited single-cycle waveforms (saw, square, triangle) for wavetable oscillators, stored 
+as a set of mip-mapped tables. Level l contains the harmonics 1..(tableSize/2 >> l), i.e. each 
+level has half the bandwidth of the one before. An oscillator picks the level from its phase 
+increment via getLevel() such that the highest harmonic stays below the Nyquist frequency and then
+needs only one linearly interpolated lookup per sample. All levels have the same length, so the 
+higher ones are heavily oversampled which keeps the interpolation error small. The tables are 
+generated by additive synthesis from the Fourier series of the waveforms.
+
+The tables depend neither on the sample rate nor on anything else, so there is no reason for each 
+plugin instance or voice to have its own copy. getShared() returns a process-wide instance per 
+waveform which is created on the first call and is read-only afterwards, so any number of 
+instances and voices can read it concurrently. The memory use is about 90 kB per waveform no 
+matter how many instances are loaded. The first call takes a few milliseconds, so it should happen
+on the main thread, e.g. in the constructor of the plugin. */
+
+class MipMappedWavetable
+{
+
+public:
+
+  static constexpr int tableSize = 2048;           // Samples per cycle
+  static constexpr int levelSize = tableSize + 1;  // +1 for the interpolation at the end
+  static constexpr int numLevels = 11;             // Level 0 has 1024 harmonics, level 10 has 1
+
+  enum Waveform { kSaw, kSquare, kTriangle, numWaveforms };
+
+  /** Creates the tables for the given waveform. Allocates. */
+  explicit MipMappedWavetable(Waveform waveform);
+
+  /** Returns the shared tables for the given waveform. They are created on the first call. */
+  static const MipMappedWavetable& getShared(Waveform waveform);
+
+  /** Returns the level to use for the given phase increment (frequency / sampleRate) in 0..0.5. 
+  That's the lowest level whose highest harmonic is at or below the Nyquist frequency. */
+  static int getLevel(float increment);
+
+  /** Returns the number of harmonics in the given level. */
+  static int getNumHarmonics(int level) { return (tableSize / 2) >> level; }
+
+  /** Returns the value at the given phase in 0..1 from the given table of length levelSize with
+  linear interpolation. */
+  static float interpolate(const float* table, float phase)
+  {
+    float x = phase * (float) tableSize;
+    int   i = (int) x;
+    float f = x - (float) i;
+    return table[i] + f * (table[i+1] - table[i]);
+  }
+
+  /** Returns the value at the given phase in 0..1 from the given level. */
+  float getValue(float phase, int level) const { return interpolate(getTable(level), phase); }
+
+  /** Returns a pointer to the levelSize values of the given level. */
+  const float* getTable(int level) const { return &data[level * levelSize]; }
+
+  /** Returns the values of all levels, one after another. Level l starts at l * levelSize. */
+  const float* getData() const { return data.data(); }
+
+  Waveform getWaveform() const { return waveform; }
+
+
+private:
+
+  /** Returns the amplitude of the given harmonic of the given waveform. */
+  static double getHarmonicAmplitude(Waveform waveform, int harmonic);
+
+  std::vector<float> data;
+  Waveform waveform;
+
+};
+
+//=================================================================================================
+
+/** A bank of sine voices for polyphonic instruments with the per-voice state stored as a 
+structure of arrays (SoA). Each voice has a phase, a phase increment, an amplitude and a simple 
+attack/release envelope. The voices are identified by the same indices as in VoiceManager, such 
+that an instrument can start, release and remove bank voices in its voice management hooks.
+
+The state arrays are indexed by slots rather than by voices. The slots of the active voices are 
+always kept contiguous in 0..numActive-1: when a voice is removed, the voice in the last slot is 
+moved into the gap. The rendering then runs over groups of L consecutive slots, processing the L 
+voices of a group side by side in the lanes of the SIMD registers. Within a group, we loop over 
+the samples and, per sample, update all L lanes with the same straight line code, so the compiler 
+can vectorize across the lanes. Unused lanes in the last group have zero amplitude. To avoid a 
+horizontal sum per sample, the lanes are accumulated into a lane-interleaved mix buffer over all 
+groups, which is summed down to one output sample only once per sample at the end. The rendering 
+is done in chunks of at most maxChunkSize frames such that the mix buffer has a fixed size.
+
+The number of lanes can be 4, 8 or 16 (the default is 8 which matches AVX). A group of lanes 
+costs the same regardless of how many of them are in use, so 8 or 16 lanes only pay off with more
+than 4 or 8 voices. With fewer voices, the bank halves the lane count, down to 4. With a single 
+voice, 4 lanes are about as fast as a scalar loop with sinCycleFast. A lane count of 1 selects the
+scalar reference path that renders one voice at a time with std::sin. That's the way, polyphonic 
+synths would naturally be written. It's mainly there for tests and benchmarks.
+
+There are two kinds of oscillators. kPolynomial evaluates sinCycleFast() of a phase accumulator 
+per sample. kRotator rotates a quadrature pair (cos, sin) by the increment per sample, which is 
+just 4 multiplications and 2 additions. The rotation matrix is computed when the increment is set 
+and the rounding errors that make the amplitude of the pair drift away from 1 are removed at the 
+end of each chunk by a renormalization with one Newton step for 1/sqrt. The rotator is the faster 
+one but its phase is not directly accessible which would matter for phase modulation or sync.
+Despite the name of the class, kWavetable plays other waveforms from a MipMappedWavetable that is 
+set via setWavetable(). It reads one interpolated value per sample from the level that fits the 
+increment of the voice. The level is selected when the increment is set, not per sample.
+
+Voices can be started and released at a frame offset within the next call to render(), which is 
+meant for instruments that don't split their blocks at note events (see 
+ClapSynthStereo32Bit::kVoiceOffsets). A voice that starts at an offset is frozen and silent until 
+then. The chunks are not split at these frames. Instead, the few voices that start or release 
+within a chunk are frozen in the lanes and rendered one at a time from their offset by a separate 
+pass, so a note event of one voice doesn't shorten the lane loops of all the others.
+
+The envelope is a one-pole filter that approaches 1 during the attack and 0 during the release. 
+A released voice is considered finished when its envelope falls below -80 dB. That check is done 
+at the end of each chunk, so the reported frame is the last frame of the chunk. Finished voices 
+are removed from the bank and reported via getNumFinishedVoices() etc. such that the instrument 
+can hand them back to its voice manager. Like VoiceManager, this class allocates only in 
+setCapacity(). */
+
+class SineVoiceBank
+{
+
+public:
+
+  static constexpr int maxLanes     = 16;
+  static constexpr int maxChunkSize = 64;
+
+  enum Stage : uint8_t { kAttack, kRelease };
+
+  enum Oscillator : uint8_t { kPolynomial, kRotator, kWavetable };
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Setup
+
+  /** Allocates memory for the given number of voices and removes all voices. Must not be called 
+  from the audio thread. */
+  void setCapacity(int newCapacity);
+
+  /** Sets the maximum number of voices that are processed side by side. Must be 1, 4, 8 or 16. 
+  With fewer active voices, narrower groups (down to 4 lanes) are used. */
+  void setNumLanes(int newNumLanes);
+
+  /** Sets the attack and release time constants in samples. */
+  void setAttackRelease(float attackSamples, float releaseSamples);
+
+  /** Selects the kind of oscillator. Playing voices are converted and continue seamlessly. */
+  void setOscillator(Oscillator newOscillator);
+
+  /** Sets the tables for kWavetable. Typically, these are shared tables that are owned by 
+  MipMappedWavetable (see getShared()). The tables must outlive their use by the bank. */
+  void setWavetable(const MipMappedWavetable* newWavetable) { wavetable = newWavetable; }
+
+  /** Removes all voices. */
+  void reset();
+
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Voice control
+
+  /** Starts the given voice with the given phase increment (frequency / sampleRate) and 
+  amplitude at the given frame within the next render() call. If the voice was already playing, 
+  it's restarted immediately with its current envelope level. */
+  void startVoice(int voice, float increment, float amplitude, int frame = 0);
+
+  /** Changes the phase increment and amplitude of a playing voice without restarting it. Does 
+  nothing, if the voice is not playing. */
+  void setVoiceParameters(int voice, float increment, float amplitude);
+
+  /** Puts the given voice into its release phase at the given frame within the next render() 
+  call. */
+  void releaseVoice(int voice, int frame = 0);
+
+  /** Removes the given voice immediately. Does nothing, if the voice is not playing. */
+  void removeVoice(int voice);
+
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Processing
+
+  /** Writes the sum of all active voices into "out". Voices that finish during this call are 
+  removed and can be inquired afterwards via getNumFinishedVoices(), etc. */
+  void render(float* out, int numFrames);
+
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Inquiry
+
+  /** Returns the number of voices that are currently playing. */
+  int getNumActiveVoices() const { return numActive; }
+
+  /** Returns true, iff the given voice is currently playing. */
+  bool isActive(int voice) const { return voiceToSlot[voice] != -1; }
+
+  /** Returns the number of voices that have finished during the last call to render(). */
+  int getNumFinishedVoices() const { return numFinished; }
+
+  /** Returns the index of the i-th voice that finished during the last call to render(). */
+  int getFinishedVoice(int i) const { return finishedVoices[i]; }
+
+  /** Returns the frame within the last rendered block at which the i-th voice has finished. */
+  int getFinishedFrame(int i) const { return finishedFrames[i]; }
+
+  int getNumLanes() const { return numLanes; }
+
+  Oscillator getOscillator() const { return oscillator; }
+
+  const MipMappedWavetable* getWavetable() const { return wavetable; }
+
+  int getCapacity() const { return (int) voiceToSlot.size(); }
+
+
+private:
+
+  /** Renders numFrames <= maxChunkSize frames of all active voices into the mix buffer in groups
+  of L lanes and sums the lanes into "out". The chunk starts at the given frame of the render() 
+  call. Voices whose start frame is later than that are frozen. */
+  template<int L, Oscillator O>
+  void renderChunk(float* out, int numFrames, int chunkStart);
+
+  /** Dispatches to renderChunk for the current number of lanes. */
+  template<Oscillator O>
+  void renderChunkLanes(float* out, int numFrames, int chunkStart);
+
+  /** Like renderChunk but one voice at a time with std::sin, a scalar rotator or wavetable. */
+  void renderChunkScalar(float* out, int numFrames, int chunkStart);
+
+  /** Renders the voices that start or release within the chunk one at a time from their start 
+  frames and adds them to "out". In the lanes, these voices are frozen. */
+  template<Oscillator O>
+  void renderPendingVoices(float* out, int numFrames, int chunkStart);
+
+  /** Releases the voices that are scheduled for the first frame of the chunk and collects those 
+  that start or release later within the chunk into pendingSlots. */
+  void collectPendingVoices(int chunkStart, int numFrames);
+
+  /** Returns true, if the given slot must not be rendered in the lanes for the given chunk 
+  because it starts or releases within it or starts after it. */
+  bool isFrozen(int slot, int chunkStart, int numFrames) const
+  {
+    return startFrame[slot] > chunkStart 
+      || (releaseFrame[slot] > chunkStart && releaseFrame[slot] < chunkStart + numFrames);
+  }
+
+  /** Switches the given slot into its release phase. */
+  void applyRelease(int slot);
+
+  /** Sets up the rotation and the wavetable level of the given slot for its current increment. */
+  void updateIncrement(int slot);
+
+  /** Removes finished voices after a chunk that ended at the given frame. */
+  void collectFinishedVoices(int frame);
+
+  /** Moves the state of the voice in the last slot into the given slot and clears the last. */
+  void removeSlot(int slot);
+
+  // The per-slot state, padded to a multiple of maxLanes:
+  std::vector<float>   phase, increment, amplitude, envelope, envTarget, envCoeff;
+  std::vector<float>   rotRe, rotIm, rotCos, rotSin;  // Quadrature pair and rotation (kRotator)
+  std::vector<int>     tableOffset;                   // Start of the level (kWavetable)
+  std::vector<int>     startFrame, releaseFrame;      // Offsets in the next render() call
+  std::vector<int>     pendingSlots;                  // Slots with events in the current chunk
+  std::vector<uint8_t> stage;
+
+  // The mapping between voices and slots:
+  std::vector<int> slotToVoice, voiceToSlot;
+
+  // The voices that finished in the last render call:
+  std::vector<int> finishedVoices, finishedFrames;
+  int numFinished = 0;
+
+  int   numActive    = 0;
+  int   numLanes     = 8;
+  float attackCoeff  = 0.f;      // Instant attack
+  float releaseCoeff = 0.f;      // Instant release
+  Oscillator oscillator = kPolynomial;
+  const MipMappedWavetable* wavetable = nullptr;
+  int   lastPendingFrame = -1;   // The latest start or release frame or -1, if there is none
+  int   numPending = 0;          // Number of valid entries in pendingSlots
+
+  alignas(64) float mix[maxChunkSize * maxLanes];
+
+};
+
+//=================================================================================================
+
+/** Decodes MIDI 1.0 messages (3 bytes) and MIDI 2.0 channel voice messages (Universal MIDI 
+Packets, UMP) into compact events and keeps track of the controller state of the 16 channels. The
+supported messages are note-off, note-on, poly pressure, control change, program change, channel
+pressure and pitch bend. The values are normalized to 0..1 (pitch bend to -1..+1) and are also 
+available in the original resolution (7, 14, 16 or 32 bits) as "raw" value. Program changes are
+an exception: their value is the program number.
+
+The decoding is table-driven: the status nibble selects a table entry that says what event type 
+it is, where the index (key or controller number) comes from, which bits of the message hold the
+value, how to scale it and where to store it in the channel state. The channel state is a flat 
+array of floats, so storing a controller value is just one indexed write. This avoids branching 
+on the message type, which matters for the dense controller streams of MPE keyboards, where the
+message types are interleaved in unpredictable ways.
+
+MIDI 2.0 messages arrive as UMP words. We decode message type 0x4 (MIDI 2.0 channel voice) and 
+message type 0x2 (MIDI 1.0 channel voice wrapped into UMP). The UMP group is reported in the event 
+but doesn't have its own channel state. Per-note controllers, per-note pitch bend, RPN/NRPN and
+relative controllers of MIDI 2.0 are not decoded. Neither are the 14-bit MSB/LSB controller pairs 
+of MIDI 1.0. Those are reported as two separate 7-bit controllers. */
+
+class MidiDecoder
+{
+
+public:
+
+  enum EventType : uint8_t 
+  { 
+    kNone, kNoteOff, kNoteOn, kPolyPressure, kControlChange, kProgramChange, kChannelPressure, 
+    kPitchBend 
+  };
+
+  /** A decoded MIDI message. */
+  struct Event
+  {
+    EventType type    = kNone;
+    uint8_t   group   = 0;   // UMP group 0..15. Always 0 for MIDI 1.0 messages.
+    uint8_t   channel = 0;   // 0..15
+    uint8_t   index   = 0;   // Key, controller or program number. 0 for channel-wide messages.
+    float     value   = 0.f; // Normalized value or the program number for program changes
+    uint32_t  raw     = 0;   // The value in the resolution of the message
+  };
+
+  /** Layout of the controller state of a channel in the array returned by getChannelState(). */
+  enum StateIndex
+  {
+    kControllers     = 0,    // 128 controllers, indexed by controller number
+    kPolyPressures   = 128,  // 128 poly pressures, indexed by key
+    kPitchBendState  = 256,
+    kChannelPressureState,
+    kProgram,                // The program number, stored as float
+    kScratch,                // Sink for events that have no state (i.e. notes)
+    kStateSize
+  };
+
+  MidiDecoder() { reset(); }
+
+  /** Resets all channels to their initial state. */
+  void reset();
+
+  /** Resets the controllers of the given channel as requested by the "reset all controllers" 
+  message (controller 121), following the recommended practice RP-015: Modulation, pedals and 
+  pressures are reset to 0, expression to 1 and pitch bend to the center. Volume, pan, bank 
+  select, effect depths and the program are kept. */
+  void resetControllers(int channel);
+
+  /** Decodes a MIDI 1.0 message and updates the channel state. Returns false for messages that 
+  are not channel voice messages (e.g. system messages). A note-on with zero velocity is turned 
+  into a note-off. */
+  bool decodeMidi1(const uint8_t data[3], Event& event);
+
+  /** Decodes a MIDI 2.0 message in UMP format and updates the channel state. Returns false for 
+  unsupported messages. Note that in MIDI 2.0, a note-on with zero velocity is a note-on. */
+  bool decodeMidi2(const uint32_t data[4], Event& event);
+
+  /** Returns the state of the given channel as array of kStateSize floats (see StateIndex). */
+  const float* getChannelState(int channel) const { return state[channel]; }
+
+  /** Convenience functions to read the channel state. */
+  float getController(int channel, int number) const { return state[channel][number]; }
+  float getPolyPressure(int channel, int key) const { return state[channel][kPolyPressures+key]; }
+  float getPitchBend(int channel) const { return state[channel][kPitchBendState]; }
+  float getChannelPressure(int channel) const { return state[channel][kChannelPressureState]; }
+  int   getProgram(int channel) const { return (int) state[channel][kProgram]; }
+
+
+private:
+
+  /** The decoding rules for one status nibble. */
+  struct Rule
+  {
+    EventType type;
+    uint8_t   indexMask;     // index = (messageIndex & indexMask) | (raw & rawIndexMask), so
+    uint8_t   rawIndexMask;  // the index can come from the message, the value or neither
+    uint8_t   valueShift;    // Bit position of the value in the value word
+    uint32_t  valueMask;     // Mask for the value bits after shifting
+    double    scale;         // Normalization: value = raw * scale + offset
+    double    offset;
+    uint16_t  stateBase;     // Where to store the value...
+    uint8_t   stateStride;   // ...plus index * stateStride
+  };
+
+  /** Applies the rule to the already extracted index and value word and stores the result. */
+  inline bool apply(const Rule& r, uint8_t group, uint8_t channel, uint8_t index, uint32_t word,
+    Event& ev);
+
+  static const Rule midi1Rules[16];  // Indexed by status nibble, value word = d1 | (d2 << 7)
+  static const Rule midi2Rules[16];  // Indexed by status nibble, value word = 2nd UMP word
+
+  float state[16][kStateSize];
+
+};
+
+//=================================================================================================
+
+/** Per-voice storage for the note expressions of CLAP (volume, pan, tuning, vibrato, expression, 
+brightness, pressure) with smoothing. The expression ids are the CLAP_NOTE_EXPRESSION_... 
+constants and the values are in the units that CLAP uses, i.e. volume as linear gain in 0..4, pan 
+in 0..1, tuning in semitones and the rest in 0..1.
+
+Incoming expression events only set a target value. They don't trigger any computations or 
+callbacks. Once per block, the instrument calls advance() which moves the values towards their 
+targets by a one-pole smoother and turns that into a linear ramp over the block: in frame n of the
+block, the value is getStart() + n * getIncrement() which ends at getEnd(). That way, a burst of 
+expression events costs almost nothing. advance() only visits the voices whose values are still 
+moving, which are kept in a list, so voices that are playing without expression changes cost 
+nothing either. The state of a voice is stored contiguously and padded to 8 values, so the work 
+per moving voice is a loop over short vectors which the compiler can vectorize.
+
+A voice that was just started via resetVoice() takes the first targets that it receives before the
+next call to advance() immediately without smoothing. That's meant for expressions that are sent 
+together with the note-on (at the same time stamp) which should not glide in from the default. */
+
+class NoteExpressions
+{
+
+public:
+
+  static constexpr int numExpressions = 7;   // CLAP_NOTE_EXPRESSION_VOLUME...PRESSURE
+  static constexpr int slotSize       = 8;   // numExpressions padded for SIMD
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Setup
+
+  /** Allocates memory for the given number of voices and resets all of them. Must not be called 
+  from the audio thread. */
+  void setCapacity(int newCapacity);
+
+  /** Sets the time constant of the smoother in samples. Zero turns smoothing off such that the 
+  values jump to their targets at the start of the next block. */
+  void setSmoothingTime(float newSmoothingSamples);
+
+  /** Sets all voices to the default values. */
+  void reset();
+
+  /** Sets the given voice to the default values. Call this when the voice is started. */
+  void resetVoice(int voice);
+
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Processing
+
+  /** Sets the target value for the given expression of the given voice. Ids outside the range 
+  0..numExpressions-1 are ignored. */
+  void setTarget(int voice, int expressionId, float value)
+  {
+    if(expressionId < 0 || expressionId >= numExpressions)
+      return;
+    Slot& s = slots[voice];
+    s.target[expressionId] = value;
+    if(fresh[voice])
+      s.start[expressionId] = s.end[expressionId] = value;
+    startMoving(voice);
+  }
+
+  /** Computes the ramps for the next block of the given length for all voices that are moving. 
+  The values of all other voices are constant, i.e. their start and end values are equal and the 
+  increments are zero. */
+  void advance(int numFrames);
+
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Inquiry
+
+  /** Returns the value at the start of the current block. */
+  float getStart(int voice, int expressionId) const { return slots[voice].start[expressionId]; }
+
+  /** Returns the value at the end of the current block. */
+  float getEnd(int voice, int expressionId) const { return slots[voice].end[expressionId]; }
+
+  /** Returns the per-sample increment of the value within the current block. */
+  float getIncrement(int voice, int expressionId) const { return slots[voice].inc[expressionId]; }
+
+  /** Returns the value that the expression is moving towards. */
+  float getTarget(int voice, int expressionId) const { return slots[voice].target[expressionId]; }
+
+  /** Returns true, if any expression of the given voice has a different value at the end of the 
+  current block than at the end of the previous block. Instruments can use this to skip the 
+  recomputation of derived per-voice values like frequencies. */
+  bool hasChanged(int voice) const { return changed[voice] != 0; }
+
+  /** Returns the number of voices whose values were not constant in the last call to advance() or
+  which got new targets since then. */
+  int getNumMovingVoices() const { return numMoving; }
+
+  /** Returns the value that a voice has initially for the given expression. */
+  static float getDefaultValue(int expressionId) { return expressionId == 0 ? 1.f : 
+    (expressionId == 1 ? 0.5f : 0.f); }
+
+  int getCapacity() const { return (int) slots.size(); }
+
+
+private:
+
+  /** Adds the voice to the list of moving voices, if it's not already in it. */
+  void startMoving(int voice)
+  {
+    if(changed[voice] == 0)
+    {
+      changed[voice] = 1;
+      moving[numMoving++] = voice;
+    }
+  }
+
+  struct alignas(32) Slot
+  {
+    float start[slotSize];
+    float end[slotSize];
+    float inc[slotSize];
+    float target[slotSize];
+  };
+
+  std::vector<Slot>    slots;
+  std::vector<uint8_t> fresh;     // Voice was reset and hasn't been advanced since
+  std::vector<uint8_t> changed;   // Voice is in the moving list
+  std::vector<int>     moving;    // The list of moving voices
+  int   numMoving = 0;
+  float smoothingSamples = 0.f;
+
+};
+
+//=================================================================================================
+
+/** A table for converting (fractional) MIDI pitches into the phase increments of oscillators, 
+i.e. into frequency / sampleRate, without calling exp() on the audio thread. 
+
+The table covers a single octave with a resolution of 1/16 semitone and is combined with a table 
+of the increments of the start frequencies of the octaves. A pitch is split into the octave and the
+position within the octave. The latter is looked up with linear interpolation. The relative error 
+of linear interpolation between points that are 1/16 semitone apart is below 2.e-6, i.e. below 
+0.01 cents. The covered range goes from 11 octaves below key 0 to 10 octaves above key 127, so 
+keys with CLAP's note expression for tuning (+-120 semitones) are covered as well. Pitches outside 
+the range are clipped.
+
+Each of the 128 keys can have a tuning offset in semitones relative to equal temperament, which 
+makes the table usable for microtonal scales. The tuned increments of the keys themselves are 
+precomputed exactly by getKeyIncrement(). Fractional pitches relative to a tuned key (e.g. for 
+pitch bend) go through the interpolated table via getIncrement(key, offset).
+
+The tables are per instance and rebuilt by setSampleRate() when the sample rate actually changes,
+which is meant to be called in activate(). Nothing allocates. */
+
+class PitchIncrementTable
+{
+
+public:
+
+  static constexpr int   numKeys          = 128;
+  static constexpr int   stepsPerSemitone = 16;
+  static constexpr int   numOctaves       = 32;
+  static constexpr float minPitch         = -132.f;  // 11 octaves below key 0
+
+  PitchIncrementTable();
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Setup
+
+  /** Sets the sample rate and rebuilds the tables, if it has changed. */
+  void setSampleRate(double newSampleRate);
+
+  /** Sets the tuning offset of the given key in semitones relative to equal temperament. */
+  void setKeyTuning(int key, double semitones);
+
+  /** Sets all keys back to equal temperament. */
+  void resetTuning();
+
+
+  //-----------------------------------------------------------------------------------------------
+  // \name Lookup
+
+  /** Returns the phase increment for the given key including its tuning offset. */
+  float getKeyIncrement(int key) const { return keyIncrements[key]; }
+
+  /** Returns the phase increment for the given key with its tuning offset plus the given offset in
+  semitones. */
+  float getIncrement(int key, float offset) const 
+  { 
+    return getIncrement((float) key + keyTuning[key] + offset); 
+  }
+
+  /** Returns the phase increment for the given fractional pitch in equal temperament. */
+  float getIncrement(float pitch) const
+  {
+    float x = clipFast(pitch - minPitch, 0.f, 12.f * numOctaves - 1.e-3f);
+    int   o = (int) (x * (1.f / 12.f));
+    float r = (x - 12.f * (float) o) * (float) stepsPerSemitone;
+    int   i = (int) r;
+    float f = r - (float) i;
+    return octaveIncrements[o] * (octaveTable[i] + f * (octaveTable[i+1] - octaveTable[i]));
+  }
+
+  /** Returns the tuning offset of the given key in semitones. */
+  float getKeyTuning(int key) const { return keyTuning[key]; }
+
+  double getSampleRate() const { return sampleRate; }
+
+
+private:
+
+  /** Recomputes the tuned increment of one key. */
+  void updateKey(int key);
+
+  static constexpr int tableSize = 12 * stepsPerSemitone + 2;  // +2 for rounding at the end
+
+  float  octaveTable[tableSize];         // 2^(i / (12 * stepsPerSemitone))
+  float  octaveIncrements[numOctaves];   // Increments of the pitches minPitch + 12 * o
+  float  keyTuning[numKeys];
+  float  keyIncrements[numKeys];
+  double sampleRate = 0.0;
+
+};